@@ -234,19 +234,49 @@ int generation = 0;
 int latest_generation = 0;
 int max_generation = 0;
 
+// The oldest generation that can still be undone to, and whether old undo records
+// are spilled to disk (rather than forgotten) when the undo journal gets too big.
+int oldest_generation = 0;
+BOOL undo_spill = TRUE;
+
+// Whether the drawing is saved in the compact binary format. Set when a binary
+// file is opened, or one is chosen in the Save As dialog.
+BOOL save_binary = FALSE;
+
 // Debugging options
 BOOL debug_view_bbox = FALSE;
 BOOL debug_view_normals = FALSE;
 BOOL debug_view_viewlist = FALSE;
 
-// Size and span of point-searching buckets used in coordinate matching.
-// Chosen so that there are 40 buckets covering +/-halfsize, in X and Y (we don't bucket on Z)
-// If these change, n_buckets must be even.
+// Initial size of the cells in the point-searching buckets used in coordinate matching.
+// The buckets pick a better size for themselves as points are added.
 float bucket_size = INITIAL_GRID * 5;
-int n_buckets = 40;
 
 BlendMode view_blend = BLEND_MULTIPLY;
 
+// Set up the parts of the model that don't depend on GL or the windows.
+// Batch mode calls this directly.
+void
+init_model(void)
+{
+    materials[0].valid = TRUE;
+    strcpy_s(materials[0].name, 64, "(default)");
+
+    plane_XY.C = 1.0;           // set up planes
+    plane_XZ.B = 1.0;
+    plane_YZ.A = 1.0;
+    plane_mXY.C = -1.0;
+    plane_mXZ.B = -1.0;
+    plane_mYZ.A = -1.0;
+
+    picked_point.hdr.type = OBJ_POINT;
+    new_point.hdr.type = OBJ_POINT;
+
+    object_tree.hdr.type = OBJ_GROUP;  // set up object tree groups
+    gcode_tree.hdr.type = OBJ_GROUP;
+    gcode_tree.hdr.lock = LOCK_VOLUME;
+}
+
 void
 Init(void)
 {
@@ -271,8 +301,7 @@ Init(void)
     glEnable(GL_LIGHTING);
     glEnable(GL_LIGHT0);
 
-    materials[0].valid = TRUE;
-    strcpy_s(materials[0].name, 64, "(default)");
+    init_model();
     SetMaterial(0, TRUE);
 
     // Enable alpha blending, so we can have transparency
@@ -289,22 +318,8 @@ Init(void)
     wglUseFontOutlines(auxGetHDC(), 0, 256, 2000, 0, 0, WGL_FONT_POLYGONS, NULL);
 #endif
 
-    plane_XY.C = 1.0;           // set up planes
-    plane_XZ.B = 1.0;
-    plane_YZ.A = 1.0;
-    plane_mXY.C = -1.0;
-    plane_mXZ.B = -1.0;
-    plane_mYZ.A = -1.0;
-
-    picked_point.hdr.type = OBJ_POINT;
-    new_point.hdr.type = OBJ_POINT;
-
     glEnable(GL_CULL_FACE);    // don't show back facing faces
 
-    object_tree.hdr.type = OBJ_GROUP;  // set up object tree groups
-    gcode_tree.hdr.type = OBJ_GROUP;
-    gcode_tree.hdr.lock = LOCK_VOLUME;
-
     init_comms();               // initialise Winsock for comms to Octoprint
 }
 
@@ -638,7 +653,8 @@ left_down(AUX_EVENTREC *event)
             // fall through for volumes/groups
         case OBJ_GROUP:
         case OBJ_VOLUME:
-            // Note group and volume have box immediately following header (mandatory)
+        case OBJ_INSTANCE:
+            // Note group, volume and instance have box immediately following header (mandatory)
             vol = (Volume *)picked_obj;
             centre_facing_plane = *facing_plane;
             centre_facing_plane.refpt.x = vol->bbox.xc;
@@ -1349,6 +1365,14 @@ int APIENTRY _tWinMain(_In_ HINSTANCE hInstance,
     PROPSHEETPAGE psp[4];
     PROPSHEETHEADER psh;
 
+    // Headless batch mode: build and export a file without any windows
+    if (_strnicmp(lpCmdLine, "-batch", 6) == 0)
+        return run_batch(lpCmdLine + 6);
+    if (_strnicmp(lpCmdLine, "-bench", 6) == 0)
+        return run_bench(lpCmdLine + 6);
+    if (_strnicmp(lpCmdLine, "-test", 5) == 0)
+        return run_test(lpCmdLine + 5);
+
 	// Initialize global strings
 	LoadString(hInstance, IDS_APP_TITLE, szTitle, MAX_LOADSTRING);
 	LoadString(hInstance, IDC_LOFTYCAD, szWindowClass, MAX_LOADSTRING);
@@ -1644,7 +1668,7 @@ int APIENTRY _tWinMain(_In_ HINSTANCE hInstance,
                 break;
             case 5:
                 // These don't go to the object tree, but to the gcode tree. Only one at a time.
-                purge_zpoly_edges(&gcode_tree);
+                purge_gcode(&gcode_tree);
                 rc = read_gcode_to_group(&gcode_tree, new_filename);
                 invalidate_dl();
                 SendMessage(hWndPropSheet, PSM_SETCURSEL, TAB_PREVIEW, 0);  // select print preview tab
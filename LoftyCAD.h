@@ -176,6 +176,9 @@ extern float clip_xoffset, clip_yoffset, clip_zoffset;
 extern int generation;
 extern int latest_generation;
 extern int max_generation;
+extern int oldest_generation;
+extern BOOL undo_spill;
+extern BOOL save_binary;
 
 extern Object *treeview_highlight;
 
@@ -194,7 +197,6 @@ extern float quat_mYZ[4];
 extern float quat_mXZ[4];
 
 extern float bucket_size;
-extern int n_buckets;
 
 extern BlendMode view_blend;
 
@@ -232,7 +234,6 @@ extern Material materials[MAX_MATERIAL];
 #undef DEBUG_VIEW_LIST_ARC
 #define DEBUG_HIGHLIGHTING_ENABLED
 #undef DEBUG_WRITE_VOL_MESH
-#undef DEBUG_FREELISTS
 
 // Timing defines
 #undef TIME_DRAWING
@@ -256,9 +257,20 @@ extern Material materials[MAX_MATERIAL];
 #define Log(msg)            OutputDebugString(msg);
 #define LogShow(msg)        OutputDebugString(msg);
 #else
-#define Log(msg)            SendDlgItemMessage(hWndDebug, IDC_DEBUG, EM_REPLACESEL, 0, (LPARAM)(msg));
+// In batch mode there is no debug window, so everything goes to stderr.
+extern BOOL batch_mode;
+void batch_log(char* msg);
+
+#define Log(msg)            { if (batch_mode) batch_log(msg); else SendDlgItemMessage(hWndDebug, IDC_DEBUG, EM_REPLACESEL, 0, (LPARAM)(msg)); }
 #define LogShow(msg)        \
 {                       \
+  if (batch_mode)       \
+  {                     \
+    batch_log(msg);     \
+    batch_log("\n");    \
+  }                     \
+  else                  \
+  {                     \
     ShowWindow(hWndDebug, SW_SHOW);                                                     \
     SetWindowPos(hWndDebug, HWND_TOP, 0, 0, 0, 0, SWP_NOMOVE | SWP_NOSIZE);             \
     CheckMenuItem(GetSubMenu(GetMenu(auxGetHWND()), 2), ID_VIEW_DEBUGLOG, MF_CHECKED);  \
@@ -266,6 +278,7 @@ extern Material materials[MAX_MATERIAL];
     SendDlgItemMessage(hWndDebug, IDC_DEBUG, EM_REPLACESEL, 0, (LPARAM)(msg));          \
     SendDlgItemMessage(hWndDebug, IDC_DEBUG, EM_REPLACESEL, 0, (LPARAM)"\r\n");         \
     ASSERT_BREAK;                                                                       \
+  }                     \
 }
 #endif
 
@@ -288,7 +301,10 @@ BOOL remove_from_selection(Object * obj);
 void clear_selection(ListHead * sel_list);
 
 // Visualisation of G-code (gcode.c)
-void spaghetti(ZPolyEdge * zedge, float zmin, float zmax);
+void gcode_add_layer(GCodeStore *gc, float z);
+void gcode_add_point(GCodeStore *gc, float x, float y, float e, float f);
+void draw_spaghetti(Group *tree, PRESENTATION pres, float zmin, float zmax);
+void invalidate_spaghetti(void);
 
 // Slic3r integration (slicer.c)
 BOOL load_slic3r_exe_and_config();
@@ -320,6 +336,30 @@ void display_help_state(STATE state);
 void change_state(STATE new_state);
 void display_cursor(STATE new_state);
 
+// Headless batch mode (batch.c)
+extern BOOL batch_strict;
+void batch_init(void);
+char* batch_next_arg(char* line, char* arg, int arglen);
+int run_batch(char* cmdline);
+int run_test(char* cmdline);
+void init_model(void);
+
+// Benchmarking of the expensive stages (bench.c)
+typedef enum BENCH_STAGE
+{
+    BENCH_DESERIALISE,
+    BENCH_FACE,
+    BENCH_SURFACE,
+    BENCH_MERGE,
+    BENCH_EXPORT,
+    BENCH_STAGES
+} BENCH_STAGE;
+
+extern BOOL benchmarking;
+void bench_start(LARGE_INTEGER* start);
+void bench_end(BENCH_STAGE stage, LARGE_INTEGER* start, int count);
+int run_bench(char* cmdline);
+
 // Status and progress bar (progress.c)
 void show_status(char* heading, char* string);
 void set_progress_range(int n);
@@ -328,6 +368,7 @@ void bump_progress(void);
 void clear_status_and_progress(void);
 int accum_render_count(Group * group);
 void start_file_progress(FILE * f, char* header, char* filename);
+void start_size_progress(int size, char* header, char* filename);
 void step_file_progress(int read);
 
 // Context menu (contextmenu.c)
@@ -367,9 +408,22 @@ int path_subdivide(Object* obj, Plane* initial_tangent, Bbox *ebox, float initia
 
 // Neighbourhood search and picking (neighbourhood.c)
 Object* Pick(GLint x_pick, GLint y_pick, BOOL force_pick);
+Object* pick_object(Object* obj, LOCK parent_lock, Plane* line, float* dist);
 void Pick_all_in_rect(GLint x_pick, GLint y_pick, GLint width, GLint height);
+void invalidate_screen_grid(void);
 Object* find_in_neighbourhood(Object * match_obj, Group * tree);
 
+// Bounding volume hierarchy for picking (bvh.c)
+void face_bbox(Face *f, Bbox *box);
+BVH *volume_bvh(Volume *vol);
+void invalidate_bvh(Volume *vol);
+void free_bvh(BVH *bvh);
+BOOL ray_hits_bbox(Plane *line, Bbox *box);
+BOOL bvh_query(BVH *bvh, Plane *line, Bbox *box, BOOL (*fn)(Face *f, void *arg), void *arg);
+BVH *mesh_volume_bvh(Volume *vol);
+void invalidate_mesh_bvh(Volume *vol);
+void bvh_query_tris(BVH *bvh, Plane *line, void (*fn)(void *arg, float x[3], float y[3], float z[3]), void *arg);
+
 // UI helpers (toolbars.c)
 void load_tooltip(HWND hWnd, int button, int toolstring);
 void LoadAndDisplayIcon(HWND hWnd, int icon, int button, int toolstring);
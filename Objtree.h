@@ -17,6 +17,7 @@ typedef enum
     OBJ_FACE,
     OBJ_VOLUME,
     OBJ_GROUP,
+    OBJ_INSTANCE,
     OBJ_MAX         // must be highest
 } OBJECT;
 
@@ -26,7 +27,7 @@ typedef enum
     EDGE_STRAIGHT = 0,              // Straight line between two endpoints
     EDGE_ARC = 1,                   // Circular arc with centre
     EDGE_BEZIER = 2,                // Cubic Bezier curve
-    EDGE_ZPOLY = 3,                 // Polyline at constant Z (comes from slicing)
+    EDGE_ZPOLY = 3,                 // Polyline at constant Z (no longer used; G-code is in a GCodeStore)
     EDGE_CONSTRUCTION = 0x8000      // OR this in to indicate a construction edge
 } EDGE;
 
@@ -103,6 +104,8 @@ typedef struct Object
                                     // with the current save count for the tree.
     struct Object   *copied_to;     // When an object is copied, the original is set to point to
                                     // the copy here. This allows sharing to be kept the same.
+    unsigned int    copy_epoch;     // The move epoch copied_to was set in. It is only valid
+                                    // during that epoch (see clear_move_copy_flags).
     BOOL            show_dims;      // If this object has dimensions, they will be shown all the time.
     LOCK            lock;           // The locking level of this object. It is only relevant
                                     // for top level objects (i.e. in the object tree)
@@ -124,8 +127,8 @@ typedef struct Point
     float           x;              // Coordinates
     float           y;
     float           z;
-    BOOL            moved;          // When a point is moved, this is set TRUE. This stops shared
-                                    // points from being moved twice.
+    unsigned int    moved_epoch;    // When a point is moved, this is set to the current move epoch.
+                                    // This stops shared points from being moved twice.
     float           decay;          // Decay factor for smooth moves.
     float           cosine;         // Cosine of normals factor for smooth moves.
     unsigned int    drawn;          // Drawn number increments and stops shared points being drawn twice.
@@ -134,7 +137,7 @@ typedef struct Point
     struct Edge     *start_list;    // List of edges that start at this point (i.e. this point is endpoint 0)
     struct Point    *bucket_next;   // Next point in sorting bucket (used for searching points by coordinate)
     POINT           winpt;          // A screen-coordinate of this Point, used when drag-selecting.
-    BOOL            win_valid;      // If TRUE, the winpt is valid ad has not changed.
+    unsigned int    win_epoch;      // If the current move epoch, the winpt is valid and has not changed.
 } Point;
 
 // Compact 2D and 3D point structs.
@@ -242,15 +245,6 @@ typedef struct BezierEdge
     float           t2;             // Approximate t-value for the second control point at bezctl[2]
 } BezierEdge;
 
-typedef struct ZPolyEdge
-{
-    struct Edge     edge;           // Edge (most of which is not used)
-    float           z;              // The Z-value of the points in the edge
-    struct Point2D* view_list;      // Array of 2D points for the view list, to save space of a real Point.
-    int             n_view;         // Number of points in the view list.
-    int             n_viewalloc;    // Alloced size of view list (in units of sizeof(Point2D))
-} ZPolyEdge;
-
 // The largest of the edge structures (only used for allocation size)
 #define FreeEdge ArcEdge
 
@@ -264,6 +258,15 @@ typedef struct Contour
     int             n_edges;        // Number of edges in this contour
 } Contour;
 
+// A run of points in a face's packed view list. A run starts a new facet (whose normal is
+// held here) or a new contour within the current facet, and extends to the start of the next run.
+typedef struct ViewRun
+{
+    int             first;          // Index of the first point of the run in the view arrays
+    PFLAG           flag;           // FLAG_NEW_FACET, FLAG_NEW_CONTOUR, or FLAG_NONE for an unfaceted first run
+    float           A, B, C;        // Facet normal (for FLAG_NEW_FACET runs)
+} ViewRun;
+
 // This structure is used for text, to allow it to be edited/regenerated while it
 // is still a face at top level (not being extruded into a volume yet)
 typedef struct Text
@@ -306,15 +309,30 @@ typedef struct Face
                                     // May be NULL, in which case there is only one contour.
     int             n_contours;     // Number of contours in the above array (0 if array is empty)
     Text            *text;          // If the face is text, its string, font etc. are here.
-    struct ListHead view_list;      // List(s) of XYZ coordinates of GL points to be rendered as line loop(s)
-                                    // (for the edges) and polygon(s) (for the face). Point flags indicate
-                                    // the presence of multiple facets. Regenerated whenever
-                                    // something has changed. Doubly linked list.
+    struct ListHead view_list;      // Scratch list of XYZ points, used while the view list is being generated
+                                    // (or while a rect or hex is being drawn in). Point flags indicate
+                                    // the presence of multiple facets and contours. It is packed into
+                                    // the arrays below, and is normally empty otherwise.
     BOOL            view_valid;     // is TRUE if the view list is up to date.
+    float           *view_x;        // Packed view list: X, Y and Z coordinates of the GL points to be
+    float           *view_y;        // rendered as polygon(s) for the face, as separate arrays. They are
+    float           *view_z;        // one allocation, with Y and Z following X at n_alloc_view intervals.
+    int             n_view;         // Number of points in the packed view list
+    int             n_alloc_view;   // Alloced size of each of the X, Y and Z arrays
+    struct ViewRun  *view_runs;     // Facet and contour runs in the packed view list, in order
+    int             n_view_runs;    // Number of runs
+    int             n_alloc_view_runs;
     struct Point2D  *view_list2D;   // Array of 2D points for the view list, for quick point-in-polygon
                                     // testing. Indexed [0] to [N-1], with [N] = [0].
     int             n_view2D;       // Number of points in the 2D view list.
     int             n_alloc2D;      // Alloced size of 2D view list (in units of sizeof(Point2D))
+    float           *tri_verts;     // Triangulated view list for drawing: XYZ and normal ABC of each vertex
+    int             n_tri_verts;    // Number of vertices (each is 6 floats)
+    int             n_alloc_tri_verts;
+    unsigned int    *tri_index;     // Vertex indices, three per triangle
+    int             n_tri_index;    // Number of indices
+    int             n_alloc_tri_index;
+    BOOL            tri_valid;      // If TRUE, the triangles are up to date with the view list
 } Face;
 
 // Bounding box for a volume or a group
@@ -331,6 +349,41 @@ typedef struct Bbox
     float           zc;
 } Bbox;
 
+// Hashed 3D grid of Points, for searching points by coordinate (see list.c)
+typedef struct PointGrid
+{
+    struct Point    **slots;        // Hash table of chains of points, linked by bucket_next
+    int             n_slots;        // Number of slots (always a power of 2)
+    int             n_points;       // Number of points in the grid
+    float           cell;           // Size of a grid cell
+    struct Bbox     bbox;           // Extent of the points in the grid
+} PointGrid;
+
+// Node in a bounding volume hierarchy over the faces of a volume (see bvh.c)
+typedef struct BVHNode
+{
+    struct Bbox     box;            // Box around all the faces under this node
+    int             left;           // Index of the left child (the right one follows it), or 0 for a leaf
+    int             first;          // First face under this node in the faces array
+    int             count;          // Number of faces under this node
+} BVHNode;
+
+// Bounding volume hierarchy over the faces of a volume, used for picking and snapping.
+// For a mesh-only volume it is over the mesh's triangles instead (faces and list are NULL).
+typedef struct BVH
+{
+    BVHNode         *nodes;         // Array of nodes, the root being [0]. Children always follow their parents.
+    int             n_nodes;
+    struct Face     **faces;        // Faces, sorted so that each leaf's faces are together
+    struct Bbox     *boxes;         // Boxes for each face, in the same order
+    struct Face     **list;         // Faces in the order of the volume's face list, to detect changes
+    int             n_faces;        // Number of faces (or triangles)
+    int             n_alloc;        // Allocated size of the face arrays (the node array is twice this)
+    BOOL            dirty;          // If TRUE, faces have been regenerated and the boxes need refitting
+    int             *tris;          // Triangles (indices into coords), sorted like faces
+    float           *coords;        // Coordinates of each triangle (x[3], y[3], z[3]) in mesh order
+} BVH;
+
 // Volume struct. This is the usual top-level 3D object.
 typedef struct Volume
 {
@@ -341,12 +394,21 @@ typedef struct Volume
     FACE            max_facetype;   // The highest order face that this volume contains
     int             material;       // Material index (0 is the default)
     BOOL            measured;       // If TRUE, all faces are paired, and the volume has dimensions (l/w/h)
-    struct Point    ***point_bucket;  // Bucket structure of Points whose coordinates are copied from 
+    struct PointGrid *point_bucket; // Bucket structure of Points whose coordinates are copied from 
                                     // child faces' view lists. Allow sharing points when importing
                                     // STL meshes, and sharing of mesh vertices when building triangle meshes.
+    struct BVH      *bvh;           // Hierarchy of face boxes for picking, or NULL if not yet built.
+    struct BVH      *mesh_bvh;      // Hierarchy of mesh triangles, for picking a mesh-only volume (or NULL)
     Mesh            *mesh;          // Surface mesh for this volume.
     BOOL            mesh_valid;     // If TRUE, the mesh is up to date.
     BOOL            mesh_merged;    // If TRUE, the mesh has been merged to its parent group mesh.
+    BOOL            mesh_dirty;     // If TRUE, the mesh has changed since it was last merged.
+    BOOL            mesh_moved;     // If TRUE, the mesh has been moved in place (see mover.c) and must be merged again.
+    BOOL            views_moved;    // If TRUE, the face view lists have been moved along with the points, and
+                                    // the next invalidate_all_view_lists should leave them alone.
+    int             mesh_gen;       // Bumped whenever the mesh changes, so instances of the volume follow it
+    int             cache_stamp;    // Stamp of the parent's stage cache that includes this mesh (0 if none)
+    BOOL            mesh_only;      // If TRUE, the volume has no faces; it is only the mesh (big imported meshes)
     struct ListHead faces;          // Doubly linked list of faces making up the volume
 } Volume;
 
@@ -376,6 +438,32 @@ typedef struct LoftParams
     float           bay_tensions[1];    // Array of tensions per bay (space between consecutive sections)
 } LoftParams;
 
+// A layer of G-code extrusion paths, at constant Z.
+typedef struct GCodeLayer
+{
+    float           z;              // The Z-value of the points in the layer
+    int             first;          // Index of the first point of the layer in the store
+} GCodeLayer;
+
+// Columnar store of the points of G-code extrusion paths, in file order. A point
+// with e > 0 is joined to the previous point by an extruded segment; a point
+// with e == 0 starts a new path.
+typedef struct GCodeStore
+{
+    float           *x;             // Columns of coordinates,
+    float           *y;
+    float           *e;             // extrusion for the segment ending at this point,
+    float           *f;             // feedrate,
+    int             *layer;         // and the layer the point belongs to
+    int             n_points;       // Number of points in the columns
+    int             n_alloc;        // Alloced size of the columns
+    GCodeLayer      *layers;        // Array of layers
+    int             n_layers;       // Number of layers
+    int             n_layers_alloc; // Alloced size of layers array
+    int             n_ready;        // Number of layers that are complete and may be drawn
+                                    // (they can be drawn while the rest of the file is read)
+} GCodeStore;
+
 // The group struct is used for groups, and also for the main object tree.
 typedef struct Group
 {
@@ -394,17 +482,71 @@ typedef struct Group
     BOOL            mesh_merged;    // If TRUE, the mesh has been merged to its parent group mesh.
     BOOL            mesh_complete;  // If TRUE, all volumes have been completely merged to this mesh.
                                     // (otherwise, some will need to be added separately to the output)
+    BOOL            mesh_dirty;     // If TRUE, the mesh has changed since it was last merged.
+    int             mesh_gen;       // Bumped whenever the mesh changes, so instances of the group follow it
+    int             cache_stamp;    // Stamp of the parent's stage cache that includes this mesh,
+                                    // or of the merge on top of it (0 if none)
+    Mesh            *stage_mesh[OP_NONE];   // Cached merge of the settled members of each op stage
+    int             stage_stamp[OP_NONE];   // Stamp marking the members included in each stage cache
+    int             stage_count[OP_NONE];   // Number of members included in each stage cache
+    int             dirty_stamp[OP_NONE];   // Stamp marking the members merged on top of each stage cache
+    int             dirty_count[OP_NONE];   // Number of members merged on top of each stage cache
     struct ListHead obj_list;       // Doubly linked list of objects making up the group
     struct LoftParams* loft;        // Lofting params, if the group has been lofted
+    struct GCodeStore* gcode;       // G-code paths, if this is the G-code group
 } Group;
 
+// An instance (linked copy) of a volume or group. It has no geometry of its own: it is
+// drawn and picked through its source, and its mesh is only made (as a transformed copy of
+// the source's mesh) when it is merged. Instances of instances are not allowed.
+typedef struct Instance
+{
+    struct Object   hdr;            // Header
+    struct Bbox     bbox;           // Bounding box for the instance in 3D (the source's bbox, transformed)
+    OPERATION       op;             // Operation to use when combining instance with tree
+                                    // NOTE THE ABOVE MUST FOLLOW immediately after header
+    struct Object   *source;        // The volume or group being instanced, or NULL if it has been deleted
+    unsigned int    source_id;      // ID of the source. Used to find it again when it has been swapped
+                                    // out by undo, or when reading a file.
+    double          xform[12];      // Transform from the source to the instance: rows of x, y and z
+                                    // coefficients, each followed by an offset (as in mover.c)
+    Mesh            *mesh;          // Transformed copy of the source's mesh, only kept while merging
+                                    // (or if it could not be merged)
+    BOOL            mesh_valid;     // If TRUE, the transform has not changed since the last merge.
+    BOOL            mesh_merged;    // If TRUE, the mesh has been merged to its parent group mesh.
+    BOOL            mesh_dirty;     // If TRUE, the mesh has changed since it was last merged.
+    int             source_gen;     // The source's mesh_gen when the instance was last checked
+    int             cache_stamp;    // Stamp of the parent's stage cache that includes this mesh (0 if none)
+} Instance;
+
+// Allocation counts for the slabs that Edges, Points and Objects are carved from.
+typedef struct AllocStats
+{
+    int             n_slabs;        // Number of slabs allocated
+    int             n_carved;       // Objects carved fresh from a slab
+    int             n_reused;       // Objects reused from the free list
+    int             n_free;         // Objects sitting in the free list (counted on demand)
+    int             size;           // Size of each object
+} AllocStats;
+
 // Externs
 
 extern unsigned int objid;
 extern ListHead free_list_edge;
 extern ListHead free_list_pt;
 extern ListHead free_list_obj;
-extern ListHead free_list_zedge;
+extern __declspec(thread) BOOL thread_alloc;
+extern __declspec(thread) ListHead thread_free_pt;
+extern unsigned int move_epoch;
+
+// Flags that are only set during the current move epoch. Starting a new epoch
+// (clear_move_copy_flags) clears them on every object at once.
+#define IS_MOVED(p)             ((p)->moved_epoch == move_epoch)
+#define SET_MOVED(p)            ((p)->moved_epoch = move_epoch)
+#define WIN_VALID(p)            ((p)->win_epoch == move_epoch)
+#define SET_WIN_VALID(p)        ((p)->win_epoch = move_epoch)
+#define COPIED_TO(obj)          ((obj)->copy_epoch == move_epoch ? (obj)->copied_to : NULL)
+#define SET_COPIED_TO(obj, c)   ((obj)->copied_to = (c), (obj)->copy_epoch = move_epoch)
 
 // Flatness test for faces based on their type
 #if 0
@@ -438,9 +580,23 @@ Point* point_newpv(Point* p);
 Point* point_newr(Point* p0, Point* p1, float ratio);
 
 Edge *edge_new(EDGE edge_type);
+Edge *edge_newv(EDGE edge_type);
 Face *face_new(FACE face_type, Plane norm);
 Volume *vol_new(void);
 Group *group_new(void);
+Instance *instance_new(Object *source);
+
+// Allocation stats (objtree.c)
+void get_alloc_stats(OBJECT type, AllocStats *stats);
+void clear_alloc_stats(void);
+void log_alloc_stats(void);
+
+// Allocation on worker threads (objtree.c)
+void init_thread_alloc(void);
+void begin_thread_alloc(void);
+void end_thread_alloc(void);
+void lock_thread_alloc(void);
+void unlock_thread_alloc(void);
 
 // Link and delink from doubly linked lists (list.c)
 void link(Object *new_obj, ListHead *obj_list);
@@ -463,11 +619,12 @@ void link_single_checked(Object *new_obj, ListHead *obj_list);
 void free_obj_list(ListHead *obj_list);
 
 // Bucket stuff (list.c)
-Point ***init_buckets(void);
-Point **find_bucket(Point *p, Point ***bucket);
-void empty_bucket(Point ***bucket);
-void free_bucket_points(Point ***bucket);
-void free_bucket(Point ***bucket);
+PointGrid *init_buckets(void);
+void insert_bucket_point(PointGrid *grid, Point *p);
+Point *find_bucket_point(PointGrid *grid, Point *pt, float tol);
+void empty_bucket(PointGrid *grid);
+void free_bucket_points(PointGrid *grid);
+void free_bucket(PointGrid *grid);
 
 // Copy and move object (mover.c)
 Object *copy_obj(Object *obj, float xoffset, float yoffset, float zoffset, BOOL cloning);
@@ -497,19 +654,29 @@ Object *find_parent_object(Group *tree, Object *obj, BOOL deep_search);
 Object *find_top_level_parent(Object *obj);
 BOOL is_top_level_object(Object *obj, Group *tree);
 
+// Instances (objtree.c)
+void update_instance_bbox(Instance *inst);
+BOOL instance_reflects(Instance *inst);
+void relink_instances(Group *tree);
+
 // Write and read a tree to a file (serialise.c)
 void serialise_tree(Group *tree, char *filename);
 BOOL deserialise_tree(Group *tree, char *filename, BOOL importing);
+void serialise_objects(Object **objs, int n, char *filename);
+BOOL deserialise_objects(Group *group, char *filename);
+
+// Undo journal (undo.c)
 void write_checkpoint(Group *tree, char *filename);
 BOOL read_checkpoint(Group *tree, char *filename, int generation);
 void clean_checkpoints(char *filename);
+void reset_undo_journal(Group *tree);
 
 // Delete an object, or the whole tree
 void purge_obj(Object *obj);
 void purge_obj_top(Object *obj, OBJECT type);
 void purge_list(ListHead* list);
 void purge_tree(Group *tree, BOOL preserve_objects, ListHead *saved_list);
-void purge_zpoly_edges(Group* group);
+void purge_gcode(Group* group);
 
 // Extrude heights/dimensions
 BOOL extrudible(Object* obj);
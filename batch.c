@@ -0,0 +1,332 @@
+#include "stdafx.h"
+#include "LoftyCAD.h"
+#include <stdio.h>
+
+// Headless batch mode. Load an LCD file, build its CSG mesh and export it,
+// without creating any windows or putting up any message boxes.
+//
+//  LoftyCAD -batch [-strict] input.lcd output.stl [output.amf output.obj output.off ...]
+//
+// The output format is chosen by the extension of each output file. Log
+// messages and mesh errors go to stderr. In strict mode, a mesh error stops
+// the merge and nothing is exported; otherwise the error is logged and the
+// merge carries on, as if OK had been pressed in the error message box.
+//
+// Exit codes are:
+//  0   success
+//  1   bad command line
+//  2   the input file could not be read
+//  3   the mesh could not be built
+//  4   one or more outputs could not be written
+//
+//  LoftyCAD -test
+//
+// runs the self tests below, without windows, reporting each one to stderr.
+// The exit code is 0 if they all pass, or 5 if any fail.
+
+BOOL batch_mode = FALSE;
+BOOL batch_strict = FALSE;
+
+// Write a log message to stderr, dropping any CR's (the debug log needs them,
+// but the console doesn't)
+void
+batch_log(char *msg)
+{
+    char *p;
+
+    for (p = msg; *p != '\0'; p++)
+    {
+        if (*p != '\r')
+            fputc(*p, stderr);
+    }
+}
+
+// Pull the next (possibly quoted) argument off the command line. Return a pointer
+// to the rest of the line, or NULL if there are no more arguments.
+char *
+batch_next_arg(char *line, char *arg, int arglen)
+{
+    int i = 0;
+
+    while (*line == ' ' || *line == '\t')
+        line++;
+    if (*line == '\0')
+        return NULL;
+
+    if (*line == '"')
+    {
+        for (line++; *line != '\0' && *line != '"'; line++)
+        {
+            if (i < arglen - 1)
+                arg[i++] = *line;
+        }
+        if (*line == '"')
+            line++;
+    }
+    else
+    {
+        for (; *line != '\0' && *line != ' ' && *line != '\t'; line++)
+        {
+            if (i < arglen - 1)
+                arg[i++] = *line;
+        }
+    }
+    arg[i] = '\0';
+
+    return line;
+}
+
+// Find the export file index (as used by export_object_tree) for a filename.
+static int
+export_index(char *filename)
+{
+    char *pdot = strrchr(filename, '.');
+
+    if (pdot == NULL)
+        return 0;
+    if (_stricmp(pdot, ".stl") == 0)
+        return 1;
+    if (_stricmp(pdot, ".amf") == 0)
+        return 3;
+    if (_stricmp(pdot, ".obj") == 0)
+        return 4;
+    if (_stricmp(pdot, ".off") == 0)
+        return 5;
+    return 0;
+}
+
+// Set up for running without windows (batch mode or benchmarking).
+void
+batch_init(void)
+{
+    FILE *f;
+
+    // Get a console to write to, if we were started from one
+    if (AttachConsole(ATTACH_PARENT_PROCESS))
+    {
+        freopen_s(&f, "CONOUT$", "w", stdout);
+        freopen_s(&f, "CONOUT$", "w", stderr);
+    }
+
+    batch_mode = TRUE;
+    init_model();
+    init_triangulator();
+}
+
+// Run in batch mode. The command line is what follows the "-batch" switch.
+// Returns the process exit code.
+int
+run_batch(char *cmdline)
+{
+    char arg[256], buf[300];
+    char *line;
+    int n_out, index, rc;
+
+    batch_init();
+
+    line = batch_next_arg(cmdline, arg, 256);
+    if (line != NULL && _stricmp(arg, "-strict") == 0)
+    {
+        batch_strict = TRUE;
+        line = batch_next_arg(line, arg, 256);
+    }
+    if (line == NULL)
+    {
+        fprintf_s(stderr, "Usage: LoftyCAD -batch [-strict] input.lcd output.stl [output.amf output.obj output.off ...]\n");
+        return 1;
+    }
+
+    strcpy_s(curr_filename, 256, arg);
+    if (!deserialise_tree(&object_tree, curr_filename, FALSE))
+    {
+        fprintf_s(stderr, "Cannot read %s\n", curr_filename);
+        return 2;
+    }
+
+    // Build the volume meshes and merge them into the tree mesh
+    gen_view_list_tree_volumes(&object_tree);
+    if (!gen_view_list_tree_surfaces(&object_tree, &object_tree) || !object_tree.mesh_valid)
+    {
+        fprintf_s(stderr, "Cannot build mesh for %s\n", curr_filename);
+        return 3;
+    }
+    if (object_tree.mesh != NULL)
+    {
+        sprintf_s(buf, 300, "%s: %d triangles%s\n", curr_filename, mesh_num_faces(object_tree.mesh),
+                  object_tree.mesh_complete ? "" : " (mesh incomplete)");
+        batch_log(buf);
+    }
+
+    // Export to each of the outputs in turn
+    rc = 0;
+    n_out = 0;
+    while ((line = batch_next_arg(line, arg, 256)) != NULL)
+    {
+        n_out++;
+        index = export_index(arg);
+        if (index == 0)
+        {
+            fprintf_s(stderr, "Unknown output file type: %s\n", arg);
+            rc = 4;
+            continue;
+        }
+
+        DeleteFile(arg);
+        export_object_tree(&object_tree, arg, index);
+        if (GetFileAttributes(arg) == INVALID_FILE_ATTRIBUTES)
+        {
+            fprintf_s(stderr, "Cannot write %s\n", arg);
+            rc = 4;
+        }
+    }
+
+    if (n_out == 0)
+    {
+        fprintf_s(stderr, "No output files given\n");
+        rc = 1;
+    }
+
+    return rc;
+}
+
+// Make a mesh-only box volume (as if imported from an STL) and put it in a tree.
+static Volume *
+test_box(Group *tree, OPERATION op, float x0, float y0, float z0, float x1, float y1, float z1)
+{
+    // Corner i has x1 if bit 0 is set, y1 if bit 1, z1 if bit 2. Triangles face outwards.
+    static int tri[36] =
+    {
+        0, 2, 1,  1, 2, 3,      // z0
+        4, 5, 6,  5, 7, 6,      // z1
+        0, 1, 4,  1, 5, 4,      // y0
+        2, 6, 3,  3, 6, 7,      // y1
+        0, 4, 2,  2, 4, 6,      // x0
+        1, 3, 5,  3, 7, 5       // x1
+    };
+    float xyz[24];
+    Volume *vol = vol_new();
+    int i, n_skipped;
+
+    for (i = 0; i < 8; i++)
+    {
+        xyz[3 * i] = (i & 1) ? x1 : x0;
+        xyz[3 * i + 1] = (i & 2) ? y1 : y0;
+        xyz[3 * i + 2] = (i & 4) ? z1 : z0;
+        expand_bbox_coords(&vol->bbox, xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2]);
+    }
+    vol->bbox.xc = (vol->bbox.xmin + vol->bbox.xmax) / 2;
+    vol->bbox.yc = (vol->bbox.ymin + vol->bbox.ymax) / 2;
+    vol->bbox.zc = (vol->bbox.zmin + vol->bbox.zmax) / 2;
+    vol->mesh = mesh_new_from_arrays(vol->material, xyz, 8, tri, 12, &n_skipped);
+    vol->mesh_valid = TRUE;
+    vol->mesh_only = TRUE;
+    vol->max_facetype = FACE_TRI;
+    vol->op = op;
+    link_tail_group((Object *)vol, tree);
+    return vol;
+}
+
+// Regenerate a tree's mesh after a change, and compare it with the mesh of a reference
+// tree holding the same shapes, merged from scratch. Return TRUE if they have the same
+// number of triangles.
+static BOOL
+test_merge(Group *tree, Group *ref, char *step)
+{
+    char buf[128];
+    int n_inc, n_full;
+
+    if (tree->mesh != NULL)
+        mesh_destroy(tree->mesh);
+    tree->mesh = NULL;
+    tree->mesh_valid = FALSE;
+    gen_view_list_tree_volumes(tree);
+    gen_view_list_tree_surfaces(tree, tree);
+    n_inc = tree->mesh != NULL ? mesh_num_faces(tree->mesh) : 0;
+
+    free_stage_meshes(ref);
+    if (ref->mesh != NULL)
+        mesh_destroy(ref->mesh);
+    ref->mesh = NULL;
+    ref->mesh_valid = FALSE;
+    gen_view_list_tree_volumes(ref);
+    gen_view_list_tree_surfaces(ref, ref);
+    n_full = ref->mesh != NULL ? mesh_num_faces(ref->mesh) : 0;
+
+    sprintf_s(buf, 128, "  %s: %d triangles, %d from scratch\n", step, n_inc, n_full);
+    batch_log(buf);
+    return n_inc == n_full;
+}
+
+// Put two union boxes and a difference box cutting both of them into a tree.
+// Return the second union box.
+static Volume *
+test_boxes(Group *tree)
+{
+    Volume *vol;
+
+    test_box(tree, OP_UNION, 0, 0, 0, 10, 10, 10);
+    vol = test_box(tree, OP_UNION, 20, 0, 0, 30, 10, 10);
+    test_box(tree, OP_DIFFERENCE, 5, -1, 5, 25, 11, 15);
+    return vol;
+}
+
+// Delete a volume from a tree, as the Delete command does.
+static void
+test_delete(Group *tree, Volume *vol)
+{
+    delink_group((Object *)vol, tree);
+    purge_obj((Object *)vol);
+    if (tree->mesh != NULL)
+        mesh_destroy(tree->mesh);
+    tree->mesh = NULL;
+    tree->mesh_valid = FALSE;
+}
+
+// The stage caches of the incremental CSG must not keep a member that has gone.
+// Edit a union member, so it is merged on top of the union stage's cache (and so
+// goes into the difference stage's cache), then delete it.
+static BOOL
+test_stage_cache(void)
+{
+    Group *tree = group_new();
+    Group *ref = group_new();
+    Volume *vol, *ref_vol;
+    BOOL rc = TRUE;
+
+    batch_log("Stage cache, edit then delete:\n");
+    vol = test_boxes(tree);
+    ref_vol = test_boxes(ref);
+    rc &= test_merge(tree, ref, "first merge");
+
+    // Moving a volume marks its mesh as moved. Leave it where it is, so the
+    // reference needn't change.
+    vol->mesh_moved = TRUE;
+    rc &= test_merge(tree, ref, "edit");
+
+    test_delete(tree, vol);
+    test_delete(ref, ref_vol);
+    rc &= test_merge(tree, ref, "delete");
+
+    purge_obj((Object *)tree);
+    purge_obj((Object *)ref);
+    return rc;
+}
+
+// Run the self tests. The command line is what follows the "-test" switch (nothing).
+// Returns the process exit code.
+int
+run_test(char *cmdline)
+{
+    BOOL rc = TRUE;
+
+    batch_init();
+    batch_strict = TRUE;
+
+    if (!test_stage_cache())
+    {
+        batch_log("FAILED\n");
+        rc = FALSE;
+    }
+
+    return rc ? 0 : 5;
+}
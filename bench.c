@@ -0,0 +1,314 @@
+#include "stdafx.h"
+#include "LoftyCAD.h"
+#include <stdio.h>
+#include <psapi.h>
+
+// Benchmarking of the expensive stages of building a model.
+//
+//  LoftyCAD -bench [-repeat n] [-stress n] [-csv results.csv] file.lcd|directory ...
+//
+// Each model (or each LCD file found under a directory, such as Examples) is loaded,
+// its volumes triangulated, the CSG mesh merged and the result exported to a temp
+// STL file. For each stage, the number of calls, the wall time, the largest working
+// set seen at the end of the stage, and a count of the triangles produced are
+// reported. The total line gives the most the working set grew over what it was at
+// the start of the model, so it doesn't depend on the models run before it. With
+// -repeat, each model is run n times and the fastest run of each stage is reported,
+// along with the most growth of any run. With -stress, the top level objects of each model are copied n times,
+// overlapping by half their width, to make a heavier synthetic model for the merges.
+//
+// After the stages, the Object, Point and Edge allocations made during the last run are
+// reported: how many were carved fresh from slabs, and how many reused from the free lists.
+//
+// Stages are timed by calls to bench_start and bench_end around them, which do
+// nothing unless benchmarking. The face stage happens mostly while deserialising,
+// so its time is taken out of the deserialise stage.
+
+BOOL benchmarking = FALSE;
+
+typedef struct BenchStat
+{
+    int         calls;          // Number of times the stage was run
+    LONGLONG    ticks;          // Total performance counter ticks
+    int         count;          // Triangles (or faces) produced
+    SIZE_T      mem;            // Largest working set at the end of the stage
+} BenchStat;
+
+static char *stage_names[BENCH_STAGES] =
+{
+    "deserialise",
+    "face",
+    "surface",
+    "merge",
+    "export"
+};
+
+static char *alloc_names[3] = { "Object", "Point", "Edge" };
+static OBJECT alloc_types[3] = { OBJ_NONE, OBJ_POINT, OBJ_EDGE };
+
+static BenchStat bench_stats[BENCH_STAGES];
+static LARGE_INTEGER bench_freq;
+static SIZE_T bench_base_mem;       // Working set at the start of the current run of a model
+
+// Start timing a stage.
+void
+bench_start(LARGE_INTEGER *start)
+{
+    if (benchmarking)
+        QueryPerformanceCounter(start);
+}
+
+// Finish timing a stage, and add in the number of triangles it produced.
+void
+bench_end(BENCH_STAGE stage, LARGE_INTEGER *start, int count)
+{
+    LARGE_INTEGER end;
+    PROCESS_MEMORY_COUNTERS pmc;
+    BenchStat *s = &bench_stats[stage];
+
+    if (!benchmarking)
+        return;
+
+    QueryPerformanceCounter(&end);
+    s->calls++;
+    s->ticks += end.QuadPart - start->QuadPart;
+    s->count += count;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)) && pmc.WorkingSetSize > s->mem)
+        s->mem = pmc.WorkingSetSize;
+}
+
+// Make a heavier model by copying the top level objects n - 1 times along X,
+// each copy overlapping the last by half its width.
+static void
+make_stress_model(int n)
+{
+    Object *obj, *last, *new_obj;
+    float dx;
+    int i;
+
+    gen_view_list_tree_volumes(&object_tree);       // to get the tree bbox
+    dx = (object_tree.bbox.xmax - object_tree.bbox.xmin) / 2;
+    last = object_tree.obj_list.tail;
+    for (i = 1; i < n; i++)
+    {
+        for (obj = object_tree.obj_list.head; obj != NULL; obj = obj->next)
+        {
+            if (obj->type == OBJ_VOLUME || obj->type == OBJ_GROUP)
+            {
+                new_obj = copy_obj(obj, dx * i, 0, 0, FALSE);
+                clear_move_copy_flags(obj);
+                link_tail_group(new_obj, &object_tree);
+            }
+            if (obj == last)
+                break;
+        }
+    }
+}
+
+// Run one model through all the stages. The stats are left in bench_stats.
+static BOOL
+bench_model(char *filename, int stress)
+{
+    LARGE_INTEGER start;
+    LONGLONG face_ticks;
+    PROCESS_MEMORY_COUNTERS pmc;
+    char tmpdir[256], stlname[256];
+
+    memset(bench_stats, 0, sizeof(bench_stats));
+    purge_tree(&object_tree, FALSE, NULL);
+    clear_alloc_stats();
+    bench_base_mem = 0;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        bench_base_mem = pmc.WorkingSetSize;
+
+    bench_start(&start);
+    if (!deserialise_tree(&object_tree, filename, FALSE))
+        return FALSE;
+    bench_end(BENCH_DESERIALISE, &start, 0);
+    face_ticks = bench_stats[BENCH_FACE].ticks;
+    bench_stats[BENCH_DESERIALISE].ticks -= face_ticks;
+
+    // Don't let the mesh cache do the work for us
+    mesh_cache_close();
+
+    if (stress > 1)
+        make_stress_model(stress);
+
+    gen_view_list_tree_volumes(&object_tree);
+    gen_view_list_tree_surfaces(&object_tree, &object_tree);
+    if (object_tree.mesh == NULL || !object_tree.mesh_valid)
+        return FALSE;
+
+    GetTempPath(256, tmpdir);
+    sprintf_s(stlname, 256, "%sLoftyCAD_bench.stl", tmpdir);
+    bench_start(&start);
+    export_object_tree(&object_tree, stlname, 1);
+    bench_end(BENCH_EXPORT, &start, mesh_num_faces(object_tree.mesh));
+    DeleteFile(stlname);
+
+    return TRUE;
+}
+
+// Benchmark a model, repeating it and keeping the fastest time for each stage.
+// Print the results and write them to the CSV file if there is one.
+static BOOL
+bench_file(char *filename, int repeat, int stress, FILE *csv)
+{
+    BenchStat best[BENCH_STAGES];
+    SIZE_T growth = 0;
+    int i, r;
+    double ms, total_ms;
+
+    for (r = 0; r < repeat; r++)
+    {
+        if (!bench_model(filename, stress))
+        {
+            fprintf_s(stdout, "%s: FAILED\n", filename);
+            return FALSE;
+        }
+        for (i = 0; i < BENCH_STAGES; i++)
+        {
+            if (r == 0 || bench_stats[i].ticks < best[i].ticks)
+                best[i] = bench_stats[i];
+            if (bench_stats[i].mem > bench_base_mem && bench_stats[i].mem - bench_base_mem > growth)
+                growth = bench_stats[i].mem - bench_base_mem;
+        }
+    }
+
+    fprintf_s(stdout, "%s", filename);
+    if (stress > 1)
+        fprintf_s(stdout, " (x%d)", stress);
+    fprintf_s(stdout, "\n    %-12s %8s %12s %12s %10s\n", "stage", "calls", "time (ms)", "triangles", "mem (MB)");
+    total_ms = 0;
+    for (i = 0; i < BENCH_STAGES; i++)
+    {
+        ms = (double)best[i].ticks * 1000.0 / bench_freq.QuadPart;
+        total_ms += ms;
+        fprintf_s(stdout, "    %-12s %8d %12.1f %12d %10.1f\n",
+                  stage_names[i], best[i].calls, ms, best[i].count, best[i].mem / 1048576.0);
+        if (csv != NULL)
+        {
+            fprintf_s(csv, "\"%s\",%d,%s,%d,%.3f,%d,%.1f\n",
+                      filename, stress, stage_names[i], best[i].calls, ms, best[i].count, best[i].mem / 1048576.0);
+        }
+    }
+    fprintf_s(stdout, "    %-12s %8s %12.1f %12s %10.1f\n", "total", "", total_ms, "", growth / 1048576.0);
+
+    fprintf_s(stdout, "    %-12s %8s %12s %12s %10s\n", "alloc", "slabs", "carved", "reused", "free");
+    for (i = 0; i < 3; i++)
+    {
+        AllocStats stats;
+
+        get_alloc_stats(alloc_types[i], &stats);
+        fprintf_s(stdout, "    %-12s %8d %12d %12d %10d\n",
+                  alloc_names[i], stats.n_slabs, stats.n_carved, stats.n_reused, stats.n_free);
+    }
+    fprintf_s(stdout, "\n");
+
+    return TRUE;
+}
+
+// Benchmark all the LCD files in a directory and its subdirectories.
+static int
+bench_dir(char *dir, int repeat, int stress, FILE *csv)
+{
+    WIN32_FIND_DATA fd;
+    HANDLE h;
+    char path[MAX_PATH];
+    int n_failed = 0;
+
+    sprintf_s(path, MAX_PATH, "%s\\*", dir);
+    h = FindFirstFile(path, &fd);
+    if (h == INVALID_HANDLE_VALUE)
+        return 0;
+
+    do
+    {
+        char *pdot = strrchr(fd.cFileName, '.');
+
+        sprintf_s(path, MAX_PATH, "%s\\%s", dir, fd.cFileName);
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            if (fd.cFileName[0] != '.')
+                n_failed += bench_dir(path, repeat, stress, csv);
+        }
+        else if (pdot != NULL && _stricmp(pdot, ".lcd") == 0)
+        {
+            if (!bench_file(path, repeat, stress, csv))
+                n_failed++;
+        }
+    } while (FindNextFile(h, &fd));
+
+    FindClose(h);
+    return n_failed;
+}
+
+// Run the benchmarks. The command line is what follows the "-bench" switch.
+// Returns the process exit code (the number of models that failed).
+int
+run_bench(char *cmdline)
+{
+    char arg[256];
+    char *line = cmdline;
+    int repeat = 1, stress = 1, n_failed = 0, n_models = 0;
+    DWORD attr;
+    FILE *csv = NULL;
+
+    batch_init();
+    benchmarking = TRUE;
+    QueryPerformanceFrequency(&bench_freq);
+
+    while ((line = batch_next_arg(line, arg, 256)) != NULL)
+    {
+        if (_stricmp(arg, "-repeat") == 0 && (line = batch_next_arg(line, arg, 256)) != NULL)
+        {
+            repeat = atoi(arg);
+            if (repeat < 1)
+                repeat = 1;
+        }
+        else if (_stricmp(arg, "-stress") == 0 && (line = batch_next_arg(line, arg, 256)) != NULL)
+        {
+            stress = atoi(arg);
+            if (stress < 1)
+                stress = 1;
+        }
+        else if (_stricmp(arg, "-csv") == 0 && (line = batch_next_arg(line, arg, 256)) != NULL)
+        {
+            if (csv != NULL)
+                fclose(csv);
+            fopen_s(&csv, arg, "wt");
+            if (csv != NULL)
+                fprintf_s(csv, "model,stress,stage,calls,ms,triangles,mem_mb\n");
+        }
+        else
+        {
+            n_models++;
+            attr = GetFileAttributes(arg);
+            if (attr == INVALID_FILE_ATTRIBUTES)
+            {
+                fprintf_s(stderr, "Cannot find %s\n", arg);
+                n_failed++;
+            }
+            else if (attr & FILE_ATTRIBUTE_DIRECTORY)
+            {
+                n_failed += bench_dir(arg, repeat, stress, csv);
+            }
+            else if (!bench_file(arg, repeat, stress, csv))
+            {
+                n_failed++;
+            }
+        }
+        if (line == NULL)
+            break;
+    }
+
+    if (n_models == 0)
+    {
+        fprintf_s(stderr, "Usage: LoftyCAD -bench [-repeat n] [-stress n] [-csv results.csv] file.lcd|directory ...\n");
+        n_failed = 1;
+    }
+
+    if (csv != NULL)
+        fclose(csv);
+    return n_failed;
+}
@@ -0,0 +1,521 @@
+#include "stdafx.h"
+#include "LoftyCAD.h"
+#include <stdio.h>
+
+// Bounding volume hierarchy over the faces of a volume, to speed up picking
+// and snapping on volumes with lots of faces (e.g. imported meshes).
+//
+// The hierarchy is built the first time it is needed. When the volume's view lists
+// are regenerated (e.g. it has been moved), the tree is marked dirty; the next query
+// then refits the boxes in place if the faces are the same, or rebuilds it if faces
+// have been added or removed.
+//
+// Face boxes include the face's edges, arc centres and bezier control points (as these
+// can be picked too), and are expanded by the snapping tolerance.
+//
+// A mesh-only volume has no faces, so it gets a hierarchy over its mesh triangles
+// instead, kept separately. Their coordinates are copied out of the mesh, as it can't
+// be indexed by triangle. When the mesh is moved or transformed the hierarchy is
+// marked dirty, and refitted if the mesh has the same number of triangles.
+
+#define BVH_LEAF_SIZE   4       // Most faces in a leaf node
+#define BVH_STACK       64      // Deep enough for any balanced-ish tree
+
+// Expand a box to include an edge and its pickable points.
+static void
+edge_bbox(Edge *e, Bbox *box)
+{
+    Point *p;
+
+    expand_bbox(box, e->endpoints[0]);
+    expand_bbox(box, e->endpoints[1]);
+    switch (e->type & ~EDGE_CONSTRUCTION)
+    {
+    case EDGE_ARC:
+        expand_bbox(box, ((ArcEdge *)e)->centre);
+        break;
+
+    case EDGE_BEZIER:
+        expand_bbox(box, ((BezierEdge *)e)->ctrlpoints[0]);
+        expand_bbox(box, ((BezierEdge *)e)->ctrlpoints[1]);
+        break;
+    }
+
+    if (e->view_valid)
+    {
+        for (p = (Point *)e->view_list.head; p != NULL; p = (Point *)p->hdr.next)
+            expand_bbox(box, p);
+    }
+}
+
+// Find the box around a face, expanded by the snapping tolerance.
+void
+face_bbox(Face *f, Bbox *box)
+{
+    int i;
+
+    clear_bbox(box);
+    for (i = 0; i < f->n_edges; i++)
+        edge_bbox(f->edges[i], box);
+
+    for (i = 0; i < f->n_view; i++)
+        expand_bbox_coords(box, f->view_x[i], f->view_y[i], f->view_z[i]);
+
+    box->xmin -= snap_tol;
+    box->xmax += snap_tol;
+    box->ymin -= snap_tol;
+    box->ymax += snap_tol;
+    box->zmin -= snap_tol;
+    box->zmax += snap_tol;
+    box->xc = (box->xmin + box->xmax) / 2;
+    box->yc = (box->ymin + box->ymax) / 2;
+    box->zc = (box->zmin + box->zmax) / 2;
+}
+
+// Return the centre coordinate of a box on an axis (0, 1, 2 = X, Y, Z)
+static float
+centre_on_axis(Bbox *box, int axis)
+{
+    return axis == 0 ? box->xc : axis == 1 ? box->yc : box->zc;
+}
+
+// Build the node n over faces first .. first + count - 1, splitting them at the middle
+// of the longest axis of their centres.
+static void
+bvh_build_node(BVH *bvh, int n, int first, int count)
+{
+    BVHNode *node = &bvh->nodes[n];
+    Bbox centres;
+    Face *tf;
+    Bbox tb;
+    float dx, dy, dz, mid;
+    int i, j, axis, left, ti;
+
+    clear_bbox(&node->box);
+    clear_bbox(&centres);
+    for (i = first; i < first + count; i++)
+    {
+        union_bbox(&node->box, &bvh->boxes[i], &node->box);
+        expand_bbox_coords(&centres, bvh->boxes[i].xc, bvh->boxes[i].yc, bvh->boxes[i].zc);
+    }
+
+    node->left = 0;
+    node->first = first;
+    node->count = count;
+    if (count <= BVH_LEAF_SIZE)
+        return;
+
+    dx = centres.xmax - centres.xmin;
+    dy = centres.ymax - centres.ymin;
+    dz = centres.zmax - centres.zmin;
+    if (dx >= dy && dx >= dz)
+    {
+        axis = 0;
+        mid = (centres.xmin + centres.xmax) / 2;
+    }
+    else if (dy >= dz)
+    {
+        axis = 1;
+        mid = (centres.ymin + centres.ymax) / 2;
+    }
+    else
+    {
+        axis = 2;
+        mid = (centres.zmin + centres.zmax) / 2;
+    }
+
+    // Partition the faces or triangles (and their boxes) about the middle.
+    for (i = first, j = first + count - 1; i <= j; )
+    {
+        if (centre_on_axis(&bvh->boxes[i], axis) < mid)
+        {
+            i++;
+        }
+        else
+        {
+            if (bvh->tris != NULL)
+            {
+                ti = bvh->tris[i];
+                bvh->tris[i] = bvh->tris[j];
+                bvh->tris[j] = ti;
+            }
+            else
+            {
+                tf = bvh->faces[i];
+                bvh->faces[i] = bvh->faces[j];
+                bvh->faces[j] = tf;
+            }
+            tb = bvh->boxes[i];
+            bvh->boxes[i] = bvh->boxes[j];
+            bvh->boxes[j] = tb;
+            j--;
+        }
+    }
+
+    // If they all fell on one side (all the centres coincide), just halve them.
+    i -= first;
+    if (i == 0 || i == count)
+        i = count / 2;
+
+    left = bvh->n_nodes;
+    bvh->n_nodes += 2;
+    node->left = left;
+    bvh_build_node(bvh, left, first, i);
+    bvh_build_node(bvh, left + 1, first + i, count - i);
+}
+
+// Build a hierarchy from scratch for a volume's faces.
+static void
+bvh_build(BVH *bvh, Volume *vol)
+{
+    Face *f;
+    int i, n = 0;
+
+    for (f = (Face *)vol->faces.head; f != NULL; f = (Face *)f->hdr.next)
+        n++;
+
+    if (n > bvh->n_alloc)
+    {
+        bvh->n_alloc = n;
+        bvh->faces = realloc(bvh->faces, n * sizeof(Face *));
+        bvh->list = realloc(bvh->list, n * sizeof(Face *));
+        bvh->boxes = realloc(bvh->boxes, n * sizeof(Bbox));
+        bvh->nodes = realloc(bvh->nodes, 2 * n * sizeof(BVHNode));
+    }
+
+    bvh->n_faces = n;
+    for (i = 0, f = (Face *)vol->faces.head; f != NULL; i++, f = (Face *)f->hdr.next)
+    {
+        bvh->faces[i] = f;
+        bvh->list[i] = f;
+        face_bbox(f, &bvh->boxes[i]);
+    }
+
+    bvh->n_nodes = 1;
+    if (n > 0)
+        bvh_build_node(bvh, 0, 0, n);
+}
+
+// Refit the node boxes to the face (or triangle) boxes, without changing the tree.
+// Children always come after their parents in the node array, so work backwards.
+static void
+bvh_refit_nodes(BVH *bvh)
+{
+    BVHNode *node;
+    int i, n;
+
+    for (n = bvh->n_nodes - 1; n >= 0; n--)
+    {
+        node = &bvh->nodes[n];
+        clear_bbox(&node->box);
+        if (node->left == 0)
+        {
+            for (i = node->first; i < node->first + node->count; i++)
+                union_bbox(&node->box, &bvh->boxes[i], &node->box);
+        }
+        else
+        {
+            union_bbox(&node->box, &bvh->nodes[node->left].box, &node->box);
+            union_bbox(&node->box, &bvh->nodes[node->left + 1].box, &node->box);
+        }
+    }
+}
+
+// Refit the boxes to the faces' new positions, without changing the tree.
+static void
+bvh_refit(BVH *bvh)
+{
+    int i;
+
+    for (i = 0; i < bvh->n_faces; i++)
+        face_bbox(bvh->faces[i], &bvh->boxes[i]);
+    bvh_refit_nodes(bvh);
+}
+
+// Get the hierarchy for a volume, building or refitting it if required.
+BVH *
+volume_bvh(Volume *vol)
+{
+    BVH *bvh = vol->bvh;
+    Face *f;
+    int i;
+
+    if (bvh == NULL)
+    {
+        bvh = vol->bvh = calloc(1, sizeof(BVH));
+        bvh_build(bvh, vol);
+        return bvh;
+    }
+
+    if (!bvh->dirty)
+        return bvh;
+
+    // Check that the faces are the same ones (in list order) as when it was built.
+    bvh->dirty = FALSE;
+    for (i = 0, f = (Face *)vol->faces.head; f != NULL; i++, f = (Face *)f->hdr.next)
+    {
+        if (i >= bvh->n_faces || bvh->list[i] != f)
+            break;
+    }
+    if (f == NULL && i == bvh->n_faces)
+        bvh_refit(bvh);
+    else
+        bvh_build(bvh, vol);
+
+    return bvh;
+}
+
+// Mark a volume's hierarchy as needing to be refitted.
+void
+invalidate_bvh(Volume *vol)
+{
+    if (vol->bvh != NULL)
+        vol->bvh->dirty = TRUE;
+}
+
+// Free a hierarchy.
+void
+free_bvh(BVH *bvh)
+{
+    if (bvh == NULL)
+        return;
+    free(bvh->faces);
+    free(bvh->list);
+    free(bvh->boxes);
+    free(bvh->nodes);
+    free(bvh->tris);
+    free(bvh->coords);
+    free(bvh);
+}
+
+// Copy a mesh triangle's coordinates into the hierarchy, growing the arrays as needed.
+static void
+gather_triangle(void *arg, float x[3], float y[3], float z[3])
+{
+    BVH *bvh = (BVH *)arg;
+    float *c;
+
+    if (bvh->n_faces >= bvh->n_alloc)
+    {
+        bvh->n_alloc = bvh->n_alloc == 0 ? 1024 : bvh->n_alloc * 2;
+        bvh->coords = realloc(bvh->coords, bvh->n_alloc * 9 * sizeof(float));
+        bvh->tris = realloc(bvh->tris, bvh->n_alloc * sizeof(int));
+        bvh->boxes = realloc(bvh->boxes, bvh->n_alloc * sizeof(Bbox));
+        bvh->nodes = realloc(bvh->nodes, 2 * bvh->n_alloc * sizeof(BVHNode));
+    }
+    c = &bvh->coords[9 * bvh->n_faces++];
+    memcpy(c, x, 3 * sizeof(float));
+    memcpy(c + 3, y, 3 * sizeof(float));
+    memcpy(c + 6, z, 3 * sizeof(float));
+}
+
+// Find the box around a triangle (given by its index into the coords), expanded by
+// the snapping tolerance so that flat boxes are not missed by rounding.
+static void
+tri_bbox(BVH *bvh, int t, Bbox *box)
+{
+    float *c = &bvh->coords[9 * t];
+    int i;
+
+    clear_bbox(box);
+    for (i = 0; i < 3; i++)
+        expand_bbox_coords(box, c[i], c[3 + i], c[6 + i]);
+    box->xmin -= snap_tol;
+    box->xmax += snap_tol;
+    box->ymin -= snap_tol;
+    box->ymax += snap_tol;
+    box->zmin -= snap_tol;
+    box->zmax += snap_tol;
+    box->xc = (box->xmin + box->xmax) / 2;
+    box->yc = (box->ymin + box->ymax) / 2;
+    box->zc = (box->zmin + box->zmax) / 2;
+}
+
+// Get the hierarchy of a mesh-only volume's triangles, building or refitting it if required.
+BVH *
+mesh_volume_bvh(Volume *vol)
+{
+    BVH *bvh = vol->mesh_bvh;
+    int i, n;
+
+    if (bvh != NULL && !bvh->dirty)
+        return bvh;
+
+    if (bvh == NULL)
+        bvh = vol->mesh_bvh = calloc(1, sizeof(BVH));
+    n = bvh->n_faces;
+    bvh->n_faces = 0;
+    if (vol->mesh != NULL)
+        mesh_foreach_face_coords(vol->mesh, gather_triangle, bvh);
+
+    if (bvh->dirty && bvh->n_faces == n)
+    {
+        // The same triangles in new places (the sorted order still refers to them)
+        for (i = 0; i < n; i++)
+            tri_bbox(bvh, bvh->tris[i], &bvh->boxes[i]);
+        bvh_refit_nodes(bvh);
+    }
+    else
+    {
+        for (i = 0; i < bvh->n_faces; i++)
+        {
+            bvh->tris[i] = i;
+            tri_bbox(bvh, i, &bvh->boxes[i]);
+        }
+        bvh->n_nodes = 1;
+        if (bvh->n_faces > 0)
+            bvh_build_node(bvh, 0, 0, bvh->n_faces);
+    }
+    bvh->dirty = FALSE;
+
+    return bvh;
+}
+
+// Mark a mesh-only volume's triangle hierarchy as needing to be refitted.
+void
+invalidate_mesh_bvh(Volume *vol)
+{
+    if (vol->mesh_bvh != NULL)
+        vol->mesh_bvh->dirty = TRUE;
+}
+
+// Test if a line (refpt and direction) passes through a box.
+BOOL
+ray_hits_bbox(Plane *line, Bbox *box)
+{
+    float tmin = -LARGE_COORD, tmax = LARGE_COORD;
+    float o[3], d[3], lo[3], hi[3], t1, t2, t;
+    int i;
+
+    o[0] = line->refpt.x;
+    o[1] = line->refpt.y;
+    o[2] = line->refpt.z;
+    d[0] = line->A;
+    d[1] = line->B;
+    d[2] = line->C;
+    lo[0] = box->xmin;
+    lo[1] = box->ymin;
+    lo[2] = box->zmin;
+    hi[0] = box->xmax;
+    hi[1] = box->ymax;
+    hi[2] = box->zmax;
+
+    for (i = 0; i < 3; i++)
+    {
+        if (fabsf(d[i]) < SMALL_COORD)
+        {
+            if (o[i] < lo[i] || o[i] > hi[i])
+                return FALSE;
+            continue;
+        }
+        t1 = (lo[i] - o[i]) / d[i];
+        t2 = (hi[i] - o[i]) / d[i];
+        if (t1 > t2)
+        {
+            t = t1;
+            t1 = t2;
+            t2 = t;
+        }
+        if (t1 > tmin)
+            tmin = t1;
+        if (t2 < tmax)
+            tmax = t2;
+        if (tmin > tmax)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+// Call fn for each face whose box is hit by the line (if line is not NULL) or
+// overlaps the box (if box is not NULL). Stop early if fn returns TRUE.
+// Return TRUE if stopped early.
+BOOL
+bvh_query(BVH *bvh, Plane *line, Bbox *box, BOOL (*fn)(Face *f, void *arg), void *arg)
+{
+    int stack[BVH_STACK];
+    int sp = 0;
+    int i;
+    BVHNode *node;
+
+    if (bvh->n_faces == 0)
+        return FALSE;
+
+    stack[sp++] = 0;
+    while (sp > 0)
+    {
+        node = &bvh->nodes[stack[--sp]];
+        if (line != NULL && !ray_hits_bbox(line, &node->box))
+            continue;
+        if (box != NULL && !intersects_bbox(box, &node->box))
+            continue;
+
+        if (node->left == 0)
+        {
+            for (i = node->first; i < node->first + node->count; i++)
+            {
+                if (line != NULL && node->count > 1 && !ray_hits_bbox(line, &bvh->boxes[i]))
+                    continue;
+                if (box != NULL && node->count > 1 && !intersects_bbox(box, &bvh->boxes[i]))
+                    continue;
+                if (fn(bvh->faces[i], arg))
+                    return TRUE;
+            }
+        }
+        else if (sp + 2 <= BVH_STACK)
+        {
+            stack[sp++] = node->left + 1;
+            stack[sp++] = node->left;
+        }
+        else
+        {
+            // Too deep (very unbalanced); just test all the faces under here
+            for (i = node->first; i < node->first + node->count; i++)
+            {
+                if (fn(bvh->faces[i], arg))
+                    return TRUE;
+            }
+        }
+    }
+
+    return FALSE;
+}
+
+// Call fn for each triangle whose box is hit by the line, with its coordinates.
+void
+bvh_query_tris(BVH *bvh, Plane *line, void (*fn)(void *arg, float x[3], float y[3], float z[3]), void *arg)
+{
+    int stack[BVH_STACK];
+    int sp = 0;
+    int i;
+    float *c;
+    BVHNode *node;
+
+    if (bvh->n_faces == 0)
+        return;
+
+    stack[sp++] = 0;
+    while (sp > 0)
+    {
+        node = &bvh->nodes[stack[--sp]];
+        if (!ray_hits_bbox(line, &node->box))
+            continue;
+
+        if (node->left == 0 || sp + 2 > BVH_STACK)
+        {
+            // A leaf, or too deep (very unbalanced); test all the triangles under here
+            for (i = node->first; i < node->first + node->count; i++)
+            {
+                if (node->left == 0 && node->count > 1 && !ray_hits_bbox(line, &bvh->boxes[i]))
+                    continue;
+                c = &bvh->coords[9 * bvh->tris[i]];
+                fn(arg, c, c + 3, c + 6);
+            }
+        }
+        else
+        {
+            stack[sp++] = node->left + 1;
+            stack[sp++] = node->left;
+        }
+    }
+}
@@ -250,7 +250,7 @@ Command(int message, int wParam, int lParam)
             break;
         case 5:
             // These don't go to the object tree, but to the gcode tree. Only one at a time.
-            purge_zpoly_edges(&gcode_tree);
+            purge_gcode(&gcode_tree);
             rc = read_gcode_to_group(&gcode_tree, new_filename);
             invalidate_dl();
             SendMessage(hWndPropSheet, PSM_SETCURSEL, TAB_PREVIEW, 0);  // select print preview tab
@@ -345,6 +345,10 @@ Command(int message, int wParam, int lParam)
             }
             break;
 
+        case ID_DEBUG_ALLOCSTATS:
+            log_alloc_stats();
+            break;
+
         case ID_VIEW_HELP:
             hMenu = GetSubMenu(GetMenu(auxGetHWND()), 2);
             if (view_help)
@@ -624,6 +628,7 @@ Command(int message, int wParam, int lParam)
             clean_checkpoints(curr_filename);
             curr_filename[0] = '\0';
             object_tree.title[0] = '\0';
+            save_binary = FALSE;
             SetWindowText(auxGetHWND(), "LoftyCAD");
             SendDlgItemMessage(hWndSlicer, IDB_SLICER_SLICE, WM_SETTEXT, 0, (LPARAM)"Slice Current Model");
             EnableWindow(GetDlgItem(hWndSlicer, IDB_SLICER_SLICE), FALSE);
@@ -680,14 +685,15 @@ Command(int message, int wParam, int lParam)
             memset(&ofn, 0, sizeof(OPENFILENAME));
             ofn.lStructSize = sizeof(OPENFILENAME);
             ofn.hwndOwner = auxGetHWND();
-            ofn.lpstrFilter = "LoftyCAD Files (*.LCD)\0*.LCD\0All Files\0*.*\0\0";
-            ofn.nFilterIndex = 1;
+            ofn.lpstrFilter = "LoftyCAD Files (*.LCD)\0*.LCD\0LoftyCAD Binary Files (*.LCD)\0*.LCD\0All Files\0*.*\0\0";
+            ofn.nFilterIndex = save_binary ? 2 : 1;
             ofn.lpstrDefExt = "lcd";
             ofn.lpstrFile = curr_filename;
             ofn.nMaxFile = 256;
             ofn.Flags = OFN_EXPLORER | OFN_OVERWRITEPROMPT;
             if (GetSaveFileName(&ofn))
             {
+                save_binary = ofn.nFilterIndex == 2;
                 serialise_tree(&object_tree, curr_filename);
                 drawing_changed = FALSE;
                 strcpy_s(window_title, 256, curr_filename);
@@ -778,7 +784,7 @@ Command(int message, int wParam, int lParam)
                     break;
                 case 6:
                     // These don't go to the object tree, but to the gcode tree. Only one at a time.
-                    purge_zpoly_edges(&gcode_tree);
+                    purge_gcode(&gcode_tree);
                     rc = read_gcode_to_group(&gcode_tree, new_filename);
                     invalidate_dl();
                     SendMessage(hWndPropSheet, PSM_SETCURSEL, TAB_PREVIEW, 0);  // select print preview tab
@@ -957,6 +963,7 @@ Command(int message, int wParam, int lParam)
                 }
             }
             clear_selection(&selection);
+            relink_instances(&object_tree);     // instances of anything deleted lose their source
             if (object_tree.mesh != NULL)
                 mesh_destroy(object_tree.mesh);
             object_tree.mesh = NULL;
@@ -1108,7 +1115,7 @@ Command(int message, int wParam, int lParam)
         else if ((HMENU)wParam == GetSubMenu(GetMenu(auxGetHWND()), 1))
         {
             // Edit menu
-            EnableMenuItem((HMENU)wParam, ID_EDIT_UNDO, generation > 0 ? MF_ENABLED : MF_GRAYED);
+            EnableMenuItem((HMENU)wParam, ID_EDIT_UNDO, generation > oldest_generation ? MF_ENABLED : MF_GRAYED);
             EnableMenuItem((HMENU)wParam, ID_EDIT_REDO, generation < latest_generation ? MF_ENABLED : MF_GRAYED);
             EnableMenuItem((HMENU)wParam, ID_EDIT_CUT, selection.head != NULL ? MF_ENABLED : MF_GRAYED);
             EnableMenuItem((HMENU)wParam, ID_EDIT_COPY, selection.head != NULL ? MF_ENABLED : MF_GRAYED);
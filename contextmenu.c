@@ -49,6 +49,7 @@ contextmenu(Object *picked_obj, POINT pt)
     OPERATION op, old_op;
     Group *group, *parent_group;
     Volume* vol;
+    Instance *inst;
     Face *face;
     Point *p, *nextp;
     int i;
@@ -118,7 +119,7 @@ contextmenu(Object *picked_obj, POINT pt)
                 InsertMenu(hMenu, 1, MF_BYPOSITION | MF_STRING, ID_OBJ_UPTOPARENT, buf2);
 
             face = (Face *)(((Volume*)parent)->faces.tail);
-            hole = face->extrude_height < 0;
+            hole = face != NULL && face->extrude_height < 0;
             EnableMenuItem(hMenu, ID_OPERATION_UNION, hole ? MF_GRAYED : MF_ENABLED);
             EnableMenuItem(hMenu, ID_OPERATION_DIFFERENCE, hole ? MF_GRAYED : MF_ENABLED);
             EnableMenuItem(hMenu, ID_OBJ_SELECTPARENTVOLUME, picked_obj->type == OBJ_VOLUME ? MF_GRAYED : MF_ENABLED);
@@ -139,6 +140,22 @@ contextmenu(Object *picked_obj, POINT pt)
 #endif // 0
             break;
 
+        case OBJ_INSTANCE:
+            // Instances take their shape from their source, so they can't be opened up
+            hMenu = LoadMenu(hInst, MAKEINTRESOURCE(IDR_CONTEXT_VOL));
+            hMenu = GetSubMenu(hMenu, 0);
+            ModifyMenu(hMenu, 0, MF_BYPOSITION | MF_GRAYED | MF_STRING, 0, buf);
+            if (has_parent_group)
+                InsertMenu(hMenu, 1, MF_BYPOSITION | MF_STRING, ID_OBJ_UPTOPARENT, buf2);
+
+            EnableMenuItem(hMenu, ID_OBJ_SELECTPARENTVOLUME, MF_GRAYED);
+            EnableMenuItem(hMenu, ID_LOCKING_FACES, MF_GRAYED);
+            EnableMenuItem(hMenu, ID_LOCKING_EDGES, MF_GRAYED);
+            EnableMenuItem(hMenu, ID_LOCKING_POINTS, MF_GRAYED);
+            EnableMenuItem(hMenu, ID_LOCKING_UNLOCKED, MF_GRAYED);
+            EnableMenuItem(hMenu, ID_OBJ_MAKEINSTANCE, MF_GRAYED);
+            break;
+
         case OBJ_GROUP:
             if (is_edge_group((Group *)parent))     // Special treatment for connected edge groups
             {
@@ -206,6 +223,7 @@ contextmenu(Object *picked_obj, POINT pt)
     case OBJ_EDGE:
     case OBJ_VOLUME:
     case OBJ_GROUP:
+    case OBJ_INSTANCE:
         EnableMenuItem(hMenu, ID_OBJ_CHAMFERCORNER, MF_GRAYED);
         EnableMenuItem(hMenu, ID_OBJ_ROUNDCORNER, MF_GRAYED);
         break;
@@ -226,6 +244,9 @@ contextmenu(Object *picked_obj, POINT pt)
     case OBJ_GROUP:
         op = ((Group *)picked_obj)->op;
         break;
+    case OBJ_INSTANCE:
+        op = ((Instance *)picked_obj)->op;
+        break;
     }
 
     old_op = op;
@@ -291,6 +312,11 @@ contextmenu(Object *picked_obj, POINT pt)
 
     suppress_drawing = FALSE;
     change_state(app_state);  // back to displaying usual state text
+
+    // A mesh-only volume needs real faces before it can be unlocked below face level
+    if ((rc == ID_LOCKING_UNLOCKED || rc == ID_LOCKING_POINTS || rc == ID_LOCKING_EDGES) && parent->type == OBJ_VOLUME)
+        expand_mesh_volume((Volume*)parent);
+
     switch (rc)
     {
     case 0:             // no item chosen
@@ -523,6 +549,22 @@ contextmenu(Object *picked_obj, POINT pt)
         }
         purge_obj(picked_obj);
         clear_selection(&selection);
+        relink_instances(&object_tree);     // an instance of the group itself loses its source
+        group_changed = TRUE;
+        break;
+
+    case ID_OBJ_MAKEINSTANCE:
+        // Put an instance of the volume or group alongside it, offset in the facing plane
+        // the way a paste would be.
+        inst = instance_new(parent);
+        move_obj((Object*)inst,
+                 nz(facing_plane->A) ? 10.0f : 0.0f,
+                 nz(facing_plane->B) ? 10.0f : 0.0f,
+                 nz(facing_plane->C) ? 10.0f : 0.0f);
+        clear_move_copy_flags((Object*)inst);
+        link_tail_group((Object*)inst, parent->parent_group != NULL ? parent->parent_group : &object_tree);
+        clear_selection(&selection);
+        link_single((Object*)inst, &selection);
         group_changed = TRUE;
         break;
 
@@ -623,6 +665,7 @@ contextmenu(Object *picked_obj, POINT pt)
         find_obj_pivot(parent, &xc, &yc, &zc);
         rotate_obj_90_facing(parent, xc, yc, zc);
         clear_move_copy_flags(parent);
+        invalidate_all_view_lists(parent, parent, 0, 0, 0);
         xform_changed = TRUE;
         break;
 
@@ -641,6 +684,9 @@ contextmenu(Object *picked_obj, POINT pt)
         {
             rotate_obj_90_facing(sel_obj->prev, xc, yc, zc);
             clear_move_copy_flags(sel_obj->prev);
+            o = find_parent_object(&object_tree, sel_obj->prev, FALSE);
+            if (o != NULL)
+                invalidate_all_view_lists(o, sel_obj->prev, 0, 0, 0);
         }
         xform_changed = TRUE;
         break;
@@ -649,6 +695,7 @@ contextmenu(Object *picked_obj, POINT pt)
         find_obj_pivot(parent, &xc, &yc, &zc);
         reflect_obj_facing(parent, xc, yc, zc);
         clear_move_copy_flags(parent);
+        invalidate_all_view_lists(parent, parent, 0, 0, 0);
         xform_changed = TRUE;
         break;
 
@@ -666,6 +713,9 @@ contextmenu(Object *picked_obj, POINT pt)
         {
             reflect_obj_facing(sel_obj->prev, xc, yc, zc);
             clear_move_copy_flags(sel_obj->prev);
+            o = find_parent_object(&object_tree, sel_obj->prev, FALSE);
+            if (o != NULL)
+                invalidate_all_view_lists(o, sel_obj->prev, 0, 0, 0);
         }
         xform_changed = TRUE;
         break;
@@ -738,12 +788,16 @@ contextmenu(Object *picked_obj, POINT pt)
         case OBJ_GROUP:
             ((Group *)picked_obj)->op = op;
             break;
+        case OBJ_INSTANCE:
+            ((Instance *)picked_obj)->op = op;
+            break;
         }
 
         invalidate_all_view_lists(parent, picked_obj, 0, 0, 0);
     }
 
-    if (material_changed || xform_changed)
+    // (transformed objects have been invalidated already, as they may keep their view lists)
+    if (material_changed)
         invalidate_all_view_lists(parent, picked_obj, 0, 0, 0);
 
     if (parent->lock != old_parent_lock || op != old_op || group_changed || dims_changed || sel_changed || xform_changed || inserted || material_changed)
@@ -1,6 +1,17 @@
 #include "stdafx.h"
 #include "LoftyCAD.h"
 
+// Distance between two points in a face's packed view list.
+static float
+view_length(Face *f, int i, int j)
+{
+    float dx = f->view_x[j] - f->view_x[i];
+    float dy = f->view_y[j] - f->view_y[i];
+    float dz = f->view_z[j] - f->view_z[i];
+
+    return sqrtf(dx * dx + dy * dy + dz * dz);
+}
+
 // Quick and dirty find first arc edge in a circle face. It is [0] for normal faces,
 // but [1] if it has been reflected.
 ArcEdge *
@@ -85,6 +96,9 @@ has_dims(Object *obj)
         if (app_state == STATE_STARTING_ROTATE || app_state == STATE_DRAWING_ROTATE)
             return TRUE;
         return FALSE;
+
+    case OBJ_INSTANCE:
+        return FALSE;
     }
 
     return TRUE;
@@ -360,7 +374,6 @@ char *
 get_dims_string(Object *obj, char buf[64])
 {
     char buf2[64], buf3[64];
-    Point *p0, *p1, *p2, *p3;
     Edge *e, *e1;
     ArcEdge *ae, *ae1, *ae2;
     Face *f, *c1, *c2;
@@ -438,26 +451,19 @@ get_dims_string(Object *obj, char buf[64])
             {
             case FACE_RECT:
                 // use view list here, then it works for drawing rects or hexes
-                // protect against NULL view list (transitory)
-                p0 = (Point *)f->view_list.head;
-                if (p0 == NULL)
+                // protect against empty view list (transitory)
+                if (f->n_view < 3)
                     break;
-                p1 = (Point *)p0->hdr.next;
-                p2 = (Point *)p1->hdr.next;
                 sprintf_s(buf, 64, "%s,%s mm",
-                          display_rounded(buf, length(p0, p1)),
-                          display_rounded(buf2, length(p1, p2)));
+                          display_rounded(buf, view_length(f, 0, 1)),
+                          display_rounded(buf2, view_length(f, 1, 2)));
                 break;
 
             case FACE_HEX:
-                p0 = (Point*)f->view_list.head;
-                if (p0 == NULL)
+                if (f->n_view < 4)
                     break;
-                p1 = (Point*)p0->hdr.next;
-                p2 = (Point*)p1->hdr.next;
-                p3 = (Point*)p2->hdr.next;
                 sprintf_s(buf, 64, "%s mm",
-                    display_rounded(buf, 0.866f * length(p0, p3)));
+                    display_rounded(buf, 0.866f * view_length(f, 0, 3)));
                 break;
 
             case FACE_CIRCLE:
@@ -620,7 +626,7 @@ show_dims_on(Object *obj, PRESENTATION pres, LOCK parent_lock)
     Volume *v;
     Face *f;
     Edge *e;
-    Point *p0, *p1, *p2;
+    Point *p0;
     int n;
     float x, y, z;
     BOOL selected = pres & DRAW_SELECTED;
@@ -677,24 +683,21 @@ show_dims_on(Object *obj, PRESENTATION pres, LOCK parent_lock)
             // use view list here if there are no edges yet, then it works for rects or hexes being drawn in.
             if (f->n_edges == 0)
             {
-                p0 = (Point *)f->view_list.head;
-                p1 = (Point *)p0->hdr.next;
-                p2 = (Point *)p1->hdr.next;
                 glRasterPos3f
                 (
-                    (p0->x + p2->x) / 2,
-                    (p0->y + p2->y) / 2,
-                    (p0->z + p2->z) / 2
+                    (f->view_x[0] + f->view_x[2]) / 2,
+                    (f->view_y[0] + f->view_y[2]) / 2,
+                    (f->view_z[0] + f->view_z[2]) / 2
                 );
             }
             else
             {
                 x = y = z = 0;
-                for (n = 0, p0 = (Point*)f->view_list.head->next; p0 != NULL; p0 = (Point*)p0->hdr.next, n++)
+                for (n = 0; n < f->n_view - 1; n++)
                 {
-                    x += p0->x;
-                    y += p0->y;
-                    z += p0->z;
+                    x += f->view_x[n + 1];
+                    y += f->view_y[n + 1];
+                    z += f->view_z[n + 1];
                 }
                 x /= n;
                 y /= n;
@@ -707,6 +710,7 @@ show_dims_on(Object *obj, PRESENTATION pres, LOCK parent_lock)
 
     case OBJ_VOLUME:
     case OBJ_GROUP:
+    case OBJ_INSTANCE:
         v = (Volume *)obj;
         color_as(OBJ_EDGE, 1.0f, FALSE, 0, FALSE);
         glRasterPos3f(v->bbox.xc, v->bbox.yc, v->bbox.zc);
@@ -34,6 +34,29 @@ BOOL sel_dl_valid = FALSE;          // The selected object(s)
 // Object ID for the highlight DL, so it can be reused if the object is revisited unchanged
 Object* hl_dl_obj = NULL;
 
+// Display lists for each top-level object in the tree (when not rendering), so that
+// only the objects that have changed are compiled again. They are kept in a hash
+// table keyed by the object. A list is valid if it was compiled in the current
+// generation with the same presentation; invalidate_dl starts a new generation.
+#define CLIP_DL 3003    // Clipping plane intersections, drawn after the per-object lists
+
+typedef struct ObjectDL
+{
+    Object          *obj;
+    GLuint          list;           // GL display list name
+    PRESENTATION    pres;           // Presentation it was compiled with
+    unsigned int    gen;            // Generation it was compiled in (0 if it never was)
+    unsigned int    seen;           // Last frame it was drawn, to find lists for deleted objects
+} ObjectDL;
+
+static ObjectDL *obj_dls = NULL;
+static int n_obj_dls = 0;
+static int max_obj_dls = 0;         // Always a power of 2 (or zero)
+static unsigned int dl_generation = 1;
+static unsigned int dl_frame = 0;
+static BOOL clip_dl_valid = FALSE;
+static BOOL fixed_dls_reserved = FALSE;
+
 #ifdef TIME_DRAWING
 LARGE_INTEGER draw_clock_start, draw_clock_end, draw_clock, clock_freq;
 int num_draws = 0;
@@ -398,7 +421,7 @@ draw_clip_intersection(Group *tree)
 
             // Make sure there's a triangle mesh. Only render if we can't get it any other
             // way, to save time. Large triangle meshes do not need rendering.
-            if (vol->max_facetype == FACE_TRI)
+            if (vol->max_facetype == FACE_TRI && !vol->mesh_only)
             {
                 color_as(OBJ_EDGE, 1.0f, TRUE, DRAW_PATH, FALSE);
                 glBegin(GL_LINES);
@@ -408,10 +431,9 @@ draw_clip_intersection(Group *tree)
             }
             else
             {
-                if (!vol->mesh_valid)
+                if (!vol->mesh_valid && !vol->mesh_only && !mesh_cache_lookup(obj))
                 {
-                    for (f = (Face*)vol->faces.head; f != NULL; f = (Face*)f->hdr.next)
-                        gen_view_list_surface(f);
+                    gen_view_list_surfaces(vol);
                     vol->mesh_valid = TRUE;
                 }
 
@@ -429,6 +451,40 @@ draw_clip_intersection(Group *tree)
     }
 }
 
+// Draw an instance by drawing its source through the instance's transform, as a GL matrix.
+// A reflection turns the source's triangles around, so the front faces wind the other way.
+static void
+draw_instance(Instance *inst, PRESENTATION pres, LOCK parent_lock)
+{
+    double *m = inst->xform;
+    BOOL reflects = instance_reflects(inst);
+    GLdouble glm[16] =
+    {
+        m[0], m[4], m[8], 0,
+        m[1], m[5], m[9], 0,
+        m[2], m[6], m[10], 0,
+        m[3], m[7], m[11], 1
+    };
+
+    if (inst->source == NULL)
+        return;
+
+    glPushMatrix();
+    glMultMatrixd(glm);
+    if (reflects)
+        glFrontFace(GL_CW);
+
+    // The source's points and edges may have been drawn already, so start a new
+    // drawn number for them, and another for whatever comes after.
+    curr_drawn_no++;
+    draw_object(inst->source, pres, parent_lock == LOCK_GROUP ? LOCK_GROUP : LOCK_VOLUME);
+    curr_drawn_no++;
+
+    if (reflects)
+        glFrontFace(GL_CCW);
+    glPopMatrix();
+}
+
 // Draw any object. Control select/highlight colors per object type, how the parent is locked,
 // and whether to draw components or just the top-level object, among other things.
 void
@@ -437,7 +493,6 @@ draw_object(Object *obj, PRESENTATION pres, LOCK parent_lock)
     int i;
     Face *face;
     Edge *edge;
-    ZPolyEdge* zedge;
     ArcEdge *ae;
     BezierEdge *be;
     Point *p;
@@ -602,12 +657,6 @@ draw_object(Object *obj, PRESENTATION pres, LOCK parent_lock)
                 draw_object((Object *)be->ctrlpoints[1], (pres & ~DRAW_WITH_DIMENSIONS), parent_lock);
             }
             break;
-
-        case EDGE_ZPOLY:
-            zedge = (ZPolyEdge*)edge;
-            color(obj, constr_edge, pres, locked);
-            spaghetti(zedge, print_zmin, print_zmax);
-            break;
         }
 
         if (re_enable)
@@ -646,10 +695,11 @@ draw_object(Object *obj, PRESENTATION pres, LOCK parent_lock)
 
     case OBJ_VOLUME:
         vol = (Volume *)obj;
-        if (view_rendered)
+        if (view_rendered || vol->mesh_only)
         {
-            // Draw from the triangulated mesh for the volume. (only for incomplete meshes)
-            ASSERT(vol->mesh_valid, "Mesh is not up to date");
+            // Draw from the triangulated mesh for the volume. (only for incomplete meshes,
+            // or for mesh-only volumes, which have no faces to draw)
+            ASSERT(vol->mesh_valid || vol->mesh_only, "Mesh is not up to date");
             color(obj, FALSE, pres, FALSE);
             glBegin(GL_TRIANGLES);
             mesh_foreach_face_coords_mat(vol->mesh, draw_triangle, NULL);
@@ -668,8 +718,8 @@ draw_object(Object *obj, PRESENTATION pres, LOCK parent_lock)
             glBegin(GL_TRIANGLES);
             for (face = (Face*)vol->faces.head; face != NULL; face = (Face*)face->hdr.next)
             {
-                for (i = 0, p = (Point*)face->view_list.head; i < 3 && p != NULL; i++, p = (Point*)p->hdr.next)
-                    glVertex3d(p->x, p->y, p->z);
+                for (i = 0; i < 3 && i < face->n_view; i++)
+                    glVertex3f(face->view_x[i], face->view_y[i], face->view_z[i]);
 
                 if (draw_components)
                 {
@@ -728,6 +778,8 @@ draw_object(Object *obj, PRESENTATION pres, LOCK parent_lock)
                         merged = ((Group*)o)->mesh_merged;
                     else if (o->type == OBJ_VOLUME)
                         merged = ((Volume*)o)->mesh_merged;
+                    else if (o->type == OBJ_INSTANCE)
+                        merged = ((Instance*)o)->mesh_merged;
                     else
                         continue;   // can't render edges, points, etc.
 
@@ -750,6 +802,10 @@ draw_object(Object *obj, PRESENTATION pres, LOCK parent_lock)
             }
         }
         break;
+
+    case OBJ_INSTANCE:
+        draw_instance((Instance *)obj, (pres & ~DRAW_WITH_DIMENSIONS), parent_lock);
+        break;
     }
 
     if (show_dims)
@@ -790,6 +846,172 @@ assign_picked_plane(POINT pt)
     // other picked obj types just wait till the mouse moves off them
 }
 
+// Find the slot for an object in the per-object DL table.
+static ObjectDL *
+object_dl_slot(Object *obj)
+{
+    int i = (int)(((UINT_PTR)obj >> 4) & (max_obj_dls - 1));
+
+    while (obj_dls[i].obj != NULL && obj_dls[i].obj != obj)
+        i = (i + 1) & (max_obj_dls - 1);
+    return &obj_dls[i];
+}
+
+// Resize the per-object DL table, dropping (and deleting the lists of) any objects
+// not drawn in the current frame, as they must have been deleted.
+static void
+resize_object_dls(int new_max)
+{
+    ObjectDL *old_dls = obj_dls;
+    int old_max = max_obj_dls;
+    int i;
+
+    obj_dls = calloc(new_max, sizeof(ObjectDL));
+    max_obj_dls = new_max;
+    n_obj_dls = 0;
+    for (i = 0; i < old_max; i++)
+    {
+        if (old_dls[i].obj == NULL)
+            continue;
+        if (old_dls[i].seen != dl_frame)
+        {
+            glDeleteLists(old_dls[i].list, 1);
+            continue;
+        }
+        *object_dl_slot(old_dls[i].obj) = old_dls[i];
+        n_obj_dls++;
+    }
+    free(old_dls);
+}
+
+// Find an object's DL entry, making a new one if it doesn't have one.
+static ObjectDL *
+find_object_dl(Object *obj)
+{
+    ObjectDL *odl;
+
+    if (2 * (n_obj_dls + 1) > max_obj_dls)
+        resize_object_dls(max_obj_dls == 0 ? 256 : max_obj_dls * 2);
+
+    odl = object_dl_slot(obj);
+    if (odl->obj == NULL)
+    {
+        odl->obj = obj;
+        odl->list = glGenLists(1);
+        odl->gen = 0;
+        n_obj_dls++;
+    }
+    return odl;
+}
+
+// Draw the object tree, one top-level object at a time, from their DL's.
+static void
+draw_tree_by_object(PRESENTATION pres)
+{
+    Object *obj;
+    ObjectDL *odl;
+    int n_top = 0;
+
+    // Make sure glGenLists can't hand out the names of the fixed DL's
+    if (!fixed_dls_reserved)
+    {
+        glNewList(DRAW_DL, GL_COMPILE);
+        glEndList();
+        glNewList(HL_DL, GL_COMPILE);
+        glEndList();
+        glNewList(SEL_DL, GL_COMPILE);
+        glEndList();
+        glNewList(CLIP_DL, GL_COMPILE);
+        glEndList();
+        fixed_dls_reserved = TRUE;
+    }
+
+    dl_frame++;
+    for (obj = object_tree.obj_list.head; obj != NULL; obj = obj->next)
+    {
+        // Instances follow their sources, which may be changing, so they are not kept in DL's
+        if (obj->type == OBJ_INSTANCE)
+        {
+            curr_drawn_no++;
+            draw_object(obj, pres, obj->lock);
+            continue;
+        }
+
+        odl = find_object_dl(obj);
+        odl->seen = dl_frame;
+        n_top++;
+        if (odl->gen == dl_generation && odl->pres == pres)
+        {
+            glCallList(odl->list);
+        }
+        else
+        {
+            glNewList(odl->list, GL_COMPILE_AND_EXECUTE);
+            curr_drawn_no++;
+            draw_object(obj, pres, obj->lock);
+            glEndList();
+            odl->gen = dl_generation;
+            odl->pres = pres;
+            clip_dl_valid = FALSE;
+        }
+    }
+
+    // If clipping, draw the intersection path of
+    // any volumes with the clipping plane.
+    if (view_clipped)
+    {
+        if (clip_dl_valid)
+        {
+            glCallList(CLIP_DL);
+        }
+        else
+        {
+            glNewList(CLIP_DL, GL_COMPILE_AND_EXECUTE);
+            draw_clip_intersection(&object_tree);
+            glEndList();
+            clip_dl_valid = TRUE;
+        }
+    }
+
+    // Throw away the lists of deleted objects when they start to pile up
+    if (n_obj_dls > 2 * n_top + 64)
+        resize_object_dls(max_obj_dls);
+}
+
+// Mark DL's as invalid. The next draw will regenerate them.
+static void invalidate_dl_lists(void)
+{
+    draw_dl_valid = FALSE;
+    sel_dl_valid = FALSE;
+    hl_dl_valid = FALSE;
+    hl_dl_obj = NULL;
+    dl_generation++;
+    clip_dl_valid = FALSE;
+}
+
+// Mark DL's as invalid when the model has changed. The screen grid used for
+// picking in a rect must be rebuilt too.
+void invalidate_dl(void)
+{
+    invalidate_dl_lists();
+    invalidate_screen_grid();
+}
+
+// While moving, only the objects being moved (and their halo) change, so only their
+// top-level objects need their DL's compiled again.
+static void
+invalidate_dl_moving(void)
+{
+    Object *obj;
+
+    if (picked_obj != NULL)
+        invalidate_dl_obj(picked_obj);
+    for (obj = selection.head; obj != NULL; obj = obj->next)
+        invalidate_dl_obj(obj->prev);
+    for (obj = halo.head; obj != NULL; obj = obj->next)
+        invalidate_dl_obj(obj->prev);
+}
+
 // Draw the contents of the main window. Everything happens in here.
 void CALLBACK
 Draw(void)
@@ -803,8 +1025,12 @@ Draw(void)
     if (suppress_drawing)
         return;
 
-    if (app_state != STATE_NONE)
-        invalidate_dl();
+    // The model doesn't change just because a frame is drawn, so leave the screen grid
+    // alone here (the view matrices are checked when it is used)
+    if (app_state == STATE_MOVING)
+        invalidate_dl_moving();
+    else if (app_state != STATE_NONE)
+        invalidate_dl_lists();
 
     // handle mouse movement actions.
     // Highlight pick targets (use highlight_obj for this)
@@ -1428,6 +1654,7 @@ Draw(void)
                     p02->hdr.next = (Object *)p03;
 
                     // set it valid, so Draw doesn't try to overwrite it
+                    pack_view_list(rf);
                     rf->view_valid = TRUE;
 
                     curr_obj = (Object *)rf;
@@ -1453,7 +1680,7 @@ Draw(void)
                     p03->y = p3.y;
                     p03->z = p3.z;
 
-                    update_view_list_2D(rf);
+                    pack_view_list(rf);
                 }
 
                 break;
@@ -1546,6 +1773,7 @@ Draw(void)
                     p04->hdr.next = (Object*)p05;
 
                     // set it valid, so Draw doesn't try to overwrite it
+                    pack_view_list(rf);
                     rf->view_valid = TRUE;
 
                     curr_obj = (Object*)rf;
@@ -1579,7 +1807,7 @@ Draw(void)
                     p05->y = p4.y;
                     p05->z = p4.z;
 
-                    update_view_list_2D(rf);
+                    pack_view_list(rf);
                 }
 
                 break;
@@ -2074,13 +2302,13 @@ Draw(void)
                             centre_facing_plane.refpt.z
                         );
                         clear_move_copy_flags(picked_obj);
+                        invalidate_all_view_lists(picked_obj, picked_obj, 0, 0, 0);
 
                         effective_angle = alpha;
                     }
                     curr_obj = picked_obj;  // for highlighting
                     picked_point = new_point;
                 }
-                invalidate_all_view_lists(picked_obj, picked_obj, 0, 0, 0);
 
                 break;
 
@@ -2180,7 +2408,15 @@ Draw(void)
     }
     QueryPerformanceCounter(&draw_clock_start);
 #endif
-    if (draw_dl_valid)
+    if (!view_rendered && !view_printer)
+    {
+        // Draw each top-level object from its own display list
+        pres = 0;
+        if (app_state >= STATE_STARTING_EDGE)
+            pres |= DRAW_HIGHLIGHT_LOCKED;
+        draw_tree_by_object(pres);
+    }
+    else if (draw_dl_valid)
     {
         // Object tree has not changed, just redraw from the display list
         glCallList(DRAW_DL);
@@ -2193,7 +2429,7 @@ Draw(void)
             pres |= DRAW_HIGHLIGHT_LOCKED;
         curr_drawn_no++;
         if (view_printer)
-            draw_object((Object*)&gcode_tree, pres, LOCK_NONE);  // locks come from objects
+            draw_spaghetti(&gcode_tree, pres, print_zmin, print_zmax);
         else
             draw_object((Object*)&object_tree, pres, LOCK_NONE);  // locks come from objects
 
@@ -2427,12 +2663,16 @@ Draw(void)
                 // The view list for a single highlighted face.
                 if (debug_view_viewlist)
                 {
-                    Point* v;
+                    Point v = { 0, };
+                    int i;
 
-                    for (v = (Point*)f->view_list.head; v->hdr.next != NULL; v = (Point*)v->hdr.next)
+                    v.hdr.type = OBJ_POINT;
+                    for (i = 0; i < f->n_view - 1; i++)
                     {
-                        if (v->flags == FLAG_NONE)
-                            draw_object((Object*)v, DRAW_SELECTED, LOCK_NONE);
+                        v.x = f->view_x[i];
+                        v.y = f->view_y[i];
+                        v.z = f->view_z[i];
+                        draw_object((Object*)&v, DRAW_SELECTED, LOCK_NONE);
                     }
                 }
             }
@@ -2571,11 +2811,64 @@ Draw(void)
     auxSwapBuffers();
 }
 
-// Mark DL's as invalid. The next draw will regenerate them.
-void invalidate_dl(void)
+// Test if an object contains an instance of anything in the top-level object top,
+// either directly or through the source of another instance.
+static BOOL
+has_instance_of(Object *obj, Object *top)
 {
+    Object *o;
+
+    switch (obj->type)
+    {
+    case OBJ_GROUP:
+        for (o = ((Group *)obj)->obj_list.head; o != NULL; o = o->next)
+        {
+            if (has_instance_of(o, top))
+                return TRUE;
+        }
+        break;
+
+    case OBJ_INSTANCE:
+        if (((Instance *)obj)->source == NULL)
+            break;
+        for (o = ((Instance *)obj)->source; o != NULL; o = (Object *)o->parent_group)
+        {
+            if (o == top)
+                return TRUE;
+        }
+        return has_instance_of(((Instance *)obj)->source, top);
+    }
+    return FALSE;
+}
+
+// Mark the DL of an object's top-level parent as invalid, leaving the rest of the
+// tree alone. Groups containing instances of it are compiled with a copy of it in
+// their DL's, so mark those invalid too.
+void invalidate_dl_obj(Object *obj)
+{
+    Object *top = find_top_level_parent(obj);
+    Object *o;
+    ObjectDL *odl;
+
     draw_dl_valid = FALSE;
     sel_dl_valid = FALSE;
     hl_dl_valid = FALSE;
     hl_dl_obj = NULL;
+    clip_dl_valid = FALSE;
+    invalidate_screen_grid();
+
+    if (top == NULL || max_obj_dls == 0)
+        return;
+    odl = object_dl_slot(top);
+    if (odl->obj != NULL)
+        odl->gen = 0;
+
+    for (o = object_tree.obj_list.head; o != NULL; o = o->next)
+    {
+        if (o == top || o->type != OBJ_GROUP || !has_instance_of(o, top))
+            continue;
+        odl = object_dl_slot(o);
+        if (odl->obj != NULL)
+            odl->gen = 0;
+    }
 }
@@ -23,6 +23,7 @@ void draw_object(Object *obj, PRESENTATION pres, LOCK parent_lock);
 Face *text_face(Text *text, Face *f);
 void CALLBACK Draw(void);
 void invalidate_dl(void);
+void invalidate_dl_obj(Object *obj);
 BOOL clipped(Point* p);
 BOOL clippedv(float x, float y, float z);
 BOOL is_bbox_clipped(Bbox* box);
@@ -0,0 +1,539 @@
+#include "stdafx.h"
+#include "LoftyCAD.h"
+#include <stdio.h>
+#include <float.h>
+
+// Ear-clipping triangulation of faces, for building surface meshes.
+//
+// Each facet in a face's packed view list is a polygon, and its contour runs are the
+// contours within it. The facet is projected onto the coordinate plane its normal is
+// closest to, any holes are bridged into the outer contour, and ears are clipped off
+// until nothing is left. The triangles refer to points in the view list by index.
+// Nothing global is touched, so faces can be triangulated on several threads at once.
+
+// A vertex of a polygon, in a circular doubly-linked list.
+typedef struct EarNode
+{
+    int             idx;            // Index of the point in the face's view arrays
+    double          u, v;           // Projected coordinates
+    struct EarNode  *prev;
+    struct EarNode  *next;
+} EarNode;
+
+// A contour of a facet, before any holes are bridged in.
+typedef struct EarRing
+{
+    EarNode         *start;         // First node of the ring
+    int             n_nodes;        // Number of nodes
+    double          nx, ny, nz;     // Newell normal (length is twice the area)
+    double          area;           // Signed area in the projection (+ve is anticlockwise)
+    EarNode         *leftmost;      // Node with the smallest u, for bridging holes
+} EarRing;
+
+// Turn from p to q to r in the projection: +ve for a left turn.
+static double
+turn(EarNode *p, EarNode *q, EarNode *r)
+{
+    return (q->u - p->u) * (r->v - q->v) - (q->v - p->v) * (r->u - q->u);
+}
+
+// Test if (px, py) is inside or on the anticlockwise triangle abc.
+static BOOL
+in_triangle(double ax, double ay, double bx, double by, double cx, double cy, double px, double py)
+{
+    return
+        (cx - px) * (ay - py) >= (ax - px) * (cy - py)
+        &&
+        (ax - px) * (by - py) >= (bx - px) * (ay - py)
+        &&
+        (bx - px) * (cy - py) >= (cx - px) * (by - py);
+}
+
+// Add a triangle to a batch.
+static void
+add_tri(TriBatch *batch, int i0, int i1, int i2)
+{
+    if (batch->nt >= batch->n_alloc)
+    {
+        batch->n_alloc = batch->n_alloc == 0 ? 16 : batch->n_alloc * 2;
+        batch->tri = realloc(batch->tri, 3 * batch->n_alloc * sizeof(int));
+    }
+    batch->tri[3 * batch->nt] = i0;
+    batch->tri[3 * batch->nt + 1] = i1;
+    batch->tri[3 * batch->nt + 2] = i2;
+    batch->nt++;
+}
+
+// Unlink a node from its list.
+static void
+remove_node(EarNode *p)
+{
+    p->next->prev = p->prev;
+    p->prev->next = p->next;
+}
+
+// Reverse the direction of a ring.
+static void
+reverse_ring(EarRing *ring)
+{
+    EarNode *p = ring->start;
+    EarNode *t;
+
+    do
+    {
+        t = p->next;
+        p->next = p->prev;
+        p->prev = t;
+        p = t;
+    } while (p != ring->start);
+    ring->area = -ring->area;
+}
+
+// Test if a point lies inside a ring (even-odd rule).
+static BOOL
+inside_ring(EarRing *ring, double u, double v)
+{
+    EarNode *p = ring->start;
+    BOOL inside = FALSE;
+
+    do
+    {
+        if ((p->v > v) != (p->next->v > v) && u < (p->next->u - p->u) * (v - p->v) / (p->next->v - p->v) + p->u)
+            inside = !inside;
+        p = p->next;
+    } while (p != ring->start);
+
+    return inside;
+}
+
+// Test if a diagonal from a to b would lie inside the polygon near a.
+static BOOL
+locally_inside(EarNode *a, EarNode *b)
+{
+    if (turn(a->prev, a, a->next) > 0)
+        return turn(a, b, a->next) <= 0 && turn(a, a->prev, b) <= 0;
+    else
+        return turn(a, b, a->prev) > 0 || turn(a, a->next, b) > 0;
+}
+
+// Test if the sector at m contains the sector at p (they have the same coordinates).
+static BOOL
+sector_contains_sector(EarNode *m, EarNode *p)
+{
+    return turn(m->prev, m, p->prev) > 0 && turn(p->next, m, m->next) > 0;
+}
+
+// Find a node on the outer polygon that the leftmost node of a hole can be joined to,
+// by casting a ray to the left and taking the nearest visible node. Return NULL if none.
+static EarNode *
+find_bridge(EarNode *hole, EarNode *outer)
+{
+    EarNode *p = outer;
+    EarNode *m = NULL;
+    EarNode *stop;
+    double hx = hole->u;
+    double hy = hole->v;
+    double qx = -DBL_MAX;
+    double x, mx, my, tan, tan_min;
+
+    // Find the nearest segment crossed by the ray, and its leftmost end
+    do
+    {
+        if (hy <= p->v && hy >= p->next->v && p->next->v != p->v)
+        {
+            x = p->u + (hy - p->v) * (p->next->u - p->u) / (p->next->v - p->v);
+            if (x <= hx && x > qx)
+            {
+                qx = x;
+                if (x == hx)
+                {
+                    if (hy == p->v)
+                        return p;
+                    if (hy == p->next->v)
+                        return p->next;
+                }
+                m = p->u < p->next->u ? p : p->next;
+            }
+        }
+        p = p->next;
+    } while (p != outer);
+
+    if (m == NULL || hx == qx)
+        return m;
+
+    // If any reflex nodes lie in the triangle between the hole, the crossing point and m,
+    // the one making the smallest angle with the ray is visible from the hole.
+    stop = m;
+    mx = m->u;
+    my = m->v;
+    tan_min = DBL_MAX;
+    p = m;
+    do
+    {
+        if
+            (
+            hx >= p->u && p->u >= mx && hx != p->u
+            &&
+            in_triangle(hy < my ? hx : qx, hy, mx, my, hy < my ? qx : hx, hy, p->u, p->v)
+            )
+        {
+            tan = fabs(hy - p->v) / (hx - p->u);
+            if
+                (
+                locally_inside(p, hole)
+                &&
+                (tan < tan_min || (tan == tan_min && (p->u > m->u || (p->u == m->u && sector_contains_sector(m, p)))))
+                )
+            {
+                m = p;
+                tan_min = tan;
+            }
+        }
+        p = p->next;
+    } while (p != stop);
+
+    return m;
+}
+
+// Join a hole node b into the polygon at node a, with a pair of coincident edges
+// between them. Two new nodes are taken from the pool for the way back.
+static void
+split_polygon(EarNode *a, EarNode *b, EarNode *pool, int *n_pool)
+{
+    EarNode *a2 = &pool[(*n_pool)++];
+    EarNode *b2 = &pool[(*n_pool)++];
+    EarNode *an = a->next;
+    EarNode *bp = b->prev;
+
+    *a2 = *a;
+    *b2 = *b;
+
+    a->next = b;
+    b->prev = a;
+    a2->next = an;
+    an->prev = a2;
+    b2->next = a2;
+    a2->prev = b2;
+    bp->next = b2;
+    b2->prev = bp;
+}
+
+// Test if either edge at node p, which lies on corner x of an anticlockwise triangle
+// x, n, pr, goes into the triangle.
+static BOOL
+enters_corner(EarNode *p, EarNode *x, EarNode *n, EarNode *pr)
+{
+    EarNode *q = p->prev;
+    int i;
+
+    for (i = 0; i < 2; i++, q = p->next)
+    {
+        if
+            (
+            (n->u - x->u) * (q->v - x->v) - (n->v - x->v) * (q->u - x->u) > 0
+            &&
+            (q->u - x->u) * (pr->v - x->v) - (q->v - x->v) * (pr->u - x->u) > 0
+            )
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+// Test if a node is an ear: convex, with no reflex nodes inside its triangle. Nodes that
+// coincide with a corner (where holes are bridged in) only count if their edges go inside.
+static BOOL
+is_ear(EarNode *ear)
+{
+    EarNode *a = ear->prev;
+    EarNode *b = ear;
+    EarNode *c = ear->next;
+    EarNode *p;
+
+    if (turn(a, b, c) <= 0)
+        return FALSE;
+
+    for (p = c->next; p != a; p = p->next)
+    {
+        if (p->u == a->u && p->v == a->v)
+        {
+            if (enters_corner(p, a, b, c))
+                return FALSE;
+        }
+        else if (p->u == b->u && p->v == b->v)
+        {
+            if (enters_corner(p, b, c, a))
+                return FALSE;
+        }
+        else if (p->u == c->u && p->v == c->v)
+        {
+            if (enters_corner(p, c, a, b))
+                return FALSE;
+        }
+        else if (in_triangle(a->u, a->v, b->u, b->v, c->u, c->v, p->u, p->v) && turn(p->prev, p, p->next) <= 0)
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+// Clip ears off an anticlockwise polygon until it is used up. If we get all the way
+// round without finding one, flat nodes are dropped, and as a last resort (the
+// polygon must be self-intersecting) the next node is clipped regardless.
+static void
+clip_ears(EarNode *ear, TriBatch *batch)
+{
+    EarNode *stop = ear;
+    EarNode *prev, *next;
+    int pass = 0;
+    double t;
+
+    while (ear->prev != ear->next)
+    {
+        prev = ear->prev;
+        next = ear->next;
+        t = turn(prev, ear, next);
+        if (is_ear(ear) || (pass >= 1 && t == 0) || pass >= 2)
+        {
+            if (t > 0)
+                add_tri(batch, prev->idx, ear->idx, next->idx);
+            remove_node(ear);
+            ear = next->next;
+            stop = ear;
+            pass = 0;
+            continue;
+        }
+
+        ear = next;
+        if (ear == stop)
+            pass++;
+    }
+}
+
+// Close off a contour read from the view list. Drop any closing points, and discard the
+// contour if there's not enough left of it. Link it up and find its normal.
+static void
+close_ring(Face *face, EarNode *nodes, int start, int *n_nodes, EarRing *rings, int *n_rings)
+{
+    EarRing *ring;
+    int i, j, n;
+
+    while (*n_nodes - start > 1 && near_view_pt(face, nodes[*n_nodes - 1].idx, nodes[start].idx, SMALL_COORD))
+        (*n_nodes)--;
+    n = *n_nodes - start;
+    if (n < 3)
+    {
+        *n_nodes = start;
+        return;
+    }
+
+    ring = &rings[(*n_rings)++];
+    ring->start = &nodes[start];
+    ring->n_nodes = n;
+    ring->nx = ring->ny = ring->nz = 0;
+    for (i = start; i < *n_nodes; i++)
+    {
+        j = i + 1 < *n_nodes ? i + 1 : start;
+        nodes[i].next = &nodes[j];
+        nodes[j].prev = &nodes[i];
+
+        ring->nx += ((double)face->view_y[nodes[i].idx] - face->view_y[nodes[j].idx]) * ((double)face->view_z[nodes[i].idx] + face->view_z[nodes[j].idx]);
+        ring->ny += ((double)face->view_z[nodes[i].idx] - face->view_z[nodes[j].idx]) * ((double)face->view_x[nodes[i].idx] + face->view_x[nodes[j].idx]);
+        ring->nz += ((double)face->view_x[nodes[i].idx] - face->view_x[nodes[j].idx]) * ((double)face->view_y[nodes[i].idx] + face->view_y[nodes[j].idx]);
+    }
+}
+
+// Sort holes from left to right.
+static int
+compare_leftmost(const void *a, const void *b)
+{
+    EarRing *ra = *(EarRing **)a;
+    EarRing *rb = *(EarRing **)b;
+
+    if (ra->leftmost->u < rb->leftmost->u)
+        return -1;
+    if (ra->leftmost->u > rb->leftmost->u)
+        return 1;
+    return 0;
+}
+
+// Triangulate one facet, given its rings. The ring with the largest area is the outer
+// contour, and the triangles are wound the same way it is. Rings inside it are holes;
+// any others are treated as separate polygons.
+static void
+triangulate_facet(Face *face, EarNode *nodes, int n_nodes, EarRing *rings, int n_rings, EarRing **holes, TriBatch *batch)
+{
+    EarRing *outer = &rings[0];
+    EarRing *ring;
+    EarNode *p, *bridge;
+    double len, len_max, nx, ny, nz;
+    float *ucoord, *vcoord;
+    double flip;
+    int i, n_holes;
+
+    // Find the outer ring
+    len_max = 0;
+    for (i = 0; i < n_rings; i++)
+    {
+        ring = &rings[i];
+        len = ring->nx * ring->nx + ring->ny * ring->ny + ring->nz * ring->nz;
+        if (len > len_max)
+        {
+            len_max = len;
+            outer = ring;
+        }
+    }
+    if (len_max == 0)
+        return;
+
+    // Project onto the plane the normal is closest to, such that the outer ring is anticlockwise.
+    nx = fabs(outer->nx);
+    ny = fabs(outer->ny);
+    nz = fabs(outer->nz);
+    if (nz >= nx && nz >= ny)
+    {
+        ucoord = face->view_x;
+        vcoord = face->view_y;
+        flip = outer->nz < 0 ? -1 : 1;
+    }
+    else if (nx >= ny)
+    {
+        ucoord = face->view_y;
+        vcoord = face->view_z;
+        flip = outer->nx < 0 ? -1 : 1;
+    }
+    else
+    {
+        ucoord = face->view_z;
+        vcoord = face->view_x;
+        flip = outer->ny < 0 ? -1 : 1;
+    }
+    for (i = 0; i < n_nodes; i++)
+    {
+        nodes[i].u = flip * ucoord[nodes[i].idx];
+        nodes[i].v = vcoord[nodes[i].idx];
+    }
+
+    // Simple facets (the usual case) don't need anything more
+    if (n_rings == 1 && outer->n_nodes == 3)
+    {
+        p = outer->start;
+        add_tri(batch, p->idx, p->next->idx, p->next->next->idx);
+        return;
+    }
+
+    // Orient the other rings: holes clockwise, separate polygons anticlockwise.
+    n_holes = 0;
+    for (i = 0; i < n_rings; i++)
+    {
+        ring = &rings[i];
+        ring->area = 0;
+        p = ring->start;
+        do
+        {
+            ring->area += (p->u * p->next->v - p->next->u * p->v) / 2;
+            p = p->next;
+        } while (p != ring->start);
+
+        if (ring == outer)
+            continue;
+
+        if (inside_ring(outer, ring->start->u, ring->start->v))
+        {
+            if (ring->area > 0)
+                reverse_ring(ring);
+            ring->leftmost = p = ring->start;
+            do
+            {
+                if (p->u < ring->leftmost->u || (p->u == ring->leftmost->u && p->v < ring->leftmost->v))
+                    ring->leftmost = p;
+                p = p->next;
+            } while (p != ring->start);
+            holes[n_holes++] = ring;
+        }
+        else
+        {
+            if (ring->area < 0)
+                reverse_ring(ring);
+            clip_ears(ring->start, batch);
+        }
+    }
+
+    // Bridge the holes into the outer ring, from left to right
+    qsort(holes, n_holes, sizeof(EarRing *), compare_leftmost);
+    for (i = 0; i < n_holes; i++)
+    {
+        bridge = find_bridge(holes[i]->leftmost, outer->start);
+        if (bridge != NULL)
+            split_polygon(bridge, holes[i]->leftmost, nodes, &n_nodes);
+    }
+
+    clip_ears(outer->start, batch);
+}
+
+// Triangulate a face from its packed view list, putting the triangles in a batch.
+// The triangles index the face's view arrays.
+void
+triangulate_face(Face *face, TriBatch *batch)
+{
+    EarNode *nodes;
+    EarRing *rings;
+    EarRing **holes;
+    int i, r, c, first, end, start, n_nodes, n_rings;
+
+    batch->nt = 0;
+    if (face->n_view_runs == 0)
+        return;
+
+    // Every point could be a node, and each hole needs two more for its bridge.
+    nodes = malloc((face->n_view + 2 * face->n_view_runs) * sizeof(EarNode));
+    rings = malloc(face->n_view_runs * sizeof(EarRing));
+    holes = malloc(face->n_view_runs * sizeof(EarRing *));
+
+    // Each facet is a polygon, and its following contour runs are contours within it.
+    r = 0;
+    while (r < face->n_view_runs)
+    {
+        first = face->view_runs[r].first;
+        c = ++r;
+        while (r < face->n_view_runs && face->view_runs[r].flag == FLAG_NEW_CONTOUR)
+            r++;
+        end = r < face->n_view_runs ? face->view_runs[r].first : face->n_view;
+
+        n_nodes = 0;
+        n_rings = 0;
+        start = 0;
+        for (i = first; i < end; )
+        {
+            if (c < r && i >= face->view_runs[c].first)
+            {
+                close_ring(face, nodes, start, &n_nodes, rings, &n_rings);
+                start = n_nodes;
+                while (c < r && i >= face->view_runs[c].first)
+                    c++;
+            }
+
+            nodes[n_nodes++].idx = i;
+
+            // Skip coincident points (don't create zero-area triangles)
+            while (i + 1 < end && near_view_pt(face, i, i + 1, SMALL_COORD))
+                i++;
+
+            i++;
+
+            // If face(t) is closed, skip the closing point. Watch for dups at the end.
+            while (i < end && near_view_pt(face, i, first, SMALL_COORD))
+                i++;
+        }
+        close_ring(face, nodes, start, &n_nodes, rings, &n_rings);
+
+        if (n_rings > 0)
+            triangulate_facet(face, nodes, n_nodes, rings, n_rings, holes, batch);
+    }
+
+    free(nodes);
+    free(rings);
+    free(holes);
+}
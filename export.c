@@ -111,12 +111,13 @@ export_triangle_obj(void* arg, int nv, Vertex_index* vi)
     fprintf_s(objv, "\n");
 }
 
-// Render an un-merged volume or group to triangles and export it to an STL file
+// Render an un-merged volume, group or instance to triangles and export it to an STL file
 void
 export_unmerged_object_stl(Object *obj)
 {
     Object *o;
     Volume *vol;
+    Instance *inst;
 
     switch (obj->type)
     {
@@ -130,7 +131,111 @@ export_unmerged_object_stl(Object *obj)
         for (o = ((Group *)obj)->obj_list.head; o != NULL; o = o->next)
             export_unmerged_object_stl(o);
         break;
+
+    case OBJ_INSTANCE:
+        inst = (Instance *)obj;
+        if (inst->mesh != NULL && !inst->mesh_merged)
+            mesh_foreach_face_coords(inst->mesh, export_triangle_stl, NULL);
+        break;
+    }
+}
+
+// Write a mesh out to an STL file
+static void
+export_mesh_stl(Mesh *mesh, char *filename, char *title)
+{
+    char buf[64];
+
+    fopen_s(&stl, filename, "wt");
+    if (stl == NULL)
+        return;
+    show_status("Exporting ", filename);
+    fprintf_s(stl, "solid %s\n", title);
+
+    num_exported_tri = 0;
+    mesh_foreach_face_coords(mesh, export_triangle_stl, NULL);
+
+    sprintf_s(buf, 64, "Mesh: %d triangles\r\n", num_exported_tri);
+    Log(buf);
+
+    fprintf_s(stl, "endsolid %s\n", title);
+    fclose(stl);
+    clear_status_and_progress();
+}
+
+// Free the meshes from split_materials
+static void
+free_split_materials(Mesh **parts)
+{
+    int i;
+
+    for (i = 0; i < MAX_MATERIAL; i++)
+    {
+        if (parts[i] != NULL)
+            mesh_destroy(parts[i]);
+        parts[i] = NULL;
+    }
+}
+
+// Mark the materials used by the volumes in an object (including those in groups,
+// and the sources of instances).
+static void
+find_materials_used(Object *obj, BOOL *used)
+{
+    Object *o;
+
+    switch (obj->type)
+    {
+    case OBJ_VOLUME:
+        used[((Volume *)obj)->material] = TRUE;
+        break;
+
+    case OBJ_GROUP:
+        for (o = ((Group *)obj)->obj_list.head; o != NULL; o = o->next)
+            find_materials_used(o, used);
+        break;
+
+    case OBJ_INSTANCE:
+        if (((Instance *)obj)->source != NULL)
+            find_materials_used(((Instance *)obj)->source, used);
+        break;
+    }
+}
+
+// Split the tree's merged mesh by material, so each material can be exported without
+// merging it all over again. Return FALSE if the mesh is incomplete, or the materials
+// don't come apart into separate solids; then they must be merged one at a time.
+// A visible material with volumes but no faces in the merged mesh (e.g. a volume
+// swallowed up by one of another material) must also be merged on its own.
+static BOOL
+split_materials(Group *tree, Mesh **parts)
+{
+    BOOL used[MAX_MATERIAL];
+    Object *obj;
+    int i;
+
+    if (!tree->mesh_complete)
+        return FALSE;
+    if (!mesh_split_by_material(tree->mesh, parts, MAX_MATERIAL))
+    {
+        Log("Materials are not separate solids - merging each one separately\r\n");
+        free_split_materials(parts);
+        return FALSE;
+    }
+
+    memset(used, 0, sizeof(used));
+    for (obj = tree->obj_list.head; obj != NULL; obj = obj->next)
+        find_materials_used(obj, used);
+    for (i = 0; i < MAX_MATERIAL; i++)
+    {
+        if (used[i] && materials[i].valid && !materials[i].hidden && parts[i] == NULL)
+        {
+            Log("Material is hidden inside another - merging each one separately\r\n");
+            free_split_materials(parts);
+            return FALSE;
+        }
     }
+    return TRUE;
 }
 
 // export every volume to various kinds of files
@@ -142,6 +247,9 @@ export_object_tree(Group *tree, char *filename, int file_index)
     char* dot;
     int i, k, baselen;
     int candidates[MAX_MATERIAL];
+    Mesh *parts[MAX_MATERIAL];
+    Mesh *mesh;
+    BOOL split;
 
     ASSERT(tree->mesh != NULL, "Tree mesh NULL");
     ASSERT(tree->mesh_valid, "Tree mesh not valid");
@@ -173,7 +281,7 @@ export_object_tree(Group *tree, char *filename, int file_index)
         {
             for (obj = tree->obj_list.head; obj != NULL; obj = obj->next)
             {
-                if (obj->type == OBJ_VOLUME || obj->type == OBJ_GROUP)
+                if (obj->type == OBJ_VOLUME || obj->type == OBJ_GROUP || obj->type == OBJ_INSTANCE)
                     export_unmerged_object_stl(obj);
             }
             sprintf_s(buf, 64, "Unmerged: %d triangles total\r\n", num_exported_tri);
@@ -201,7 +309,23 @@ export_object_tree(Group *tree, char *filename, int file_index)
         dot = strrchr(filename, '.');
         *dot = '\0';
 
-        // for each one of these, hide all the others, generate the surface and export it
+        // If the merged mesh comes apart by material, just write out the parts
+        if (split_materials(tree, parts))
+        {
+            for (i = 0; i < k; i++)
+            {
+                char name[256];
+
+                if (parts[candidates[i]] == NULL)
+                    continue;
+                sprintf_s(name, 256, "%s_%d.STL", filename, candidates[i]);
+                export_mesh_stl(parts[candidates[i]], name, tree->title);
+            }
+            free_split_materials(parts);
+            break;
+        }
+
+        // Otherwise, for each one of these, hide all the others, generate the surface and export it
         for (i = 0; i < k; i++)
         {
             char name[256];
@@ -272,28 +396,36 @@ export_object_tree(Group *tree, char *filename, int file_index)
                 candidates[k++] = i;
         }
 
-        // for each one of these, hide all the others, generate the surface and export it
+        // Split the merged mesh by material if it comes apart cleanly
+        split = k > 1 && split_materials(tree, parts);
+
+        // for each one of these, take its part of the mesh, or hide all the others and
+        // generate the surface, and export it
         for (i = 0; i < k; i++)
         {
             int j;
 
-            for (j = 0; j < k; j++)
-                materials[candidates[j]].hidden = TRUE;
-            materials[candidates[i]].hidden = FALSE;
-
-            if (k > 1)                      // don't bother re-rendering, if there's only one material
+            if (!split)
             {
-                if (object_tree.mesh != NULL)
-                    mesh_destroy(object_tree.mesh);
-                object_tree.mesh = NULL;
-                object_tree.mesh_valid = FALSE;
-                gen_view_list_tree_surfaces(&object_tree, &object_tree);
+                for (j = 0; j < k; j++)
+                    materials[candidates[j]].hidden = TRUE;
+                materials[candidates[i]].hidden = FALSE;
+
+                if (k > 1)                  // don't bother re-rendering, if there's only one material
+                {
+                    if (object_tree.mesh != NULL)
+                        mesh_destroy(object_tree.mesh);
+                    object_tree.mesh = NULL;
+                    object_tree.mesh_valid = FALSE;
+                    gen_view_list_tree_surfaces(&object_tree, &object_tree);
+                }
             }
-            if (!object_tree.mesh_valid)    // nothing for this material
+            mesh = split ? parts[candidates[i]] : tree->mesh;
+            if (mesh == NULL || !object_tree.mesh_valid)    // nothing for this material
                 continue;
 
             // vertices for the mesh for this material
-            mesh_foreach_vertex(tree->mesh, export_vertex_amf, NULL);
+            mesh_foreach_vertex(mesh, export_vertex_amf, NULL);
 
             // AMF volume for this material (write it to a temp file and append it at the end)
             if (candidates[i] != 0)
@@ -301,7 +433,7 @@ export_object_tree(Group *tree, char *filename, int file_index)
             else
                 fprintf_s(amfv, "      <volume>\n");
             fprintf_s(amfv, "        <metadata type=\"slic3r.extruder\">%d</metadata>\n", candidates[i]);
-            mesh_foreach_face_vertices(tree->mesh, export_triangle_amf, NULL);
+            mesh_foreach_face_vertices(mesh, export_triangle_amf, NULL);
             fprintf_s(amfv, "      </volume>\n");
         }
 
@@ -341,7 +473,11 @@ export_object_tree(Group *tree, char *filename, int file_index)
         DeleteFile(tmp);
         clear_status_and_progress();
 
-        if (k > 1)
+        if (split)
+        {
+            free_split_materials(parts);
+        }
+        else if (k > 1)
         {
             // reinstate all the non-hidden materials and mark the surface mesh for regeneration
             for (i = 0; i < k; i++)
@@ -410,33 +546,41 @@ export_object_tree(Group *tree, char *filename, int file_index)
         // Node renumbering array (assumes full mesh is built beforehand..)
         reindex = (int*)calloc(mesh_num_vertices(tree->mesh), sizeof(int));
 
-        // for each material index, hide all the others, generate the surface and export it
+        // Split the merged mesh by material if it comes apart cleanly
+        split = k > 1 && split_materials(tree, parts);
+
+        // for each material index, take its part of the mesh, or hide all the others and
+        // generate the surface, and export it
         for (i = 0; i < k; i++)
         {
             int j;
 
-            for (j = 0; j < k; j++)
-                materials[candidates[j]].hidden = TRUE;
-            materials[candidates[i]].hidden = FALSE;
-
-            if (k > 1)
+            if (!split)
             {
-                if (object_tree.mesh != NULL)
-                    mesh_destroy(object_tree.mesh);
-                object_tree.mesh = NULL;
-                object_tree.mesh_valid = FALSE;
-                gen_view_list_tree_surfaces(&object_tree, &object_tree);
+                for (j = 0; j < k; j++)
+                    materials[candidates[j]].hidden = TRUE;
+                materials[candidates[i]].hidden = FALSE;
+
+                if (k > 1)
+                {
+                    if (object_tree.mesh != NULL)
+                        mesh_destroy(object_tree.mesh);
+                    object_tree.mesh = NULL;
+                    object_tree.mesh_valid = FALSE;
+                    gen_view_list_tree_surfaces(&object_tree, &object_tree);
+                }
             }
-            if (!object_tree.mesh_valid)    // nothing for this material
+            mesh = split ? parts[candidates[i]] : tree->mesh;
+            if (mesh == NULL || !object_tree.mesh_valid)    // nothing for this material
                 continue;
 
             // vertices for the mesh for this material
-            mesh_foreach_vertex(tree->mesh, export_vertex_obj, NULL);
+            mesh_foreach_vertex(mesh, export_vertex_obj, NULL);
 
             // OBJ volume for this material (write it to a temp file and append it at the end)
             if (candidates[i] != 0)
                 fprintf_s(objv, "usemtl %s\n", materials[candidates[i]].name);
-            mesh_foreach_face_vertices(tree->mesh, export_triangle_obj, NULL);
+            mesh_foreach_face_vertices(mesh, export_triangle_obj, NULL);
         }
 
         free(reindex);
@@ -473,6 +617,12 @@ export_object_tree(Group *tree, char *filename, int file_index)
 
         fclose(mtl);
 
+        if (split)
+        {
+            free_split_materials(parts);
+            break;
+        }
+
         // reinstate all the non-hidden materials and mark the surface mesh for regeneration
         for (i = 0; i < k; i++)
             materials[candidates[i]].hidden = FALSE;
@@ -2,18 +2,22 @@
 #include "LoftyCAD.h"
 #include <stdio.h>
 
-// G-code visualisation as a thin tube around the line segments of a ZPolyEdge.
+// G-code visualisation as a thin tube around the extrusion paths in a G-code store.
+//
+// The tubes for the whole G-code store are built into a single vertex array,
+// with an array of quad indices that is ordered layer by layer. Each layer
+// remembers its range of indices, so drawing a range of layers is just drawing
+// a range of the index array. Layers are added to the arrays as they become ready
+// in the store (so they can be previewed while the file is still being read).
+// The arrays are rebuilt when the G-code is reloaded, or if the bed size or layer
+// height change.
 
 // Number of points in the endcap circles. This must be even to take advantage of symmetry.
 #define NPTS 6
 
 // Circular (approximated) endcaps. The first point lies on the ZPolyEdge and the rest of the
 // circle lies below, of diameter = layer_height.
-typedef struct Endcap
-{
-    Point3D pts[NPTS];
-} Endcap;
-
+//
 // Precalculated offsets of endcap points for different NPTS values, expressed as multiples
 // of the layer height. The offsets are from point[0] in the XZ plane of the endcap.
 #if NPTS == 6
@@ -21,131 +25,191 @@ float xcap[NPTS] = { 0, -0.5f, -0.5f, 0, 0.5f, 0.5f };
 float zcap[NPTS] = { 0, -0.33333f, -0.66666f, -1, -0.66666f, -0.33333f };
 #endif // NPTS
 
+// A vertex in the tube array. The normal is packed into bytes to save space, as
+// there are a lot of these.
+typedef struct SpagVertex
+{
+    float   x, y, z;
+    GLbyte  norm[4];                // Normal A, B, C (scaled to 127), and padding
+} SpagVertex;
+
+// The index range for the quads of one layer of the store
+typedef struct SpagLayer
+{
+    float   z;
+    int     first;                  // First index in spag_index
+    int     count;                  // Number of indices (4 per quad)
+} SpagLayer;
+
+static SpagVertex *spag_verts = NULL;
+static int n_spag_verts = 0;
+static int max_spag_verts = 0;
+static unsigned int *spag_index = NULL;
+static int n_spag_index = 0;
+static int max_spag_index = 0;
+static SpagLayer *spag_layers = NULL;
+static int n_spag_layers = 0;
+static int max_spag_layers = 0;
+
+static BOOL spag_valid = FALSE;
+static int n_spag_built = 0;                                   // Number of store layers built so far
+static float spag_xoffset, spag_yoffset, spag_layer_height;    // What the arrays were built with
 
+// Scaled endcap offsets, calculated once per build.
+static float xcap_lh[NPTS], zcap_lh[NPTS];
 
+// Grow the columns of a G-code store to hold at least one more point.
+static void
+grow_gcode_points(GCodeStore *gc)
+{
+    if (gc->n_points < gc->n_alloc)
+        return;
+
+    gc->n_alloc = gc->n_alloc == 0 ? 65536 : gc->n_alloc * 2;
+    gc->x = realloc(gc->x, gc->n_alloc * sizeof(float));
+    gc->y = realloc(gc->y, gc->n_alloc * sizeof(float));
+    gc->e = realloc(gc->e, gc->n_alloc * sizeof(float));
+    gc->f = realloc(gc->f, gc->n_alloc * sizeof(float));
+    gc->layer = realloc(gc->layer, gc->n_alloc * sizeof(int));
+}
+
+// Start a new layer at height z. The previous layer is complete.
+void
+gcode_add_layer(GCodeStore *gc, float z)
+{
+    if (gc->n_layers >= gc->n_layers_alloc)
+    {
+        gc->n_layers_alloc = gc->n_layers_alloc == 0 ? 256 : gc->n_layers_alloc * 2;
+        gc->layers = realloc(gc->layers, gc->n_layers_alloc * sizeof(GCodeLayer));
+    }
+    gc->layers[gc->n_layers].z = z;
+    gc->layers[gc->n_layers].first = gc->n_points;
+    gc->n_ready = gc->n_layers;
+    gc->n_layers++;
+}
 
-// 2D direction and dot product helpers
+// Add a point to the current layer. e is zero if the point starts a new path.
 void
-dirn(Point2D* p0, Point2D* p1, Point2D* d)
+gcode_add_point(GCodeStore *gc, float x, float y, float e, float f)
+{
+    int n = gc->n_points;
+
+    grow_gcode_points(gc);
+    gc->x[n] = x;
+    gc->y[n] = y;
+    gc->e[n] = e;
+    gc->f[n] = f;
+    gc->layer[n] = gc->n_layers - 1;
+    gc->n_points++;
+}
+
+// Normalised 2D direction from (x0, y0) to (x1, y1)
+static void
+dirn(float x0, float y0, float x1, float y1, Point2D* d)
 {
     float len;
 
-    d->x = p1->x - p0->x;
-    d->y = p1->y - p0->y;
+    d->x = x1 - x0;
+    d->y = y1 - y0;
     len = sqrtf(d->x * d->x + d->y * d->y);
-    d->x /= len;
-    d->y /= len;
+    if (len > 0)
+    {
+        d->x /= len;
+        d->y /= len;
+    }
 }
 
-float
+static float
 dot2d(Point2D* d0, Point2D* d1)
 {
     return d0->x * d1->x + d0->y * d1->y;
 }
 
-// Make an endcap circle at curr.  The line is in (normalised) direction d0. 
+// Make an endcap circle at (x, y) and add its points to the vertex array, returning the
+// index of its first point. The line is in (normalised) direction d0.
 // The next line is in direction d1. If d1 is not NULL, the endcap is mitered
 // between the two directions.
-void
-endcap(Point2D* curr, Point2D *d0, Point2D *d1, float z, Endcap* cap)
+static int
+endcap(float x, float y, Point2D *d0, Point2D *d1, float z)
 {
-    Point3D c[NPTS];
     Point2D adj_d0;
-    int i;
-    float lensq;
-
-    // X/Y offsets are subtracted here.
-    float xoffset = (float)(bed_xmax - bed_xmin) / 2;
-    float yoffset = (float)(bed_ymax - bed_ymin) / 2;
+    SpagVertex *v;
+    float lensq, px, py, cx, cy, nx, ny, nz, len;
+    int i, o, base;
 
     // The endcap is a polygon, anti-clockwise as seen looking along direction d0.
-    if (d1 == NULL)
+    // It lies across the perpendicular (px, py) to the line.
+    px = -d0->y;
+    py = d0->x;
+    if (d1 != NULL)
     {
-        for (i = 0; i < NPTS; i++)
-        {
-            c[i].x = -d0->y * xcap[i];
-            c[i].y = d0->x * xcap[i];
-            c[i].z = zcap[i];
-        }
-    }
-    else
-    {
-        // Adjust direction for the turn between d0 and d1. Cope with near-parallel cases.
-#if 0
-        adj_d0.x = (d1->x - d0->x) / 2;
-        adj_d0.y = (d1->y - d0->y) / 2;
-        lensq = adj_d0.x * adj_d0.x + adj_d0.y * adj_d0.y;
-        if (lensq < 0.01)
-        {
-            // Same direction or near - just use the standard endcap
-            for (i = 0; i < NPTS; i++)
-            {
-                c[i].x = -d0->y * xcap[i];
-                c[i].y = d0->x * xcap[i];
-                c[i].z = zcap[i];
-            }
-        }
-        else
-        {
-            // Adjust size of endcap to cope with increasing angle between the lines.
-            // This works up to 90 degrees (protected by caller)
-            corr = sqrtf(1 - lensq);
-            lensq = sqrtf(lensq);
-            adj_d0.x /= (lensq * corr);
-            adj_d0.y /= (lensq * corr);
-            for (i = 0; i < NPTS; i++)
-            {
-                c[i].x = adj_d0.x * xcap[i];
-                c[i].y = adj_d0.y * xcap[i];
-                c[i].z = zcap[i];
-            }
-        }
-#else
+        // Adjust size of endcap to cope with increasing angle between the lines,
+        // by normalising it to the length of (d0+d1)/2.
+        // This works up to 90 degrees (protected by caller)
         adj_d0.x = (d1->x + d0->x) / 2;
         adj_d0.y = (d1->y + d0->y) / 2;
         lensq = adj_d0.x * adj_d0.x + adj_d0.y * adj_d0.y;
-        if (lensq > 0.99)
-        {
-            // Same direction or near - just use the standard endcap
-            for (i = 0; i < NPTS; i++)
-            {
-                c[i].x = -d0->y * xcap[i];
-                c[i].y = d0->x * xcap[i];
-                c[i].z = zcap[i];
-            }
-        }
-        else
+        if (lensq <= 0.99)
         {
-            // Adjust size of endcap to cope with increasing angle between the lines,
-            // by normalising it to the length of (d0+d1)/2.
-            // This works up to 90 degrees (protected by caller)
             lensq = sqrtf(lensq);
-            adj_d0.x /= lensq;
-            adj_d0.y /= lensq;
-            for (i = 0; i < NPTS; i++)
-            {
-                c[i].x = -adj_d0.y * xcap[i];
-                c[i].y = adj_d0.x * xcap[i];
-                c[i].z = zcap[i];
-            }
+            px = -adj_d0.y / lensq;
+            py = adj_d0.x / lensq;
         }
-#endif
     }
 
+    if (n_spag_verts + NPTS > max_spag_verts)
+    {
+        max_spag_verts = max_spag_verts == 0 ? 4096 : max_spag_verts * 2;
+        spag_verts = realloc(spag_verts, max_spag_verts * sizeof(SpagVertex));
+    }
+    base = n_spag_verts;
+    v = &spag_verts[base];
+    n_spag_verts += NPTS;
+
+    // X/Y offsets are subtracted here. The loops are kept simple so the
+    // compiler can vectorise them.
+    cx = x - spag_xoffset;
+    cy = y - spag_yoffset;
+    for (i = 0; i < NPTS; i++)
+    {
+        v[i].x = cx + px * xcap_lh[i];
+        v[i].y = cy + py * xcap_lh[i];
+        v[i].z = z + zcap_lh[i];
+    }
+
+    // Normals point outwards from the opposite point on the circle.
     for (i = 0; i < NPTS; i++)
     {
-        cap->pts[i].x = curr->x - xoffset + c[i].x * layer_height;
-        cap->pts[i].y = curr->y - yoffset + c[i].y * layer_height;
-        cap->pts[i].z = z + c[i].z * layer_height;
+        o = (i + NPTS / 2) % NPTS;
+        nx = v[i].x - v[o].x;
+        ny = v[i].y - v[o].y;
+        nz = v[i].z - v[o].z;
+        len = sqrtf(nx * nx + ny * ny + nz * nz);
+        if (len > 0)
+            len = 127.0f / len;
+        v[i].norm[0] = (GLbyte)(nx * len);
+        v[i].norm[1] = (GLbyte)(ny * len);
+        v[i].norm[2] = (GLbyte)(nz * len);
+        v[i].norm[3] = 0;
     }
+
+    return base;
 }
 
-// Put out faces (quads) between two endcaps.
-void
-tube(Endcap* e0, Endcap* e1)
+// Put out faces (quads) between two endcaps, given the indices of their first points.
+static void
+tube(int e0, int e1)
 {
-    int i, j, o; 
-    Plane norm;
+    unsigned int *q;
+    int i, j;
+
+    if (n_spag_index + 4 * NPTS > max_spag_index)
+    {
+        max_spag_index = max_spag_index == 0 ? 16384 : max_spag_index * 2;
+        spag_index = realloc(spag_index, max_spag_index * sizeof(unsigned int));
+    }
+    q = &spag_index[n_spag_index];
+    n_spag_index += 4 * NPTS;
 
     for (i = 0; i < NPTS; i++)
     {
@@ -153,76 +217,171 @@ tube(Endcap* e0, Endcap* e1)
         if (j == NPTS)
             j = 0;
 
-        o = i - (NPTS / 2) + 1;     // opposite point for facet normal
-        if (o < 0)
-            o += NPTS;
-
-        norm.A = e0->pts[i].x - e0->pts[o].x;
-        norm.B = e0->pts[i].y - e0->pts[o].y;
-        norm.C = e0->pts[i].z - e0->pts[o].z;
-        normalise_plane(&norm);
-        glNormal3f(norm.A, norm.B, norm.C);
-
-        glVertex3f(e0->pts[i].x, e0->pts[i].y, e0->pts[i].z);
-        glVertex3f(e0->pts[j].x, e0->pts[j].y, e0->pts[j].z);
-        glVertex3f(e1->pts[j].x, e1->pts[j].y, e1->pts[j].z);
-        glVertex3f(e1->pts[i].x, e1->pts[i].y, e1->pts[i].z);
+        *q++ = e0 + i;
+        *q++ = e0 + j;
+        *q++ = e1 + j;
+        *q++ = e1 + i;
     }
 }
 
-
-// Put out faces for the line segments of the ZPolyEdge view_list. 
-void
-spaghetti(ZPolyEdge *zedge, float zmin, float zmax)
+// Put out faces for the line segments of one path (n points, starting at x[0], y[0]).
+// Each segment's direction is found once and carried along to the next segment.
+static void
+spaghetti(float *x, float *y, int n, float z)
 {
-    int i;
-    Endcap endcap0, endcap1;
+    int i, endcap0, endcap1;
     Point2D d0, d1;
     float bend;
 
-    glBegin(GL_QUADS);
-
-    for (i = 1; i < zedge->n_view; i++)
-    {
-        Point2D* p = &zedge->view_list[i];
+    if (n < 2)
+        return;
 
-        if (zedge->z < zmin - (layer_height / 2) || zedge->z > zmax + (layer_height / 2))
-            continue;
+    // Get the direction cosines of the first segment, and start the tube off
+    dirn(x[0], y[0], x[1], y[1], &d0);
+    endcap0 = endcap(x[0], y[0], &d0, NULL, z);
 
-        // Get the direction cosines of the current and next segments
-        dirn(&zedge->view_list[i - 1], &zedge->view_list[i], &d0);
-        if (i == 1)  // start the tube off
-            endcap(&zedge->view_list[0], &d0, NULL, zedge->z, &endcap0);
-
-        if (i == zedge->n_view - 1)
-        {
-            // We have arrived at the end. Finish the last tube.
-            endcap(&zedge->view_list[i], &d0, NULL, zedge->z, &endcap1);
-            tube(&endcap0, &endcap1);
-            break;
-        }
-
-        dirn(&zedge->view_list[i], &zedge->view_list[i + 1], &d1);
+    for (i = 1; i < n - 1; i++)
+    {
+        // Get the direction cosines of the next segment
+        dirn(x[i], y[i], x[i + 1], y[i + 1], &d1);
         bend = dot2d(&d0, &d1);
 
         // Calculate the next endcap. If the included angle between this segment and the next
         // is less than 90, close off the tube and start again (to prevent miter spikes)
-
         if (bend < 0.05)
         {
-            endcap(&zedge->view_list[i], &d0, NULL, zedge->z, &endcap1);
-            tube(&endcap0, &endcap1);
-            endcap(&zedge->view_list[i], &d1, NULL, zedge->z, &endcap0);
-            tube(&endcap1, &endcap0);   // join the two caps at the corner  
+            endcap1 = endcap(x[i], y[i], &d0, NULL, z);
+            tube(endcap0, endcap1);
+            endcap0 = endcap(x[i], y[i], &d1, NULL, z);
+            tube(endcap1, endcap0);   // join the two caps at the corner
         }
         else
         {
-            endcap(&zedge->view_list[i], &d0, &d1, zedge->z, &endcap1);
-            tube(&endcap0, &endcap1);
+            endcap1 = endcap(x[i], y[i], &d0, &d1, z);
+            tube(endcap0, endcap1);
             endcap0 = endcap1;
         }
+        d0 = d1;
     }
 
-    glEnd();
+    // We have arrived at the end. Finish the last tube.
+    endcap1 = endcap(x[i], y[i], &d0, NULL, z);
+    tube(endcap0, endcap1);
 }
 
+// Start the tubes again from scratch.
+static void
+reset_spaghetti(void)
+{
+    int i;
+
+    spag_xoffset = (float)(bed_xmax - bed_xmin) / 2;
+    spag_yoffset = (float)(bed_ymax - bed_ymin) / 2;
+    spag_layer_height = layer_height;
+    for (i = 0; i < NPTS; i++)
+    {
+        xcap_lh[i] = xcap[i] * layer_height;
+        zcap_lh[i] = zcap[i] * layer_height;
+    }
+
+    n_spag_verts = 0;
+    n_spag_index = 0;
+    n_spag_layers = 0;
+    n_spag_built = 0;
+    spag_valid = TRUE;
+}
+
+// Build the tubes for any layers in the store that have become ready since last time.
+static void
+build_spaghetti(GCodeStore *gc)
+{
+    SpagLayer *layer;
+    int l, i, start, end;
+
+    for (l = n_spag_built; l < gc->n_ready; l++)
+    {
+        if (n_spag_layers >= max_spag_layers)
+        {
+            max_spag_layers = max_spag_layers == 0 ? 256 : max_spag_layers * 2;
+            spag_layers = realloc(spag_layers, max_spag_layers * sizeof(SpagLayer));
+        }
+        layer = &spag_layers[n_spag_layers++];
+        layer->z = gc->layers[l].z;
+        layer->first = n_spag_index;
+
+        // Split the layer into paths at the points that start a new path
+        end = (l + 1 < gc->n_layers) ? gc->layers[l + 1].first : gc->n_points;
+        for (start = gc->layers[l].first; start < end; start = i)
+        {
+            for (i = start + 1; i < end && gc->e[i] > 0; i++)
+                ;
+            spaghetti(&gc->x[start], &gc->y[start], i - start, layer->z);
+        }
+        layer->count = n_spag_index - layer->first;
+    }
+    n_spag_built = gc->n_ready;
+}
+
+// Throw away the tubes (the G-code has been reloaded)
+void
+invalidate_spaghetti(void)
+{
+    spag_valid = FALSE;
+}
+
+// Draw the tubes for all the layers of the G-code tree lying between zmin and zmax.
+// Consecutive layers in the range are drawn together.
+void
+draw_spaghetti(Group *tree, PRESENTATION pres, float zmin, float zmax)
+{
+    float lo = zmin - (layer_height / 2);
+    float hi = zmax + (layer_height / 2);
+    int i, first = 0, count;
+
+    if (tree->gcode == NULL)
+        return;
+    if
+    (
+        !spag_valid
+        ||
+        spag_layer_height != layer_height
+        ||
+        spag_xoffset != (float)(bed_xmax - bed_xmin) / 2
+        ||
+        spag_yoffset != (float)(bed_ymax - bed_ymin) / 2
+    )
+        reset_spaghetti();
+    build_spaghetti(tree->gcode);
+    if (n_spag_index == 0)
+        return;
+
+    color_as(OBJ_EDGE, 1.0f, FALSE, pres, TRUE);     // G-code is always locked
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glVertexPointer(3, GL_FLOAT, sizeof(SpagVertex), &spag_verts[0].x);
+    glNormalPointer(GL_BYTE, sizeof(SpagVertex), spag_verts[0].norm);
+
+    // Layers are stored in order, so a run of visible layers is a run of indices.
+    count = 0;
+    for (i = 0; i < n_spag_layers; i++)
+    {
+        SpagLayer *layer = &spag_layers[i];
+
+        if (layer->z >= lo && layer->z <= hi)
+        {
+            if (count == 0)
+                first = layer->first;
+            count += layer->count;
+        }
+        else if (count > 0)
+        {
+            glDrawElements(GL_QUADS, count, GL_UNSIGNED_INT, &spag_index[first]);
+            count = 0;
+        }
+    }
+    if (count > 0)
+        glDrawElements(GL_QUADS, count, GL_UNSIGNED_INT, &spag_index[first]);
+
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
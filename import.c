@@ -13,22 +13,14 @@ char buf[512];
 
 // Helpers for STL reading; find existing points by coordinate
 Point *
-find_point_coord(Point *pt, Point ***bucket)
+find_point_coord(Point *pt, PointGrid *bucket)
 {
-    Point *p;
-    Point **b = find_bucket(pt, bucket);
-
-    for (p = *b; p != NULL; p = p->bucket_next)
-    {
-        if (near_pt(pt, p, SMALL_COORD))
-            break;
-    }
+    Point *p = find_bucket_point(bucket, pt, SMALL_COORD);
 
     if (p == NULL)
     {
         p = point_newp(pt);
-        p->bucket_next = *b;
-        *b = p;
+        insert_bucket_point(bucket, p);
     }
 
     return p;
@@ -71,6 +63,237 @@ find_edge(Point *p0, Point *p1)
 }
 
 
+// Binary STL files with at least this many triangles are read straight into a mesh-only
+// volume (see read_stl_binary_mesh). Smaller ones get real faces and edges as usual.
+#define FAST_STL_MIN_TRI    10000
+
+// Number of triangles read from the file at a time
+#define STL_BLOCK           4096
+
+// Most triangles to allocate space for up front
+#define STL_MAX_PREALLOC    (1 << 22)
+
+// Size of a cell in the welding hash. It must be at least twice the welding tolerance.
+#define WELD_CELL           0.001f
+
+// 3D spatial hash for welding the vertices of big imported meshes. Vertices are chained
+// from a hash slot chosen by the grid cell they fall in. A vertex close to a cell boundary
+// may match one in the neighbouring cell, so those are searched too.
+typedef struct WeldHash
+{
+    int     *heads;             // Head of the chain for each slot (-1 if empty)
+    int     n_slots;            // Always a power of 2
+    int     *next;              // Next vertex in the chain
+    float   *xyz;               // Vertex coordinates, 3 per vertex
+    int     n_verts;
+    int     max_verts;
+} WeldHash;
+
+static unsigned int
+weld_slot(WeldHash *w, int cx, int cy, int cz)
+{
+    return ((cx * 73856093u) ^ (cy * 19349663u) ^ (cz * 83492791u)) & (w->n_slots - 1);
+}
+
+static void
+weld_cell(float x, float y, float z, int *cx, int *cy, int *cz)
+{
+    *cx = (int)floorf(x / WELD_CELL);
+    *cy = (int)floorf(y / WELD_CELL);
+    *cz = (int)floorf(z / WELD_CELL);
+}
+
+// Size the hash table and chain all the vertices into it.
+static void
+weld_rehash(WeldHash *w, int n_slots)
+{
+    int i, cx, cy, cz;
+    unsigned int slot;
+
+    free(w->heads);
+    w->n_slots = n_slots;
+    w->heads = malloc(n_slots * sizeof(int));
+    memset(w->heads, 0xFF, n_slots * sizeof(int));
+    for (i = 0; i < w->n_verts; i++)
+    {
+        weld_cell(w->xyz[3 * i], w->xyz[3 * i + 1], w->xyz[3 * i + 2], &cx, &cy, &cz);
+        slot = weld_slot(w, cx, cy, cz);
+        w->next[i] = w->heads[slot];
+        w->heads[slot] = i;
+    }
+}
+
+static void
+weld_init(WeldHash *w, int expected_verts)
+{
+    int n = 1024;
+
+    while (n < 2 * expected_verts)
+        n *= 2;
+    w->heads = NULL;
+    w->n_verts = 0;
+    w->max_verts = n / 2;
+    w->next = malloc(w->max_verts * sizeof(int));
+    w->xyz = malloc(w->max_verts * 3 * sizeof(float));
+    weld_rehash(w, n);
+}
+
+static void
+weld_free(WeldHash *w)
+{
+    free(w->heads);
+    free(w->next);
+    free(w->xyz);
+}
+
+// Search one cell's chain for a vertex near (x,y,z). Return its index, or -1.
+static int
+weld_find(WeldHash *w, int cx, int cy, int cz, float x, float y, float z)
+{
+    int i;
+    float *v;
+
+    for (i = w->heads[weld_slot(w, cx, cy, cz)]; i >= 0; i = w->next[i])
+    {
+        v = &w->xyz[3 * i];
+        if (fabsf(v[0] - x) < SMALL_COORD && fabsf(v[1] - y) < SMALL_COORD && fabsf(v[2] - z) < SMALL_COORD)
+            return i;
+    }
+    return -1;
+}
+
+// Find the vertex at (x,y,z), adding it if it is not there. Return its index.
+static int
+weld_vertex(WeldHash *w, float x, float y, float z)
+{
+    int i, cx, cy, cz, nx, ny, nz;
+    int dx, dy, dz;
+    unsigned int slot;
+
+    weld_cell(x, y, z, &cx, &cy, &cz);
+    i = weld_find(w, cx, cy, cz, x, y, z);
+    if (i >= 0)
+        return i;
+
+    // Which neighbouring cells (if any) are within tolerance in each direction
+    nx = (x - cx * WELD_CELL < SMALL_COORD) ? -1 : ((cx + 1) * WELD_CELL - x < SMALL_COORD) ? 1 : 0;
+    ny = (y - cy * WELD_CELL < SMALL_COORD) ? -1 : ((cy + 1) * WELD_CELL - y < SMALL_COORD) ? 1 : 0;
+    nz = (z - cz * WELD_CELL < SMALL_COORD) ? -1 : ((cz + 1) * WELD_CELL - z < SMALL_COORD) ? 1 : 0;
+    if (nx != 0 || ny != 0 || nz != 0)
+    {
+        for (dx = 0; dx <= abs(nx); dx++)
+        {
+            for (dy = 0; dy <= abs(ny); dy++)
+            {
+                for (dz = 0; dz <= abs(nz); dz++)
+                {
+                    if (dx == 0 && dy == 0 && dz == 0)
+                        continue;
+                    i = weld_find(w, cx + dx * nx, cy + dy * ny, cz + dz * nz, x, y, z);
+                    if (i >= 0)
+                        return i;
+                }
+            }
+        }
+    }
+
+    // Not found. Add a new vertex, growing the table if it is getting full.
+    if (w->n_verts >= w->max_verts)
+    {
+        w->max_verts *= 2;
+        w->next = realloc(w->next, w->max_verts * sizeof(int));
+        w->xyz = realloc(w->xyz, w->max_verts * 3 * sizeof(float));
+        weld_rehash(w, w->n_slots * 2);
+    }
+    i = w->n_verts++;
+    w->xyz[3 * i] = x;
+    w->xyz[3 * i + 1] = y;
+    w->xyz[3 * i + 2] = z;
+    slot = weld_slot(w, cx, cy, cz);
+    w->next[i] = w->heads[slot];
+    w->heads[slot] = i;
+
+    return i;
+}
+
+// Read the triangles of a binary STL file (positioned after the triangle count) in
+// blocks, welding the vertices as we go, and build the CGAL mesh directly. The volume
+// is mesh-only: it has no faces or edges, and is locked at face level.
+static BOOL
+read_stl_binary_mesh(Group *group, FILE *f, int n_tri)
+{
+    unsigned char *block, *rec;
+    int *tri;
+    int n_read, i, j, k, n_out, max_out, n_skipped;
+    float v[9];
+    int vi[3];
+    WeldHash w;
+    Volume *vol;
+    char buf[64];
+
+    // Don't trust the triangle count too far; the arrays will grow if needed
+    if (n_tri > STL_MAX_PREALLOC)
+        n_tri = STL_MAX_PREALLOC;
+    block = malloc(STL_BLOCK * 50);
+    max_out = n_tri;
+    tri = malloc(max_out * 3 * sizeof(int));
+    n_out = 0;
+    weld_init(&w, n_tri / 2);
+    vol = vol_new();
+    vol->hdr.lock = LOCK_FACES;
+
+    while ((n_read = fread(block, 50, STL_BLOCK, f)) > 0)
+    {
+        step_file_progress(n_read * 50);
+        for (i = 0, rec = block; i < n_read; i++, rec += 50)
+        {
+            memcpy(v, rec + 12, 9 * sizeof(float));     // skip the normal, ignore the attribute
+            for (j = 0, k = 0; j < 3; j++, k += 3)
+            {
+                vi[j] = weld_vertex(&w, v[k], v[k + 1], v[k + 2]);
+                expand_bbox_coords(&vol->bbox, v[k], v[k + 1], v[k + 2]);
+            }
+            if (vi[0] == vi[1] || vi[1] == vi[2] || vi[2] == vi[0])
+                continue;
+
+            if (n_out >= max_out)
+            {
+                max_out *= 2;
+                tri = realloc(tri, max_out * 3 * sizeof(int));
+            }
+            tri[3 * n_out] = vi[0];
+            tri[3 * n_out + 1] = vi[1];
+            tri[3 * n_out + 2] = vi[2];
+            n_out++;
+        }
+        if (n_read < STL_BLOCK)
+            break;
+    }
+
+    vol->mesh = mesh_new_from_arrays(vol->material, w.xyz, w.n_verts, tri, n_out, &n_skipped);
+    vol->mesh_valid = TRUE;
+    vol->mesh_only = TRUE;
+    vol->max_facetype = FACE_TRI;
+    vol->bbox.xc = (vol->bbox.xmin + vol->bbox.xmax) / 2;
+    vol->bbox.yc = (vol->bbox.ymin + vol->bbox.ymax) / 2;
+    vol->bbox.zc = (vol->bbox.zmin + vol->bbox.zmax) / 2;
+    link_group((Object *)vol, group);
+
+    sprintf_s(buf, 64, "Imported %d triangles, %d vertices\r\n", n_out - n_skipped, w.n_verts);
+    Log(buf);
+    if (n_skipped != 0)
+    {
+        sprintf_s(buf, 64, "Skipped %d non-manifold triangles\r\n", n_skipped);
+        Log(buf);
+    }
+
+    weld_free(&w);
+    free(tri);
+    free(block);
+    return TRUE;
+}
+
+
 // Read an STL mesh
 BOOL
 read_stl_to_group(Group *group, char *filename)
@@ -216,6 +439,17 @@ binary_stl:
     group->title[79] = '\0';    // in case there's no NULL char
     if (fread_s(&n_tri, 4, 1, 4, f) != 4)
         goto error_return;
+
+    // Big meshes go straight into a mesh-only volume
+    if (n_tri >= FAST_STL_MIN_TRI)
+    {
+        BOOL rc = read_stl_binary_mesh(group, f, n_tri);
+
+        fclose(f);
+        clear_status_and_progress();
+        return rc;
+    }
+
     vol = vol_new();
     vol->hdr.lock = LOCK_FACES;
 
@@ -294,6 +528,66 @@ binary_eof:
     return TRUE;
 }
 
+// Add a triangle from a mesh-only volume's mesh as a real face.
+static void
+expand_triangle(void *arg, float x[3], float y[3], float z[3])
+{
+    Volume *vol = (Volume *)arg;
+    Point pt[3];
+    Point *p0, *p1, *p2;
+    Plane norm;
+    Face *tf;
+    int i;
+
+    for (i = 0; i < 3; i++)
+    {
+        pt[i].x = x[i];
+        pt[i].y = y[i];
+        pt[i].z = z[i];
+    }
+    if (!normal3(&pt[1], &pt[0], &pt[2], &norm))
+        return;
+
+    p0 = find_point_coord(&pt[0], vol->point_bucket);
+    p1 = find_point_coord(&pt[1], vol->point_bucket);
+    p2 = find_point_coord(&pt[2], vol->point_bucket);
+
+    tf = face_new(FACE_TRI, norm);
+    tf->edges[0] = find_edge(p0, p1);
+    tf->edges[1] = find_edge(p1, p2);
+    tf->edges[2] = find_edge(p2, p0);
+    tf->n_edges = 3;
+    if
+        (
+        tf->edges[0]->endpoints[1] == tf->edges[1]->endpoints[0]
+        ||
+        tf->edges[0]->endpoints[1] == tf->edges[1]->endpoints[1]
+        )
+        tf->initial_point = tf->edges[0]->endpoints[0];
+    else
+        tf->initial_point = tf->edges[0]->endpoints[1];
+
+    tf->vol = vol;
+    link((Object *)tf, &vol->faces);
+}
+
+// Give a mesh-only volume real faces, edges and points made from its mesh, so that
+// it can be edited like any other volume. This is as slow as the ordinary import.
+void
+expand_mesh_volume(Volume *vol)
+{
+    if (!vol->mesh_only)
+        return;
+
+    show_status("Expanding mesh ", "");
+    mesh_foreach_face_coords(vol->mesh, expand_triangle, vol);
+    empty_bucket(vol->point_bucket);
+    vol->mesh_only = FALSE;
+    free_bvh(vol->mesh_bvh);
+    vol->mesh_bvh = NULL;
+    clear_status_and_progress();
+}
+
 // Find a material in the list by name, and return its index, or zero if not found.
 int
 find_material(char* mat_name)
@@ -949,241 +1243,351 @@ eof_error:
     return FALSE;
 }
 
-// Read a G-code file and store it as an edge group of Z-poly edges.
+// G-code reading. The file is mapped into memory and scanned in place with a simple
+// tokenizer, rather than being read a line at a time with fgets/strtok/atof, as
+// sliced files can run to hundreds of MB.
+
+// Redraw the preview after reading this many bytes, so the layers read so far can be seen.
+#define GCODE_CHUNK     (16 * 1024 * 1024)
+
+// Powers of ten for gcode_float.
+static const double gcode_pow10[] =
+{
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+    1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18
+};
+
+// Parse a number at *pp (optional sign, digits, optional decimal point and digits)
+// and advance past it. Exponents are not recognised, as E is a G-code word.
+static float
+gcode_float(char **pp, char *end)
+{
+    char *p = *pp;
+    BOOL neg = FALSE;
+    unsigned __int64 mant = 0;
+    int digits = 0;
+    int scale = 0;
+    double v;
+
+    if (p < end && (*p == '-' || *p == '+'))
+        neg = *p++ == '-';
+
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+    {
+        if (digits < 18)
+        {
+            mant = mant * 10 + (*p - '0');
+            if (mant != 0)
+                digits++;
+        }
+        else
+        {
+            scale++;
+        }
+    }
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++)
+        {
+            if (digits < 18)
+            {
+                mant = mant * 10 + (*p - '0');
+                if (mant != 0)
+                    digits++;
+                scale--;
+            }
+        }
+    }
+
+    *pp = p;
+    v = (double)mant;
+    if (scale < 0)
+    {
+        // Leading zeros after the point keep lowering the scale, without limit
+        while (scale < -18)
+        {
+            v /= gcode_pow10[18];
+            scale += 18;
+        }
+        v /= gcode_pow10[-scale];
+    }
+    else if (scale > 0)
+        v *= gcode_pow10[scale < 18 ? scale : 18];
+    return (float)(neg ? -v : v);
+}
+
+// Skip over any characters in the set.
+static void
+gcode_skip(char **pp, char *end, char *set)
+{
+    char *p = *pp;
+
+    while (p < end && *p != '\0' && strchr(set, *p) != NULL)
+        p++;
+    *pp = p;
+}
+
+// Test for a word at *pp, followed by a blank, '=' or the end. Advance past it if found.
+static BOOL
+gcode_word(char **pp, char *end, char *word)
+{
+    int len = strlen(word);
+    char *p = *pp;
+
+    if (end - p < len || strncmp(p, word, len) != 0)
+        return FALSE;
+    p += len;
+    if (p < end && *p != ' ' && *p != '\t' && *p != '=' && *p != '\r')
+        return FALSE;
+    *pp = p;
+    return TRUE;
+}
+
+// Copy the rest of the comment line after a heading, e.g. "Filament " + "used = 1234.5mm"
+static void
+gcode_rest_of_line(char *dest, char *heading, char *p, char *end)
+{
+    if (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    while (end > p && (end[-1] == '\r' || end[-1] == ' '))
+        end--;
+    strcpy_s(dest, 80, heading);
+    strncat_s(dest, 80, p, min(end - p, 79 - (int)strlen(heading)));
+}
+
+// Gather up some geometry from comments put there by Slic3r, e.g.
+// ; bed_shape = 0x0,250x0,250x210,0x210
+// The comment runs from p (after the semicolon) to end.
+static void
+gcode_comment(Group *group, char *p, char *end)
+{
+    gcode_skip(&p, end, " \t");
+    if (gcode_word(&p, end, "bed_shape"))
+    {
+        gcode_skip(&p, end, " \t");
+        if (p >= end || *p != '=')
+            return;
+        p++;
+        gcode_skip(&p, end, " \t");
+        bed_xmin = gcode_float(&p, end);                // 0x0
+        gcode_skip(&p, end, "x");
+        bed_ymin = gcode_float(&p, end);
+        gcode_skip(&p, end, ", \t");
+        gcode_float(&p, end);                           // 250x0 (skip)
+        gcode_skip(&p, end, "x");
+        gcode_float(&p, end);
+        gcode_skip(&p, end, ", \t");
+        bed_xmax = gcode_float(&p, end);                // 250x210
+        gcode_skip(&p, end, "x");
+        bed_ymax = gcode_float(&p, end);
+
+        group->xoffset = (bed_xmax - bed_xmin) / 2;
+        group->yoffset = (bed_ymax - bed_ymin) / 2;
+    }
+    else if (gcode_word(&p, end, "layer_height"))      // layer_height = 0.2 (e.g.)
+    {
+        gcode_skip(&p, end, " \t");
+        if (p >= end || *p != '=')
+            return;
+        p++;
+        gcode_skip(&p, end, " \t");
+        layer_height = gcode_float(&p, end);
+    }
+    else if (gcode_word(&p, end, "filament") && group->fil_used[0] == '\0')
+    {
+        // Extract estimated time to print and filament used from comments.
+        gcode_rest_of_line(group->fil_used, "Filament ", p, end);
+    }
+    else if (gcode_word(&p, end, "estimated") && group->est_print[0] == '\0')
+    {
+        gcode_rest_of_line(group->est_print, "Estimated ", p, end);
+    }
+}
+
+// Read a G-code file and store its extrusion paths in the group's G-code store.
 // It does not go into the object tree. There is only one G-code group, 
-// so delete the old one (if it exists) before importing the new one.
+// so purge the old one (if it exists) before importing the new one.
+// Layers are marked ready as they are completed, and the preview is redrawn
+// every so often, so a big file can be seen coming in.
 BOOL
 read_gcode_to_group(Group* group, char* filename)
 {
-    FILE* f;
+    HANDLE h, map;
+    LARGE_INTEGER size;
+    GCodeStore *gc;
+    char *base, *p, *end, *eol, *next_draw;
     float cur_x = 0;
     float cur_y = 0;
     float cur_z = 0;
-    float next_x, next_y, next_z, ext;
+    float cur_f = 0;
+    float next_x = 0, next_y = 0, next_z = 0, ext = 0, val;
     BOOL have_x, have_y, have_z, have_e;
-    ZPolyEdge* edge = NULL;
-    BOOL new_edge = FALSE;
+    BOOL new_path = TRUE;
+    int code;
+    char c;
 
     group->fil_used[0] = '\0';
     group->est_print[0] = '\0';
-    nexttok = NULL;
-    fopen_s(&f, filename, "rt");
-    if (f == NULL)
-        return FALSE;
-    start_file_progress(f, "Importing ", filename);
+    if (group->gcode == NULL)
+        group->gcode = calloc(1, sizeof(GCodeStore));
+    gc = group->gcode;
 
-    while (TRUE)
+    h = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (h == INVALID_HANDLE_VALUE)
+        return FALSE;
+    if (!GetFileSizeEx(h, &size) || size.HighPart != 0)
     {
-        if (fgets(buf, 512, f) == NULL)
-            break;
+        CloseHandle(h);
+        return FALSE;
+    }
+    if (size.LowPart == 0)
+    {
+        CloseHandle(h);             // nothing in it (and it can't be mapped)
+        return TRUE;
+    }
+    map = CreateFileMapping(h, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (map == NULL)
+    {
+        CloseHandle(h);
+        return FALSE;
+    }
+    base = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+    if (base == NULL)
+    {
+        CloseHandle(map);
+        CloseHandle(h);
+        return FALSE;
+    }
 
-        step_file_progress(strlen(buf));
+    start_size_progress(size.LowPart, "Importing ", filename);
+    end = base + size.LowPart;
+    next_draw = base + GCODE_CHUNK;
 
-        tok = strtok_s(buf, " \t\n", &nexttok);
+    for (p = base; p < end; p = eol + 1)
+    {
+        eol = memchr(p, '\n', end - p);
+        if (eol == NULL)
+            eol = end;
 
-        // Skip blank lines or whole-line comments, but gather up some geometry from
-        // comments put there by Slic3r. e.g. ; bed_shape = 0x0, 250x0, 250x210, 0x210
-        if (tok == NULL)
-            continue;
-        if (tok[0] == ';')
+        step_file_progress(eol - p + 1);
+        if (p >= next_draw)
         {
-            tok = strtok_s(NULL, " \t\n", &nexttok);
-            if (tok == NULL)
-                continue;
-            if (strcmp(tok, "bed_shape") == 0)
-            {
-                // Suck up the '=' sign and get the corner coords
-                tok = strtok_s(NULL, " \t\n", &nexttok);
-                if (tok[0] != '=')
-                    continue;
-                tok = strtok_s(NULL, "x, \t\n", &nexttok);      // 0x0
-                bed_xmin = (float)atof(tok);
-                tok = strtok_s(NULL, "x, \t\n", &nexttok);
-                bed_ymin = (float)atof(tok);
-
-                tok = strtok_s(NULL, ", \t\n", &nexttok);       // 250x0 (skip)
-                tok = strtok_s(NULL, "x, \t\n", &nexttok);      // 250x210
-                bed_xmax = (float)atof(tok);
-                tok = strtok_s(NULL, "x, \t\n", &nexttok);
-                bed_ymax = (float)atof(tok);
-
-                group->xoffset = (bed_xmax - bed_xmin) / 2;
-                group->yoffset = (bed_ymax - bed_ymin) / 2;
-            }
-            else if (strcmp(tok, "layer_height") == 0)          // layer_height = 0.2 (e.g.)
-            {
-                tok = strtok_s(NULL, " \t\n", &nexttok);
-                if (tok[0] != '=')
-                    continue;
-                tok = strtok_s(NULL, " \t\n", &nexttok);
-                layer_height = (float)atof(tok);
-            }
-            else if (strcmp(tok, "filament") == 0 && group->fil_used[0] == '\0')
+            next_draw = p + GCODE_CHUNK;
+            if (view_printer)
             {
-                // Extract estimated time to print and filament used from comments.
-                tok = strtok_s(NULL, "\n", &nexttok);
-                if (tok != NULL)
-                {
-                    strcpy_s(group->fil_used, 80, "Filament ");
-                    strcat_s(group->fil_used, 80, tok);
-                }
-            }
-            else if (strcmp(tok, "estimated") == 0 && group->est_print[0] == '\0')
-            {
-                tok = strtok_s(NULL, "\n", &nexttok);
-                if (tok != NULL)
-                {
-                    strcpy_s(group->est_print, 80, "Estimated ");
-                    strcat_s(group->est_print, 80, tok);
-                }
+                invalidate_dl();
+                Draw();
             }
-            continue;
         }
 
-        if (tok[0] == 'N')                  // Skip line numbers at the start of the line
-            tok = strtok_s(NULL, " \t\n", &nexttok);
-        if (tok[0] == 'G')                  // Process G-codes
+        // Skip blank lines, and look at whole-line comments
+        gcode_skip(&p, eol, " \t\r");
+        if (p >= eol)
+            continue;
+        if (*p == ';')
         {
-            int code = atoi(&tok[1]);
+            gcode_comment(group, p + 1, eol);
+            continue;
+        }
 
-            switch (code)
+        // Gather up the words (letter and number) till EOL or semicolon. Line numbers
+        // are skipped, and so are lines without a G-code (e.g. M-codes)
+        code = -1;
+        have_x = have_y = have_z = have_e = FALSE;
+        while (p < eol)
+        {
+            c = *p++;
+            if (c >= 'a' && c <= 'z')
+                c -= 'a' - 'A';
+            if (c == ';' || c == '*')
+                break;              // comment or checksum
+            if (c < 'A' || c > 'Z')
+                continue;
+            val = gcode_float(&p, eol);
+            switch (c)
             {
-            case 0:                         // move or draw XYZ
-            case 1:
-                have_x = have_y = have_z = have_e = FALSE;
-                while (TRUE)
-                {
-                    // Gather up the options (XYZEF..) till EOL or semicolon
-                    tok = strtok_s(NULL, " \t\n", &nexttok);
-                    if (tok == NULL)
-                        break;
-                    if (tok[0] == ';')
-                        break;
-                    switch (tok[0])
-                    {
-                    case 'X':
-                        have_x = TRUE;
-                        next_x = (float)atof(&tok[1]);
-                        break;
-                    case 'Y':
-                        have_y = TRUE;
-                        next_y = (float)atof(&tok[1]);
-                        break;
-                    case 'Z':
-                        have_z = TRUE;
-                        next_z = (float)atof(&tok[1]);
-                        break;
-                    case 'E':
-                        have_e = TRUE;
-                        ext = (float)atof(&tok[1]);
-                        break;
-                    default:                // here for F and other stuff we ignore
-                        break;
-                    }
-                }
+            case 'G':
+                code = (int)val;
+                break;
+            case 'M':
+                p = eol;
+                break;
+            case 'X':
+                have_x = TRUE;
+                next_x = val;
+                break;
+            case 'Y':
+                have_y = TRUE;
+                next_y = val;
+                break;
+            case 'Z':
+                have_z = TRUE;
+                next_z = val;
+                break;
+            case 'E':
+                have_e = TRUE;
+                ext = val;
+                break;
+            case 'F':
+                cur_f = val;
+                break;
+            default:                // here for N and other stuff we ignore
+                break;
+            }
+        }
 
-                // If X/Y have been given with a positive E, add a line to the current edge
-                if (have_x && have_y && have_e && ext > 0)
+        switch (code)
+        {
+        case 0:                     // move or draw XYZ
+        case 1:
+            // If X/Y have been given with a positive E, add a segment to the current path
+            if (have_x && have_y && have_e && ext > 0)
+            {
+                if (new_path || (have_z && next_z != cur_z))
                 {
-                    if (new_edge || (have_z && next_z != cur_z))
-                    {
-                        new_edge = FALSE;
-
-                        // Get a new edge from the free list if there is one available
-                        if (free_list_zedge.head != NULL)
-                        {
-                            edge = (ZPolyEdge*)free_list_zedge.head;
-                            free_list_zedge.head = free_list_zedge.head->next;
-                            if (free_list_zedge.head == NULL)
-                                free_list_zedge.tail = NULL;
-                        }
-                        else
-                        {
-                            edge = (ZPolyEdge*)edge_new(EDGE_ZPOLY);
-                            objid--;
-                            edge->edge.hdr.ID = 0;      // not for the object list
-                            edge->n_viewalloc = 32;
-                            edge->view_list = malloc(edge->n_viewalloc * sizeof(Point2D));
-                        }
-
-                        edge->z = next_z;
+                    new_path = FALSE;
+                    if (have_z)
                         cur_z = next_z;
-                        edge->n_view = 0;
-                        link_tail_group((Object*)edge, group);
 
-                        // TEMP for debugging first layers
-                        //if (group->n_members > 5)
-                        //    return TRUE;
-                    }
+                    // Start a new layer if the Z has changed, then start the path off
+                    // from the current position.
+                    if (gc->n_layers == 0 || gc->layers[gc->n_layers - 1].z != cur_z)
+                        gcode_add_layer(gc, cur_z);
+                    gcode_add_point(gc, cur_x, cur_y, 0, cur_f);
+                }
 
-                    if (edge->n_view >= edge->n_viewalloc)
-                    {
-                        edge->n_viewalloc *= 2;    // Grow the allocation
-                        edge->view_list = realloc(edge->view_list, edge->n_viewalloc * sizeof(Point2D));
-                    }
-                    if (edge->n_view == 0)
-                    {
-                        // Add the first point
-                        edge->view_list[0].x = cur_x;
-                        edge->view_list[0].y = cur_y;
-                        edge->n_view = 1;
-                    }
-                    edge->view_list[edge->n_view].x = next_x;
-                    edge->view_list[edge->n_view].y = next_y;
-                    edge->n_view++;
+                gcode_add_point(gc, next_x, next_y, ext, cur_f);
+                cur_x = next_x;
+                cur_y = next_y;
+            }
+            else if (have_x || have_y || have_z)
+            {
+                // Just a move to the position. Prepare for a new path.
+                if (have_x)
                     cur_x = next_x;
+                if (have_y)
                     cur_y = next_y;
-                }
-                else if (have_x || have_y || have_z)
-                {
-                    // Just a move to the position. Prepare for a new edge.
-                    if (have_x)
-                        cur_x = next_x;
-                    if (have_y)
-                        cur_y = next_y;
-                    if (have_z)
-                        cur_z = next_z;
-                    new_edge = TRUE;
-                }
-                break;
-
-            case 92:                        // set position XYZE (usually used just for E)
-                while (TRUE)
-                {
-                    tok = strtok_s(NULL, " \t\n", &nexttok);
-                    if (tok == NULL)
-                        break;
-                    switch (tok[0])
-                    {
-                    case 'X':
-                        cur_x = (float)atof(&tok[1]);
-                        break;
-                    case 'Y':
-                        cur_y = (float)atof(&tok[1]);
-                        break;
-                    case 'Z':
-                        cur_z = (float)atof(&tok[1]);
-                        break;
-                    case 'E':
-                        ext = (float)atof(&tok[1]);
-                        break;
-                    default:   
-                        break;
-                    }
-                }
-                break;
+                if (have_z)
+                    cur_z = next_z;
+                new_path = TRUE;
             }
+            break;
+
+        case 92:                    // set position XYZE (usually used just for E)
+            if (have_x)
+                cur_x = next_x;
+            if (have_y)
+                cur_y = next_y;
+            if (have_z)
+                cur_z = next_z;
+            break;
         }
     }
 
-    fclose(f);
+    gc->n_ready = gc->n_layers;
+    UnmapViewOfFile(base);
+    CloseHandle(map);
+    CloseHandle(h);
     clear_status_and_progress();
     return TRUE;
-
-#if 0 // unused?
-eof_error:
-    fclose(f);
-    clear_status_and_progress();
-    return FALSE;
-#endif
-}
\ No newline at end of file
+}
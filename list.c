@@ -162,28 +162,34 @@ void
 free_edge(Object* obj)
 {
     ASSERT(obj->type == OBJ_EDGE, "This must be an Edge");
+    lock_thread_alloc();
     obj->next = (Object*)free_list_edge.head;
     if (free_list_edge.head == NULL)
         free_list_edge.tail = obj;
     free_list_edge.head = obj;
+    unlock_thread_alloc();
 }
 
 // Free a Point to its free list.
 void
 free_point(Object* obj)
 {
+    ListHead *free_list = thread_alloc ? &thread_free_pt : &free_list_pt;
+
     ASSERT(obj->type == OBJ_POINT, "This must be a Point");
-    obj->next = (Object*)free_list_pt.head;
-    if (free_list_pt.head == NULL)
-        free_list_pt.tail = obj;
-    free_list_pt.head = obj;
+    obj->next = (Object*)free_list->head;
+    if (free_list->head == NULL)
+        free_list->tail = obj;
+    free_list->head = obj;
 }
 
 // Clean out a view list (a singly linked list of Points) by joining it to the free list.
-// The points already have ID's of 0. 
+// The points already have ID's of 0. Worker threads free to their own free list.
 void
 free_point_list(ListHead *pt_list)
 {
+    ListHead *free_list = thread_alloc ? &thread_free_pt : &free_list_pt;
+
     if (pt_list->head == NULL)
         return;
 
@@ -191,17 +197,17 @@ free_point_list(ListHead *pt_list)
     ASSERT(pt_list->head->type == OBJ_POINT, "Only Points should be in here");
     ASSERT(pt_list->head->ID == 0, "Only view list or temporary Points should be in here");
 
-    if (free_list_pt.head == NULL)
+    if (free_list->head == NULL)
     {
-        ASSERT(free_list_pt.tail == NULL, "Tail should be NULL");
-        free_list_pt.head = pt_list->head;
-        free_list_pt.tail = pt_list->tail;
+        ASSERT(free_list->tail == NULL, "Tail should be NULL");
+        free_list->head = pt_list->head;
+        free_list->tail = pt_list->tail;
     }
     else
     {
-        ASSERT(free_list_pt.tail != NULL, "Tail should not be NULL");
-        free_list_pt.tail->next = pt_list->head;
-        free_list_pt.tail = pt_list->tail;
+        ASSERT(free_list->tail != NULL, "Tail should not be NULL");
+        free_list->tail->next = pt_list->head;
+        free_list->tail = pt_list->tail;
     }
 
     pt_list->head = NULL;
@@ -233,103 +239,179 @@ void free_obj_list(ListHead *obj_list)
     obj_list->count = 0;
 }
 
-// Allocate the point bucket list structure.
-Point ***
-init_buckets(void)
-{
-    Point ***bl = calloc(n_buckets, sizeof(Point **));
-    int i;
+// Point buckets. These are a 3D hashed grid of Points, used for finding points by
+// coordinate. Each slot of the hash table holds a chain of points (linked through
+// bucket_next) from all the grid cells that hash to it. The table doubles in size
+// as points are added, and when it does, the cell size is chosen again from the
+// extent of the points, so the chains stay short however big or tall the part is.
+
+#define INITIAL_SLOTS   256
+#define MIN_CELL        0.001f      // Must be much larger than the tolerance used in lookups
 
-    for (i = 0; i < n_buckets; i++)
-        bl[i] = calloc(n_buckets, sizeof(Point *));
+// Find the cell index along one axis. Clamp it so silly coordinates can't overflow.
+static int
+cell_index(float x, float cell)
+{
+    double d = floor(x / cell);
 
-    return bl;
+    if (d > 1.0e9)
+        d = 1.0e9;
+    else if (d < -1.0e9)
+        d = -1.0e9;
+    return (int)d;
 }
 
-// Find a bucket header for a given point. The buckets are bottom-inclusive, top-exclusive in X and Y.
-Point **
-find_bucket(Point *p, Point ***bucket)
+// Hash a cell to a slot.
+static int
+cell_slot(PointGrid *grid, int i, int j, int k)
 {
-    int bias = n_buckets / 2;
-    int i = (int)floor(p->x / bucket_size) + bias;
-    int j = (int)floor(p->y / bucket_size) + bias;
-    Point **bh;
-
-    if (i < 0)
-        i = 0;
-    else if (i >= n_buckets)
-        i = n_buckets - 1;
-    bh = bucket[i];
-
-    if (j < 0)
-        j = 0;
-    else if (j >= n_buckets)
-        j = n_buckets - 1;
-
-    return &bh[j];
+    unsigned int h = ((unsigned int)i * 73856093u) ^ ((unsigned int)j * 19349663u) ^ ((unsigned int)k * 83492791u);
+
+    return h & (grid->n_slots - 1);
 }
 
-// Clear a bucket structure to empty, but don't free anything.
-void empty_bucket(Point ***bucket)
+// Find the slot for a point.
+static int
+point_slot(PointGrid *grid, Point *p)
 {
-    int i, j;
+    return cell_slot(grid, cell_index(p->x, grid->cell), cell_index(p->y, grid->cell), cell_index(p->z, grid->cell));
+}
 
-    for (i = 0; i < n_buckets; i++)
+// Double the hash table and rehash all the points into it. Since the points
+// mostly lie on surfaces, size the cells so there are about as many cells
+// across the largest dimension as the square root of the number of points.
+static void
+grow_bucket(PointGrid *grid)
+{
+    Point **old_slots = grid->slots;
+    int old_n_slots = grid->n_slots;
+    float size, cell;
+    Point *p, *nextp;
+    int i, s;
+
+    size = grid->bbox.xmax - grid->bbox.xmin;
+    if (grid->bbox.ymax - grid->bbox.ymin > size)
+        size = grid->bbox.ymax - grid->bbox.ymin;
+    if (grid->bbox.zmax - grid->bbox.zmin > size)
+        size = grid->bbox.zmax - grid->bbox.zmin;
+    cell = size / (float)sqrt((double)grid->n_points);
+    if (cell < MIN_CELL)
+        cell = MIN_CELL;
+    grid->cell = cell;
+
+    grid->n_slots = old_n_slots * 2;
+    grid->slots = calloc(grid->n_slots, sizeof(Point *));
+    for (i = 0; i < old_n_slots; i++)
     {
-        Point **bh = bucket[i];
-
-        for (j = 0; j < n_buckets; j++)
-            bh[j] = NULL;
+        for (p = old_slots[i]; p != NULL; p = nextp)
+        {
+            nextp = p->bucket_next;
+            s = point_slot(grid, p);
+            p->bucket_next = grid->slots[s];
+            grid->slots[s] = p;
+        }
     }
+    free(old_slots);
 }
 
-// Free all the Points a bucket references, and clear the buckets to empty.
-void free_bucket_points(Point ***bucket)
+// Allocate an empty point bucket structure.
+PointGrid *
+init_buckets(void)
 {
-    int i, j;
-    Point *p, *nextp;
+    PointGrid *grid = calloc(1, sizeof(PointGrid));
 
-    for (i = 0; i < n_buckets; i++)
-    {
-        Point **bh = bucket[i];
+    grid->n_slots = INITIAL_SLOTS;
+    grid->slots = calloc(grid->n_slots, sizeof(Point *));
+    grid->cell = bucket_size;
+    clear_bbox(&grid->bbox);
+
+    return grid;
+}
+
+// Add a point to the buckets. The point must not already be in any bucket.
+void
+insert_bucket_point(PointGrid *grid, Point *p)
+{
+    int s;
+
+    expand_bbox(&grid->bbox, p);
+    grid->n_points++;
+    if (grid->n_points > 2 * grid->n_slots)
+        grow_bucket(grid);
+
+    s = point_slot(grid, p);
+    p->bucket_next = grid->slots[s];
+    grid->slots[s] = p;
+}
+
+// Find a point in the buckets within tol of the given point's coordinates, or NULL
+// if there is none. Cells are bottom-inclusive, top-exclusive, so if the point is
+// within tol of a cell boundary, the cells on the other side are searched too.
+Point *
+find_bucket_point(PointGrid *grid, Point *pt, float tol)
+{
+    int i, j, k, i0, i1, j0, j1, k0, k1;
+    Point *p;
 
-        for (j = 0; j < n_buckets; j++)
+    i0 = cell_index(pt->x - tol, grid->cell);
+    i1 = cell_index(pt->x + tol, grid->cell);
+    j0 = cell_index(pt->y - tol, grid->cell);
+    j1 = cell_index(pt->y + tol, grid->cell);
+    k0 = cell_index(pt->z - tol, grid->cell);
+    k1 = cell_index(pt->z + tol, grid->cell);
+
+    for (i = i0; i <= i1; i++)
+    {
+        for (j = j0; j <= j1; j++)
         {
-            for (p = bh[j]; p != NULL; p = nextp)
+            for (k = k0; k <= k1; k++)
             {
-                nextp = p->bucket_next;
-                p->hdr.next = free_list_pt.head;
-                if (free_list_pt.head == NULL)
-                    free_list_pt.tail = (Object *)p;
-                free_list_pt.head = (Object *)p;
+                for (p = grid->slots[cell_slot(grid, i, j, k)]; p != NULL; p = p->bucket_next)
+                {
+                    if (near_pt(pt, p, tol))
+                        return p;
+                }
             }
-            bh[j] = NULL;
         }
     }
+
+    return NULL;
 }
 
-// Free a bucket structure, and all the Points it references.
-void free_bucket(Point ***bucket)
+// Clear a bucket structure to empty, but don't free anything.
+void empty_bucket(PointGrid *grid)
 {
-    int i, j;
+    memset(grid->slots, 0, grid->n_slots * sizeof(Point *));
+    grid->n_points = 0;
+    clear_bbox(&grid->bbox);
+}
+
+// Free all the Points a bucket references, and clear the buckets to empty.
+void free_bucket_points(PointGrid *grid)
+{
+    int i;
     Point *p, *nextp;
 
-    for (i = 0; i < n_buckets; i++)
+    for (i = 0; i < grid->n_slots; i++)
     {
-        Point **bh = bucket[i];
-
-        for (j = 0; j < n_buckets; j++)
+        for (p = grid->slots[i]; p != NULL; p = nextp)
         {
-            for (p = bh[j]; p != NULL; p = nextp)
-            {
-                nextp = p->bucket_next;
-                p->hdr.next = free_list_pt.head;
-                if (free_list_pt.head == NULL)
-                    free_list_pt.tail = (Object *)p;
-                free_list_pt.head = (Object *)p;
-            }
+            nextp = p->bucket_next;
+            p->hdr.next = free_list_pt.head;
+            if (free_list_pt.head == NULL)
+                free_list_pt.tail = (Object *)p;
+            free_list_pt.head = (Object *)p;
         }
-        free(bucket[i]);
+        grid->slots[i] = NULL;
     }
-    free(bucket);
+    grid->n_points = 0;
+    clear_bbox(&grid->bbox);
+}
+
+// Free a bucket structure, and all the Points it references.
+void free_bucket(PointGrid *grid)
+{
+    free_bucket_points(grid);
+    free(grid->slots);
+    free(grid);
 }
@@ -0,0 +1,170 @@
+#include "stdafx.h"
+#include "LoftyCAD.h"
+#include <stdio.h>
+
+// Balanced parallel union of a set of meshes.
+//
+// Folding volumes one at a time into an accumulator mesh makes every later union
+// slower, as the accumulator keeps growing. Instead, union the meshes pairwise in a
+// balanced reduction tree, so that each level halves the number of meshes. The pairs
+// at each level are independent, so they are handed out to a pool of worker threads.
+
+// A mesh at some level of the reduction tree. Meshes at the bottom level belong to
+// their volumes or groups, and must be copied before they are merged into.
+typedef struct MergeNode
+{
+    Mesh    *mesh;
+    BOOL    owned;
+} MergeNode;
+
+// The work for one level of the tree. Each job merges node 2i+1 into node 2i.
+typedef struct MergeLevel
+{
+    MergeNode       *nodes;
+    int             n_jobs;
+    volatile LONG   next_job;       // Index of the next job to be picked up
+    volatile LONG   n_failed;       // Number of merges that failed
+} MergeLevel;
+
+// Find the number of worker threads to use (also used for view list generation)
+int
+worker_thread_count(void)
+{
+    SYSTEM_INFO si;
+    int n;
+
+    GetSystemInfo(&si);
+    n = si.dwNumberOfProcessors;
+    if (n < 1)
+        n = 1;
+    if (n > MAX_WORKER_THREADS)
+        n = MAX_WORKER_THREADS;
+    return n;
+}
+
+// Worker thread. Keep taking jobs from the level until there are none left.
+// Note that a failing merge writes the global err/exception in mesh.cpp; the
+// caller will redo the merges one at a time to report the errors properly.
+static DWORD WINAPI
+merge_worker(LPVOID param)
+{
+    MergeLevel *level = (MergeLevel *)param;
+    MergeNode *a, *b;
+    int job;
+
+    while ((job = InterlockedIncrement(&level->next_job) - 1) < level->n_jobs)
+    {
+        a = &level->nodes[2 * job];
+        b = &level->nodes[2 * job + 1];
+        if (!a->owned)
+        {
+            a->mesh = mesh_copy(a->mesh);
+            a->owned = TRUE;
+        }
+        if (!mesh_union(&a->mesh, b->mesh))
+            InterlockedIncrement(&level->n_failed);
+        if (b->owned)
+            mesh_destroy(b->mesh);
+        b->mesh = NULL;
+        b->owned = FALSE;
+    }
+
+    return 0;
+}
+
+// Run all the jobs in a level, waiting for the workers to finish. Keep the UI
+// ticking over while we wait.
+static BOOL
+merge_level(MergeLevel *level)
+{
+    HANDLE threads[MAX_WORKER_THREADS];
+    int n_threads = worker_thread_count();
+    int i;
+
+    if (n_threads > level->n_jobs)
+        n_threads = level->n_jobs;
+
+    level->next_job = 0;
+    level->n_failed = 0;
+    for (i = 0; i < n_threads; i++)
+    {
+        threads[i] = CreateThread(NULL, 0, merge_worker, level, 0, NULL);
+        if (threads[i] == NULL)
+            break;
+    }
+    n_threads = i;
+
+    if (n_threads == 0)
+    {
+        merge_worker(level);        // couldn't start any threads, do it here
+    }
+    else
+    {
+        while (WaitForMultipleObjects(n_threads, threads, TRUE, 100) == WAIT_TIMEOUT)
+            process_messages();
+        for (i = 0; i < n_threads; i++)
+            CloseHandle(threads[i]);
+    }
+
+    return level->n_failed == 0;
+}
+
+// Union an array of n meshes together, returning a new mesh in *result. The input
+// meshes are not changed (apart from any properties CGAL attaches to them).
+// Return FALSE if any of the merges failed, in which case *result is NULL and
+// the caller should fall back to merging them one at a time to find the culprit.
+BOOL
+mesh_union_balanced(Mesh **meshes, int n, Mesh **result)
+{
+    MergeLevel level;
+    MergeNode *nodes;
+    BOOL rc = TRUE;
+    int i, n_nodes;
+    LARGE_INTEGER start;
+
+    *result = NULL;
+    if (n <= 0)
+        return TRUE;
+
+    bench_start(&start);
+
+    nodes = malloc(n * sizeof(MergeNode));
+    for (i = 0; i < n; i++)
+    {
+        nodes[i].mesh = meshes[i];
+        nodes[i].owned = FALSE;
+    }
+
+    // Merge pairs at each level, then pack the survivors down to the start of
+    // the array for the next level. An odd node at the end just goes up a level.
+    level.nodes = nodes;
+    for (n_nodes = n; n_nodes > 1; n_nodes = (n_nodes + 1) / 2)
+    {
+        level.n_jobs = n_nodes / 2;
+        if (!merge_level(&level))
+        {
+            rc = FALSE;
+            break;
+        }
+        for (i = 0; i < n_nodes; i += 2)
+            nodes[i / 2] = nodes[i];
+    }
+
+    if (rc)
+    {
+        *result = nodes[0].owned ? nodes[0].mesh : mesh_copy(nodes[0].mesh);
+    }
+    else
+    {
+        for (i = 0; i < n_nodes; i++)
+        {
+            if (nodes[i].owned && nodes[i].mesh != NULL)
+                mesh_destroy(nodes[i].mesh);
+        }
+    }
+
+    free(nodes);
+    if (benchmarking && rc)
+        bench_end(BENCH_MERGE, &start, mesh_num_faces(*result));
+    return rc;
+}
@@ -1,6 +1,8 @@
 // C interface to a little bit of CGAL's polygon mesh processing library.
 
 #include "mesh.h"
+#include <stdio.h>
+#include <stdlib.h>
 typedef void(*FaceCoordCB)(void* arg, float x[3], float y[3], float z[3]);
 typedef void(*FaceCoordMaterialCB)(void* arg, int mat_index, float x[3], float y[3], float z[3]);
 typedef void(*FaceVertexCB)(void *arg, int nv, Vertex_index *vi);
@@ -30,102 +32,261 @@ extern "C"
         return mesh;
     }
 
-    // Copy a mesh.
+    // Add vertices and triangles to an existing mesh. The coordinates are 3 per vertex
+    // and the triangles are 3 vertex indices each. Return the number of triangles skipped.
+    int
+        mesh_add_arrays(Mesh *mesh, float *xyz, int nv, int *tri, int nt)
+    {
+        std::vector<Vertex_index> vi(nv);
+        Face_index fi;
+        int i, n_skipped = 0;
+
+        mesh->reserve(mesh->number_of_vertices() + nv, mesh->number_of_edges() + 3 * nt / 2, mesh->number_of_faces() + nt);
+        for (i = 0; i < nv; i++)
+            vi[i] = mesh->add_vertex(K::Point_3(xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2]));
+
+        for (i = 0; i < nt; i++)
+        {
+            fi = mesh->add_face(vi[tri[3 * i]], vi[tri[3 * i + 1]], vi[tri[3 * i + 2]]);
+            if (fi == Mesh::null_face())
+                n_skipped++;
+        }
+        return n_skipped;
+    }
+
+    // Build a mesh from an array of vertex coordinates (3 per vertex) and an array of
+    // triangles (3 vertex indices each). Triangles that can't be added without making
+    // the mesh non-manifold are skipped, and counted in n_skipped.
     Mesh *
-        mesh_copy(Mesh *from)
+        mesh_new_from_arrays(int material, float *xyz, int nv, int *tri, int nt, int *n_skipped)
     {
-        Mesh *mesh = new Mesh(*from);
+        Mesh *mesh = mesh_new(material);
+
+        *n_skipped = mesh_add_arrays(mesh, xyz, nv, tri, nt);
         return mesh;
     }
 
-    // Build a mesh by adding vertices or faces.
+    // Get a mesh's vertex coordinates and triangles as arrays, in the form taken by
+    // mesh_new_from_arrays. The arrays are malloc'ed and must be freed by the caller.
     void
-        mesh_add_vertex(Mesh *mesh, double x, double y, double z, Vertex_index *vi)
+        mesh_get_arrays(Mesh *mesh, float **xyz, int *nv, int **tri, int *nt)
     {
-        K::Point_3 p = { x, y, z };
-        *vi = mesh->add_vertex(p);
+        std::vector<int> index(mesh->number_of_vertices() + mesh->number_of_removed_vertices());
+        int i, j;
+
+        *nv = mesh->number_of_vertices();
+        *nt = mesh->number_of_faces();
+        *xyz = (float *)malloc(3 * (*nv + 1) * sizeof(float));
+        *tri = (int *)malloc(3 * (*nt + 1) * sizeof(int));
+
+        i = 0;
+        BOOST_FOREACH(Vertex_index v, mesh->vertices())
+        {
+            (*xyz)[3 * i] = (float)mesh->point(v).x();
+            (*xyz)[3 * i + 1] = (float)mesh->point(v).y();
+            (*xyz)[3 * i + 2] = (float)mesh->point(v).z();
+            index[v] = i++;
+        }
+
+        i = 0;
+        BOOST_FOREACH(Face_index fi, mesh->faces())
+        {
+            j = 0;
+            BOOST_FOREACH(Vertex_index v, CGAL::vertices_around_face(mesh->halfedge(fi), *mesh))
+            {
+                if (j < 3)
+                    (*tri)[3 * i + j] = index[v];
+                j++;
+            }
+            i++;
+        }
     }
 
+    // Round the exact points of a mesh to its inexact points, and remove the exact
+    // property maps. The tree mesh is kept exact through the whole chain of merges
+    // (its inexact points are not updated) and is rounded once at the end.
     void
-        mesh_add_face(Mesh *mesh, Vertex_index *v1, Vertex_index *v2, Vertex_index *v3, Face_index *fi)
+        mesh_round(Mesh *mesh)
     {
-        *fi = mesh->add_face(*v1, *v2, *v3);
+        std::pair<Exact_point_map, bool> ep =
+            mesh->property_map<vertex_descriptor, EK::Point_3>("e:exact_point");
+        std::pair<Exact_point_computed, bool> epc =
+            mesh->property_map<vertex_descriptor, bool>("e:exact_points_computed");
+        CGAL::Cartesian_converter<EK, K> to_input;
+
+        if (ep.second && epc.second)
+        {
+            BOOST_FOREACH(Vertex_index v, mesh->vertices())
+            {
+                if (epc.first[v])
+                    mesh->point(v) = to_input(ep.first[v]);
+            }
+        }
+        if (ep.second)
+            mesh->remove_property_map(ep.first);
+        if (epc.second)
+            mesh->remove_property_map(epc.first);
     }
 
-// Non-in-place operations to work around CGAL issue #4522 (for CGAL 5.0) but also to keep the
-// original mesh intact (not corefined) in case of a non-fatal error.
-    int // no BOOL here
-        mesh_union(Mesh **mesh1_ptr, Mesh *mesh2)
+    // Move all the vertices of a mesh by an offset. Any exact points would be left
+    // behind, so round them first.
+    void
+        mesh_translate(Mesh *mesh, double dx, double dy, double dz)
     {
-        Mesh* mesh1 = *mesh1_ptr;
-        Mesh *out = new Mesh;
-        bool rc;
+        K::Vector_3 d(dx, dy, dz);
 
-        // Create new (or reference existing) property maps
-        Exact_point_map mesh1_exact_points =
-            mesh1->add_property_map<vertex_descriptor, EK::Point_3>("e:exact_point").first;
-        Exact_point_computed mesh1_exact_points_computed =
-            mesh1->add_property_map<vertex_descriptor, bool>("e:exact_points_computed").first;
+        mesh_round(mesh);
+        BOOST_FOREACH(Vertex_index v, mesh->vertices())
+        {
+            mesh->point(v) = mesh->point(v) + d;
+        }
+    }
 
-        Exact_point_map mesh2_exact_points =
-            mesh2->add_property_map<vertex_descriptor, EK::Point_3>("e:exact_point").first;
-        Exact_point_computed mesh2_exact_points_computed =
-            mesh2->add_property_map<vertex_descriptor, bool>("e:exact_points_computed").first;
+    // Transform all the vertices of a mesh by a 3x4 affine matrix (rows of x, y and z
+    // coefficients, each followed by an offset). If the transform is a reflection,
+    // turn the faces around so they still face outwards. As for mesh_translate, the
+    // exact points are rounded first.
+    void
+        mesh_transform(Mesh *mesh, double m[12], int reflect)
+    {
+        mesh_round(mesh);
+        BOOST_FOREACH(Vertex_index v, mesh->vertices())
+        {
+            K::Point_3 p = mesh->point(v);
+
+            mesh->point(v) = K::Point_3
+            (
+                m[0] * p.x() + m[1] * p.y() + m[2] * p.z() + m[3],
+                m[4] * p.x() + m[5] * p.y() + m[6] * p.z() + m[7],
+                m[8] * p.x() + m[9] * p.y() + m[10] * p.z() + m[11]
+            );
+        }
 
-        Exact_point_map out_exact_points =
-            out->add_property_map<vertex_descriptor, EK::Point_3>("e:exact_point").first;
-        Exact_point_computed out_exact_points_computed =
-            out->add_property_map<vertex_descriptor, bool>("e:exact_points_computed").first;
+        if (reflect)
+            PMP::reverse_face_orientations(*mesh);
+    }
 
-        Coref_point_map mesh1_pm(mesh1_exact_points, mesh1_exact_points_computed, *mesh1);
-        Coref_point_map mesh2_pm(mesh2_exact_points, mesh2_exact_points_computed, *mesh2);
-        Coref_point_map out_pm(out_exact_points, out_exact_points_computed, *out);
+    // Copy a mesh.
+    Mesh *
+        mesh_copy(Mesh *from)
+    {
+        Mesh *mesh = new Mesh(*from);
+        return mesh;
+    }
 
-        Mesh::Property_map<Mesh::Face_index, int> mesh1_id =
-            mesh1->add_property_map<Mesh::Face_index, int>("f:id", 0).first;
-        Mesh::Property_map<Mesh::Face_index, int> mesh2_id =
-            mesh2->add_property_map<Mesh::Face_index, int>("f:id", 0).first;
-        Mesh::Property_map<Mesh::Face_index, int> out_id =
-            out->add_property_map<Mesh::Face_index, int>("f:id", 0).first;
+    // Split a mesh into a mesh for each material found on its faces, using the material
+    // index carried on the faces through the merges. Meshes are returned in parts[material],
+    // or NULL where there are no faces of that material. Return FALSE if any part is not a
+    // closed solid on its own (e.g. where two materials touch).
+    int // no BOOL here
+        mesh_split_by_material(Mesh *mesh, Mesh **parts, int n_parts)
+    {
+        std::vector<std::vector<Vertex_index> > index(n_parts);
+        Mesh::Property_map<Mesh::Face_index, int> mesh_id =
+            mesh->add_property_map<Mesh::Face_index, int>("f:id", 0).first;
+        Vertex_index vi[3];
+        Face_index fi;
+        int i, mat;
+        bool closed = true;
 
-        Visitor visitor;
-        visitor.properties[mesh1] = mesh1_id;
-        visitor.properties[mesh2] = mesh2_id;
-        visitor.properties[out] = out_id;
+        for (i = 0; i < n_parts; i++)
+            parts[i] = NULL;
 
-        try
+        BOOST_FOREACH(Face_index f, mesh->faces())
         {
-            rc = (PMP::corefine_and_compute_union(*mesh1,
-                *mesh2,
-                *out,
-                params::vertex_point_map(mesh1_pm).visitor(visitor).throw_on_self_intersection(true),
-                params::vertex_point_map(mesh2_pm),
-                params::vertex_point_map(out_pm)));
+            mat = mesh_id[f];
+            if (mat < 0 || mat >= n_parts)
+                mat = 0;
+            if (parts[mat] == NULL)
+            {
+                parts[mat] = mesh_new(mat);
+                index[mat].assign(mesh->number_of_vertices() + mesh->number_of_removed_vertices(), Mesh::null_vertex());
+            }
 
-            if (rc)
+            i = 0;
+            BOOST_FOREACH(Vertex_index v, CGAL::vertices_around_face(mesh->halfedge(f), *mesh))
             {
-                delete mesh1;
-                *mesh1_ptr = out;
+                if (index[mat][v] == Mesh::null_vertex())
+                    index[mat][v] = parts[mat]->add_vertex(mesh->point(v));
+                if (i < 3)
+                    vi[i] = index[mat][v];
+                i++;
             }
-            exception = 0;
+
+            fi = parts[mat]->add_face(vi[0], vi[1], vi[2]);
+            if (fi == Mesh::null_face())
+                closed = false;
         }
-        catch (PMP::Corefinement::Self_intersection_exception& e)
+
+        for (i = 0; i < n_parts; i++)
         {
-            rc = 0;
-            strcpy_s(err, 256, "CGAL: Self-intersection detected");
-            exception = 1;
+            if (parts[i] != NULL && !CGAL::is_closed(*parts[i]))
+                closed = false;
         }
-        catch (CGAL::Failure_exception& e)
+
+        return closed;
+    }
+
+    // Build a mesh by adding vertices or faces.
+    void
+        mesh_add_vertex(Mesh *mesh, double x, double y, double z, Vertex_index *vi)
+    {
+        K::Point_3 p = { x, y, z };
+        *vi = mesh->add_vertex(p);
+    }
+
+    void
+        mesh_add_face(Mesh *mesh, Vertex_index *v1, Vertex_index *v2, Vertex_index *v3, Face_index *fi)
+    {
+        *fi = mesh->add_face(*v1, *v2, *v3);
+    }
+
+    // Find the bounding box of a mesh. Where a vertex has an exact point, use its
+    // interval approximation, as the inexact point may not have been rounded yet.
+    static CGAL::Bbox_3
+        mesh_bbox(Mesh* mesh)
+    {
+        std::pair<Exact_point_map, bool> ep =
+            mesh->property_map<vertex_descriptor, EK::Point_3>("e:exact_point");
+        std::pair<Exact_point_computed, bool> epc =
+            mesh->property_map<vertex_descriptor, bool>("e:exact_points_computed");
+        CGAL::Bbox_3 box;
+
+        if (!ep.second || !epc.second)
+            return PMP::bbox(*mesh);
+
+        BOOST_FOREACH(Vertex_index v, mesh->vertices())
         {
-            rc = 0;
-            strcpy_s(err, 256, e.what());
-            exception = 2;
+            if (epc.first[v])
+                box += ep.first[v].bbox();
+            else
+                box += mesh->point(v).bbox();
         }
-        return rc;
+        return box;
     }
 
-    int // no BOOL here
-        mesh_intersection(Mesh** mesh1_ptr, Mesh* mesh2)
+    // Test if the bounding boxes of two meshes are disjoint. If so, a boolean operation
+    // between them doesn't need any corefinement.
+    static bool
+        mesh_disjoint(Mesh* mesh1, Mesh* mesh2)
+    {
+        return !CGAL::do_overlap(mesh_bbox(mesh1), mesh_bbox(mesh2));
+    }
+
+    enum MeshOp
+    {
+        MESH_UNION,
+        MESH_INTERSECTION,
+        MESH_DIFFERENCE
+    };
+
+// Non-in-place operations to work around CGAL issue #4522 (for CGAL 5.0) but also to keep the
+// original mesh intact (not corefined) in case of a non-fatal error.
+// The exact points of mesh1 and the output are kept in their property maps, and not rounded,
+// so the next operation in the chain picks them up where this one left off. Call mesh_round
+// when the chain is finished. Mesh2 (a volume or group mesh) is rounded as it is corefined.
+    static int
+        mesh_corefine_op(MeshOp op, Mesh** mesh1_ptr, Mesh* mesh2)
     {
         Mesh* mesh1 = *mesh1_ptr;
         Mesh* out = new Mesh;
@@ -147,9 +308,9 @@ extern "C"
         Exact_point_computed out_exact_points_computed =
             out->add_property_map<vertex_descriptor, bool>("e:exact_points_computed").first;
 
-        Coref_point_map mesh1_pm(mesh1_exact_points, mesh1_exact_points_computed, *mesh1);
+        Coref_point_map mesh1_pm(mesh1_exact_points, mesh1_exact_points_computed, *mesh1, false);
         Coref_point_map mesh2_pm(mesh2_exact_points, mesh2_exact_points_computed, *mesh2);
-        Coref_point_map out_pm(out_exact_points, out_exact_points_computed, *out);
+        Coref_point_map out_pm(out_exact_points, out_exact_points_computed, *out, false);
 
         Mesh::Property_map<Mesh::Face_index, int> mesh1_id =
             mesh1->add_property_map<Mesh::Face_index, int>("f:id", 0).first;
@@ -163,22 +324,36 @@ extern "C"
         visitor.properties[mesh2] = mesh2_id;
         visitor.properties[out] = out_id;
 
-        rc = PMP::does_self_intersect(*mesh1);
-        if (!rc)
-            rc = PMP::does_bound_a_volume(*mesh1);
-        rc = PMP::does_self_intersect(*mesh2);
-        if (!rc)
-            rc = PMP::does_bound_a_volume(*mesh2);
-
-            
         try
         {
-            rc = (PMP::corefine_and_compute_intersection(*mesh1,
-                *mesh2,
-                *out,
-                params::vertex_point_map(mesh1_pm).visitor(visitor).throw_on_self_intersection(true),
-                params::vertex_point_map(mesh2_pm),
-                params::vertex_point_map(out_pm)));
+            switch (op)
+            {
+            case MESH_UNION:
+                rc = PMP::corefine_and_compute_union(*mesh1,
+                    *mesh2,
+                    *out,
+                    params::vertex_point_map(mesh1_pm).visitor(visitor).throw_on_self_intersection(true),
+                    params::vertex_point_map(mesh2_pm),
+                    params::vertex_point_map(out_pm));
+                break;
+            case MESH_INTERSECTION:
+                rc = PMP::corefine_and_compute_intersection(*mesh1,
+                    *mesh2,
+                    *out,
+                    params::vertex_point_map(mesh1_pm).visitor(visitor).throw_on_self_intersection(true),
+                    params::vertex_point_map(mesh2_pm),
+                    params::vertex_point_map(out_pm));
+                break;
+            case MESH_DIFFERENCE:
+            default:
+                rc = PMP::corefine_and_compute_difference(*mesh1,
+                    *mesh2,
+                    *out,
+                    params::vertex_point_map(mesh1_pm).visitor(visitor).throw_on_self_intersection(true),
+                    params::vertex_point_map(mesh2_pm),
+                    params::vertex_point_map(out_pm));
+                break;
+            }
 
             if (rc)
             {
@@ -200,78 +375,63 @@ extern "C"
             exception = 2;
         }
 
+        if (!rc)
+            delete out;
         return rc;
     }
 
     int // no BOOL here
-        mesh_difference(Mesh** mesh1_ptr, Mesh* mesh2)
+        mesh_union(Mesh **mesh1_ptr, Mesh *mesh2)
     {
         Mesh* mesh1 = *mesh1_ptr;
-        Mesh* out = new Mesh;
-        bool rc;
 
-        // Create new (or reference existing) property maps
-        Exact_point_map mesh1_exact_points =
-            mesh1->add_property_map<vertex_descriptor, EK::Point_3>("e:exact_point").first;
-        Exact_point_computed mesh1_exact_points_computed =
-            mesh1->add_property_map<vertex_descriptor, bool>("e:exact_points_computed").first;
-
-        Exact_point_map mesh2_exact_points =
-            mesh2->add_property_map<vertex_descriptor, EK::Point_3>("e:exact_point").first;
-        Exact_point_computed mesh2_exact_points_computed =
-            mesh2->add_property_map<vertex_descriptor, bool>("e:exact_points_computed").first;
-
-        Exact_point_map out_exact_points =
-            out->add_property_map<vertex_descriptor, EK::Point_3>("e:exact_point").first;
-        Exact_point_computed out_exact_points_computed =
-            out->add_property_map<vertex_descriptor, bool>("e:exact_points_computed").first;
-
-        Coref_point_map mesh1_pm(mesh1_exact_points, mesh1_exact_points_computed, *mesh1);
-        Coref_point_map mesh2_pm(mesh2_exact_points, mesh2_exact_points_computed, *mesh2);
-        Coref_point_map out_pm(out_exact_points, out_exact_points_computed, *out);
-
-        Mesh::Property_map<Mesh::Face_index, int> mesh1_id =
-            mesh1->add_property_map<Mesh::Face_index, int>("f:id", 0).first;
-        Mesh::Property_map<Mesh::Face_index, int> mesh2_id =
-            mesh2->add_property_map<Mesh::Face_index, int>("f:id", 0).first;
-        Mesh::Property_map<Mesh::Face_index, int> out_id =
-            out->add_property_map<Mesh::Face_index, int>("f:id", 0).first;
-
-        Visitor visitor;
-        visitor.properties[mesh1] = mesh1_id;
-        visitor.properties[mesh2] = mesh2_id;
-        visitor.properties[out] = out_id;
-
-        try
+        // Disjoint meshes are simply appended to each other. Make sure mesh1 has
+        // exact maps for any exact points of mesh2 to be carried across into.
+        if (mesh_disjoint(mesh1, mesh2))
         {
-            rc = (PMP::corefine_and_compute_difference(*mesh1,
-                *mesh2,
-                *out,
-                params::vertex_point_map(mesh1_pm).visitor(visitor).throw_on_self_intersection(true),
-                params::vertex_point_map(mesh2_pm),
-                params::vertex_point_map(out_pm)));
-
-            if (rc)
+            if (mesh2->property_map<vertex_descriptor, EK::Point_3>("e:exact_point").second)
             {
-                delete mesh1;
-                *mesh1_ptr = out;
+                mesh1->add_property_map<vertex_descriptor, EK::Point_3>("e:exact_point");
+                mesh1->add_property_map<vertex_descriptor, bool>("e:exact_points_computed");
             }
+            *mesh1 += *mesh2;
             exception = 0;
+            return 1;
         }
-        catch (PMP::Corefinement::Self_intersection_exception& e)
+
+        return mesh_corefine_op(MESH_UNION, mesh1_ptr, mesh2);
+    }
+
+    int // no BOOL here
+        mesh_intersection(Mesh** mesh1_ptr, Mesh* mesh2)
+    {
+        Mesh* mesh1 = *mesh1_ptr;
+
+        // Disjoint meshes have nothing in common, so the result is empty
+        if (mesh_disjoint(mesh1, mesh2))
         {
-            rc = 0;
-            strcpy_s(err, 256, "CGAL: Self-intersection detected");
-            exception = 1;
+            *mesh1_ptr = mesh_new(0);
+            delete mesh1;
+            exception = 0;
+            return 1;
         }
-        catch (CGAL::Failure_exception& e)
+
+        return mesh_corefine_op(MESH_INTERSECTION, mesh1_ptr, mesh2);
+    }
+
+    int // no BOOL here
+        mesh_difference(Mesh** mesh1_ptr, Mesh* mesh2)
+    {
+        Mesh* mesh1 = *mesh1_ptr;
+
+        // Nothing to take away if the meshes are disjoint
+        if (mesh_disjoint(mesh1, mesh2))
         {
-            rc = 0;
-            strcpy_s(err, 256, e.what());
-            exception = 2;
+            exception = 0;
+            return 1;
         }
 
-        return rc;
+        return mesh_corefine_op(MESH_DIFFERENCE, mesh1_ptr, mesh2);
     }
 
     // Routines for enumerating vertices in index or coord form.
@@ -355,6 +515,94 @@ extern "C"
         }
     }
 
+    // Write a mesh to a binary file. The vertex and face counts are followed by the
+    // vertex coordinates, then the faces as three vertex indices and a material index.
+    // The mesh must be triangulated.
+    void
+        mesh_write_binary(Mesh* mesh, FILE* f)
+    {
+        int nv = mesh->number_of_vertices();
+        int nf = mesh->number_of_faces();
+        std::vector<int> index(mesh->number_of_vertices() + mesh->number_of_removed_vertices());
+        double xyz[3];
+        int rec[4];
+        int i;
+        Mesh::Property_map<Mesh::Face_index, int> mesh_id =
+            mesh->add_property_map<Mesh::Face_index, int>("f:id", 0).first;
+
+        fwrite(&nv, sizeof(int), 1, f);
+        fwrite(&nf, sizeof(int), 1, f);
+
+        i = 0;
+        BOOST_FOREACH(Vertex_index v, mesh->vertices())
+        {
+            xyz[0] = mesh->point(v).x();
+            xyz[1] = mesh->point(v).y();
+            xyz[2] = mesh->point(v).z();
+            fwrite(xyz, sizeof(double), 3, f);
+            index[v] = i++;
+        }
+
+        BOOST_FOREACH(Face_index fi, mesh->faces())
+        {
+            i = 0;
+            BOOST_FOREACH(Vertex_index v, CGAL::vertices_around_face(mesh->halfedge(fi), *mesh))
+            {
+                if (i < 3)
+                    rec[i] = index[v];
+                i++;
+            }
+            rec[3] = mesh_id[fi];
+            fwrite(rec, sizeof(int), 4, f);
+        }
+    }
+
+    // Read a mesh written by mesh_write_binary. Return NULL if the file is short or
+    // the mesh is not well formed.
+    Mesh*
+        mesh_read_binary(FILE* f)
+    {
+        Mesh* mesh;
+        int nv, nf, i;
+        double xyz[3];
+        int rec[4];
+        Face_index fi;
+
+        if (fread(&nv, sizeof(int), 1, f) != 1 || fread(&nf, sizeof(int), 1, f) != 1)
+            return NULL;
+        if (nv < 0 || nf < 0)
+            return NULL;
+
+        mesh = mesh_new(0);
+        Mesh::Property_map<Mesh::Face_index, int> mesh_id =
+            mesh->property_map<Mesh::Face_index, int>("f:id").first;
+
+        mesh->reserve(nv, 3 * nf / 2, nf);
+        for (i = 0; i < nv; i++)
+        {
+            if (fread(xyz, sizeof(double), 3, f) != 3)
+                goto bad_mesh;
+            mesh->add_vertex(K::Point_3(xyz[0], xyz[1], xyz[2]));
+        }
+
+        for (i = 0; i < nf; i++)
+        {
+            if (fread(rec, sizeof(int), 4, f) != 4)
+                goto bad_mesh;
+            if (rec[0] < 0 || rec[0] >= nv || rec[1] < 0 || rec[1] >= nv || rec[2] < 0 || rec[2] >= nv)
+                goto bad_mesh;
+            fi = mesh->add_face(Vertex_index(rec[0]), Vertex_index(rec[1]), Vertex_index(rec[2]));
+            if (fi == Mesh::null_face())
+                goto bad_mesh;
+            mesh_id[fi] = rec[3];
+        }
+        return mesh;
+
+    bad_mesh:
+        delete mesh;
+        return NULL;
+    }
+
     int
         mesh_num_vertices(Mesh *mesh)
     {
@@ -5,6 +5,8 @@
 #include <boost/container/flat_map.hpp>
 #include <CGAL/Polygon_mesh_processing/corefinement.h>
 #include <CGAL/Polygon_mesh_processing/repair.h>
+#include <CGAL/Polygon_mesh_processing/bbox.h>
+#include <CGAL/Polygon_mesh_processing/orientation.h>
 
 typedef CGAL::Exact_predicates_inexact_constructions_kernel K;
 typedef CGAL::Exact_predicates_exact_constructions_kernel EK;
@@ -31,6 +33,10 @@ struct Coref_point_map
     Exact_point_map* exact_point_ptr;
     Mesh* mesh_ptr;
 
+    // If false, put() leaves the inexact point alone. The mesh must then be rounded
+    // (see mesh_round) before its inexact points are used.
+    bool round_points;
+
     Exact_point_computed& exact_point_computed() const
     {
         CGAL_assertion(exact_point_computed_ptr != NULL);
@@ -57,14 +63,17 @@ struct Coref_point_map
         : exact_point_computed_ptr(NULL)
         , exact_point_ptr(NULL)
         , mesh_ptr(NULL)
+        , round_points(true)
     {}
 
     Coref_point_map(Exact_point_map& ep,
                     Exact_point_computed& epc,
-                    Mesh& m)
+                    Mesh& m,
+                    bool round = true)
                     : exact_point_computed_ptr(&epc)
                     , exact_point_ptr(&ep)
                     , mesh_ptr(&m)
+                    , round_points(round)
     {}
 
     friend
@@ -85,7 +94,8 @@ struct Coref_point_map
         map.exact_point_computed()[k] = true;
         map.exact_point()[k] = p;
         // create the input point from the exact one
-        map.mesh().point(k) = map.to_input(p);
+        if (map.round_points)
+            map.mesh().point(k) = map.to_input(p);
     }
 };
 
@@ -0,0 +1,520 @@
+#include "stdafx.h"
+#include "LoftyCAD.h"
+#include <stdio.h>
+
+// Persistent cache of volume and group meshes.
+//
+// Each volume mesh is keyed by a hash of the volume's geometry (its faces, edges and
+// points) plus the tolerance and material. Group meshes (including the object tree)
+// are keyed by a hash of their members' keys and operations. The meshes are kept in a
+// binary file in the temp directory, named after the drawing and its path. It is written when the
+// drawing is saved, and read when it is opened, so reopening a drawing can pick up
+// the triangulated and merged meshes without regenerating them.
+//
+// File format:
+//  8-byte magic string, then a list of entries until the end of the file.
+//  Each entry is an 8-byte key followed by a mesh written by mesh_write_binary.
+
+#define MESH_CACHE_MAGIC    "LCMESH01"
+
+typedef unsigned long long MeshKey;
+
+// Index of entries in the cache file. Open addressed hash table (key 0 is empty)
+typedef struct CacheEntry
+{
+    MeshKey     key;
+    __int64     offset;             // Offset of the mesh in the cache file (64-bit, it can exceed 2GB)
+} CacheEntry;
+
+typedef struct CacheIndex
+{
+    CacheEntry  *entries;
+    int         n_entries;
+    int         n_alloc;            // Always a power of 2
+} CacheIndex;
+
+// The open cache file and its index.
+static FILE *cache_file = NULL;
+static char cache_filename[256] = { 0, };
+static CacheIndex cache_index = { NULL, 0, 0 };
+
+// FNV-1a hashing of blocks of data.
+#define FNV_OFFSET  14695981039346656037ULL
+#define FNV_PRIME   1099511628211ULL
+
+static void
+hash_bytes(MeshKey *h, void *data, int n)
+{
+    unsigned char *p = (unsigned char *)data;
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        *h ^= p[i];
+        *h *= FNV_PRIME;
+    }
+}
+
+static void
+hash_int(MeshKey *h, int i)
+{
+    hash_bytes(h, &i, sizeof(int));
+}
+
+static void
+hash_point(MeshKey *h, Point *p)
+{
+    if (p == NULL)
+    {
+        hash_int(h, 0);
+        return;
+    }
+    hash_bytes(h, &p->x, sizeof(float));
+    hash_bytes(h, &p->y, sizeof(float));
+    hash_bytes(h, &p->z, sizeof(float));
+}
+
+// Hash the geometry of an edge.
+static void
+hash_edge(MeshKey *h, Edge *e)
+{
+    ArcEdge *ae;
+    BezierEdge *be;
+
+    hash_int(h, e->type);
+    hash_int(h, e->corner);
+    hash_int(h, e->nsteps);
+    hash_int(h, e->band);
+    hash_point(h, e->endpoints[0]);
+    hash_point(h, e->endpoints[1]);
+    switch (e->type & ~EDGE_CONSTRUCTION)
+    {
+    case EDGE_ARC:
+        ae = (ArcEdge *)e;
+        hash_bytes(h, &ae->normal.A, 3 * sizeof(float));
+        hash_int(h, ae->clockwise);
+        hash_point(h, ae->centre);
+        hash_bytes(h, &ae->ecc, sizeof(float));
+        break;
+
+    case EDGE_BEZIER:
+        be = (BezierEdge *)e;
+        hash_point(h, be->ctrlpoints[0]);
+        hash_point(h, be->ctrlpoints[1]);
+        break;
+    }
+}
+
+// Hash a vertex of a mesh-only volume's mesh.
+static void
+hash_mesh_vertex(void *arg, Vertex_index *v, double x, double y, double z)
+{
+    MeshKey *h = (MeshKey *)arg;
+
+    hash_bytes(h, &x, sizeof(double));
+    hash_bytes(h, &y, sizeof(double));
+    hash_bytes(h, &z, sizeof(double));
+}
+
+// Hash the geometry of a volume, with everything else that affects its mesh.
+static MeshKey
+hash_volume(Volume *vol)
+{
+    MeshKey h = FNV_OFFSET;
+    Face *f;
+    int i;
+
+    hash_int(&h, OBJ_VOLUME);
+    hash_bytes(&h, &tolerance, sizeof(float));
+    hash_int(&h, vol->material);
+    if (vol->mesh_only)
+    {
+        // There are no faces; the mesh is all there is
+        hash_int(&h, mesh_num_vertices(vol->mesh));
+        hash_int(&h, mesh_num_faces(vol->mesh));
+        mesh_foreach_vertex_d(vol->mesh, hash_mesh_vertex, &h);
+    }
+    for (f = (Face *)vol->faces.head; f != NULL; f = (Face *)f->hdr.next)
+    {
+        hash_int(&h, f->type);
+        hash_int(&h, f->n_edges);
+        hash_int(&h, f->corner);
+        hash_point(&h, f->initial_point);
+        for (i = 0; i < f->n_edges; i++)
+            hash_edge(&h, f->edges[i]);
+        for (i = 0; i < f->n_contours; i++)
+            hash_bytes(&h, &f->contours[i], sizeof(Contour));
+    }
+    return h != 0 ? h : 1;
+}
+
+// Hash the members of a group that take part in its mesh (see gen_view_list_tree_surfaces_op)
+static void
+hash_group_members(MeshKey *h, Group *tree)
+{
+    Object *obj;
+    Volume *vol;
+    Group *group;
+    Instance *inst;
+
+    for (obj = tree->obj_list.head; obj != NULL; obj = obj->next)
+    {
+        switch (obj->type)
+        {
+        case OBJ_VOLUME:
+            vol = (Volume *)obj;
+            if (materials[vol->material].hidden)
+                break;
+            hash_int(h, vol->op);
+            *h ^= hash_volume(vol);
+            *h *= FNV_PRIME;
+            break;
+
+        case OBJ_GROUP:
+            group = (Group *)obj;
+            if (group->op == OP_NONE)
+            {
+                hash_group_members(h, group);
+                break;
+            }
+            hash_int(h, group->op);
+            hash_int(h, OBJ_GROUP);
+            hash_group_members(h, group);
+            hash_int(h, -1);
+            break;
+
+        case OBJ_INSTANCE:
+            // The source's geometry, as it comes out after the instance's transform
+            inst = (Instance *)obj;
+            if (inst->source == NULL)
+                break;
+            if (inst->source->type == OBJ_VOLUME && materials[((Volume *)inst->source)->material].hidden)
+                break;
+            hash_int(h, inst->op);
+            hash_int(h, OBJ_INSTANCE);
+            if (inst->source->type == OBJ_VOLUME)
+            {
+                *h ^= hash_volume((Volume *)inst->source);
+                *h *= FNV_PRIME;
+            }
+            else
+            {
+                hash_group_members(h, (Group *)inst->source);
+            }
+            hash_bytes(h, inst->xform, 12 * sizeof(double));
+            hash_int(h, -1);
+            break;
+        }
+    }
+}
+
+static MeshKey
+hash_group(Group *group)
+{
+    MeshKey h = FNV_OFFSET;
+
+    hash_int(&h, OBJ_GROUP);
+    hash_bytes(&h, &tolerance, sizeof(float));
+    hash_group_members(&h, group);
+    return h != 0 ? h : 1;
+}
+
+// Find a key in an index. Return the slot it occupies, or the empty slot where it would go.
+static CacheEntry *
+find_entry(CacheIndex *index, MeshKey key)
+{
+    int i = (int)(key & (index->n_alloc - 1));
+
+    while (index->entries[i].key != 0 && index->entries[i].key != key)
+        i = (i + 1) & (index->n_alloc - 1);
+
+    return &index->entries[i];
+}
+
+// Add a key to an index, growing it when it gets over half full.
+// Return FALSE if it was already there.
+static BOOL
+add_entry(CacheIndex *index, MeshKey key, __int64 offset)
+{
+    CacheEntry *old = index->entries;
+    CacheEntry *e;
+    int i, n_old = index->n_alloc;
+
+    if (2 * (index->n_entries + 1) > index->n_alloc)
+    {
+        index->n_alloc = index->n_alloc == 0 ? 64 : index->n_alloc * 2;
+        index->entries = calloc(index->n_alloc, sizeof(CacheEntry));
+        for (i = 0; i < n_old; i++)
+        {
+            if (old[i].key != 0)
+                *find_entry(index, old[i].key) = old[i];
+        }
+        free(old);
+    }
+
+    e = find_entry(index, key);
+    if (e->key != 0)
+        return FALSE;
+    e->key = key;
+    e->offset = offset;
+    index->n_entries++;
+    return TRUE;
+}
+
+static void
+free_index(CacheIndex *index)
+{
+    free(index->entries);
+    index->entries = NULL;
+    index->n_entries = 0;
+    index->n_alloc = 0;
+}
+
+// Skip over (or copy to another file) a mesh in the cache file. Return FALSE if it is short.
+static BOOL
+skip_mesh(FILE *f, FILE *copy_to)
+{
+    int n[2];
+    __int64 size;
+    char buf[4096];
+    int chunk;
+
+    if (fread(n, sizeof(int), 2, f) != 2 || n[0] < 0 || n[1] < 0)
+        return FALSE;
+    size = (__int64)n[0] * 3 * sizeof(double) + (__int64)n[1] * 4 * sizeof(int);
+    if (copy_to == NULL)
+        return _fseeki64(f, size, SEEK_CUR) == 0;
+
+    fwrite(n, sizeof(int), 2, copy_to);
+    while (size > 0)
+    {
+        chunk = size > 4096 ? 4096 : (int)size;
+        if ((int)fread(buf, 1, chunk, f) != chunk)
+            return FALSE;
+        fwrite(buf, 1, chunk, copy_to);
+        size -= chunk;
+    }
+    return TRUE;
+}
+
+// Make the cache filename for a drawing: the drawing's base name in the temp directory,
+// followed by a hash of its full path, so drawings of the same name in different
+// folders don't share a cache. Paths are not case sensitive, so hash them in lower case.
+static void
+make_cache_filename(char *filename, char *cachename)
+{
+    char basename[256], tmpdir[256], fullname[256];
+    char *pdot;
+    MeshKey h = FNV_OFFSET;
+    int i;
+
+    if (GetFullPathName(filename, 256, fullname, NULL) == 0)
+        strcpy_s(fullname, 256, filename);
+    for (i = 0; fullname[i] != '\0'; i++)
+    {
+        char c = (char)tolower((unsigned char)fullname[i]);
+
+        hash_bytes(&h, &c, 1);
+    }
+
+    pdot = strrchr(filename, '\\');
+    if (pdot != NULL)
+        strcpy_s(basename, 256, pdot + 1);
+    else
+        strcpy_s(basename, 256, filename);
+    if ((pdot = strrchr(basename, '.')) != NULL)
+        *pdot = '\0';
+    GetTempPath(256, tmpdir);
+    sprintf_s(cachename, 256, "%s%s_%08x.lcm", tmpdir, basename, (unsigned int)(h ^ (h >> 32)));
+}
+
+// Close the mesh cache, if it is open.
+void
+mesh_cache_close(void)
+{
+    if (cache_file != NULL)
+        fclose(cache_file);
+    cache_file = NULL;
+    cache_filename[0] = '\0';
+    free_index(&cache_index);
+}
+
+// Open the mesh cache for a drawing, and read its index. If there is no cache
+// (or it is no good) the cache is left empty.
+void
+mesh_cache_open(char *filename)
+{
+    char magic[8];
+    MeshKey key;
+    __int64 offset;
+
+    mesh_cache_close();
+    make_cache_filename(filename, cache_filename);
+    fopen_s(&cache_file, cache_filename, "rb");
+    if (cache_file == NULL)
+        return;
+
+    if (fread(magic, 1, 8, cache_file) != 8 || strncmp(magic, MESH_CACHE_MAGIC, 8) != 0)
+    {
+        mesh_cache_close();
+        return;
+    }
+
+    while (fread(&key, sizeof(MeshKey), 1, cache_file) == 1)
+    {
+        offset = _ftelli64(cache_file);
+        if (!skip_mesh(cache_file, NULL))
+            break;
+        add_entry(&cache_index, key, offset);
+    }
+}
+
+// Read a mesh from the cache, or return NULL if it isn't there.
+static Mesh *
+read_cached_mesh(MeshKey key)
+{
+    CacheEntry *e;
+
+    if (cache_file == NULL || cache_index.n_entries == 0)
+        return NULL;
+    e = find_entry(&cache_index, key);
+    if (e->key == 0)
+        return NULL;
+    if (_fseeki64(cache_file, e->offset, SEEK_SET) != 0)
+        return NULL;
+    return mesh_read_binary(cache_file);
+}
+
+// Look up the mesh for a volume or group in the cache. If it is found, it replaces
+// the object's mesh, which is marked valid. Return TRUE if found.
+BOOL
+mesh_cache_lookup(Object *obj)
+{
+    Volume *vol;
+    Group *group;
+    Mesh *mesh;
+
+    if (cache_file == NULL || cache_index.n_entries == 0)
+        return FALSE;
+
+    switch (obj->type)
+    {
+    case OBJ_VOLUME:
+        vol = (Volume *)obj;
+        mesh = read_cached_mesh(hash_volume(vol));
+        if (mesh == NULL)
+            return FALSE;
+        if (vol->mesh != NULL)
+            mesh_destroy(vol->mesh);
+        vol->mesh = mesh;
+        vol->mesh_valid = TRUE;
+        return TRUE;
+
+    case OBJ_GROUP:
+        group = (Group *)obj;
+        mesh = read_cached_mesh(hash_group(group));
+        if (mesh == NULL)
+            return FALSE;
+        if (group->mesh != NULL)
+            mesh_destroy(group->mesh);
+        group->mesh = mesh;
+        group->mesh_valid = TRUE;
+        group->mesh_complete = TRUE;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+// Write a mesh to the new cache file, unless its key has already been written.
+// If the mesh is NULL (not up to date in memory) it is copied from the old cache
+// if it is there.
+static void
+write_cache_entry(FILE *f, MeshKey key, Mesh *mesh, CacheIndex *written)
+{
+    CacheEntry *e;
+
+    if (!add_entry(written, key, 0))
+        return;         // already written (identical geometry)
+
+    if (mesh != NULL)
+    {
+        fwrite(&key, sizeof(MeshKey), 1, f);
+        mesh_write_binary(mesh, f);
+    }
+    else if (cache_file != NULL && cache_index.n_entries != 0 && (e = find_entry(&cache_index, key))->key != 0)
+    {
+        _fseeki64(cache_file, e->offset, SEEK_SET);
+        fwrite(&key, sizeof(MeshKey), 1, f);
+        skip_mesh(cache_file, f);
+    }
+}
+
+// Write the meshes of all the volumes and groups in a tree to the new cache file.
+static void
+write_cached_meshes(FILE *f, Group *tree, CacheIndex *written)
+{
+    Object *obj;
+    Volume *vol;
+    Group *group;
+    Mesh *mesh = NULL;
+    MeshKey key;
+
+    for (obj = tree->obj_list.head; obj != NULL; obj = obj->next)
+    {
+        switch (obj->type)
+        {
+        case OBJ_VOLUME:
+            vol = (Volume *)obj;
+            key = hash_volume(vol);
+            mesh = (vol->mesh != NULL && vol->mesh_valid) ? vol->mesh : NULL;
+            break;
+
+        case OBJ_GROUP:
+            group = (Group *)obj;
+            write_cached_meshes(f, group, written);
+            if (group->op == OP_NONE)
+                continue;
+            key = hash_group(group);
+            mesh = (group->mesh != NULL && group->mesh_valid && group->mesh_complete) ? group->mesh : NULL;
+            break;
+
+        default:
+            continue;
+        }
+
+        write_cache_entry(f, key, mesh, written);
+    }
+}
+
+// Save the mesh cache for a drawing. This is done when the drawing is saved.
+void
+mesh_cache_save(Group *tree, char *filename)
+{
+    char newname[256], tempname[256];
+    CacheIndex written = { NULL, 0, 0 };
+    Mesh *mesh;
+    FILE *f;
+
+    make_cache_filename(filename, newname);
+    sprintf_s(tempname, 256, "%s.tmp", newname);
+    fopen_s(&f, tempname, "wb");
+    if (f == NULL)
+        return;
+
+    fwrite(MESH_CACHE_MAGIC, 1, 8, f);
+    write_cached_meshes(f, tree, &written);
+
+    // The whole tree
+    mesh = (tree->mesh != NULL && tree->mesh_valid && tree->mesh_complete) ? tree->mesh : NULL;
+    write_cache_entry(f, hash_group(tree), mesh, &written);
+
+    fclose(f);
+    free_index(&written);
+
+    // Replace the old cache with the new one, and reopen it.
+    mesh_cache_close();
+    remove(newname);
+    rename(tempname, newname);
+    mesh_cache_open(filename);
+}
@@ -6,91 +6,306 @@
 static float rotate_3x3[9];
 static BOOL rotate_3x3_valid = FALSE;
 
+// The current move epoch (see clear_move_copy_flags). Zero is never current, so newly
+// allocated objects start out unmoved and uncopied.
+unsigned int move_epoch = 1;
+
 // Anything to do with moving and copying objects.
 
-// Clear the moved and copied_to flags, and the window-coordinate valid flag,
-// on all points referenced by the object.
+// Clear the moved and copied_to flags, and the window-coordinate valid flag, on every
+// object at once. The flags only count if they carry the current move epoch, so this
+// just starts a new one, instead of walking everything the object references.
 // Call this after move_obj, copy_obj or the rotate/reflect functions.
 void
 clear_move_copy_flags(Object* obj)
 {
+    rotate_3x3_valid = FALSE;
+    move_epoch++;
+}
+
+// Move a mesh-only volume by moving its mesh and bbox. It has no faces to move.
+static void
+move_mesh_volume(Volume* vol, float xoffset, float yoffset, float zoffset)
+{
+    mesh_translate(vol->mesh, xoffset, yoffset, zoffset);
+    invalidate_mesh_bvh(vol);
+    vol->bbox.xmin += xoffset;
+    vol->bbox.xmax += xoffset;
+    vol->bbox.xc += xoffset;
+    vol->bbox.ymin += yoffset;
+    vol->bbox.ymax += yoffset;
+    vol->bbox.yc += yoffset;
+    vol->bbox.zmin += zoffset;
+    vol->bbox.zmax += zoffset;
+    vol->bbox.zc += zoffset;
+}
+
+// Moving, rotating or reflecting a whole volume doesn't change its shape, so instead of
+// regenerating its face view lists and mesh from the moved points, the same transform
+// is applied to them directly. Transforms are held as a 3x4 matrix: rows of x, y and z
+// coefficients, each followed by an offset.
+
+// Build the matrix for a transform of the form c + L(p - c), given the images of the
+// three unit axes under L (i.e. the columns of L) and the centre c.
+static void
+affine_about_centre(float axes[3][3], float xc, float yc, float zc, double m[12])
+{
+    double c[3] = { xc, yc, zc };
     int i;
-    Point* p;
-    EDGE type;
-    Edge* edge;
-    ArcEdge* ae;
-    BezierEdge* be;
+
+    for (i = 0; i < 3; i++)
+    {
+        m[i * 4] = axes[0][i];
+        m[i * 4 + 1] = axes[1][i];
+        m[i * 4 + 2] = axes[2][i];
+        m[i * 4 + 3] = c[i] - (axes[0][i] * c[0] + axes[1][i] * c[1] + axes[2][i] * c[2]);
+    }
+}
+
+// Transform a coordinate.
+static void
+transform_coord(double m[12], float* x, float* y, float* z)
+{
+    double x0 = *x;
+    double y0 = *y;
+    double z0 = *z;
+
+    *x = (float)(m[0] * x0 + m[1] * y0 + m[2] * z0 + m[3]);
+    *y = (float)(m[4] * x0 + m[5] * y0 + m[6] * z0 + m[7]);
+    *z = (float)(m[8] * x0 + m[9] * y0 + m[10] * z0 + m[11]);
+}
+
+// Transform a direction (a normal). Only good for rotations and reflections.
+static void
+transform_dirn(double m[12], float* A, float* B, float* C)
+{
+    double A0 = *A;
+    double B0 = *B;
+    double C0 = *C;
+
+    *A = (float)(m[0] * A0 + m[1] * B0 + m[2] * C0);
+    *B = (float)(m[4] * A0 + m[5] * B0 + m[6] * C0);
+    *C = (float)(m[8] * A0 + m[9] * B0 + m[10] * C0);
+}
+
+// Callback to expand a bbox to take in a mesh vertex.
+static void
+expand_bbox_vertex(void* arg, Vertex_index* v, float x, float y, float z)
+{
+    expand_bbox_coords((Bbox*)arg, x, y, z);
+}
+
+// Transform a mesh-only volume by transforming its mesh and finding its new bbox.
+static void
+transform_mesh_volume(Volume* vol, double m[12], BOOL reflect)
+{
+    mesh_transform(vol->mesh, m, reflect);
+    invalidate_mesh_bvh(vol);
+    clear_bbox(&vol->bbox);
+    mesh_foreach_vertex(vol->mesh, expand_bbox_vertex, &vol->bbox);
+    vol->bbox.xc = (vol->bbox.xmin + vol->bbox.xmax) / 2;
+    vol->bbox.yc = (vol->bbox.ymin + vol->bbox.ymax) / 2;
+    vol->bbox.zc = (vol->bbox.zmin + vol->bbox.zmax) / 2;
+}
+
+// Return TRUE if all the faces of a volume have up to date view lists that can be
+// transformed along with the volume.
+static BOOL
+views_transformable(Volume* vol)
+{
     Face* face;
-    Volume* vol;
-    Group* grp;
-    Object* o;
 
-    rotate_3x3_valid = FALSE;
+    if (vol->faces.head == NULL)
+        return FALSE;
+    for (face = (Face*)vol->faces.head; face != NULL; face = (Face*)face->hdr.next)
+    {
+        if (!face->view_valid)
+            return FALSE;
+    }
+    return TRUE;
+}
 
-    switch (obj->type)
+// Reverse the order of the points in a run of a face's view list.
+static void
+reverse_view_run(Face* face, int first, int end)
+{
+    float t;
+    int i, j;
+
+    for (i = first, j = end - 1; i < j; i++, j--)
     {
-    case OBJ_POINT:
-        p = (Point*)obj;
-        p->moved = FALSE;
-        p->win_valid = FALSE;
-        obj->copied_to = NULL;
-        break;
+        t = face->view_x[i];
+        face->view_x[i] = face->view_x[j];
+        face->view_x[j] = t;
+        t = face->view_y[i];
+        face->view_y[i] = face->view_y[j];
+        face->view_y[j] = t;
+        t = face->view_z[i];
+        face->view_z[i] = face->view_z[j];
+        face->view_z[j] = t;
+    }
+}
 
-    case OBJ_EDGE:
-        type = ((Edge*)obj)->type & ~EDGE_CONSTRUCTION;
-        edge = (Edge*)obj;
-        clear_move_copy_flags((Object*)edge->endpoints[0]);
-        clear_move_copy_flags((Object*)edge->endpoints[1]);
-        obj->copied_to = NULL;
+// Transform the view lists of a volume's faces (whose points have already been
+// transformed), along with their normals and triangles, and the volume's mesh and bbox.
+// The faces are marked valid again. Reflections turn everything inside out, so the
+// view list runs and triangles are reversed to keep them facing outwards.
+static void
+transform_volume_views(Volume* vol, double m[12], BOOL reflect)
+{
+    Face* face;
+    ViewRun* run;
+    float* v;
+    unsigned int t;
+    int i, r, end;
 
-        switch (type)
+    clear_bbox(&vol->bbox);
+    for (face = (Face*)vol->faces.head; face != NULL; face = (Face*)face->hdr.next)
+    {
+        for (i = 0; i < face->n_view; i++)
         {
-        case EDGE_ARC:
-            ae = (ArcEdge*)obj;
-            clear_move_copy_flags((Object*)ae->centre);
-            clear_move_copy_flags((Object*)&ae->normal.refpt);
-            break;
-
-        case EDGE_BEZIER:
-            be = (BezierEdge*)obj;
-            clear_move_copy_flags((Object*)be->ctrlpoints[0]);
-            clear_move_copy_flags((Object*)be->ctrlpoints[1]);
-            break;
+            transform_coord(m, &face->view_x[i], &face->view_y[i], &face->view_z[i]);
+            expand_bbox_coords(&vol->bbox, face->view_x[i], face->view_y[i], face->view_z[i]);
         }
-        break;
 
-    case OBJ_FACE:
-        face = (Face*)obj;
-        for (i = 0; i < face->n_edges; i++)
+        transform_dirn(m, &face->normal.A, &face->normal.B, &face->normal.C);
+        for (i = 0; i < face->n_local; i++)
+            transform_dirn(m, &face->local_norm[i].A, &face->local_norm[i].B, &face->local_norm[i].C);
+        for (r = 0; r < face->n_view_runs; r++)
         {
-            edge = face->edges[i];
-            clear_move_copy_flags((Object*)edge);
+            run = &face->view_runs[r];
+            if (run->flag == FLAG_NEW_FACET)
+                transform_dirn(m, &run->A, &run->B, &run->C);
+            if (reflect)
+            {
+                end = r + 1 < face->n_view_runs ? face->view_runs[r + 1].first : face->n_view;
+                reverse_view_run(face, run->first, end);
+            }
         }
-        for (p = (Point*)face->view_list.head; p != NULL; p = (Point*)p->hdr.next)
-            clear_move_copy_flags((Object*)p);
-        if (face->text != NULL)             // and the text positions
+
+        if (face->tri_valid)
         {
-            clear_move_copy_flags((Object*)&face->text->origin);
-            clear_move_copy_flags((Object*)&face->text->endpt);
+            for (i = 0; i < face->n_tri_verts; i++)
+            {
+                v = &face->tri_verts[i * 6];
+                transform_coord(m, &v[0], &v[1], &v[2]);
+                transform_dirn(m, &v[3], &v[4], &v[5]);
+            }
+            if (reflect)
+            {
+                for (i = 0; i < face->n_tri_index; i += 3)
+                {
+                    t = face->tri_index[i + 1];
+                    face->tri_index[i + 1] = face->tri_index[i + 2];
+                    face->tri_index[i + 2] = t;
+                }
+            }
         }
 
-        obj->copied_to = NULL;
-        break;
+        update_view_list_2D(face);
+        face->view_valid = TRUE;
+    }
+    vol->bbox.xc = (vol->bbox.xmin + vol->bbox.xmax) / 2;
+    vol->bbox.yc = (vol->bbox.ymin + vol->bbox.ymax) / 2;
+    vol->bbox.zc = (vol->bbox.zmin + vol->bbox.zmax) / 2;
+
+    // The face boxes will need refitting before the next pick
+    invalidate_bvh(vol);
+
+    // A mesh that is not up to date will be regenerated from the view lists anyway
+    if (vol->mesh != NULL && vol->mesh_valid)
+        mesh_transform(vol->mesh, m, reflect);
+
+    vol->views_moved = TRUE;
+    vol->mesh_moved = TRUE;
+}
+
+// Instances hold their transform as a 3x4 matrix too, applied after the source's own
+// geometry. Find the first point of an instance's source, to tell whether the source
+// has already been moved by the current operation (mesh-only volumes have none).
+static Point*
+source_first_point(Object* obj)
+{
+    Face* face;
+    Object* o;
+    Point* p;
+
+    switch (obj->type)
+    {
+    case OBJ_POINT:
+        return (Point*)obj;
+
+    case OBJ_EDGE:
+        return ((Edge*)obj)->endpoints[0];
+
+    case OBJ_FACE:
+        face = (Face*)obj;
+        return face->n_edges > 0 ? face->edges[0]->endpoints[0] : NULL;
 
     case OBJ_VOLUME:
-        vol = (Volume*)obj;
-        for (face = (Face*)vol->faces.head; face != NULL; face = (Face*)face->hdr.next)
-            clear_move_copy_flags((Object*)face);
-        obj->copied_to = NULL;
-        break;
+        face = (Face*)((Volume*)obj)->faces.head;
+        return face != NULL ? source_first_point((Object*)face) : NULL;
 
     case OBJ_GROUP:
-        grp = (Group*)obj;
-        for (o = grp->obj_list.head; o != NULL; o = o->next)
-            clear_move_copy_flags(o);
-        obj->copied_to = NULL;
+        for (o = ((Group*)obj)->obj_list.head; o != NULL; o = o->next)
+        {
+            if (o->type == OBJ_INSTANCE)
+                continue;
+            p = source_first_point(o);
+            if (p != NULL)
+                return p;
+        }
         break;
     }
+    return NULL;
+}
+
+// Apply a rigid transform m to an instance. Normally the instance's transform
+// becomes m.X, but if the source has been moved along with it (they are both in
+// a group being moved, say) the source carries the instance with it already,
+// so the transform becomes m.X.m^-1 instead.
+static void
+transform_instance(Instance* inst, double m[12])
+{
+    double x[12], inv[12];
+    Point* p;
+    int i, j;
+
+    p = inst->source != NULL ? source_first_point(inst->source) : NULL;
+    if (p != NULL && IS_MOVED(p))
+    {
+        // Invert m. Its linear part is orthogonal, so use the transpose.
+        for (i = 0; i < 3; i++)
+        {
+            for (j = 0; j < 3; j++)
+                inv[i * 4 + j] = m[j * 4 + i];
+            inv[i * 4 + 3] = -(m[i] * m[3] + m[4 + i] * m[7] + m[8 + i] * m[11]);
+        }
+        for (i = 0; i < 3; i++)
+        {
+            for (j = 0; j < 4; j++)
+            {
+                x[i * 4 + j] = inst->xform[i * 4] * inv[j]
+                    + inst->xform[i * 4 + 1] * inv[4 + j]
+                    + inst->xform[i * 4 + 2] * inv[8 + j];
+            }
+            x[i * 4 + 3] += inst->xform[i * 4 + 3];
+        }
+    }
+    else
+    {
+        memcpy(x, inst->xform, 12 * sizeof(double));
+    }
+
+    for (i = 0; i < 3; i++)
+    {
+        for (j = 0; j < 4; j++)
+            inst->xform[i * 4 + j] = m[i * 4] * x[j] + m[i * 4 + 1] * x[4 + j] + m[i * 4 + 2] * x[8 + j];
+        inst->xform[i * 4 + 3] += m[i * 4 + 3];
+    }
+
+    update_instance_bbox(inst);
+    inst->mesh_valid = FALSE;
 }
 
 // Copy any object, with an offset on all its point coordinates. Optionally if cloning,
@@ -111,38 +326,44 @@ copy_obj(Object* obj, float xoffset, float yoffset, float zoffset, BOOL cloning)
     Volume* vol, * new_vol;
     Object* o;
     Group* grp, * new_grp;
+    Instance* inst, * new_inst;
+    Object** members;
+    int n;
+    double d[3] = { xoffset, yoffset, zoffset };
 
     switch (obj->type)
     {
     case OBJ_POINT:
         p = (Point*)obj;
-        if (obj->copied_to != NULL)
+        if (COPIED_TO(obj) != NULL)
         {
-            new_obj = obj->copied_to;
+            new_obj = COPIED_TO(obj);
         }
         else
         {
             new_obj = (Object*)point_new(p->x + xoffset, p->y + yoffset, p->z + zoffset);
             new_obj->lock = obj->lock;
-            obj->copied_to = new_obj;
+            SET_COPIED_TO(obj, new_obj);
         }
         break;
 
     case OBJ_EDGE:
-        if (obj->copied_to != NULL)
+        if (COPIED_TO(obj) != NULL)
         {
-            new_obj = obj->copied_to;
+            new_obj = COPIED_TO(obj);
         }
         else
         {
             // Copy the edge.
             new_obj = (Object*)edge_new(((Edge*)obj)->type);
             new_obj->lock = obj->lock;
-            obj->copied_to = new_obj;
+            new_obj->show_dims = obj->show_dims;
+            SET_COPIED_TO(obj, new_obj);
 
             // Copy the points
             edge = (Edge*)obj;
             new_edge = (Edge*)new_obj;
+            new_edge->corner = edge->corner;
             new_edge->endpoints[0] = (Point*)copy_obj((Object*)edge->endpoints[0], xoffset, yoffset, zoffset, cloning);
             new_edge->endpoints[1] = (Point*)copy_obj((Object*)edge->endpoints[1], xoffset, yoffset, zoffset, cloning);
             type = ((Edge*)obj)->type & ~EDGE_CONSTRUCTION;
@@ -154,6 +375,7 @@ copy_obj(Object* obj, float xoffset, float yoffset, float zoffset, BOOL cloning)
                 nae->centre = (Point*)copy_obj((Object*)ae->centre, xoffset, yoffset, zoffset, cloning);
                 nae->clockwise = ae->clockwise;
                 nae->normal = ae->normal;
+                nae->ecc = ae->ecc;
                 move_obj((Object *)&nae->normal.refpt, xoffset, yoffset, zoffset);
                 new_edge->nsteps = edge->nsteps;
                 if (cloning)
@@ -184,6 +406,7 @@ copy_obj(Object* obj, float xoffset, float yoffset, float zoffset, BOOL cloning)
         new_face = face_new(face->type, face->normal);
         new_obj = (Object*)new_face;
         new_obj->lock = obj->lock;
+        new_obj->show_dims = obj->show_dims;
 
         // Realloc the edge array if we need a big one
         if (face->n_edges >= new_face->max_edges)
@@ -194,7 +417,8 @@ copy_obj(Object* obj, float xoffset, float yoffset, float zoffset, BOOL cloning)
         new_face->n_edges = face->n_edges;
         new_face->paired = face->paired;
         new_face->extrude_height = face->extrude_height;
-
+        new_face->corner = face->corner;
+        new_face->has_corners = face->has_corners;
 
         // Alloc and copy any contour array. Don't worry about the power of 2 thing as it will
         // not be extended again.
@@ -205,6 +429,19 @@ copy_obj(Object* obj, float xoffset, float yoffset, float zoffset, BOOL cloning)
             memcpy(new_face->contours, face->contours, face->n_contours * sizeof(Contour));
         }
 
+        // Copy any text, moving its reference points along with the face
+        if (face->text != NULL)
+        {
+            new_face->text = malloc(sizeof(Text));
+            memcpy(new_face->text, face->text, sizeof(Text));
+            new_face->text->origin.x += xoffset;
+            new_face->text->origin.y += yoffset;
+            new_face->text->origin.z += zoffset;
+            new_face->text->endpt.x += xoffset;
+            new_face->text->endpt.y += yoffset;
+            new_face->text->endpt.z += zoffset;
+        }
+
         // Copy the edges
         for (i = 0; i < face->n_edges; i++)
         {
@@ -232,6 +469,7 @@ copy_obj(Object* obj, float xoffset, float yoffset, float zoffset, BOOL cloning)
         new_vol = vol_new();
         new_obj = (Object*)new_vol;
         new_obj->lock = obj->lock;
+        SET_COPIED_TO(obj, new_obj);       // so instances of it can follow it
         for (face = (Face*)vol->faces.head; face != NULL; face = (Face*)face->hdr.next)
         {
             new_face = (Face*)copy_obj((Object*)face, xoffset, yoffset, zoffset, cloning);
@@ -242,19 +480,42 @@ copy_obj(Object* obj, float xoffset, float yoffset, float zoffset, BOOL cloning)
         new_vol->material = vol->material;
         new_vol->measured = vol->measured;
         new_vol->max_facetype = vol->max_facetype;
+        if (vol->mesh_only)
+        {
+            new_vol->mesh = mesh_copy(vol->mesh);
+            new_vol->mesh_valid = TRUE;
+            new_vol->mesh_only = TRUE;
+            new_vol->bbox = vol->bbox;
+            move_mesh_volume(new_vol, xoffset, yoffset, zoffset);
+        }
         break;
 
     case OBJ_GROUP:
         grp = (Group*)obj;
         new_grp = group_new();
-        for (o = grp->obj_list.head; o != NULL; o = o->next)
+
+        // Copy instances last, so their sources have been copied, but keep the order.
+        for (n = 0, o = grp->obj_list.head; o != NULL; o = o->next)
+            n++;
+        members = malloc(n * sizeof(Object*));
+        for (i = 0, o = grp->obj_list.head; o != NULL; o = o->next, i++)
+        {
+            if (o->type != OBJ_INSTANCE)
+                members[i] = copy_obj(o, xoffset, yoffset, zoffset, cloning);
+        }
+        for (i = 0, o = grp->obj_list.head; o != NULL; o = o->next, i++)
         {
-            new_obj = copy_obj(o, xoffset, yoffset, zoffset, cloning);
-            link_tail_group(new_obj, new_grp);
+            if (o->type == OBJ_INSTANCE)
+                members[i] = copy_obj(o, xoffset, yoffset, zoffset, cloning);
         }
+        for (i = 0; i < n; i++)
+            link_tail_group(members[i], new_grp);
+        free(members);
         new_obj = (Object*)new_grp;
         new_obj->lock = obj->lock;
+        SET_COPIED_TO(obj, new_obj);
         new_grp->op = grp->op;
+        strcpy_s(new_grp->title, 256, grp->title);
         if (grp->loft != NULL)
         {
             size_t loft_size = sizeof(LoftParams) + grp->loft->n_bays * sizeof(float);
@@ -263,6 +524,34 @@ copy_obj(Object* obj, float xoffset, float yoffset, float zoffset, BOOL cloning)
             memcpy_s(new_grp->loft, loft_size, grp->loft, loft_size);
         }
         break;
+
+    case OBJ_INSTANCE:
+        // If the source has been copied too, the copy is an instance of the copied
+        // source. The source copy is already offset, so compensate for it.
+        inst = (Instance*)obj;
+        if (inst->source != NULL && COPIED_TO(inst->source) != NULL)
+        {
+            new_inst = instance_new(COPIED_TO(inst->source));
+            memcpy(new_inst->xform, inst->xform, 12 * sizeof(double));
+            for (i = 0; i < 3; i++)
+            {
+                new_inst->xform[i * 4 + 3] += d[i]
+                    - (inst->xform[i * 4] * d[0] + inst->xform[i * 4 + 1] * d[1] + inst->xform[i * 4 + 2] * d[2]);
+            }
+        }
+        else
+        {
+            new_inst = instance_new(inst->source);
+            new_inst->source_id = inst->source_id;
+            memcpy(new_inst->xform, inst->xform, 12 * sizeof(double));
+            for (i = 0; i < 3; i++)
+                new_inst->xform[i * 4 + 3] += d[i];
+        }
+        new_obj = (Object*)new_inst;
+        new_obj->lock = obj->lock;
+        new_inst->op = inst->op;
+        update_instance_bbox(new_inst);
+        break;
     }
 
     return new_obj;
@@ -398,17 +687,18 @@ move_obj(Object* obj, float xoffset, float yoffset, float zoffset)
     Volume* vol;
     Group* grp;
     Object* o;
+    BOOL keep_views;
 
     switch (obj->type)
     {
     case OBJ_POINT:
         p = (Point*)obj;
-        if (!p->moved)
+        if (!IS_MOVED(p))
         {
             p->x += xoffset;
             p->y += yoffset;
             p->z += zoffset;
-            p->moved = TRUE;
+            SET_MOVED(p);
         }
         break;
 
@@ -459,14 +749,39 @@ move_obj(Object* obj, float xoffset, float yoffset, float zoffset)
 
     case OBJ_VOLUME:
         vol = (Volume*)obj;
+        if (vol->mesh_only)
+            move_mesh_volume(vol, xoffset, yoffset, zoffset);
+        keep_views = views_transformable(vol);
         for (face = (Face*)vol->faces.head; face != NULL; face = (Face*)face->hdr.next)
             move_obj((Object*)face, xoffset, yoffset, zoffset);
+        if (keep_views)
+        {
+            double m[12] = { 1, 0, 0, xoffset, 0, 1, 0, yoffset, 0, 0, 1, zoffset };
+
+            transform_volume_views(vol, m, FALSE);
+        }
         break;
 
     case OBJ_GROUP:
         grp = (Group*)obj;
         for (o = grp->obj_list.head; o != NULL; o = o->next)
-            move_obj(o, xoffset, yoffset, zoffset);
+        {
+            if (o->type != OBJ_INSTANCE)
+                move_obj(o, xoffset, yoffset, zoffset);
+        }
+        for (o = grp->obj_list.head; o != NULL; o = o->next)
+        {
+            if (o->type == OBJ_INSTANCE)
+                move_obj(o, xoffset, yoffset, zoffset);
+        }
+        break;
+
+    case OBJ_INSTANCE:
+        {
+            double m[12] = { 1, 0, 0, xoffset, 0, 1, 0, yoffset, 0, 0, 1, zoffset };
+
+            transform_instance((Instance*)obj, m);
+        }
         break;
     }
 }
@@ -661,6 +976,12 @@ find_obj_pivot(Object* obj, float* x, float* y, float* z)
         *y = grp->bbox.yc;
         *z = grp->bbox.zc;
         break;
+
+    case OBJ_INSTANCE:
+        *x = ((Instance*)obj)->bbox.xc;
+        *y = ((Instance*)obj)->bbox.yc;
+        *z = ((Instance*)obj)->bbox.zc;
+        break;
     }
 }
 
@@ -739,15 +1060,18 @@ rotate_obj_90_facing(Object* obj, float xc, float yc, float zc)
     Volume* vol;
     Group* grp;
     Object* o;
+    float axes[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+    double m[12];
+    BOOL keep_views;
 
     switch (obj->type)
     {
     case OBJ_POINT:
         p = (Point*)obj;
-        if (!p->moved)
+        if (!IS_MOVED(p))
         {
             rotate_coord_90_facing(&p->x, &p->y, &p->z, xc, yc, zc);
-            p->moved = TRUE;
+            SET_MOVED(p);
         }
         break;
 
@@ -760,7 +1084,7 @@ rotate_obj_90_facing(Object* obj, float xc, float yc, float zc)
         {
         case EDGE_ARC:
             ae = (ArcEdge*)obj;
-            if (!ae->centre->moved)     // don't do it twice
+            if (!IS_MOVED(ae->centre))     // don't do it twice
                 rotate_plane_90_facing(&ae->normal);
             rotate_obj_90_facing((Object*)ae->centre, xc, yc, zc);
             rotate_obj_90_facing((Object*)&ae->normal.refpt, xc, yc, zc);
@@ -795,14 +1119,37 @@ rotate_obj_90_facing(Object* obj, float xc, float yc, float zc)
 
     case OBJ_VOLUME:
         vol = (Volume*)obj;
+        for (i = 0; i < 3; i++)
+            rotate_coord_90_facing(&axes[i][0], &axes[i][1], &axes[i][2], 0, 0, 0);
+        affine_about_centre(axes, xc, yc, zc, m);
+        if (vol->mesh_only)
+            transform_mesh_volume(vol, m, FALSE);
+        keep_views = views_transformable(vol);
         for (face = (Face*)vol->faces.head; face != NULL; face = (Face*)face->hdr.next)
             rotate_obj_90_facing((Object*)face, xc, yc, zc);
+        if (keep_views)
+            transform_volume_views(vol, m, FALSE);
         break;
 
     case OBJ_GROUP:
         grp = (Group*)obj;
         for (o = grp->obj_list.head; o != NULL; o = o->next)
-            rotate_obj_90_facing(o, xc, yc, zc);
+        {
+            if (o->type != OBJ_INSTANCE)
+                rotate_obj_90_facing(o, xc, yc, zc);
+        }
+        for (o = grp->obj_list.head; o != NULL; o = o->next)
+        {
+            if (o->type == OBJ_INSTANCE)
+                rotate_obj_90_facing(o, xc, yc, zc);
+        }
+        break;
+
+    case OBJ_INSTANCE:
+        for (i = 0; i < 3; i++)
+            rotate_coord_90_facing(&axes[i][0], &axes[i][1], &axes[i][2], 0, 0, 0);
+        affine_about_centre(axes, xc, yc, zc, m);
+        transform_instance((Instance*)obj, m);
         break;
     }
 }
@@ -896,15 +1243,18 @@ rotate_obj_free_facing(Object* obj, float alpha, float xc, float yc, float zc)
     Volume* vol;
     Group* grp;
     Object* o;
+    float axes[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+    double m[12];
+    BOOL keep_views;
 
     switch (obj->type)
     {
     case OBJ_POINT:
         p = (Point*)obj;
-        if (!p->moved)
+        if (!IS_MOVED(p))
         {
             rotate_coord_free_facing(&p->x, &p->y, &p->z, alpha, xc, yc, zc);
-            p->moved = TRUE;
+            SET_MOVED(p);
         }
         break;
 
@@ -917,7 +1267,7 @@ rotate_obj_free_facing(Object* obj, float alpha, float xc, float yc, float zc)
         {
         case EDGE_ARC:
             ae = (ArcEdge*)obj;
-            if (!ae->centre->moved)     // don't do it twice
+            if (!IS_MOVED(ae->centre))     // don't do it twice
                 rotate_plane_free_facing(&ae->normal, alpha);
             rotate_obj_free_facing((Object*)ae->centre, alpha, xc, yc, zc);
             rotate_obj_free_facing((Object*)&ae->normal.refpt, alpha, xc, yc, zc);
@@ -952,14 +1302,37 @@ rotate_obj_free_facing(Object* obj, float alpha, float xc, float yc, float zc)
 
     case OBJ_VOLUME:
         vol = (Volume*)obj;
+        for (i = 0; i < 3; i++)
+            rotate_coord_free_facing(&axes[i][0], &axes[i][1], &axes[i][2], alpha, 0, 0, 0);
+        affine_about_centre(axes, xc, yc, zc, m);
+        if (vol->mesh_only)
+            transform_mesh_volume(vol, m, FALSE);
+        keep_views = views_transformable(vol);
         for (face = (Face*)vol->faces.head; face != NULL; face = (Face*)face->hdr.next)
             rotate_obj_free_facing((Object*)face, alpha, xc, yc, zc);
+        if (keep_views)
+            transform_volume_views(vol, m, FALSE);
         break;
 
     case OBJ_GROUP:
         grp = (Group*)obj;
         for (o = grp->obj_list.head; o != NULL; o = o->next)
-            rotate_obj_free_facing(o, alpha, xc, yc, zc);
+        {
+            if (o->type != OBJ_INSTANCE)
+                rotate_obj_free_facing(o, alpha, xc, yc, zc);
+        }
+        for (o = grp->obj_list.head; o != NULL; o = o->next)
+        {
+            if (o->type == OBJ_INSTANCE)
+                rotate_obj_free_facing(o, alpha, xc, yc, zc);
+        }
+        break;
+
+    case OBJ_INSTANCE:
+        for (i = 0; i < 3; i++)
+            rotate_coord_free_facing(&axes[i][0], &axes[i][1], &axes[i][2], alpha, 0, 0, 0);
+        affine_about_centre(axes, xc, yc, zc, m);
+        transform_instance((Instance*)obj, m);
         break;
     }
 }
@@ -1009,6 +1382,26 @@ rotate_coord_free_abc(float* x, float* y, float* z, Plane* v1, Plane* v2)
     *z = rotate_3x3[6] * x0 + rotate_3x3[7] * y0 + rotate_3x3[8] * z0 + v2->refpt.z;
 }
 
+// Return TRUE if any face of a volume has an arc edge. Arcs are not rotated by
+// rotate_obj_free_abc, so the volume does not keep its shape and can't have its
+// view lists simply rotated along with it.
+static BOOL
+has_arc_edges(Volume* vol)
+{
+    Face* face;
+    int i;
+
+    for (face = (Face*)vol->faces.head; face != NULL; face = (Face*)face->hdr.next)
+    {
+        for (i = 0; i < face->n_edges; i++)
+        {
+            if ((face->edges[i]->type & ~EDGE_CONSTRUCTION) == EDGE_ARC)
+                return TRUE;
+        }
+    }
+    return FALSE;
+}
+
 // Rotate any object by the angle between two Planes in 3D; i.e. taking v1 onto v2.
 // They must not be at 180 degrees. Small (<90) angles preferred. 
 // The centre of rotation is the refpt of v2.
@@ -1025,6 +1418,9 @@ rotate_obj_free_abc(Object* obj, Plane* v1, Plane* v2)
     Volume* vol;
     Group* grp;
     Object* o;
+    float axes[3][3];
+    double m[12];
+    BOOL keep_views;
 
     if (!rotate_3x3_valid)
     {
@@ -1036,10 +1432,10 @@ rotate_obj_free_abc(Object* obj, Plane* v1, Plane* v2)
     {
     case OBJ_POINT:
         p = (Point*)obj;
-        if (!p->moved)
+        if (!IS_MOVED(p))
         {
             rotate_coord_free_abc(&p->x, &p->y, &p->z, v1, v2);
-            p->moved = TRUE;
+            SET_MOVED(p);
         }
         break;
 
@@ -1053,7 +1449,7 @@ rotate_obj_free_abc(Object* obj, Plane* v1, Plane* v2)
         case EDGE_ARC:
 #if 0 // not supported in tubing
             ae = (ArcEdge*)obj;
-            if (!ae->centre->moved)     // don't do it twice
+            if (!IS_MOVED(ae->centre))     // don't do it twice
                 rotate_plane_free_abc(&ae->normal, v1, v2);
             rotate_obj_free_abc((Object*)ae->centre, v1, v2);
             rotate_obj_free_abc((Object*)&ae->normal.refpt, v1, v2);
@@ -1089,14 +1485,45 @@ rotate_obj_free_abc(Object* obj, Plane* v1, Plane* v2)
 
     case OBJ_VOLUME:
         vol = (Volume*)obj;
+        for (i = 0; i < 3; i++)
+        {
+            axes[i][0] = rotate_3x3[i];
+            axes[i][1] = rotate_3x3[3 + i];
+            axes[i][2] = rotate_3x3[6 + i];
+        }
+        affine_about_centre(axes, v2->refpt.x, v2->refpt.y, v2->refpt.z, m);
+        if (vol->mesh_only)
+            transform_mesh_volume(vol, m, FALSE);
+        keep_views = views_transformable(vol) && !has_arc_edges(vol);
         for (face = (Face*)vol->faces.head; face != NULL; face = (Face*)face->hdr.next)
             rotate_obj_free_abc((Object*)face, v1, v2);
+        if (keep_views)
+            transform_volume_views(vol, m, FALSE);
         break;
 
     case OBJ_GROUP:
         grp = (Group*)obj;
         for (o = grp->obj_list.head; o != NULL; o = o->next)
-            rotate_obj_free_abc(o, v1, v2);
+        {
+            if (o->type != OBJ_INSTANCE)
+                rotate_obj_free_abc(o, v1, v2);
+        }
+        for (o = grp->obj_list.head; o != NULL; o = o->next)
+        {
+            if (o->type == OBJ_INSTANCE)
+                rotate_obj_free_abc(o, v1, v2);
+        }
+        break;
+
+    case OBJ_INSTANCE:
+        for (i = 0; i < 3; i++)
+        {
+            axes[i][0] = rotate_3x3[i];
+            axes[i][1] = rotate_3x3[3 + i];
+            axes[i][2] = rotate_3x3[6 + i];
+        }
+        affine_about_centre(axes, v2->refpt.x, v2->refpt.y, v2->refpt.z, m);
+        transform_instance((Instance*)obj, m);
         break;
     }
 }
@@ -1119,7 +1546,7 @@ scale_coord_free(float* x, float* y, float* z, float sx, float sy, float sz, flo
     *z = (*z - zc) * sz + zc;
 }
 
-// Scale an object.
+// Scale an object. Instances only take rigid transforms, so they are left alone.
 void
 scale_obj_free(Object* obj, float sx, float sy, float sz, float xc, float yc, float zc)
 {
@@ -1138,10 +1565,10 @@ scale_obj_free(Object* obj, float sx, float sy, float sz, float xc, float yc, fl
     {
     case OBJ_POINT:
         p = (Point*)obj;
-        if (!p->moved)
+        if (!IS_MOVED(p))
         {
             scale_coord_free(&p->x, &p->y, &p->z, sx, sy, sz, xc, yc, zc);
-            p->moved = TRUE;
+            SET_MOVED(p);
         }
         break;
 
@@ -1187,6 +1614,7 @@ scale_obj_free(Object* obj, float sx, float sy, float sz, float xc, float yc, fl
 
     case OBJ_VOLUME:
         vol = (Volume*)obj;
+        expand_mesh_volume(vol);
         for (face = (Face*)vol->faces.head; face != NULL; face = (Face*)face->hdr.next)
             scale_obj_free((Object*)face, sx, sy, sz, xc, yc, zc);
         break;
@@ -1269,16 +1697,19 @@ reflect_obj_facing(Object* obj, float xc, float yc, float zc)
     Volume* vol;
     Group* grp;
     Object* o;
+    float axes[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+    double m[12];
+    BOOL keep_views;
     Point** ipts = NULL;
 
     switch (obj->type)
     {
     case OBJ_POINT:
         p = (Point*)obj;
-        if (!p->moved)
+        if (!IS_MOVED(p))
         {
             reflect_coord_facing(&p->x, &p->y, &p->z, xc, yc, zc);
-            p->moved = TRUE;
+            SET_MOVED(p);
         }
         break;
 
@@ -1291,7 +1722,7 @@ reflect_obj_facing(Object* obj, float xc, float yc, float zc)
         {
         case EDGE_ARC:
             ae = (ArcEdge*)obj;
-            if (!ae->centre->moved)             // don't do these things twice
+            if (!IS_MOVED(ae->centre))             // don't do these things twice
             {
                 reflect_plane_facing(&ae->normal);
                 ae->clockwise = !ae->clockwise;     // keep the sense of the arc when reflected
@@ -1389,14 +1820,37 @@ reflect_obj_facing(Object* obj, float xc, float yc, float zc)
 
     case OBJ_VOLUME:
         vol = (Volume*)obj;
+        for (i = 0; i < 3; i++)
+            reflect_coord_facing(&axes[i][0], &axes[i][1], &axes[i][2], 0, 0, 0);
+        affine_about_centre(axes, xc, yc, zc, m);
+        if (vol->mesh_only)
+            transform_mesh_volume(vol, m, TRUE);
+        keep_views = views_transformable(vol);
         for (face = (Face*)vol->faces.head; face != NULL; face = (Face*)face->hdr.next)
             reflect_obj_facing((Object*)face, xc, yc, zc);
+        if (keep_views)
+            transform_volume_views(vol, m, TRUE);
         break;
 
     case OBJ_GROUP:
         grp = (Group*)obj;
         for (o = grp->obj_list.head; o != NULL; o = o->next)
-            reflect_obj_facing(o, xc, yc, zc);
+        {
+            if (o->type != OBJ_INSTANCE)
+                reflect_obj_facing(o, xc, yc, zc);
+        }
+        for (o = grp->obj_list.head; o != NULL; o = o->next)
+        {
+            if (o->type == OBJ_INSTANCE)
+                reflect_obj_facing(o, xc, yc, zc);
+        }
+        break;
+
+    case OBJ_INSTANCE:
+        for (i = 0; i < 3; i++)
+            reflect_coord_facing(&axes[i][0], &axes[i][1], &axes[i][2], 0, 0, 0);
+        affine_about_centre(axes, xc, yc, zc, m);
+        transform_instance((Instance*)obj, m);
         break;
     }
 }
@@ -1,5 +1,6 @@
 #include "stdafx.h"
 #include "LoftyCAD.h"
+#include <limits.h>
 
 
 // Neighbourhood functions - use for picking when dragging a 3D object.
@@ -56,6 +57,39 @@ point_in_polygon2D(Point2D P, Point2D* V, int n)
 }
 
 
+// State for searching the faces of a volume through its BVH.
+typedef struct FaceSearch
+{
+    Point   *point;         // Point or face being snapped
+    Face    *face;
+    Plane   *line;          // Pick ray, and the lock to pick with
+    LOCK    lock;
+    Object  *found;         // Whatever was found
+    float   dist;           // and its distance along the ray
+} FaceSearch;
+
+Object *find_in_neighbourhood_point(Point *point, Object *obj);
+Object *find_in_neighbourhood_face(Face *face, Object *obj);
+
+// BVH callbacks for find_in_neighbourhood on a volume. Stop at the first hit.
+static BOOL
+snap_point_to_face(Face *f, void *arg)
+{
+    FaceSearch *fs = (FaceSearch *)arg;
+
+    fs->found = find_in_neighbourhood_point(fs->point, (Object *)f);
+    return fs->found != NULL;
+}
+
+static BOOL
+snap_face_to_face(Face *f, void *arg)
+{
+    FaceSearch *fs = (FaceSearch *)arg;
+
+    fs->found = find_in_neighbourhood_face(fs->face, (Object *)f);
+    return fs->found != NULL;
+}
+
 // Helper for find_in_neighbourhood:
 // Find any snappable component in obj, within snapping distance of point.
 // obj may be a point or a straight edge.
@@ -70,6 +104,8 @@ find_in_neighbourhood_point(Point *point, Object *obj)
     Volume *vol;
     Group *group;
     Object *o;
+    FaceSearch fs;
+    Bbox box;
     int i;
 
     if (clipped(point))
@@ -145,14 +181,12 @@ find_in_neighbourhood_point(Point *point, Object *obj)
 
     case OBJ_VOLUME:
         vol = (Volume *)obj;
-        for (f = (Face *)vol->faces.head; f != NULL; f = (Face *)f->hdr.next)
-        {
-            Object *test = find_in_neighbourhood_point(point, (Object *)f);
-
-            if (test != NULL)
-                return test;
-        }
-        break;
+        fs.point = point;
+        fs.found = NULL;
+        clear_bbox(&box);
+        expand_bbox(&box, point);
+        bvh_query(volume_bvh(vol), NULL, &box, snap_point_to_face, &fs);
+        return fs.found;
 
     case OBJ_GROUP:
         group = (Group *)obj;
@@ -175,9 +209,11 @@ find_in_neighbourhood_point(Point *point, Object *obj)
 Object *
 find_in_neighbourhood_face(Face *face, Object *obj)
 {
-    Face *f, *face1;
+    Face *face1;
     Volume *vol;
     Object *o;
+    FaceSearch fs;
+    Bbox box;
     float dx, dy, dz;
     int i;
 
@@ -218,14 +254,11 @@ find_in_neighbourhood_face(Face *face, Object *obj)
 
     case OBJ_VOLUME:
         vol = (Volume *)obj;
-        for (f = (Face *)vol->faces.head; f != NULL; f = (Face *)f->hdr.next)
-        {
-            Object *test = find_in_neighbourhood_face(face, (Object *)f);
-
-            if (test != NULL)
-                return test;
-        }
-        break;
+        fs.face = face;
+        fs.found = NULL;
+        face_bbox(face, &box);
+        bvh_query(volume_bvh(vol), NULL, &box, snap_face_to_face, &fs);
+        return fs.found;
 
     case OBJ_GROUP:
         for (o = ((Group *)obj)->obj_list.head; o != NULL; o = o->next)
@@ -380,9 +413,9 @@ Object* pick_edge(Edge* e, LOCK parent_lock, Plane* line, float* dist, float bia
 Object* pick_face(Face* f, LOCK parent_lock, Plane* line, float* dist, float bias)
 {
     Point point;
-    Point* p;
     Point2D pt;
     float a, b, c;
+    int r, j, k;
 
     switch (f->type & ~FACE_CONSTRUCTION)
     {
@@ -459,21 +492,25 @@ Object* pick_face(Face* f, LOCK parent_lock, Plane* line, float* dist, float bia
         }
 
         // These faces have facets in their view lists. Test each one separately. Could be slow...
-        for (p = (Point*)f->view_list.head; p != NULL; )
+        for (r = 0; r < f->n_view_runs; r++)
         {
             Plane facet_normal;
             Point2D facet2D[5];
-
-            ASSERT(p->flags == FLAG_NEW_FACET, "Expecting a facet normal");
-            facet_normal.A = p->x;
-            facet_normal.B = p->y;
-            facet_normal.C = p->z;
-            p = (Point *)p->hdr.next;           // get first point of 4
-            facet_normal.refpt = *p;
+            ViewRun *run = &f->view_runs[r];
+
+            ASSERT(run->flag == FLAG_NEW_FACET, "Expecting a facet normal");
+            ASSERT(run->first + 4 <= f->n_view, "Facet too short");
+            facet_normal.A = run->A;
+            facet_normal.B = run->B;
+            facet_normal.C = run->C;
+            j = run->first;                     // get first point of 4
+            facet_normal.refpt.x = f->view_x[j];
+            facet_normal.refpt.y = f->view_y[j];
+            facet_normal.refpt.z = f->view_z[j];
 
             // test normal facing away first
             if (pldot(line, &facet_normal) >= 0)
-                goto next_facet;
+                continue;
 
             // test for intersection within facet
             if (intersect_line_plane(line, &facet_normal, &point) > 0)
@@ -482,56 +519,41 @@ Object* pick_face(Face* f, LOCK parent_lock, Plane* line, float* dist, float bia
                 b = fabsf(facet_normal.B);
                 c = fabsf(facet_normal.C);
 
+                for (k = 0; k < 4; k++, j++)
+                {
+                    if (c > b && c > a)
+                    {
+                        facet2D[k].x = f->view_x[j];
+                        facet2D[k].y = f->view_y[j];
+                    }
+                    else if (b > a && b > c)
+                    {
+                        facet2D[k].x = f->view_x[j];
+                        facet2D[k].y = f->view_z[j];
+                    }
+                    else
+                    {
+                        facet2D[k].x = f->view_y[j];
+                        facet2D[k].y = f->view_z[j];
+                    }
+                }
+
                 if (c > b && c > a)
                 {
                     pt.x = point.x;
                     pt.y = point.y;
-                    facet2D[0].x = p->x;
-                    facet2D[0].y = p->y;
-                    p = (Point*)p->hdr.next; 
-                    facet2D[1].x = p->x;
-                    facet2D[1].y = p->y;
-                    p = (Point*)p->hdr.next; 
-                    facet2D[2].x = p->x;
-                    facet2D[2].y = p->y;
-                    p = (Point*)p->hdr.next; 
-                    facet2D[3].x = p->x;
-                    facet2D[3].y = p->y;
                 }
                 else if (b > a && b > c)
                 {
                     pt.x = point.x;
                     pt.y = point.z;
-                    facet2D[0].x = p->x;
-                    facet2D[0].y = p->z;
-                    p = (Point*)p->hdr.next;
-                    facet2D[1].x = p->x;
-                    facet2D[1].y = p->z;
-                    p = (Point*)p->hdr.next;
-                    facet2D[2].x = p->x;
-                    facet2D[2].y = p->z;
-                    p = (Point*)p->hdr.next;
-                    facet2D[3].x = p->x;
-                    facet2D[3].y = p->z;
                 }
                 else
                 {
                     pt.x = point.y;
                     pt.y = point.z;
-                    facet2D[0].x = p->y;
-                    facet2D[0].y = p->z;
-                    p = (Point*)p->hdr.next;
-                    facet2D[1].x = p->y;
-                    facet2D[1].y = p->z;
-                    p = (Point*)p->hdr.next;
-                    facet2D[2].x = p->y;
-                    facet2D[2].y = p->z;
-                    p = (Point*)p->hdr.next;
-                    facet2D[3].x = p->y;
-                    facet2D[3].y = p->z;
                 }
 
-                p = (Point*)p->hdr.next;
                 facet2D[4] = facet2D[0];        // close the polygon
                 if (point_in_polygon2D(pt, facet2D, 4) && !clipped(&point))
                 {
@@ -539,9 +561,6 @@ Object* pick_face(Face* f, LOCK parent_lock, Plane* line, float* dist, float bia
                     return (Object*)f;
                 }
             }
-        next_facet:
-            while (p != NULL && p->flags != FLAG_NEW_FACET)
-                p = (Point*)p->hdr.next;
         }
         break;
     }
@@ -549,11 +568,125 @@ Object* pick_face(Face* f, LOCK parent_lock, Plane* line, float* dist, float bia
     return NULL;
 }
 
+// Ray pick against the triangles of a mesh-only volume, which has no faces to pick.
+typedef struct MeshPick
+{
+    Plane   *line;
+    float   dist;           // Distance along the ray to the nearest hit so far
+    BOOL    hit;
+} MeshPick;
+
+// Moller-Trumbore ray/triangle intersection.
+static void
+pick_mesh_triangle(void* arg, float x[3], float y[3], float z[3])
+{
+    MeshPick* mp = (MeshPick*)arg;
+    Plane* line = mp->line;
+    float e1x, e1y, e1z, e2x, e2y, e2z, px, py, pz, qx, qy, qz, tx, ty, tz;
+    float det, u, v, t;
+
+    e1x = x[1] - x[0];
+    e1y = y[1] - y[0];
+    e1z = z[1] - z[0];
+    e2x = x[2] - x[0];
+    e2y = y[2] - y[0];
+    e2z = z[2] - z[0];
+    cross(line->A, line->B, line->C, e2x, e2y, e2z, &px, &py, &pz);
+    det = dot(e1x, e1y, e1z, px, py, pz);
+    if (nz(det))
+        return;
+
+    tx = line->refpt.x - x[0];
+    ty = line->refpt.y - y[0];
+    tz = line->refpt.z - z[0];
+    u = dot(tx, ty, tz, px, py, pz) / det;
+    if (u < 0 || u > 1)
+        return;
+    cross(tx, ty, tz, e1x, e1y, e1z, &qx, &qy, &qz);
+    v = dot(line->A, line->B, line->C, qx, qy, qz) / det;
+    if (v < 0 || u + v > 1)
+        return;
+    t = dot(e2x, e2y, e2z, qx, qy, qz) / det;
+    if (t < 0 || (mp->hit && t >= mp->dist))
+        return;
+    if (clippedv(line->refpt.x + t * line->A, line->refpt.y + t * line->B, line->refpt.z + t * line->C))
+        return;
+
+    mp->dist = t;
+    mp->hit = TRUE;
+}
+
+// Pick a mesh-only volume. The ray direction must be normalised.
+static Object*
+pick_mesh_volume(Volume* vol, Plane* line, float* dist)
+{
+    MeshPick mp;
+
+    if (vol->mesh == NULL || !ray_hits_bbox(line, &vol->bbox))
+        return NULL;
+    mp.line = line;
+    mp.dist = LARGE_COORD;
+    mp.hit = FALSE;
+    bvh_query_tris(mesh_volume_bvh(vol), line, pick_mesh_triangle, &mp);
+    if (!mp.hit)
+        return NULL;
+
+    *dist = mp.dist;
+    return (Object*)vol;
+}
+
+// BVH callback for picking the faces of a volume. Keep the nearest hit.
+static BOOL
+pick_face_in_volume(Face *f, void *arg)
+{
+    FaceSearch *fs = (FaceSearch *)arg;
+    Object *test;
+    float dist;
+
+    test = pick_face(f, fs->lock, fs->line, &dist, 0);
+    if (test != NULL && (fs->found == NULL || dist < fs->dist))
+    {
+        fs->found = test;
+        fs->dist = dist;
+    }
+    return FALSE;
+}
+
+// Pick an instance, by taking the ray back through the instance's transform and picking
+// its source. The transform is rigid (it may reflect), so its inverse is its transpose,
+// and distances along the ray are the same. The whole instance is picked.
+static Object*
+pick_instance(Instance* inst, Plane* line, float* dist)
+{
+    double* m = inst->xform;
+    Plane local;
+    double x, y, z;
+    Object* test;
+
+    if (inst->source == NULL || !ray_hits_bbox(line, &inst->bbox))
+        return NULL;
+
+    x = line->refpt.x - m[3];
+    y = line->refpt.y - m[7];
+    z = line->refpt.z - m[11];
+    local.refpt.x = (float)(m[0] * x + m[4] * y + m[8] * z);
+    local.refpt.y = (float)(m[1] * x + m[5] * y + m[9] * z);
+    local.refpt.z = (float)(m[2] * x + m[6] * y + m[10] * z);
+    local.A = (float)(m[0] * line->A + m[4] * line->B + m[8] * line->C);
+    local.B = (float)(m[1] * line->A + m[5] * line->B + m[9] * line->C);
+    local.C = (float)(m[2] * line->A + m[6] * line->B + m[10] * line->C);
+
+    test = pick_object(inst->source, LOCK_VOLUME, &local, dist);
+    if (test == NULL)
+        return NULL;
+    return (Object*)inst;
+}
+
 Object* pick_object(Object* obj, LOCK parent_lock, Plane* line, float* dist)
 {
     Object* test = NULL;
     Object* o;
-    Face* f;
+    FaceSearch fs;
 
     switch (obj->type)
     {
@@ -570,12 +703,18 @@ Object* pick_object(Object* obj, LOCK parent_lock, Plane* line, float* dist)
         break;
 
     case OBJ_VOLUME:
-        for (f = (Face*)((Volume*)obj)->faces.head; f != NULL; f = (Face*)f->hdr.next)
+        if (((Volume*)obj)->mesh_only)
         {
-            test = pick_face(f, parent_lock, line, dist, 0);
-            if (test != NULL)
-                break;
+            test = pick_mesh_volume((Volume*)obj, line, dist);
+            break;
         }
+        fs.line = line;
+        fs.lock = parent_lock;
+        fs.found = NULL;
+        bvh_query(volume_bvh((Volume*)obj), line, NULL, pick_face_in_volume, &fs);
+        test = fs.found;
+        if (test != NULL)
+            *dist = fs.dist;
         break;
 
     case OBJ_GROUP:
@@ -586,6 +725,10 @@ Object* pick_object(Object* obj, LOCK parent_lock, Plane* line, float* dist)
                 break;
         }
         break;
+
+    case OBJ_INSTANCE:
+        test = pick_instance((Instance*)obj, line, dist);
+        break;
     }
 
     return test;
@@ -819,14 +962,14 @@ find_in_rect_point(Point* p, RECT *winrc)
 {
     GLdouble winx, winy, winz;
 
-    if (!p->win_valid)
+    if (!WIN_VALID(p))
     {
         gluProject(p->x, p->y, p->z, model, proj, viewport, &winx, &winy, &winz);
 
         // Window coordinates are bottom-up
         p->winpt.x = (int)winx;
         p->winpt.y = viewport[3] - (int)winy;
-        p->win_valid = TRUE;
+        SET_WIN_VALID(p);
     }
     if (clipped(p))
         return FALSE;   // but we will still have the winpt, in case we need it
@@ -898,6 +1041,32 @@ BOOL find_in_rect_face(Face* f, RECT* winrc)
     return FALSE;
 }
 
+// Find if any corner of a bbox is in a rect (window coordinates). Used for mesh-only
+// volumes, which have no edges to test.
+BOOL
+find_in_rect_bbox(Bbox* box, RECT* winrc)
+{
+    GLdouble winx, winy, winz;
+    POINT pt;
+    int i;
+
+    for (i = 0; i < 8; i++)
+    {
+        gluProject
+        (
+            (i & 1) ? box->xmax : box->xmin,
+            (i & 2) ? box->ymax : box->ymin,
+            (i & 4) ? box->zmax : box->zmin,
+            model, proj, viewport, &winx, &winy, &winz
+        );
+        pt.x = (int)winx;
+        pt.y = viewport[3] - (int)winy;
+        if (PtInRect(winrc, pt))
+            return TRUE;
+    }
+    return FALSE;
+}
+
 // Find if an object is within a window-coordinate rect.
 BOOL
 find_in_rect(Object* obj, RECT* winrc)
@@ -918,6 +1087,8 @@ find_in_rect(Object* obj, RECT* winrc)
         return find_in_rect_face((Face*)obj, winrc);
 
     case OBJ_VOLUME:
+        if (((Volume*)obj)->mesh_only)
+            return find_in_rect_bbox(&((Volume*)obj)->bbox, winrc);
         for (f = (Face*)((Volume*)obj)->faces.head; f != NULL; f = (Face*)f->hdr.next)
         {
             rc = find_in_rect_face(f, winrc); 
@@ -926,6 +1097,9 @@ find_in_rect(Object* obj, RECT* winrc)
         }
         break;
 
+    case OBJ_INSTANCE:
+        return find_in_rect_bbox(&((Instance*)obj)->bbox, winrc);
+
     case OBJ_GROUP:
         // TODO: Work out whether, and how, to allow selection inside unlocked groups.
         for (o = ((Group*)obj)->obj_list.head; o != NULL; o = o->next)
@@ -941,19 +1115,269 @@ find_in_rect(Object* obj, RECT* winrc)
 }
 
 
+// Screen-space grid for drag selection. Every face, edge and point of the tree is
+// projected once into window coordinates, and its window rect entered into the cells
+// of a coarse grid over the viewport. As the selection rect is dragged, only the
+// parts in the cells it covers need to be tested. The grid is rebuilt when the view
+// matrices change or the drawing is changed (see invalidate_dl).
+
+#define SCREEN_CELL     32          // Size of a grid cell in pixels
+
+// A pickable part (face, edge or point) of a top-level object, and its window rect.
+typedef struct ScreenPart
+{
+    Object  *part;
+    int     top;                    // Index of its top-level object in screen_tops
+    RECT    rc;
+} ScreenPart;
+
+static BOOL screen_grid_valid = FALSE;
+static GLdouble screen_model[16], screen_proj[16];
+static GLint screen_viewport[4];
+
+static ScreenPart *screen_parts = NULL;
+static int n_screen_parts = 0;
+static int max_screen_parts = 0;
+static Object **screen_tops = NULL;
+static int *screen_top_stamp = NULL;
+static int n_screen_tops = 0;
+static int max_screen_tops = 0;
+static int screen_stamp = 0;
+
+static int screen_nx, screen_ny;    // Grid size in cells
+static int *screen_cell_start = NULL; // Start of each cell's parts in screen_cell_parts (nx * ny + 1 of them)
+static int *screen_cell_parts = NULL;
+
+// Mark the screen grid as needing rebuilding.
+void
+invalidate_screen_grid(void)
+{
+    screen_grid_valid = FALSE;
+}
+
+// Project a point to the window, and expand a rect to include it.
+static void
+screen_expand_point(Point *p, RECT *rc)
+{
+    GLdouble winx, winy, winz;
+
+    gluProject(p->x, p->y, p->z, model, proj, viewport, &winx, &winy, &winz);
+    p->winpt.x = (int)winx;
+    p->winpt.y = viewport[3] - (int)winy;
+    SET_WIN_VALID(p);
+
+    if (p->winpt.x < rc->left)
+        rc->left = p->winpt.x;
+    if (p->winpt.x > rc->right)
+        rc->right = p->winpt.x;
+    if (p->winpt.y < rc->top)
+        rc->top = p->winpt.y;
+    if (p->winpt.y > rc->bottom)
+        rc->bottom = p->winpt.y;
+}
+
+static void
+screen_expand_edge(Edge *e, RECT *rc)
+{
+    Point *p;
+
+    screen_expand_point(e->endpoints[0], rc);
+    screen_expand_point(e->endpoints[1], rc);
+    if ((e->type == EDGE_ARC || e->type == EDGE_BEZIER) && e->view_valid)
+    {
+        for (p = (Point*)e->view_list.head; p != NULL; p = (Point*)p->hdr.next)
+            screen_expand_point(p, rc);
+    }
+}
+
+// Add a part to the list, with its window rect.
+static void
+screen_add_part(Object *part, int top)
+{
+    ScreenPart *sp;
+    Volume *vol;
+    int i;
+
+    if (n_screen_parts >= max_screen_parts)
+    {
+        max_screen_parts = max_screen_parts == 0 ? 1024 : max_screen_parts * 2;
+        screen_parts = realloc(screen_parts, max_screen_parts * sizeof(ScreenPart));
+    }
+    sp = &screen_parts[n_screen_parts++];
+    sp->part = part;
+    sp->top = top;
+    sp->rc.left = sp->rc.top = LONG_MAX;
+    sp->rc.right = sp->rc.bottom = LONG_MIN;
+
+    switch (part->type)
+    {
+    case OBJ_POINT:
+        screen_expand_point((Point*)part, &sp->rc);
+        break;
+
+    case OBJ_EDGE:
+        screen_expand_edge((Edge*)part, &sp->rc);
+        break;
+
+    case OBJ_FACE:
+        for (i = 0; i < ((Face*)part)->n_edges; i++)
+            screen_expand_edge(((Face*)part)->edges[i], &sp->rc);
+        break;
+
+    case OBJ_VOLUME:
+    case OBJ_INSTANCE:
+        // Only mesh-only volumes and instances come here. Use the corners of their bbox.
+        vol = (Volume*)part;
+        for (i = 0; i < 8; i++)
+        {
+            Point corner;
+
+            corner.x = (i & 1) ? vol->bbox.xmax : vol->bbox.xmin;
+            corner.y = (i & 2) ? vol->bbox.ymax : vol->bbox.ymin;
+            corner.z = (i & 4) ? vol->bbox.zmax : vol->bbox.zmin;
+            screen_expand_point(&corner, &sp->rc);
+        }
+        break;
+    }
+}
+
+// Add the parts of an object, under the given top-level object index.
+static void
+screen_add_object(Object *obj, int top)
+{
+    Face *f;
+    Object *o;
+
+    switch (obj->type)
+    {
+    case OBJ_POINT:
+    case OBJ_EDGE:
+    case OBJ_FACE:
+        screen_add_part(obj, top);
+        break;
+
+    case OBJ_VOLUME:
+        if (((Volume*)obj)->mesh_only)
+        {
+            screen_add_part(obj, top);
+            break;
+        }
+        for (f = (Face*)((Volume*)obj)->faces.head; f != NULL; f = (Face*)f->hdr.next)
+            screen_add_part((Object*)f, top);
+        break;
+
+    case OBJ_INSTANCE:
+        screen_add_part(obj, top);
+        break;
+
+    case OBJ_GROUP:
+        for (o = ((Group*)obj)->obj_list.head; o != NULL; o = o->next)
+            screen_add_object(o, top);
+        break;
+    }
+}
+
+// Find the range of cells covered by a rect, clamped to the grid.
+static void
+screen_cells(RECT *rc, int *i0, int *i1, int *j0, int *j1)
+{
+    *i0 = max(0, min(screen_nx - 1, rc->left / SCREEN_CELL));
+    *i1 = max(0, min(screen_nx - 1, rc->right / SCREEN_CELL));
+    *j0 = max(0, min(screen_ny - 1, rc->top / SCREEN_CELL));
+    *j1 = max(0, min(screen_ny - 1, rc->bottom / SCREEN_CELL));
+}
+
+// Rebuild the grid: project all the parts of the tree, then bin them into the cells.
+static void
+build_screen_grid(void)
+{
+    Object *obj;
+    int i, j, k, c, i0, i1, j0, j1, n_cells;
+
+    n_screen_parts = 0;
+    n_screen_tops = 0;
+    for (obj = object_tree.obj_list.head; obj != NULL; obj = obj->next)
+    {
+        if (n_screen_tops >= max_screen_tops)
+        {
+            max_screen_tops = max_screen_tops == 0 ? 256 : max_screen_tops * 2;
+            screen_tops = realloc(screen_tops, max_screen_tops * sizeof(Object *));
+            screen_top_stamp = realloc(screen_top_stamp, max_screen_tops * sizeof(int));
+        }
+        screen_tops[n_screen_tops] = obj;
+        screen_top_stamp[n_screen_tops] = 0;
+        screen_add_object(obj, n_screen_tops);
+        n_screen_tops++;
+    }
+    screen_stamp = 0;
+
+    // Count the parts in each cell, then make the count into start indices
+    screen_nx = viewport[2] / SCREEN_CELL + 1;
+    screen_ny = viewport[3] / SCREEN_CELL + 1;
+    n_cells = screen_nx * screen_ny;
+    screen_cell_start = realloc(screen_cell_start, (n_cells + 1) * sizeof(int));
+    memset(screen_cell_start, 0, (n_cells + 1) * sizeof(int));
+    for (k = 0; k < n_screen_parts; k++)
+    {
+        screen_cells(&screen_parts[k].rc, &i0, &i1, &j0, &j1);
+        for (j = j0; j <= j1; j++)
+        {
+            for (i = i0; i <= i1; i++)
+                screen_cell_start[j * screen_nx + i + 1]++;
+        }
+    }
+    for (c = 0; c < n_cells; c++)
+        screen_cell_start[c + 1] += screen_cell_start[c];
+
+    // Fill the cells, using the start indices as fill pointers (they end up
+    // shifted along by one cell, so shift them back afterwards)
+    screen_cell_parts = realloc(screen_cell_parts, (screen_cell_start[n_cells] + 1) * sizeof(int));
+    for (k = 0; k < n_screen_parts; k++)
+    {
+        screen_cells(&screen_parts[k].rc, &i0, &i1, &j0, &j1);
+        for (j = j0; j <= j1; j++)
+        {
+            for (i = i0; i <= i1; i++)
+                screen_cell_parts[screen_cell_start[j * screen_nx + i]++] = k;
+        }
+    }
+    for (c = n_cells; c > 0; c--)
+        screen_cell_start[c] = screen_cell_start[c - 1];
+    screen_cell_start[0] = 0;
+
+    memcpy(screen_model, model, sizeof(model));
+    memcpy(screen_proj, proj, sizeof(proj));
+    memcpy(screen_viewport, viewport, sizeof(viewport));
+    screen_grid_valid = TRUE;
+}
+
 // Pick all top-level objects intersecting the given rect and add them to 
 // the current selection. 
 void
 Pick_all_in_rect(GLint x_pick, GLint y_pick, GLint w_pick, GLint h_pick)
 {
     RECT winrc;
-    Object* obj;
+    ScreenPart *sp;
+    int i, j, k, c, i0, i1, j0, j1;
 
     // Get the matrices. They should not change while this pick is happening.
     glGetDoublev(GL_MODELVIEW_MATRIX, model);
     glGetDoublev(GL_PROJECTION_MATRIX, proj);
     glGetIntegerv(GL_VIEWPORT, viewport);
 
+    // If the view has changed, the window coordinates must all be found again.
+    if
+    (
+        !screen_grid_valid
+        ||
+        memcmp(model, screen_model, sizeof(model)) != 0
+        ||
+        memcmp(proj, screen_proj, sizeof(proj)) != 0
+        ||
+        memcmp(viewport, screen_viewport, sizeof(viewport)) != 0
+    )
+        build_screen_grid();
+
     // The passed in (x_pick, y_pick) is the centre of the rect. Convert it to a
     // proper RECT.
     winrc.left = x_pick - w_pick / 2;
@@ -961,12 +1385,34 @@ Pick_all_in_rect(GLint x_pick, GLint y_pick, GLint w_pick, GLint h_pick)
     winrc.top = y_pick - h_pick / 2;
     winrc.bottom = winrc.top + h_pick;
 
-    // Loop though top-level objects.
-    for (obj = object_tree.obj_list.head; obj != NULL; obj = obj->next)
+    // Test the parts in the cells the rect covers. Each top-level object is
+    // only added once (the stamp records that it has been seen this time).
+    screen_stamp++;
+    screen_cells(&winrc, &i0, &i1, &j0, &j1);
+    for (j = j0; j <= j1; j++)
     {
-        if (find_in_rect(obj, &winrc))
-            link_single(obj, &selection);
+        for (i = i0; i <= i1; i++)
+        {
+            c = j * screen_nx + i;
+            for (k = screen_cell_start[c]; k < screen_cell_start[c + 1]; k++)
+            {
+                sp = &screen_parts[screen_cell_parts[k]];
+                if (screen_top_stamp[sp->top] == screen_stamp)
+                    continue;
+                if
+                (
+                    sp->rc.right < winrc.left || sp->rc.left > winrc.right
+                    ||
+                    sp->rc.bottom < winrc.top || sp->rc.top > winrc.bottom
+                )
+                    continue;
+
+                if (find_in_rect(sp->part, &winrc))
+                {
+                    screen_top_stamp[sp->top] = screen_stamp;
+                    link_single(screen_tops[sp->top], &selection);
+                }
+            }
+        }
     }
 }
-
-
@@ -8,15 +8,197 @@ ListHead free_list_edge = { NULL, NULL };
 ListHead free_list_pt = { NULL, NULL };
 ListHead free_list_obj = { NULL, NULL };
 
-// List head for ZPolyEdge free list. Used by G-code visualisation.
-ListHead free_list_zedge = { NULL, NULL };
+// When a free list is empty, new Edges, Points and Objects are carved from slabs of
+// SLAB_OBJECTS at a time, rather than being calloc'ed one by one. Slabs are never
+// given back; everything carved from them is recycled through the free lists.
+#define SLAB_OBJECTS    4096
 
-#ifdef DEBUG_FREELISTS
-// Some counters
-int n_alloc_obj = 0;
-int n_alloc_pt = 0;
-int n_alloc_edge = 0;
-#endif
+typedef struct Arena
+{
+    char            *slab;          // The rest of the current slab
+    int             n_left;         // Number of objects left in it
+    int             size;           // Size of each object
+    AllocStats      stats;          // Allocation counts
+} Arena;
+
+static Arena arena_obj = { NULL, 0, sizeof(Object), { 0, } };
+static Arena arena_pt = { NULL, 0, sizeof(Point), { 0, } };
+static Arena arena_edge = { NULL, 0, sizeof(FreeEdge), { 0, } };
+
+// Carve a fresh (zeroed) object from an arena, starting a new slab if needed.
+static void *
+arena_new(Arena *arena)
+{
+    void *obj;
+
+    if (arena->n_left == 0)
+    {
+        arena->slab = calloc(SLAB_OBJECTS, arena->size);
+        arena->n_left = SLAB_OBJECTS;
+        arena->stats.n_slabs++;
+    }
+    obj = arena->slab;
+    arena->slab += arena->size;
+    arena->n_left--;
+    arena->stats.n_carved++;
+    return obj;
+}
+
+// Worker threads generating view lists allocate and free Points through their own free
+// list, which is topped up from the main free list (or a slab) THREAD_POINT_BATCH at a
+// time, so the lock is seldom taken. Edges are rare on workers, and just take the lock.
+// Nothing else touches the main free lists while the workers are running.
+#define THREAD_POINT_BATCH  256
+
+static CRITICAL_SECTION alloc_lock;
+static BOOL alloc_lock_valid = FALSE;
+__declspec(thread) BOOL thread_alloc = FALSE;
+__declspec(thread) ListHead thread_free_pt = { NULL, NULL };
+
+// Prepare for worker threads to allocate. Call on the main thread before starting them.
+void
+init_thread_alloc(void)
+{
+    if (!alloc_lock_valid)
+    {
+        InitializeCriticalSection(&alloc_lock);
+        alloc_lock_valid = TRUE;
+    }
+}
+
+// Start allocating through this thread's own free list. Call at the start of a worker.
+void
+begin_thread_alloc(void)
+{
+    thread_alloc = TRUE;
+}
+
+// Give this thread's free Points back to the main free list. Call at the end of a worker.
+void
+end_thread_alloc(void)
+{
+    EnterCriticalSection(&alloc_lock);
+    thread_alloc = FALSE;
+    free_point_list(&thread_free_pt);
+    LeaveCriticalSection(&alloc_lock);
+}
+
+// Lock the main free lists, if on a worker thread.
+void
+lock_thread_alloc(void)
+{
+    if (thread_alloc)
+        EnterCriticalSection(&alloc_lock);
+}
+
+void
+unlock_thread_alloc(void)
+{
+    if (thread_alloc)
+        LeaveCriticalSection(&alloc_lock);
+}
+
+// Top up this thread's free list of Points from the main free list, or a slab.
+static void
+refill_thread_points(void)
+{
+    Object *obj;
+    int i;
+
+    EnterCriticalSection(&alloc_lock);
+    for (i = 0; i < THREAD_POINT_BATCH; i++)
+    {
+        if (free_list_pt.head != NULL)
+        {
+            obj = free_list_pt.head;
+            free_list_pt.head = free_list_pt.head->next;
+            if (free_list_pt.head == NULL)
+                free_list_pt.tail = NULL;
+            arena_pt.stats.n_reused++;
+        }
+        else
+        {
+            obj = arena_new(&arena_pt);
+        }
+
+        obj->next = thread_free_pt.head;
+        if (thread_free_pt.head == NULL)
+            thread_free_pt.tail = obj;
+        thread_free_pt.head = obj;
+    }
+    LeaveCriticalSection(&alloc_lock);
+}
+
+// Count the objects sitting in a free list.
+static int
+free_list_length(ListHead *list)
+{
+    Object *obj;
+    int n = 0;
+
+    for (obj = list->head; obj != NULL; obj = obj->next)
+        n++;
+    return n;
+}
+
+// Return the allocation stats for Objects, Points or Edges (by their OBJECT type;
+// OBJ_NONE gives plain Objects). The number free is counted on demand.
+void
+get_alloc_stats(OBJECT type, AllocStats *stats)
+{
+    switch (type)
+    {
+    case OBJ_POINT:
+        *stats = arena_pt.stats;
+        stats->n_free = free_list_length(&free_list_pt);
+        stats->size = arena_pt.size;
+        break;
+    case OBJ_EDGE:
+        *stats = arena_edge.stats;
+        stats->n_free = free_list_length(&free_list_edge);
+        stats->size = arena_edge.size;
+        break;
+    default:
+        *stats = arena_obj.stats;
+        stats->n_free = free_list_length(&free_list_obj);
+        stats->size = arena_obj.size;
+        break;
+    }
+}
+
+// Zero the allocation counts, e.g. before a regeneration whose churn is to be measured.
+// The slab counts are kept, as the slabs are still there.
+void
+clear_alloc_stats(void)
+{
+    arena_obj.stats.n_carved = arena_obj.stats.n_reused = 0;
+    arena_pt.stats.n_carved = arena_pt.stats.n_reused = 0;
+    arena_edge.stats.n_carved = arena_edge.stats.n_reused = 0;
+}
+
+// Write the allocation stats to the debug log.
+void
+log_alloc_stats(void)
+{
+    static char *names[3] = { "Object", "Point", "Edge" };
+    static OBJECT types[3] = { OBJ_NONE, OBJ_POINT, OBJ_EDGE };
+    char buf[256];
+    AllocStats stats;
+    int i;
+
+    for (i = 0; i < 3; i++)
+    {
+        get_alloc_stats(types[i], &stats);
+        sprintf_s(buf, 256, "%s: %d slabs (%d KB), %d carved, %d reused, %d free\r\n",
+                  names[i],
+                  stats.n_slabs,
+                  (int)((LONGLONG)stats.n_slabs * SLAB_OBJECTS * stats.size / 1024),
+                  stats.n_carved,
+                  stats.n_reused,
+                  stats.n_free);
+        Log(buf);
+    }
+}
 
 // Creation functions for objects
 Object *obj_new(void)
@@ -31,13 +213,11 @@ Object *obj_new(void)
         if (free_list_obj.head == NULL)
             free_list_obj.tail = NULL;
         memset(obj, 0, sizeof(Object));
+        arena_obj.stats.n_reused++;
     }
     else
     {
-        obj = calloc(1, sizeof(Object));
-#ifdef DEBUG_FREELISTS
-        n_alloc_obj++;
-#endif
+        obj = arena_new(&arena_obj);
     }
 
     obj->type = OBJ_NONE;
@@ -50,6 +230,19 @@ Point* point_new_raw()
 {
     Point* pt;
 
+    // Worker threads use their own free list
+    if (thread_alloc)
+    {
+        if (thread_free_pt.head == NULL)
+            refill_thread_points();
+        pt = (Point*)thread_free_pt.head;
+        thread_free_pt.head = thread_free_pt.head->next;
+        if (thread_free_pt.head == NULL)
+            thread_free_pt.tail = NULL;
+        memset(pt, 0, sizeof(Point));
+        return pt;
+    }
+
     // Try and obtain a point from the free list first
     if (free_list_pt.head != NULL)
     {
@@ -58,13 +251,11 @@ Point* point_new_raw()
         if (free_list_pt.head == NULL)
             free_list_pt.tail = NULL;
         memset(pt, 0, sizeof(Point));
+        arena_pt.stats.n_reused++;
     }
     else
     {
-        pt = calloc(1, sizeof(Point));
-#ifdef DEBUG_FREELISTS
-        n_alloc_pt++;
-#endif
+        pt = arena_new(&arena_pt);
     }
     return pt;
 }
@@ -134,10 +325,20 @@ Point* point_newr(Point* p0, Point* p1, float ratio)
 
 // Edges. 
 Edge *edge_new(EDGE edge_type)
+{
+    Edge* e = edge_newv(edge_type);
+
+    e->hdr.ID = objid++;
+    return e;
+}
+
+// The same, but don't store or increment an objid. Used for temporary edges.
+Edge *edge_newv(EDGE edge_type)
 {
     FreeEdge* fe;
     Edge* e;
 
+    lock_thread_alloc();
     if (free_list_edge.head != NULL)
     {
         fe = (FreeEdge *)free_list_edge.head;
@@ -145,18 +346,17 @@ Edge *edge_new(EDGE edge_type)
         if (free_list_edge.head == NULL)
             free_list_edge.tail = NULL;
         memset(fe, 0, sizeof(FreeEdge));
+        arena_edge.stats.n_reused++;
     }
     else
     {
-        fe = calloc(1, sizeof(FreeEdge));
-#ifdef DEBUG_FREELISTS
-        n_alloc_edge++;
-#endif
+        fe = arena_new(&arena_edge);
     }
+    unlock_thread_alloc();
 
     e = (Edge*)fe;
     e->hdr.type = OBJ_EDGE;
-    e->hdr.ID = objid++;
+    e->hdr.ID = 0;
     e->hdr.show_dims = edge_type & EDGE_CONSTRUCTION;
     e->type = edge_type;
 
@@ -235,6 +435,130 @@ Group *group_new(void)
     return grp;
 }
 
+// Make an instance of a volume or group, with an identity transform. It takes the
+// source's op, so it adds to or subtracts from the tree in the same way.
+// The source may be NULL when reading a file; it is linked up by ID later.
+Instance *instance_new(Object *source)
+{
+    Instance *inst = calloc(1, sizeof(Instance));
+
+    ASSERT(source == NULL || source->type == OBJ_VOLUME || source->type == OBJ_GROUP, "Can only instance a volume or group");
+    inst->hdr.type = OBJ_INSTANCE;
+    inst->hdr.ID = objid++;
+    inst->hdr.lock = LOCK_VOLUME;
+    inst->source = source;
+    inst->op = OP_UNION;
+    if (source != NULL)
+    {
+        inst->source_id = source->ID;
+        inst->op = source->type == OBJ_VOLUME ? ((Volume *)source)->op : ((Group *)source)->op;
+    }
+    if (inst->op == OP_NONE)
+        inst->op = OP_UNION;
+    inst->xform[0] = 1;
+    inst->xform[5] = 1;
+    inst->xform[10] = 1;
+    update_instance_bbox(inst);
+    return inst;
+}
+
+// Find an instance's bbox by transforming the corners of its source's bbox.
+void
+update_instance_bbox(Instance *inst)
+{
+    Bbox *src;
+    double *m = inst->xform;
+    float x, y, z;
+    int i;
+
+    clear_bbox(&inst->bbox);
+    if (inst->source == NULL)
+        return;
+    src = &((Volume *)inst->source)->bbox;      // volumes and groups both have the bbox after the header
+    if (src->xmin > src->xmax)
+        return;             // the source's bbox is empty
+
+    for (i = 0; i < 8; i++)
+    {
+        x = (i & 1) ? src->xmax : src->xmin;
+        y = (i & 2) ? src->ymax : src->ymin;
+        z = (i & 4) ? src->zmax : src->zmin;
+        expand_bbox_coords
+        (
+            &inst->bbox,
+            (float)(m[0] * x + m[1] * y + m[2] * z + m[3]),
+            (float)(m[4] * x + m[5] * y + m[6] * z + m[7]),
+            (float)(m[8] * x + m[9] * y + m[10] * z + m[11])
+        );
+    }
+    inst->bbox.xc = (inst->bbox.xmin + inst->bbox.xmax) / 2;
+    inst->bbox.yc = (inst->bbox.ymin + inst->bbox.ymax) / 2;
+    inst->bbox.zc = (inst->bbox.zmin + inst->bbox.zmax) / 2;
+}
+
+// Return TRUE if an instance's transform is a reflection (it turns the source inside out).
+BOOL
+instance_reflects(Instance *inst)
+{
+    double *m = inst->xform;
+    double det =
+        m[0] * (m[5] * m[10] - m[6] * m[9])
+        - m[1] * (m[4] * m[10] - m[6] * m[8])
+        + m[2] * (m[4] * m[9] - m[5] * m[8]);
+
+    return det < 0;
+}
+
+// Find a volume or group anywhere in a tree by its ID.
+static Object *
+find_source_by_id(Group *tree, unsigned int id)
+{
+    Object *obj, *found;
+
+    for (obj = tree->obj_list.head; obj != NULL; obj = obj->next)
+    {
+        if (obj->ID == id && (obj->type == OBJ_VOLUME || obj->type == OBJ_GROUP))
+            return obj;
+        if (obj->type == OBJ_GROUP)
+        {
+            found = find_source_by_id((Group *)obj, id);
+            if (found != NULL)
+                return found;
+        }
+    }
+    return NULL;
+}
+
+// Point the instances in a tree at their sources again, by ID. This is needed after
+// reading a file, and after anything that can swap out or delete top-level objects
+// (undo/redo, deleting and ungrouping). An instance whose source has gone is left empty.
+static void
+relink_instances_in(Group *tree, Group *group)
+{
+    Object *obj;
+    Instance *inst;
+
+    for (obj = group->obj_list.head; obj != NULL; obj = obj->next)
+    {
+        if (obj->type == OBJ_GROUP)
+        {
+            relink_instances_in(tree, (Group *)obj);
+        }
+        else if (obj->type == OBJ_INSTANCE)
+        {
+            inst = (Instance *)obj;
+            inst->source = find_source_by_id(tree, inst->source_id);
+            inst->mesh_valid = FALSE;
+        }
+    }
+}
+
+void
+relink_instances(Group *tree)
+{
+    relink_instances_in(tree, tree);
+}
+
 // Test if an object is in a tree at the top level (and not a component)
 BOOL
 is_top_level_object(Object *obj, Group *tree)
@@ -343,8 +667,8 @@ find_parent_object(Group *tree, Object *obj, BOOL deep_search)
 {
     Object *top_level;
 
-    // Special case for groups and volumes, just return the object.
-    if (obj->type == OBJ_VOLUME || obj->type == OBJ_GROUP)
+    // Special case for groups, volumes and instances, just return the object.
+    if (obj->type == OBJ_VOLUME || obj->type == OBJ_GROUP || obj->type == OBJ_INSTANCE)
         return obj;
 
     // Special case for faces, as we can get to the volume quickly.
@@ -412,6 +736,7 @@ purge_obj_top(Object *obj, OBJECT top_type)
     Object *o;
     Volume *vol;
     Group *group;
+    Instance *inst;
 
     switch (obj->type)
     {
@@ -458,6 +783,10 @@ purge_obj_top(Object *obj, OBJECT top_type)
             purge_obj_top((Object *)face->edges[i], top_type);
         free(face->edges);
         free(face->view_list2D);
+        free(face->view_x);
+        free(face->view_runs);
+        free(face->tri_verts);
+        free(face->tri_index);
         if (face->contours != NULL)
             free(face->contours);
         if (face->text != NULL)
@@ -472,7 +801,11 @@ purge_obj_top(Object *obj, OBJECT top_type)
             next_face = (Face *)face->hdr.next;
             purge_obj_top((Object *)face, top_type);
         }
+        if (vol->mesh != NULL)
+            mesh_destroy(vol->mesh);
         free_bucket(vol->point_bucket);
+        free_bvh(vol->bvh);
+        free_bvh(vol->mesh_bvh);
         free(obj);
         break;
 
@@ -485,12 +818,21 @@ purge_obj_top(Object *obj, OBJECT top_type)
         }
         if (group->mesh != NULL)
             mesh_destroy(group->mesh);
+        free_stage_meshes(group);
         if (group->loft != NULL)
             free(group->loft);
         free(obj);
         if (curr_path == obj)
             curr_path = NULL;
         break;
+
+    case OBJ_INSTANCE:
+        // The source belongs to the tree, so only the instance's own mesh goes
+        inst = (Instance *)obj;
+        if (inst->mesh != NULL)
+            mesh_destroy(inst->mesh);
+        free(obj);
+        break;
     }
 }
 
@@ -501,21 +843,19 @@ purge_obj(Object *obj)
     purge_obj_top(obj, obj->type);
 }
 
-// Free the ZPolyEdges attached to their own group. They are recycled in their own
-// free list. The group is left alone to be reused.
+// Empty the G-code paths attached to their own group. The store's arrays and the
+// group are left alone to be reused.
 void
-purge_zpoly_edges(Group* group)
+purge_gcode(Group* group)
 {
-    ASSERT(group->hdr.lock == LOCK_VOLUME, "Group is not a ZPolyEdge group");
-    if (free_list_zedge.head == NULL)
-        free_list_zedge.head = group->obj_list.head;
-    else
-        free_list_zedge.tail->next = group->obj_list.head;
-    free_list_zedge.tail = group->obj_list.tail;
-
-    group->n_members = 0;
-    group->obj_list.head = NULL;
-    group->obj_list.tail = NULL;
+    ASSERT(group->hdr.lock == LOCK_VOLUME, "Group is not a G-code group");
+    if (group->gcode != NULL)
+    {
+        group->gcode->n_points = 0;
+        group->gcode->n_layers = 0;
+        group->gcode->n_ready = 0;
+    }
+    invalidate_spaghetti();
 }
 
 // Free a list of temporary edges. They and their points have ID's of zero.
@@ -589,6 +929,7 @@ purge_tree(Group *tree, BOOL preserve_objects, ListHead *saved_list)
     tree->mesh = NULL;
     tree->mesh_valid = FALSE;
     tree->mesh_complete = FALSE;
+    free_stage_meshes(tree);
 }
 
 // Can we extrude this face? Any face can be extruded, as long it has a valid normal
@@ -622,6 +963,8 @@ calc_extrude_heights(Volume* vol)
     // initially extruded. If they were not, we assume the volue is imported and
     // may not have any parallel faces (you can still extrude, but no heights will be shown)
     last_face = (Face *)vol->faces.tail;
+    if (last_face == NULL)
+        return;         // a mesh-only volume has no faces
     prev_last = (Face *)last_face->hdr.prev;
 
     // Unpair everything first
@@ -77,6 +77,10 @@ int accum_render_count(Group* tree)
                 break;
             count += accum_render_count(group);
             break;
+
+        case OBJ_INSTANCE:
+            count++;
+            break;
         }
     }
 
@@ -86,11 +90,20 @@ int accum_render_count(Group* tree)
 // How big is this file? Set up the progress bar for reading, in case it's a big one.
 void start_file_progress(FILE *f, char *header, char *filename)
 {
+    int size;
+
     fseek(f, 0, SEEK_END);
-    file_size = ftell(f);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    start_size_progress(size, header, filename);
+}
+
+// Set up the progress bar for reading a file whose size is already known (e.g. it is mapped)
+void start_size_progress(int size, char *header, char *filename)
+{
+    file_size = size;
     file_prog = 0;
     file_read = 0;
-    fseek(f, 0, SEEK_SET);
     show_status(header, filename);    // TODO: Strip directory (just show the filename) so it fits in bar
 
     // Count in MB.
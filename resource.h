@@ -369,6 +369,8 @@
 #define ID_OBJ_REMOVETUBEDGROUP         32937
 #define ID_HELP_LOFTING                 32938
 #define ID_HELP_TUBING                  32939
+#define ID_DEBUG_ALLOCSTATS             32940
+#define ID_OBJ_MAKEINSTANCE             32941
 #define IDC_STATIC                      -1
 
 // Next default values for new objects
@@ -377,7 +379,7 @@
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NO_MFC                     1
 #define _APS_NEXT_RESOURCE_VALUE        166
-#define _APS_NEXT_COMMAND_VALUE         32940
+#define _APS_NEXT_COMMAND_VALUE         32942
 #define _APS_NEXT_CONTROL_VALUE         1093
 #define _APS_NEXT_SYMED_VALUE           110
 #endif
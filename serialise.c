@@ -23,23 +23,138 @@ static unsigned int save_count = 1;
 // Marks whether a material has been written out.
 static BOOL mat_written[MAX_MATERIAL] = { 0, };
 
+// Set while writing or reading objects for the undo journal. The mesh cache belongs
+// to the real file, and is not touched by them.
+static BOOL in_checkpoint = FALSE;
+
 // Names of things that make the serialised format a little easier to read/write.
 // Agree with enums in objtree.h
 
 char* locktypes[] = { "N", "P", "E", "F", "V", "G" };
 
 #if 0
-char* objname[] = { "(none)", "POINT", "}EDGE", "}FACE", "}VOLUME", "}GROUP" };
+char* objname[] = { "(none)", "POINT", "}EDGE", "}FACE", "}VOLUME", "}GROUP", "INSTANCE" };
 char *edgetypes[] = { "STRAIGHT", "ARC", "BEZIER" };
 char *facetypes[] = { "TRI", "RECT", "HEX", "CIRCLE", "FLAT", "CYLINDRICAL", "BARREL", "BEZIER" };
 char *optypes[] = { "UNION", "INTER", "DIFF", "NONE" };
 #else // compact versions
-char* objname[] = { "(none)", "P", "}E", "}F", "}V", "}G" };
+char* objname[] = { "(none)", "P", "}E", "}F", "}V", "}G", "INST" };
 char* edgetypes[] = { "S", "ARC", "BEZ" };
 char* facetypes[] = { "T", "R", "H", "C", "F", "CYL", "BAR", "BEZ" };
 char* optypes[] = { "U", "I", "D", "N" };
 #endif
 
+// The binary format. A header, followed by the sections it counts: materials,
+// points, typed fixed-size records for everything else, then arrays of ID's (and other
+// ints) and floats that the records index into, and a string table for titles and text.
+// Points are kept together so they can be read in bulk; each record says how many of
+// them precede it, so they resolve in the same order as they would in a text file.
+#define BIN_MAGIC       "LOFTYBIN"
+#define BIN_VERSION     1
+#define BIN_TOP         0xFFFFFFFF      // Parent ID of objects linked into the tree itself
+
+// Record types that are not objects. Object records use the OBJECT type.
+#define BIN_LINK        16              // Link a point (already read) into the tree or a group
+#define BIN_TEXT        17              // Text on a face
+#define BIN_LOFT        18              // Loft parameters and bays for a group
+#define BIN_MESH        19              // Mesh of a mesh-only volume
+
+// Record flags.
+#define BIN_DIMS        1
+#define BIN_CORNER      2
+#define BIN_CLOCKWISE   4
+#define BIN_BOLD        8
+#define BIN_ITALIC      16
+
+typedef struct BinHeader
+{
+    char            magic[8];           // BIN_MAGIC (no terminator)
+    unsigned int    version;            // BIN_VERSION
+    unsigned int    max_id;             // Highest object ID in the file
+    float           half_size;          // The SCALE settings
+    float           grid_snap;
+    float           tolerance;
+    int             angle_snap;
+    float           round_rad;
+    float           default_stepsize;
+    unsigned int    title;              // String table offset of the title
+    unsigned int    n_materials;        // Sizes of the sections that follow the header
+    unsigned int    n_points;
+    unsigned int    n_records;
+    unsigned int    n_ids;
+    unsigned int    n_floats;
+    unsigned int    n_chars;
+    unsigned int    sel_start;          // Selection ID's in the ID array
+    unsigned int    n_sel;
+    unsigned int    path;               // ID of the current path, or 0
+    int             view_clipped;       // The clip plane
+    int             draw_on_clip_plane;
+    float           clip[4];
+} BinHeader;
+
+typedef struct BinMaterial
+{
+    int             index;
+    int             hidden;
+    float           color[3];
+    float           shiny;
+    unsigned int    name;               // String table offset
+} BinMaterial;
+
+typedef struct BinPoint
+{
+    unsigned int    id;
+    float           x;
+    float           y;
+    float           z;
+} BinPoint;
+
+// What goes in the fields depends on the type:
+// Edge:    subtype = edge type, ref = endpoints, then centre or control points,
+//          val = arc normal and eccentricity, n = nsteps
+// Face:    subtype = face type, ref[0] = initial point, ref[1], ref[2] = start and count of
+//          contours (3 ints each), start, n = edge ID's
+// Volume:  subtype = op, ref[0] = material, start, n = face ID's
+// Group:   subtype = op, ref[0] = title. Written before its members, which name it as parent.
+// Instance: subtype = op, ref[0] = source ID, start = transform (12 floats)
+// Link:    id = point ID
+// Text:    id = face ID, ref[0], ref[1] = string and font, start = origin, endpt and plane (9 floats)
+// Loft:    id = group ID, val = tensions, start = the 7 int parameters,
+//          ref[0], ref[1] = start and count of bay tensions
+// Mesh:    id = volume ID, ref[0], ref[1] = start and count of vertices (3 floats each),
+//          ref[2], ref[3] = start and count of triangles (3 ints each)
+typedef struct BinRecord
+{
+    unsigned short  type;               // OBJECT type or BIN_ record type
+    unsigned short  subtype;            // Edge or face type (with construction bit), or op
+    unsigned short  lock;
+    unsigned short  flags;              // BIN_ flags
+    unsigned int    id;
+    unsigned int    parent;             // Group linked into, BIN_TOP for the tree, or 0 if none
+    unsigned int    n_points;           // Number of points written before this record
+    unsigned int    ref[4];
+    unsigned int    start;
+    unsigned int    n;
+    float           val[4];
+} BinRecord;
+
+// The sections of a binary file as they are being built up for writing.
+typedef struct BinFile
+{
+    BinHeader       hdr;
+    BinMaterial     *materials;
+    BinPoint        *points;
+    int             n_points_alloc;
+    BinRecord       *records;
+    int             n_records_alloc;
+    unsigned int    *ids;
+    int             n_ids_alloc;
+    float           *floats;
+    int             n_floats_alloc;
+    char            *chars;
+    int             n_chars_alloc;
+} BinFile;
+
 #ifdef PRETTY_INDENT
 // Indent by (level * 2) spaces.
 void
@@ -54,6 +169,25 @@ indent(int level, FILE *f)
 #define INDENT(level, f)
 #endif
 
+// Write out the mesh of a mesh-only volume, as its vertices and then its triangles.
+static void
+serialise_mesh(Volume *vol, FILE *f, int level)
+{
+    float *xyz;
+    int *tri;
+    int nv, nt, i;
+
+    mesh_get_arrays(vol->mesh, &xyz, &nv, &tri, &nt);
+    INDENT(level, f);
+    fprintf_s(f, "MESH %d %d %d\n", vol->hdr.ID, nv, nt);
+    for (i = 0; i < nv; i++)
+        fprintf_s(f, "%f %f %f\n", xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2]);
+    for (i = 0; i < nt; i++)
+        fprintf_s(f, "%d %d %d\n", tri[3 * i], tri[3 * i + 1], tri[3 * i + 2]);
+    free(xyz);
+    free(tri);
+}
+
 // Serialise an object. Children go out before their parents, in general.
 void
 serialise_obj(Object *obj, FILE *f, int level)
@@ -66,6 +200,7 @@ serialise_obj(Object *obj, FILE *f, int level)
     Face *face;
     Volume *vol;
     Group *group;
+    Instance *inst;
     Object *o;
 
     // check for object already saved
@@ -132,6 +267,10 @@ serialise_obj(Object *obj, FILE *f, int level)
         for (o = group->obj_list.head; o != NULL; o = o->next)
             serialise_obj(o, f, level + 1);
         break;
+
+    case OBJ_INSTANCE:
+        // The source is found by ID when reading back, wherever it is written
+        break;
     }
 
     // Now write the object itself
@@ -272,6 +411,8 @@ serialise_obj(Object *obj, FILE *f, int level)
                 mat_written[vol->material] = TRUE;
             }
         }
+        if (vol->mesh_only)
+            serialise_mesh(vol, f, level);
         break;
 
     case OBJ_GROUP:
@@ -302,11 +443,394 @@ serialise_obj(Object *obj, FILE *f, int level)
             fprintf_s(f, "\n");
         }
         break;
+
+    case OBJ_INSTANCE:
+        inst = (Instance *)obj;
+        fprintf_s(f, "%s %d ", optypes[inst->op], inst->source_id);
+        for (i = 0; i < 12; i++)
+            fprintf_s(f, "%f ", inst->xform[i]);
+        fprintf_s(f, "\n");
+        break;
     }
 
     obj->save_count = save_count;
 }
 
+// Make room for n more elements in one of the sections of a binary file.
+static void *
+bin_grow(void *arr, unsigned int used, int *n_alloc, int n, int size)
+{
+    if (used + n > (unsigned int)*n_alloc)
+    {
+        while (used + n > (unsigned int)*n_alloc)
+            *n_alloc = *n_alloc == 0 ? 1024 : *n_alloc * 2;
+        arr = realloc(arr, *n_alloc * size);
+    }
+    return arr;
+}
+
+// Add a record, zeroed apart from its type, ID and parent.
+static BinRecord *
+bin_record(BinFile *b, int type, unsigned int id, unsigned int parent)
+{
+    BinRecord *r;
+
+    b->records = bin_grow(b->records, b->hdr.n_records, &b->n_records_alloc, 1, sizeof(BinRecord));
+    r = &b->records[b->hdr.n_records++];
+    memset(r, 0, sizeof(BinRecord));
+    r->type = type;
+    r->id = id;
+    r->parent = parent;
+    r->n_points = b->hdr.n_points;
+    return r;
+}
+
+// Append ID's (or other ints), floats or a string. Return where they start.
+static unsigned int
+bin_ids(BinFile *b, unsigned int *ids, int n)
+{
+    unsigned int start = b->hdr.n_ids;
+
+    b->ids = bin_grow(b->ids, b->hdr.n_ids, &b->n_ids_alloc, n, sizeof(unsigned int));
+    memcpy(&b->ids[start], ids, n * sizeof(unsigned int));
+    b->hdr.n_ids += n;
+    return start;
+}
+
+static unsigned int
+bin_floats(BinFile *b, float *floats, int n)
+{
+    unsigned int start = b->hdr.n_floats;
+
+    b->floats = bin_grow(b->floats, b->hdr.n_floats, &b->n_floats_alloc, n, sizeof(float));
+    memcpy(&b->floats[start], floats, n * sizeof(float));
+    b->hdr.n_floats += n;
+    return start;
+}
+
+static unsigned int
+bin_string(BinFile *b, char *str)
+{
+    unsigned int start = b->hdr.n_chars;
+    int n = strlen(str) + 1;
+
+    b->chars = bin_grow(b->chars, b->hdr.n_chars, &b->n_chars_alloc, n, 1);
+    memcpy(&b->chars[start], str, n);
+    b->hdr.n_chars += n;
+    return start;
+}
+
+// Serialise an object to the binary sections. As for the text format, children
+// go out before their parents, except for groups, whose members name them as parent.
+static void
+serialise_obj_binary(BinFile *b, Object *obj, unsigned int parent)
+{
+    int i;
+    unsigned int id, start;
+    EDGE type;
+    Point *p;
+    BinPoint *bp;
+    BinRecord *r;
+    Edge *e;
+    ArcEdge *ae;
+    BezierEdge *be;
+    Face *face;
+    Volume *vol;
+    Group *group;
+    Instance *inst;
+    Object *o;
+
+    // check for object already saved
+    if (obj->save_count == save_count)
+        return;
+
+    if (obj->ID > b->hdr.max_id)
+        b->hdr.max_id = obj->ID;
+
+    switch (obj->type)
+    {
+    case OBJ_POINT:
+        p = (Point *)obj;
+        b->points = bin_grow(b->points, b->hdr.n_points, &b->n_points_alloc, 1, sizeof(BinPoint));
+        bp = &b->points[b->hdr.n_points++];
+        bp->id = obj->ID;
+        bp->x = p->x;
+        bp->y = p->y;
+        bp->z = p->z;
+        if (parent != 0)
+            bin_record(b, BIN_LINK, obj->ID, parent);
+        break;
+
+    case OBJ_EDGE:
+        e = (Edge *)obj;
+        type = e->type & ~EDGE_CONSTRUCTION;
+        if (type == EDGE_ZPOLY)
+            return;                  // don't serialise these
+
+        serialise_obj_binary(b, (Object *)e->endpoints[0], 0);
+        serialise_obj_binary(b, (Object *)e->endpoints[1], 0);
+        switch (type)
+        {
+        case EDGE_ARC:
+            ae = (ArcEdge *)obj;
+            serialise_obj_binary(b, (Object *)ae->centre, 0);
+            break;
+
+        case EDGE_BEZIER:
+            be = (BezierEdge *)obj;
+            serialise_obj_binary(b, (Object *)be->ctrlpoints[0], 0);
+            serialise_obj_binary(b, (Object *)be->ctrlpoints[1], 0);
+            break;
+        }
+
+        r = bin_record(b, OBJ_EDGE, obj->ID, parent);
+        r->subtype = e->type;
+        r->lock = obj->lock;
+        r->flags = (obj->show_dims ? BIN_DIMS : 0) | (e->corner ? BIN_CORNER : 0);
+        r->ref[0] = e->endpoints[0]->hdr.ID;
+        r->ref[1] = e->endpoints[1]->hdr.ID;
+        r->n = e->nsteps;
+        switch (type)
+        {
+        case EDGE_ARC:
+            ae = (ArcEdge *)obj;
+            r->flags |= ae->clockwise ? BIN_CLOCKWISE : 0;
+            r->ref[2] = ae->centre->hdr.ID;
+            r->val[0] = ae->normal.A;
+            r->val[1] = ae->normal.B;
+            r->val[2] = ae->normal.C;
+            r->val[3] = ae->ecc;
+            break;
+
+        case EDGE_BEZIER:
+            be = (BezierEdge *)obj;
+            r->ref[2] = be->ctrlpoints[0]->hdr.ID;
+            r->ref[3] = be->ctrlpoints[1]->hdr.ID;
+            break;
+        }
+        break;
+
+    case OBJ_FACE:
+        face = (Face *)obj;
+        for (i = 0; i < face->n_edges; i++)
+            serialise_obj_binary(b, (Object *)face->edges[i], 0);
+
+        start = b->hdr.n_ids;
+        for (i = 0; i < face->n_edges; i++)
+            bin_ids(b, &face->edges[i]->hdr.ID, 1);
+
+        r = bin_record(b, OBJ_FACE, obj->ID, parent);
+        r->subtype = face->type;
+        r->lock = obj->lock;
+        r->flags = (obj->show_dims ? BIN_DIMS : 0) | (face->corner ? BIN_CORNER : 0);
+        r->ref[0] = face->initial_point->hdr.ID;
+        r->ref[1] = bin_ids(b, (unsigned int *)face->contours, 3 * face->n_contours);
+        r->ref[2] = face->n_contours;
+        r->start = start;
+        r->n = face->n_edges;
+
+        if (face->text != NULL)
+        {
+            Text *text = face->text;
+            float coords[9];
+
+            coords[0] = text->origin.x;
+            coords[1] = text->origin.y;
+            coords[2] = text->origin.z;
+            coords[3] = text->endpt.x;
+            coords[4] = text->endpt.y;
+            coords[5] = text->endpt.z;
+            coords[6] = text->plane.A;
+            coords[7] = text->plane.B;
+            coords[8] = text->plane.C;
+            r = bin_record(b, BIN_TEXT, obj->ID, 0);
+            r->flags = (text->bold ? BIN_BOLD : 0) | (text->italic ? BIN_ITALIC : 0);
+            r->ref[0] = bin_string(b, text->string);
+            r->ref[1] = bin_string(b, text->font);
+            r->start = bin_floats(b, coords, 9);
+        }
+        break;
+
+    case OBJ_VOLUME:
+        vol = (Volume *)obj;
+        for (face = (Face *)vol->faces.head; face != NULL; face = (Face *)face->hdr.next)
+            serialise_obj_binary(b, (Object *)face, 0);
+
+        start = b->hdr.n_ids;
+        for (face = (Face *)vol->faces.head; face != NULL; face = (Face *)face->hdr.next)
+            bin_ids(b, &face->hdr.ID, 1);
+
+        r = bin_record(b, OBJ_VOLUME, obj->ID, parent);
+        r->subtype = vol->op;
+        r->lock = obj->lock;
+        r->ref[0] = vol->material;
+        r->start = start;
+        r->n = b->hdr.n_ids - start;
+
+        if (vol->mesh_only)
+        {
+            float *xyz;
+            int *tri;
+            int nv, nt;
+
+            mesh_get_arrays(vol->mesh, &xyz, &nv, &tri, &nt);
+            r = bin_record(b, BIN_MESH, obj->ID, 0);
+            r->ref[0] = bin_floats(b, xyz, 3 * nv);
+            r->ref[1] = nv;
+            r->ref[2] = bin_ids(b, (unsigned int *)tri, 3 * nt);
+            r->ref[3] = nt;
+            free(xyz);
+            free(tri);
+        }
+        break;
+
+    case OBJ_GROUP:
+        group = (Group *)obj;
+        id = obj->ID;
+        r = bin_record(b, OBJ_GROUP, id, parent);
+        r->subtype = group->op;
+        r->lock = obj->lock;
+        r->ref[0] = bin_string(b, group->title);
+
+        for (o = group->obj_list.head; o != NULL; o = o->next)
+            serialise_obj_binary(b, o, id);
+
+        if (group->loft != NULL)
+        {
+            LoftParams* loft = group->loft;
+            unsigned int params[7];
+
+            params[0] = loft->body_angle_break;
+            params[1] = loft->nose_angle_break;
+            params[2] = loft->tail_angle_break;
+            params[3] = loft->nose_join_mode;
+            params[4] = loft->tail_join_mode;
+            params[5] = loft->follow_path;
+            params[6] = loft->key_direction;
+            r = bin_record(b, BIN_LOFT, id, 0);
+            r->val[0] = loft->nose_tension;
+            r->val[1] = loft->tail_tension;
+            r->start = bin_ids(b, params, 7);
+            r->ref[0] = bin_floats(b, loft->bay_tensions, loft->n_bays);
+            r->ref[1] = loft->n_bays;
+        }
+        break;
+
+    case OBJ_INSTANCE:
+        {
+            float xform[12];
+
+            inst = (Instance *)obj;
+            for (i = 0; i < 12; i++)
+                xform[i] = (float)inst->xform[i];
+            r = bin_record(b, OBJ_INSTANCE, obj->ID, parent);
+            r->subtype = inst->op;
+            r->lock = obj->lock;
+            r->ref[0] = inst->source_id;
+            r->start = bin_floats(b, xform, 12);
+            r->n = 12;
+        }
+        break;
+    }
+
+    obj->save_count = save_count;
+}
+
+// Write out a section of a binary file, if there's anything in it.
+static void
+bin_write(void *arr, int size, unsigned int n, FILE *f)
+{
+    if (n != 0)
+        fwrite(arr, size, n, f);
+}
+
+// Serialise an object tree to a binary file. The sections are built up in memory
+// and written out in one go.
+static void
+serialise_tree_binary(Group *tree, char *filename)
+{
+    BinFile b;
+    FILE *f;
+    Object *obj;
+    int i;
+
+    memset(&b, 0, sizeof(BinFile));
+    memcpy(b.hdr.magic, BIN_MAGIC, 8);
+    b.hdr.version = BIN_VERSION;
+    b.hdr.half_size = half_size;
+    b.hdr.grid_snap = grid_snap;
+    b.hdr.tolerance = tolerance;
+    b.hdr.angle_snap = angle_snap;
+    b.hdr.round_rad = round_rad;
+    b.hdr.default_stepsize = default_stepsize;
+    b.hdr.title = bin_string(&b, tree->title);
+
+    // Write all the materials, whether used or not (but not the default [0] material)
+    b.materials = malloc(MAX_MATERIAL * sizeof(BinMaterial));
+    for (i = 1; i < MAX_MATERIAL; i++)
+    {
+        BinMaterial *bm = &b.materials[b.hdr.n_materials];
+
+        if (!materials[i].valid)
+            continue;
+        bm->index = i;
+        bm->hidden = materials[i].hidden;
+        bm->color[0] = materials[i].color[0];
+        bm->color[1] = materials[i].color[1];
+        bm->color[2] = materials[i].color[2];
+        bm->shiny = materials[i].shiny;
+        bm->name = bin_string(&b, materials[i].name);
+        b.hdr.n_materials++;
+    }
+
+    // Write object tree
+    show_status("Writing ", filename);
+    set_progress_range(tree->n_members);
+    save_count++;
+    for (obj = tree->obj_list.head; obj != NULL; obj = obj->next)
+    {
+        bump_progress();
+        serialise_obj_binary(&b, obj, BIN_TOP);
+    }
+
+    // Selection, current path and any clip, whether in effect or not.
+    b.hdr.sel_start = b.hdr.n_ids;
+    for (obj = selection.head; obj != NULL; obj = obj->next)
+    {
+        bin_ids(&b, &obj->prev->ID, 1);
+        b.hdr.n_sel++;
+    }
+    if (curr_path != NULL)
+        b.hdr.path = curr_path->ID;
+    b.hdr.view_clipped = view_clipped;
+    b.hdr.draw_on_clip_plane = draw_on_clip_plane;
+    b.hdr.clip[0] = clip_plane.A;
+    b.hdr.clip[1] = clip_plane.B;
+    b.hdr.clip[2] = clip_plane.C;
+    b.hdr.clip[3] = clip_plane.D;
+
+    fopen_s(&f, filename, "wb");
+    if (f != NULL)
+    {
+        fwrite(&b.hdr, sizeof(BinHeader), 1, f);
+        bin_write(b.materials, sizeof(BinMaterial), b.hdr.n_materials, f);
+        bin_write(b.points, sizeof(BinPoint), b.hdr.n_points, f);
+        bin_write(b.records, sizeof(BinRecord), b.hdr.n_records, f);
+        bin_write(b.ids, sizeof(unsigned int), b.hdr.n_ids, f);
+        bin_write(b.floats, sizeof(float), b.hdr.n_floats, f);
+        bin_write(b.chars, 1, b.hdr.n_chars, f);
+        fclose(f);
+    }
+
+    clear_status_and_progress();
+    free(b.materials);
+    free(b.points);
+    free(b.records);
+    free(b.ids);
+    free(b.floats);
+    free(b.chars);
+}
+
 // Serialise an object tree to a file.
 void
 serialise_tree(Group *tree, char *filename)
@@ -315,6 +839,13 @@ serialise_tree(Group *tree, char *filename)
     Object *obj;
     int i, n;
 
+    if (save_binary && tree == &object_tree && !in_checkpoint)
+    {
+        serialise_tree_binary(tree, filename);
+        mesh_cache_save(tree, filename);
+        return;
+    }
+
     // Write header
     fopen_s(&f, filename, "wt");
     fprintf_s(f, "LOFTYCAD %.1f\n", file_version);
@@ -390,6 +921,10 @@ serialise_tree(Group *tree, char *filename)
 
     clear_status_and_progress();
     fclose(f);
+
+    // Save the meshes along with the file, so they can be picked up when it is reopened.
+    if (tree == &object_tree && !in_checkpoint)
+        mesh_cache_save(tree, filename);
 }
 
 // Check obj array size and grow if necessary (process for each obj type read in)
@@ -488,6 +1023,578 @@ subtype_of(char* tok, char* match, BOOL *constr, BOOL *dims)
 }
 
 
+// Work out the offsets to be added to object ID's and materials read from a file.
+// If we're importing to a group, we need to avoid ID conflicts on objects and materials.
+// Objects read back from the undo journal already use the tree's materials.
+static void
+get_import_offsets(BOOL importing, int *id_offset, int *mat_offset)
+{
+    int mat;
+
+    if (importing)
+    {
+        *id_offset = maxobjid + 1;
+        *mat_offset = 0;
+        for (mat = 0; mat < MAX_MATERIAL && !in_checkpoint; mat++)
+        {
+            if (materials[mat].valid)
+                *mat_offset = mat;
+        }
+    }
+    else
+    {
+        maxobjid = 0;
+        *id_offset = 0;
+        *mat_offset = 0;
+    }
+}
+
+// Tidy up after reading a file in either format.
+static void
+end_deserialise(Group *tree, char *filename, BOOL importing)
+{
+    objid = maxobjid + 1;
+    if (!importing)
+        save_count = 1;
+    clear_status_and_progress();
+
+    // Pick up any meshes saved with the file, and start the undo journal off.
+    if (tree == &object_tree && !importing && !in_checkpoint)
+    {
+        mesh_cache_open(filename);
+        reset_undo_journal(tree);
+    }
+}
+
+// Point the instances read from a file at their sources. Objects read back from the
+// undo journal keep the ID's of their volumes and groups instead, as instances in the
+// tree refer to them by those; the journal relinks everything once they are swapped in.
+static void
+finish_instances(Group *tree, Object **object, unsigned int n, int id_offset)
+{
+    unsigned int i;
+
+    if (!in_checkpoint)
+    {
+        relink_instances(tree);
+        return;
+    }
+    for (i = 1; i < n; i++)
+    {
+        if (object[i] != NULL && (object[i]->type == OBJ_VOLUME || object[i]->type == OBJ_GROUP))
+            object[i]->ID = i - id_offset;
+    }
+}
+
+// Look up an object by its ID in a binary file, or return NULL if it's out of range.
+static Object *
+bin_object(Object **object, BinHeader *hdr, unsigned int id)
+{
+    if (id == 0 || id > hdr->max_id)
+        return NULL;
+    return object[id];
+}
+
+// Look up a string in the string table of a binary file. Out-of-range offsets
+// give the empty string at the end of the table.
+static char *
+bin_chars(char *chars, BinHeader *hdr, unsigned int offset)
+{
+    if (offset >= hdr->n_chars)
+        offset = hdr->n_chars - 1;
+    return &chars[offset];
+}
+
+// Check that a range of ints or floats lies within its section.
+static BOOL
+bin_range(unsigned int start, unsigned int n, unsigned int size)
+{
+    return start <= size && n <= size - start;
+}
+
+// As bin_range, for n items of several ints or floats each. The count is checked
+// without multiplying it out, so it can't wrap around.
+static BOOL
+bin_range_items(unsigned int start, unsigned int n, unsigned int width, unsigned int size)
+{
+    return start <= size && n <= (size - start) / width;
+}
+
+// Look up a point by its ID in a binary file, or return NULL if it's not a point.
+static Point *
+bin_point(Object **object, BinHeader *hdr, unsigned int id)
+{
+    Object *obj = bin_object(object, hdr, id);
+
+    if (obj == NULL || obj->type != OBJ_POINT)
+        return NULL;
+    return (Point *)obj;
+}
+
+// Create points from a binary file, up to the given number.
+static void
+bin_points(BinPoint *bp, unsigned int *np, unsigned int n, Object **object, BinHeader *hdr, int id_offset)
+{
+    Point *p;
+    unsigned int start = *np;
+
+    for (; *np < n && *np < hdr->n_points; (*np)++)
+    {
+        ASSERT(bp[*np].id > 0 && bp[*np].id <= hdr->max_id, "Bad point ID");
+        if (bp[*np].id == 0 || bp[*np].id > hdr->max_id)
+            continue;
+        p = point_new(bp[*np].x, bp[*np].y, bp[*np].z);
+        p->hdr.ID = bp[*np].id + id_offset;
+        object[bp[*np].id] = (Object *)p;
+    }
+    step_file_progress((*np - start) * sizeof(BinPoint));
+}
+
+// Deserialise a tree from a binary file. The whole file is read into memory, then
+// the records are gone through, with the points before each one created first.
+static BOOL
+deserialise_binary(Group *tree, char *filename, BOOL importing)
+{
+    FILE *f;
+    char *buf, *chars;
+    long size;
+    long long expected;
+    BinHeader *hdr;
+    BinMaterial *bm;
+    BinPoint *bp;
+    BinRecord *r;
+    unsigned int *ids;
+    float *floats;
+    Object **object;
+    Object *obj;
+    int id_offset, mat_offset, mat;
+    unsigned int i, j, np;
+
+    fopen_s(&f, filename, "rb");
+    if (f == NULL)
+        return FALSE;
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(size);
+    if (buf == NULL || fread(buf, 1, size, f) != size)
+    {
+        free(buf);
+        fclose(f);
+        return FALSE;
+    }
+    fclose(f);
+
+    // Check the header and that the file is as long as it says it is.
+    hdr = (BinHeader *)buf;
+    if (size < sizeof(BinHeader) || hdr->version != BIN_VERSION || hdr->n_chars == 0)
+    {
+        free(buf);
+        return FALSE;
+    }
+    expected = sizeof(BinHeader)
+        + (long long)hdr->n_materials * sizeof(BinMaterial)
+        + (long long)hdr->n_points * sizeof(BinPoint)
+        + (long long)hdr->n_records * sizeof(BinRecord)
+        + (long long)hdr->n_ids * sizeof(unsigned int)
+        + (long long)hdr->n_floats * sizeof(float)
+        + hdr->n_chars;
+    object = (Object **)calloc((size_t)hdr->max_id + 1, sizeof(Object *));
+    if (expected > size || object == NULL)
+    {
+        free(object);
+        free(buf);
+        return FALSE;
+    }
+
+    bm = (BinMaterial *)(hdr + 1);
+    bp = (BinPoint *)(bm + hdr->n_materials);
+    r = (BinRecord *)(bp + hdr->n_points);
+    ids = (unsigned int *)(r + hdr->n_records);
+    floats = (float *)(ids + hdr->n_ids);
+    chars = (char *)(floats + hdr->n_floats);
+    chars[hdr->n_chars - 1] = '\0';
+
+    start_size_progress(size, "Reading ", filename);
+    get_import_offsets(importing, &id_offset, &mat_offset);
+    if (hdr->max_id + id_offset > maxobjid)
+        maxobjid = hdr->max_id + id_offset;
+
+    strcpy_s(tree->title, 256, bin_chars(chars, hdr, hdr->title));
+    if (!importing)      // Don't overwrite settings when importing to group
+    {
+        half_size = hdr->half_size;
+        grid_snap = hdr->grid_snap;
+        tolerance = hdr->tolerance;
+        snap_tol = 3 * tolerance;
+        chamfer_rad = 3.5f * tolerance;
+        tol_log = (int)ceilf(log10f(1.0f / tolerance));
+        angle_snap = hdr->angle_snap;
+        round_rad = hdr->round_rad;
+        default_stepsize = hdr->default_stepsize;
+    }
+
+    for (i = 0; i < hdr->n_materials; i++, bm++)
+    {
+        mat = bm->index + mat_offset;
+        if (mat <= 0 || mat >= MAX_MATERIAL || materials[mat].valid)
+            continue;
+        materials[mat].hidden = bm->hidden;
+        materials[mat].color[0] = bm->color[0];
+        materials[mat].color[1] = bm->color[1];
+        materials[mat].color[2] = bm->color[2];
+        materials[mat].shiny = bm->shiny;
+        strcpy_s(materials[mat].name, 64, bin_chars(chars, hdr, bm->name));
+        materials[mat].valid = TRUE;
+    }
+
+    np = 0;
+    for (i = 0; i < hdr->n_records; i++, r++)
+    {
+        Edge *edge;
+        ArcEdge *ae;
+        BezierEdge *be;
+        Face *face;
+        Volume *vol;
+        Group *grp;
+        Instance *inst;
+
+        step_file_progress(sizeof(BinRecord));
+        bin_points(bp, &np, r->n_points, object, hdr, id_offset);
+        ASSERT(r->id > 0 && r->id <= hdr->max_id, "Bad object ID");
+        if (r->id == 0 || r->id > hdr->max_id)
+            continue;
+
+        obj = NULL;
+        switch (r->type)
+        {
+        case OBJ_EDGE:
+            {
+                Point *end0 = bin_point(object, hdr, r->ref[0]);
+                Point *end1 = bin_point(object, hdr, r->ref[1]);
+                Point *ref2 = bin_point(object, hdr, r->ref[2]);
+                Point *ref3 = bin_point(object, hdr, r->ref[3]);
+
+                // Skip the edge if any of the points it needs are missing.
+                ASSERT(end0 != NULL && end1 != NULL, "Bad endpoint ID");
+                if (end0 == NULL || end1 == NULL)
+                    continue;
+                switch (r->subtype & ~EDGE_CONSTRUCTION)
+                {
+                case EDGE_ARC:
+                    ASSERT(ref2 != NULL, "Bad centre point ID");
+                    if (ref2 == NULL)
+                        continue;
+                    break;
+                case EDGE_BEZIER:
+                    ASSERT(ref2 != NULL && ref3 != NULL, "Bad control point ID");
+                    if (ref2 == NULL || ref3 == NULL)
+                        continue;
+                    break;
+                }
+            }
+
+            edge = edge_new(r->subtype & ~EDGE_CONSTRUCTION);
+            edge->type = r->subtype;
+            edge->corner = (r->flags & BIN_CORNER) != 0;
+            edge->nsteps = r->n;
+            edge->endpoints[0] = bin_point(object, hdr, r->ref[0]);
+            edge->endpoints[1] = bin_point(object, hdr, r->ref[1]);
+            switch (r->subtype & ~EDGE_CONSTRUCTION)
+            {
+            case EDGE_ARC:
+                ae = (ArcEdge *)edge;
+                ae->clockwise = (r->flags & BIN_CLOCKWISE) != 0;
+                ae->centre = bin_point(object, hdr, r->ref[2]);
+                ae->normal.A = r->val[0];
+                ae->normal.B = r->val[1];
+                ae->normal.C = r->val[2];
+                ae->normal.refpt = *ae->centre;
+                ae->ecc = r->val[3];
+                break;
+
+            case EDGE_BEZIER:
+                be = (BezierEdge *)edge;
+                be->ctrlpoints[0] = bin_point(object, hdr, r->ref[2]);
+                be->ctrlpoints[1] = bin_point(object, hdr, r->ref[3]);
+                break;
+            }
+            obj = (Object *)edge;
+            break;
+
+        case OBJ_FACE:
+            {
+                Plane norm = { 0, };
+
+                ASSERT(bin_range(r->start, r->n, hdr->n_ids), "Bad face edges");
+                ASSERT(bin_range_items(r->ref[1], r->ref[2], 3, hdr->n_ids), "Bad face contours");
+                ASSERT(bin_point(object, hdr, r->ref[0]) != NULL, "Bad initial point ID");
+                if
+                (
+                    !bin_range(r->start, r->n, hdr->n_ids)
+                    ||
+                    !bin_range_items(r->ref[1], r->ref[2], 3, hdr->n_ids)
+                    ||
+                    bin_point(object, hdr, r->ref[0]) == NULL
+                )
+                    continue;
+
+                face = face_new(r->subtype, norm);        // any norm will do
+                face->initial_point = bin_point(object, hdr, r->ref[0]);
+                face->corner = (r->flags & BIN_CORNER) != 0;
+
+                if (r->n > (unsigned int)face->max_edges)
+                {
+                    while (r->n > (unsigned int)face->max_edges)
+                        face->max_edges *= 2;
+                    face->edges = realloc(face->edges, face->max_edges * sizeof(Edge *));
+                }
+                for (j = 0; j < r->n; j++)
+                {
+                    edge = (Edge *)bin_object(object, hdr, ids[r->start + j]);
+                    ASSERT(edge != NULL, "Bad edge ID");
+                    if (edge == NULL)
+                        continue;
+                    face->edges[face->n_edges++] = edge;
+                    if (edge->corner)
+                        face->has_corners = TRUE;
+                }
+
+                if (r->ref[2] != 0)
+                {
+                    face->n_contours = r->ref[2];
+                    face->contours = malloc(face->n_contours * sizeof(Contour));
+                    memcpy(face->contours, &ids[r->ref[1]], face->n_contours * sizeof(Contour));
+                }
+                obj = (Object *)face;
+            }
+            break;
+
+        case OBJ_VOLUME:
+            ASSERT(bin_range(r->start, r->n, hdr->n_ids), "Bad volume faces");
+            if (!bin_range(r->start, r->n, hdr->n_ids))
+                continue;
+
+            vol = vol_new();
+            vol->op = r->subtype < OP_MAX ? r->subtype : OP_UNION;
+            if (r->ref[0] != 0)
+                vol->material = r->ref[0] + mat_offset;
+
+            // Link in the faces that make up the volume.
+            for (j = 0; j < r->n; j++)
+            {
+                face = (Face *)bin_object(object, hdr, ids[r->start + j]);
+                ASSERT(face != NULL, "Bad face ID");
+                if (face == NULL)
+                    continue;
+                face->vol = vol;
+                link_tail((Object *)face, &vol->faces);
+                if ((face->type & ~FACE_CONSTRUCTION) > vol->max_facetype)
+                    vol->max_facetype = face->type & ~FACE_CONSTRUCTION;
+            }
+
+            // Generate the bounding box and normals, then the extrude heights,
+            // so dims show on the volume
+            gen_view_list_vol(vol);
+            calc_extrude_heights(vol);
+            obj = (Object *)vol;
+            break;
+
+        case OBJ_GROUP:
+            grp = group_new();
+            strcpy_s(grp->title, 256, bin_chars(chars, hdr, r->ref[0]));
+            grp->op = r->subtype < OP_MAX ? r->subtype : OP_NONE;
+            obj = (Object *)grp;
+            break;
+
+        case OBJ_INSTANCE:
+            ASSERT(r->n == 12 && bin_range(r->start, r->n, hdr->n_floats), "Bad instance transform");
+            if (r->n != 12 || !bin_range(r->start, r->n, hdr->n_floats))
+                continue;
+
+            inst = instance_new(NULL);
+            inst->op = r->subtype < OP_MAX ? r->subtype : OP_UNION;
+            inst->source_id = r->ref[0] + (in_checkpoint ? 0 : id_offset);
+            for (j = 0; j < 12; j++)
+                inst->xform[j] = floats[r->start + j];
+            obj = (Object *)inst;
+            break;
+
+        case BIN_LINK:
+            obj = bin_object(object, hdr, r->id);
+            ASSERT(obj != NULL, "Bad point ID");
+            if (obj != NULL && r->parent == BIN_TOP)
+                link_tail_group(obj, tree);
+            else if (obj != NULL && IS_GROUP(bin_object(object, hdr, r->parent)))
+                link_tail_group(obj, (Group *)object[r->parent]);
+            continue;
+
+        case BIN_TEXT:
+            face = (Face *)bin_object(object, hdr, r->id);
+            ASSERT(face != NULL && face->hdr.type == OBJ_FACE, "Text must be on face");
+            ASSERT(bin_range(r->start, 9, hdr->n_floats), "Bad text coordinates");
+            if (face == NULL || face->hdr.type != OBJ_FACE || !bin_range(r->start, 9, hdr->n_floats))
+                continue;
+            if (face->text == NULL)
+                face->text = calloc(1, sizeof(Text));
+            face->text->origin.hdr.type = OBJ_POINT;
+            face->text->endpt.hdr.type = OBJ_POINT;
+            face->text->origin.x = floats[r->start];
+            face->text->origin.y = floats[r->start + 1];
+            face->text->origin.z = floats[r->start + 2];
+            face->text->endpt.x = floats[r->start + 3];
+            face->text->endpt.y = floats[r->start + 4];
+            face->text->endpt.z = floats[r->start + 5];
+            face->text->plane.A = floats[r->start + 6];
+            face->text->plane.B = floats[r->start + 7];
+            face->text->plane.C = floats[r->start + 8];
+            strcpy_s(face->text->string, 80, bin_chars(chars, hdr, r->ref[0]));
+            strcpy_s(face->text->font, 32, bin_chars(chars, hdr, r->ref[1]));
+            face->text->bold = (r->flags & BIN_BOLD) != 0;
+            face->text->italic = (r->flags & BIN_ITALIC) != 0;
+            continue;
+
+        case BIN_LOFT:
+            {
+                LoftParams* loft;
+                int n_bays;
+
+                grp = (Group *)bin_object(object, hdr, r->id);
+                ASSERT(IS_GROUP((Object *)grp), "Lofted object is not a group");
+                ASSERT(bin_range(r->start, 7, hdr->n_ids), "Bad loft parameters");
+                ASSERT(bin_range(r->ref[0], r->ref[1], hdr->n_floats), "Bad loft bays");
+                if (!IS_GROUP((Object *)grp) || !bin_range(r->start, 7, hdr->n_ids) || !bin_range(r->ref[0], r->ref[1], hdr->n_floats))
+                    continue;
+
+                // At least large enough for the bays
+                n_bays = max((int)r->ref[1], grp->n_members - 1);
+                grp->loft = malloc(sizeof(LoftParams) + max(n_bays - 1, 0) * sizeof(float));
+                loft = grp->loft;
+                loft->nose_tension = r->val[0];
+                loft->tail_tension = r->val[1];
+                loft->body_angle_break = ids[r->start];
+                loft->nose_angle_break = ids[r->start + 1];
+                loft->tail_angle_break = ids[r->start + 2];
+                loft->nose_join_mode = ids[r->start + 3];
+                loft->tail_join_mode = ids[r->start + 4];
+                loft->follow_path = ids[r->start + 5];
+                loft->key_direction = ids[r->start + 6];
+                loft->n_bays = r->ref[1];
+                memcpy(loft->bay_tensions, &floats[r->ref[0]], loft->n_bays * sizeof(float));
+            }
+            continue;
+
+        case BIN_MESH:
+            {
+                float *xyz;
+                int *tri;
+                int nv, nt, n_good, n_skipped;
+
+                vol = (Volume *)bin_object(object, hdr, r->id);
+                ASSERT(vol != NULL && vol->hdr.type == OBJ_VOLUME, "Mesh must be on volume");
+                ASSERT(bin_range_items(r->ref[0], r->ref[1], 3, hdr->n_floats), "Bad mesh vertices");
+                ASSERT(bin_range_items(r->ref[2], r->ref[3], 3, hdr->n_ids), "Bad mesh triangles");
+                if
+                (
+                    vol == NULL
+                    ||
+                    vol->hdr.type != OBJ_VOLUME
+                    ||
+                    !bin_range_items(r->ref[0], r->ref[1], 3, hdr->n_floats)
+                    ||
+                    !bin_range_items(r->ref[2], r->ref[3], 3, hdr->n_ids)
+                )
+                    continue;
+
+                // The arrays are used in place, but drop any triangles with bad indices first.
+                xyz = &floats[r->ref[0]];
+                nv = r->ref[1];
+                tri = (int *)&ids[r->ref[2]];
+                nt = r->ref[3];
+                for (j = 0; j < (unsigned int)nv; j++)
+                    expand_bbox_coords(&vol->bbox, xyz[3 * j], xyz[3 * j + 1], xyz[3 * j + 2]);
+                for (j = n_good = 0; j < (unsigned int)nt; j++)
+                {
+                    int *t = &tri[3 * j];
+
+                    if (t[0] >= 0 && t[0] < nv && t[1] >= 0 && t[1] < nv && t[2] >= 0 && t[2] < nv)
+                    {
+                        memmove(&tri[3 * n_good], t, 3 * sizeof(int));
+                        n_good++;
+                    }
+                }
+
+                if (vol->mesh != NULL)
+                    mesh_destroy(vol->mesh);
+                vol->mesh = mesh_new_from_arrays(vol->material, xyz, nv, tri, n_good, &n_skipped);
+                vol->mesh_valid = TRUE;
+                vol->mesh_only = TRUE;
+                vol->max_facetype = FACE_TRI;
+                vol->bbox.xc = (vol->bbox.xmin + vol->bbox.xmax) / 2;
+                vol->bbox.yc = (vol->bbox.ymin + vol->bbox.ymax) / 2;
+                vol->bbox.zc = (vol->bbox.zmin + vol->bbox.zmax) / 2;
+            }
+            continue;
+
+        default:
+            ASSERT(FALSE, "Bad record type");
+            continue;
+        }
+
+        // Fill in the object header and link the object to its parent group, if any.
+        obj->ID = r->id + id_offset;
+        obj->lock = r->lock;
+        obj->show_dims = (r->flags & BIN_DIMS) != 0;
+        object[r->id] = obj;
+        if (r->parent == BIN_TOP)
+            link_tail_group(obj, tree);
+        else if (IS_GROUP(bin_object(object, hdr, r->parent)))
+            link_tail_group(obj, (Group *)object[r->parent]);
+    }
+    bin_points(bp, &np, hdr->n_points, object, hdr, id_offset);
+    finish_instances(tree, object, hdr->max_id + 1, 0);
+
+    if (!importing)      // Don't overwrite selection, path or clip plane when importing to group
+    {
+        clear_selection(&selection);
+        if (bin_range(hdr->sel_start, hdr->n_sel, hdr->n_ids))
+        {
+            for (j = 0; j < hdr->n_sel; j++)
+            {
+                obj = bin_object(object, hdr, ids[hdr->sel_start + j]);
+                ASSERT(obj != NULL, "Bad selection ID");
+                if (obj != NULL)
+                    link_single(obj, &selection);
+            }
+        }
+
+        if (hdr->path != 0)
+        {
+            curr_path = bin_object(object, hdr, hdr->path);
+            ASSERT(curr_path != NULL, "Bad path group ID");
+        }
+
+        if (hdr->clip[0] != 0 || hdr->clip[1] != 0 || hdr->clip[2] != 0)
+        {
+            view_clipped = hdr->view_clipped;
+            draw_on_clip_plane = hdr->draw_on_clip_plane;
+            clip_plane.A = hdr->clip[0];
+            clip_plane.B = hdr->clip[1];
+            clip_plane.C = hdr->clip[2];
+            clip_plane.D = hdr->clip[3];
+            if (view_clipped)
+                glEnable(GL_CLIP_PLANE0);
+        }
+        save_binary = TRUE;
+    }
+
+    free(object);
+    free(buf);
+    end_deserialise(tree, filename, importing);
+
+    return TRUE;
+}
+
 // Deserialise a tree from file. 
 BOOL
 deserialise_tree(Group *tree, char *filename, BOOL importing)
@@ -501,34 +1608,26 @@ deserialise_tree(Group *tree, char *filename, BOOL importing)
     Object **object;
     Group *grp;
 
+    if (!importing)
+        save_binary = FALSE;
     fopen_s(&f, filename, "rt");
     if (f == NULL)
         return FALSE;
 
+    // Binary files have their own reader.
+    if (fread(buf, 1, 8, f) == 8 && strncmp(buf, BIN_MAGIC, 8) == 0)
+    {
+        fclose(f);
+        return deserialise_binary(tree, filename, importing);
+    }
+
     // How big is this file? Set up the progress bar for reading, in case it's a big one.
     start_file_progress(f, "Reading ", filename);
 
     // initialise the object array
     object = (Object **)calloc(objsize, sizeof(Object *));
     stkptr = 0;
-
-    // If we're importing to a group, we need to avoid ID conflicts on objects and materials
-    if (importing)
-    {
-        id_offset = maxobjid + 1;
-        mat_offset = 0;
-        for (mat = 0; mat < MAX_MATERIAL; mat++)
-        {
-            if (materials[mat].valid)
-                mat_offset = mat;
-        }
-    }
-    else
-    {
-        maxobjid = 0;
-        id_offset = 0;
-        mat_offset = 0;
-    }
+    get_import_offsets(importing, &id_offset, &mat_offset);
 
     // read the file line by line
     while (TRUE)
@@ -1061,6 +2160,41 @@ deserialise_tree(Group *tree, char *filename, BOOL importing)
             else if (IS_GROUP(object[stack[stkptr - 1]]))
                 link_tail_group(object[id], (Group *)object[stack[stkptr - 1]]);
         }
+        else if (objtype_of(tok, "INSTANCE"))
+        {
+            Instance *inst;
+            int i;
+
+            tok = strtok_s(NULL, " \t\n", &nexttok);
+            id = atoi(tok) + id_offset;
+            check_and_grow(id, &object, &objsize);
+            tok = strtok_s(NULL, " \t\n", &nexttok);
+            lock = locktype_of(tok);
+
+            inst = instance_new(NULL);
+            inst->hdr.ID = id;
+            inst->hdr.lock = lock;
+            object[id] = (Object *)inst;
+
+            tok = strtok_s(NULL, " \t\n", &nexttok);
+            inst->op = optype_of(tok);
+            if (inst->op == OP_MAX)
+                inst->op = OP_UNION;
+            tok = strtok_s(NULL, " \t\n", &nexttok);
+            inst->source_id = atoi(tok) + (in_checkpoint ? 0 : id_offset);
+            for (i = 0; i < 12; i++)
+            {
+                tok = strtok_s(NULL, " \t\n", &nexttok);
+                if (tok == NULL)
+                    break;
+                inst->xform[i] = atof(tok);
+            }
+
+            if (stkptr == 0)
+                link_tail_group((Object *)inst, tree);
+            else if (IS_GROUP(object[stack[stkptr - 1]]))
+                link_tail_group((Object *)inst, (Group *)object[stack[stkptr - 1]]);
+        }
         else if (strcmp(tok, "LOFT") == 0)
         {
             LoftParams* loft;
@@ -1111,6 +2245,94 @@ deserialise_tree(Group *tree, char *filename, BOOL importing)
                 loft->bay_tensions[i] = (float)atof(tok);
             }
         }
+        else if (strcmp(tok, "MESH") == 0)
+        {
+            Volume* vol;
+            float *xyz;
+            int *tri;
+            int nv, nt, i, n_good, n_skipped;
+            char *p;
+
+            tok = strtok_s(NULL, " \t\n", &nexttok);
+            id = tok != NULL ? atoi(tok) + id_offset : 0;
+            tok = strtok_s(NULL, " \t\n", &nexttok);
+            nv = tok != NULL ? atoi(tok) : 0;
+            tok = strtok_s(NULL, " \t\n", &nexttok);
+            nt = tok != NULL ? atoi(tok) : 0;
+            if (nv < 0)
+                nv = 0;
+            if (nt < 0)
+                nt = 0;
+
+            // The vertices and triangles follow, one per line. If the mesh has nowhere
+            // to go, skip over them.
+            vol = NULL;
+            if (id > 0 && id < objsize && object[id] != NULL && object[id]->type == OBJ_VOLUME)
+                vol = (Volume*)object[id];
+            ASSERT(vol != NULL, "Mesh must be on volume");
+            xyz = NULL;
+            tri = NULL;
+            if (vol != NULL)
+            {
+                xyz = malloc(3 * ((size_t)nv + 1) * sizeof(float));
+                tri = malloc(3 * ((size_t)nt + 1) * sizeof(int));
+            }
+            if (xyz == NULL || tri == NULL)
+            {
+                free(xyz);
+                free(tri);
+                for (i = 0; i < nv; i++)
+                {
+                    if (fgets(buf, MAXLINE, f) == NULL)
+                        break;
+                }
+                for (i = 0; i < nt; i++)
+                {
+                    if (fgets(buf, MAXLINE, f) == NULL)
+                        break;
+                }
+                continue;
+            }
+            for (i = 0; i < nv; i++)
+            {
+                if (fgets(buf, MAXLINE, f) == NULL)
+                {
+                    nv = i;
+                    break;
+                }
+                step_file_progress(strlen(buf));
+                xyz[3 * i] = strtof(buf, &p);
+                xyz[3 * i + 1] = strtof(p, &p);
+                xyz[3 * i + 2] = strtof(p, &p);
+                expand_bbox_coords(&vol->bbox, xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2]);
+            }
+            for (i = n_good = 0; i < nt; i++)
+            {
+                int *t = &tri[3 * n_good];
+
+                if (fgets(buf, MAXLINE, f) == NULL)
+                    break;
+                step_file_progress(strlen(buf));
+                t[0] = strtol(buf, &p, 10);
+                t[1] = strtol(p, &p, 10);
+                t[2] = strtol(p, &p, 10);
+                if (t[0] >= 0 && t[0] < nv && t[1] >= 0 && t[1] < nv && t[2] >= 0 && t[2] < nv)
+                    n_good++;
+            }
+            nt = n_good;
+
+            if (vol->mesh != NULL)
+                mesh_destroy(vol->mesh);
+            vol->mesh = mesh_new_from_arrays(vol->material, xyz, nv, tri, nt, &n_skipped);
+            vol->mesh_valid = TRUE;
+            vol->mesh_only = TRUE;
+            vol->max_facetype = FACE_TRI;
+            vol->bbox.xc = (vol->bbox.xmin + vol->bbox.xmax) / 2;
+            vol->bbox.yc = (vol->bbox.ymin + vol->bbox.ymax) / 2;
+            vol->bbox.zc = (vol->bbox.zmin + vol->bbox.zmax) / 2;
+            free(xyz);
+            free(tri);
+        }
         else if (strcmp(tok, "MATERIAL") == 0)
         {
             Volume* vol;
@@ -1200,98 +2422,45 @@ deserialise_tree(Group *tree, char *filename, BOOL importing)
         }
     }
 
-    objid = maxobjid + 1;
-    if (!importing)
-        save_count = 1;
+    finish_instances(tree, object, objsize, id_offset);
     free(object);
     fclose(f);
-    clear_status_and_progress();
+    end_deserialise(tree, filename, importing);
 
     return TRUE;
 }
 
-// Write a checkpoint (a file in the undo stack).
+// Write some top-level objects to a file, e.g. to spill part of the undo journal to disk.
+// The materials are assumed to exist already when the objects are read back.
 void
-write_checkpoint(Group *tree, char *filename)
+serialise_objects(Object **objs, int n, char *filename)
 {
-    char basename[256], check[256], tmpdir[256];
-    int baselen;
-    char *pdot;
+    FILE *f;
+    int i;
 
-    pdot = strrchr(filename, '\\');
-    if (pdot != NULL)
-        strcpy_s(basename, 256, pdot+1);          // cut off any directory in file
-    else
-        strcpy_s(basename, 256, filename);
-    baselen = strlen(basename);
-    if (baselen > 4 && (pdot = strrchr(basename, '.')) != NULL)
-        *pdot = '\0';                                            // cut off ".lcd" 
-    GetTempPath(256, tmpdir);
-    sprintf_s(check, 256, "%s%s_%04d.lcd", tmpdir, basename, ++generation);
-    serialise_tree(tree, check);
-    latest_generation = generation;
-    if (generation > max_generation)
-        max_generation = generation;
+    fopen_s(&f, filename, "wt");
+    if (f == NULL)
+        return;
+    fprintf_s(f, "LOFTYCAD %.1f\n", file_version);
+    for (i = 0; i < MAX_MATERIAL; i++)
+        mat_written[i] = TRUE;
+    save_count++;
+    for (i = 0; i < n; i++)
+        serialise_obj(objs[i], f, 0);
+    fclose(f);
 }
 
-// Read back a given generation of checkpoint. Generation zero is the
-// original file (or an empty tree). Clean out the existing tree first.
+// Read back objects written by serialise_objects into a group. They get new ID's,
+// so they don't clash with anything in the tree.
 BOOL
-read_checkpoint(Group *tree, char *filename, int generation)
+deserialise_objects(Group *group, char *filename)
 {
-    char basename[256], check[256], tmpdir[256];
-    int baselen;
-    BOOL rc = FALSE;
-    char *pdot;
-
-    clear_selection(&selection);
-    clear_selection(&saved_list);
-    clear_selection(&clipboard);
-    purge_tree(tree, FALSE, NULL);
-
-    if (generation > 0)
-    {
-        pdot = strrchr(filename, '\\');
-        if (pdot != NULL)
-            strcpy_s(basename, 256, pdot+1);          // cut off any directory in file
-        else
-            strcpy_s(basename, 256, filename);
-        baselen = strlen(basename);
-        if (baselen > 4 && (pdot = strrchr(basename, '.')) != NULL)
-            *pdot = '\0';                                            // cut off ".lcd" 
-        GetTempPath(256, tmpdir);
-        sprintf_s(check, 256, "%s%s_%04d.lcd", tmpdir, basename, generation);
-        rc = deserialise_tree(tree, check, FALSE);
-    }
-    else if (filename[0] != '\0')
-    {
-        drawing_changed = FALSE;
-        rc = deserialise_tree(tree, filename, FALSE);
-    }
+    BOOL rc;
 
+    if (maxobjid < objid)
+        maxobjid = objid;
+    in_checkpoint = TRUE;
+    rc = deserialise_tree(group, filename, TRUE);
+    in_checkpoint = FALSE;
     return rc;
 }
-
-// Clean out all the checkpoint files for a filename.
-void
-clean_checkpoints(char *filename)
-{
-    char basename[256], check[256];
-    int baselen, gen;
-    char *pdot;
-
-    strcpy_s(basename, 256, filename);
-    baselen = strlen(basename);
-    if (baselen > 4 && (pdot = strrchr(basename, '.')) != NULL)
-        *pdot = '\0';                                            // cut off ".lcd" 
-
-    for (gen = 1; gen <= max_generation; gen++)
-    {
-        sprintf_s(check, 256, "%s_%04d.lcd", basename, gen);
-        DeleteFile(check);
-    }
-    
-    generation = 0;
-    latest_generation = 0;
-    max_generation = 0;
-}
@@ -1065,7 +1065,7 @@ run_slicer(char* slicer_exe, char* cmd_line, char* dir, char* gcode_filename)
     // If we have an output, send it to the print preview. Otherwise, alert via a message box.
     if (have_output)
     {
-        purge_zpoly_edges(&gcode_tree);
+        purge_gcode(&gcode_tree);
         if (!read_gcode_to_group(&gcode_tree, out_filename))
         {
             MessageBox(hWndSlicer, "Slicer output was not found", out_filename, MB_OK | MB_ICONWARNING);
@@ -53,6 +53,7 @@ char *obj_description(Object *obj, char *descr, int descr_len, BOOL verbose)
     Edge *edge;
     Volume *vol;
     Group *grp;
+    Instance *inst;
     char tmpbuf[256];
 
     switch (obj->type)
@@ -158,6 +159,21 @@ char *obj_description(Object *obj, char *descr, int descr_len, BOOL verbose)
             }
         }
         break;
+
+    case OBJ_INSTANCE:
+        inst = (Instance *)obj;
+        if (inst->source == NULL)
+            sprintf_s(descr, descr_len, "%s Instance %d (source deleted)",
+                op_string[inst->op],
+                obj->ID
+            );
+        else
+            sprintf_s(descr, descr_len, "%s Instance %d of %d",
+                op_string[inst->op],
+                obj->ID,
+                inst->source_id
+            );
+        break;
     }
 
     return descr;
@@ -249,6 +265,10 @@ char* brief_description(Object* obj, char* descr, int descr_len)
             }
         }
         break;
+
+    case OBJ_INSTANCE:
+        sprintf_s(descr, descr_len, "Instance %d", obj->ID);
+        break;
     }
 
     return descr;
@@ -421,6 +441,26 @@ populate_treeview_object(Object *obj, Object *parent, HTREEITEM hItem, char *tag
             }
         }
         break;
+
+    case OBJ_INSTANCE:
+        // An instance has no components of its own to show
+        tvi.pszText = obj_description(obj, descr, 128, TRUE);
+        tvi.cchTextMax = strlen(tvi.pszText);
+        tvi.lParam = (LPARAM)obj;
+        tvi.mask = TVIF_TEXT | TVIF_PARAM;
+        tvi.state = 0;
+        tvi.stateMask = 0;
+        if (is_selected_direct(obj, &o))
+        {
+            tvi.mask |= TVIF_STATE;
+            tvi.state |= TVIS_BOLD;
+            tvi.stateMask |= TVIS_BOLD;
+        }
+        tvins.item = tvi;
+        tvins.hParent = hItem;
+        tvins.hInsertAfter = TVI_LAST;
+        SendDlgItemMessage(hWndTree, IDC_TREEVIEW, TVM_INSERTITEM, 0, (LPARAM)&tvins);
+        break;
     }
 }
 
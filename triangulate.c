@@ -185,6 +185,22 @@ invalidate_all_view_lists(Object *parent, Object *obj, float dx, float dy, float
     case OBJ_VOLUME:
         vol = (Volume *)parent;
 
+        // A mesh-only volume has no view lists, and its mesh and bbox have already
+        // been moved. Just mark it as changed.
+        if (vol->mesh_only)
+        {
+            vol->mesh_valid = FALSE;
+            break;
+        }
+
+        // A volume moved as a whole has had its view lists, bbox and mesh moved with it
+        // (see mover.c), so they are still up to date.
+        if (vol->views_moved)
+        {
+            vol->views_moved = FALSE;
+            break;
+        }
+
         // Clear the current bbox so it gets updated with the view list.
         // Mark this volume as needing a new mesh update.
         clear_bbox(&vol->bbox);
@@ -194,6 +210,12 @@ invalidate_all_view_lists(Object *parent, Object *obj, float dx, float dy, float
             invalidate_all_view_lists((Object *)f, obj, dx, dy, dz);
         break;
 
+    case OBJ_INSTANCE:
+        // Only the transform can have changed. Its bbox is updated, and it is marked
+        // as changed, when the volumes are next generated.
+        ((Instance *)parent)->mesh_valid = FALSE;
+        break;
+
     case OBJ_FACE:
         f = (Face *)parent;
         f->view_valid = FALSE;
@@ -229,10 +251,10 @@ invalidate_all_view_lists(Object *parent, Object *obj, float dx, float dy, float
     }
 }
 
-// Generate volume view lists (meshes) for all volumes in tree. Return TRUE if something new
-// was generated, FALSE if everything was up to date.
-BOOL
-gen_view_list_tree_volumes(Group *tree)
+// Generate volume view lists (meshes) for all volumes in a tree whose faces are up to date.
+// Return TRUE if something new was generated, FALSE if everything was up to date.
+static BOOL
+gen_view_list_tree_vols(Group *tree)
 {
     Object *obj;
     Volume *vol;
@@ -266,8 +288,15 @@ gen_view_list_tree_volumes(Group *tree)
 
         case OBJ_VOLUME:
             vol = (Volume * )obj;
-            if (gen_view_list_vol(vol) || !vol->mesh_valid)
+            if (gen_view_list_vol(vol) || !vol->mesh_valid || vol->mesh_moved)
+            {
+                // Mark it as changed, and take it out of the parent's stage cache
+                vol->mesh_moved = FALSE;
+                vol->mesh_dirty = TRUE;
+                vol->mesh_gen++;
+                vol->cache_stamp = 0;
                 rc = TRUE;
+            }
 
             // update the group bbox with the volume bbox
             union_bbox(&vol->bbox, &tree->bbox, &tree->bbox);
@@ -275,8 +304,12 @@ gen_view_list_tree_volumes(Group *tree)
 
         case OBJ_GROUP:
             group = (Group *)obj;
-            if (gen_view_list_tree_volumes(group))
+            if (gen_view_list_tree_vols(group))
+            {
+                group->mesh_dirty = TRUE;
+                group->cache_stamp = 0;
                 rc = TRUE;
+            }
 
             // update the group bbox centre
             box = &group->bbox;
@@ -288,25 +321,112 @@ gen_view_list_tree_volumes(Group *tree)
         }
     }
 
-    // clear and reinit the tree mesh if any volumes needed regenerating
+    // clear and reinit the tree mesh if any volumes needed regenerating.
+    // The stage caches are kept, so only the changed members need to be merged again.
     if (rc)
     {
         if (tree->mesh != NULL)
             mesh_destroy(tree->mesh);
         tree->mesh = NULL;
         tree->mesh_valid = FALSE;
+        tree->mesh_gen++;
     }
     invalidate_dl();
     return rc;
 }
 
+// An instance is hidden along with its source's material. If its source has gone,
+// there is nothing to show, so it's treated as hidden too.
+static BOOL
+instance_hidden(Instance *inst)
+{
+    if (inst->source == NULL)
+        return TRUE;
+    if (inst->source->type == OBJ_VOLUME)
+        return materials[((Volume *)inst->source)->material].hidden;
+    return FALSE;
+}
+
+// Bring the instances in a tree up to date with their sources and transforms. This is
+// done after all the volumes and groups have been generated, as a source may come after
+// its instances in the tree. Return TRUE if any instance needs merging again.
+static BOOL
+gen_view_list_tree_instances(Group *tree)
+{
+    Object *obj;
+    Instance *inst;
+    Group *group;
+    BOOL rc = FALSE;
+    Bbox *box;
+    int gen;
+
+    for (obj = tree->obj_list.head; obj != NULL; obj = obj->next)
+    {
+        switch (obj->type)
+        {
+        case OBJ_INSTANCE:
+            inst = (Instance *)obj;
+            update_instance_bbox(inst);
+            union_bbox(&inst->bbox, &tree->bbox, &tree->bbox);
+            if (instance_hidden(inst))
+                break;
+
+            // The source's mesh generation tells if it has changed since last time.
+            gen = ((Volume *)inst->source)->mesh_gen;
+            if (inst->source->type == OBJ_GROUP)
+                gen = ((Group *)inst->source)->mesh_gen;
+            if (!inst->mesh_valid || gen != inst->source_gen)
+            {
+                // Throw away any stale mesh left over from a failed merge.
+                if (inst->mesh != NULL)
+                    mesh_destroy(inst->mesh);
+                inst->mesh = NULL;
+                inst->mesh_valid = TRUE;
+                inst->source_gen = gen;
+                inst->mesh_dirty = TRUE;
+                inst->cache_stamp = 0;
+                rc = TRUE;
+            }
+            break;
+
+        case OBJ_GROUP:
+            group = (Group *)obj;
+            if (gen_view_list_tree_instances(group))
+            {
+                group->mesh_dirty = TRUE;
+                group->cache_stamp = 0;
+                rc = TRUE;
+            }
+
+            box = &group->bbox;
+            box->xc = (box->xmin + box->xmax) / 2;
+            box->yc = (box->ymin + box->ymax) / 2;
+            box->zc = (box->zmin + box->zmax) / 2;
+            union_bbox(&group->bbox, &tree->bbox, &tree->bbox);
+            break;
+        }
+    }
+
+    if (rc)
+    {
+        if (tree->mesh != NULL)
+            mesh_destroy(tree->mesh);
+        tree->mesh = NULL;
+        tree->mesh_valid = FALSE;
+        tree->mesh_gen++;
+    }
+    return rc;
+}
+
 // Mesh merge operations. The mesh1 pointer may change if CGAL is being called to do
 // separate (non-in-place) output as a workaround to CGAL issue #4522.
 BOOL
 mesh_merge_op(OPERATION op, Mesh **mesh1, Mesh *mesh2)
 {
     BOOL rc;
+    LARGE_INTEGER start;
 
+    bench_start(&start);
     switch (op)
     {
     case OP_UNION:
@@ -320,17 +440,39 @@ mesh_merge_op(OPERATION op, Mesh **mesh1, Mesh *mesh2)
         rc = mesh_difference(mesh1, mesh2);
         break;
     }
+    if (benchmarking)
+        bench_end(BENCH_MERGE, &start, mesh_num_faces(*mesh1));
     return rc;
 }
 
 // If a mesh operation fails due to an assertion or other error in CGAL,
 // gather up the incriminating evidence and flash it to the user in a
 // MessageBox. Return the OK/Cancel status.
+// In batch mode, just log it. Carry on (as for OK) unless strict.
 int
 inform_mesh_error(Object* obj)
 {
     char buf[64];
 
+    if (batch_mode)
+    {
+        char *msg;
+
+        if (exception > 0)
+            msg = err;
+        else if (exception == -1)
+            msg = "Object mesh is not manifold";
+        else if (exception == -2)
+            msg = "Object mesh has self-intersections";
+        else
+            msg = "Could not merge object (mesh is probably OK)";
+        Log(obj_description(obj, buf, 64, FALSE));
+        Log(": ");
+        Log(msg);
+        Log("\r\n");
+        return batch_strict ? IDCANCEL : IDOK;
+    }
+
     if (exception > 0)
         return MessageBox(auxGetHWND(), err, obj_description(obj, buf, 64, FALSE), MB_OKCANCEL | MB_ICONEXCLAMATION);
     else if (exception == -1)
@@ -342,17 +484,356 @@ inform_mesh_error(Object* obj)
 }
 
 
+// Incremental CSG. Each group keeps a cached mesh per op stage (unions, differences,
+// intersections) containing the merge of the stage's input with all the members that
+// have settled (not changed since the last merge). Members are marked as included in
+// the cache by a stamp. When one volume changes, only the changed members (and any
+// later stages whose input has changed) need to be merged again. The changed members
+// merged on top of the cache are marked by a second stamp, so that if one of them
+// disappears the stage output is known to have changed, although its cache has not.
+static int stage_stamp_counter = 0;
+
+// Which members to merge in a pass over a stage.
+#define PASS_SETTLED    1       // Members that have not changed since the last merge
+#define PASS_DIRTY      2       // Members that have changed
+#define PASS_ALL        (PASS_SETTLED | PASS_DIRTY)
+
+// Free a group's cached stage meshes.
+void
+free_stage_meshes(Group *group)
+{
+    int i;
+
+    for (i = 0; i < OP_NONE; i++)
+    {
+        if (group->stage_mesh[i] != NULL)
+            mesh_destroy(group->stage_mesh[i]);
+        group->stage_mesh[i] = NULL;
+        group->stage_stamp[i] = 0;
+        group->stage_count[i] = 0;
+        group->dirty_stamp[i] = 0;
+        group->dirty_count[i] = 0;
+    }
+}
+
+// Count the members of a stage that are included in the parent tree's cached stage mesh,
+// and those that were merged on top of it last time (in n_dirty).
+// If a member has been changed, deleted, hidden or had its op changed, the counts will
+// not match the numbers recorded when the stage was last merged.
+static int
+count_cached_members(OPERATION op, Group *tree, Group *parent_tree, int *n_dirty)
+{
+    Object *obj;
+    Volume *vol;
+    Group *group;
+    Instance *inst;
+    int count = 0;
+    int stamp = parent_tree->stage_stamp[op];
+    int dirty_stamp = parent_tree->dirty_stamp[op];
+
+    for (obj = tree->obj_list.head; obj != NULL; obj = obj->next)
+    {
+        switch (obj->type)
+        {
+        case OBJ_VOLUME:
+            vol = (Volume *)obj;
+            if (vol->op != op || materials[vol->material].hidden)
+                break;
+            if (stamp != 0 && vol->cache_stamp == stamp)
+                count++;
+            else if (dirty_stamp != 0 && vol->cache_stamp == dirty_stamp)
+                (*n_dirty)++;
+            break;
+
+        case OBJ_GROUP:
+            group = (Group *)obj;
+            if (group->op == OP_NONE)
+            {
+                count += count_cached_members(op, group, parent_tree, n_dirty);
+                break;
+            }
+            if (group->op != op)
+                break;
+
+            // A group whose mesh is not valid will be regenerated, so treat it as changed.
+            if (!group->mesh_valid)
+            {
+                group->mesh_dirty = TRUE;
+                group->cache_stamp = 0;
+            }
+            if (stamp != 0 && group->cache_stamp == stamp)
+                count++;
+            else if (dirty_stamp != 0 && group->cache_stamp == dirty_stamp)
+                (*n_dirty)++;
+            break;
+
+        case OBJ_INSTANCE:
+            inst = (Instance *)obj;
+            if (inst->op != op || instance_hidden(inst))
+                break;
+            if (stamp != 0 && inst->cache_stamp == stamp)
+                count++;
+            else if (dirty_stamp != 0 && inst->cache_stamp == dirty_stamp)
+                (*n_dirty)++;
+            break;
+        }
+    }
+
+    return count;
+}
+
+// Copy or merge a member's mesh into the parent tree mesh. Return FALSE if an error
+// occurred and the user cancelled via the message box.
+static BOOL
+merge_member_mesh(OPERATION op, Object *obj, Mesh *mesh, BOOL *merged, Group *parent_tree)
+{
+    char buf[64];
+
+    if (!parent_tree->mesh_valid)
+    {
+        // First one: copy the mesh into tree->mesh
+        show_status(obj->type == OBJ_VOLUME ? "Copying volume: " : "Copying group: ", obj_description(obj, buf, 64, FALSE));
+        bump_progress();
+        process_messages();
+
+        parent_tree->mesh = mesh_copy(mesh);
+        parent_tree->mesh_valid = TRUE;
+        *merged = TRUE;
+#ifdef DEBUG_WRITE_VOL_MESH
+        sprintf_s(buf, 64, "Copied %s %d\r\n", obj->type == OBJ_VOLUME ? "vol" : "group", obj->ID);
+        Log(buf);
+#endif
+    }
+    else
+    {
+        show_status(obj->type == OBJ_VOLUME ? "Merging volume: " : "Merging group: ", obj_description(obj, buf, 64, FALSE));
+        bump_progress();
+        process_messages();
+
+        // Merge member mesh to tree mesh
+        *merged = mesh_merge_op(op, &parent_tree->mesh, mesh);
+        if (!*merged)
+        {
+            parent_tree->mesh_complete = FALSE;
+            if (inform_mesh_error(obj) == IDCANCEL)
+            {
+                parent_tree->mesh_valid = FALSE;
+                return FALSE;
+            }
+        }
+#ifdef DEBUG_WRITE_VOL_MESH
+        mesh_write_off(obj->type == OBJ_VOLUME ? "merge_vol" : "merge_group", obj->ID, parent_tree->mesh);
+#endif
+    }
+    return TRUE;
+}
+
+// Union members are not merged as they are found, but collected into a batch
+// and unioned together in a balanced tree (see mergetree.c)
+typedef struct MergeBatch
+{
+    Object      **objs;
+    Mesh        **meshes;
+    int         n_objs;
+    int         max_objs;
+} MergeBatch;
+
+// Don't bother with the balanced merge for fewer members than this.
+#define MIN_BALANCED_MERGE  4
+
+// Record the result of merging a member. Settled members go into the stage cache.
+// Changed ones are merged on top of it, and will become settled next time if they
+// are left alone. Both are stamped, so the stage knows next time what went into it.
+static void
+settle_member(OPERATION op, Object *obj, BOOL merged, int pass, Group *parent_tree, int *n_merged)
+{
+    Volume *vol;
+    Group *group;
+    Instance *inst;
+    int stamp = 0;
+
+    if (merged)
+    {
+        (*n_merged)++;
+        if (pass == PASS_SETTLED)
+        {
+            parent_tree->stage_count[op]++;
+            stamp = parent_tree->stage_stamp[op];
+        }
+        else if (pass == PASS_DIRTY)
+        {
+            parent_tree->dirty_count[op]++;
+            stamp = parent_tree->dirty_stamp[op];
+        }
+    }
+
+    switch (obj->type)
+    {
+    case OBJ_VOLUME:
+        vol = (Volume *)obj;
+        vol->mesh_merged = merged;
+        if (stamp != 0)
+            vol->cache_stamp = stamp;
+        vol->mesh_dirty = FALSE;
+        break;
+
+    case OBJ_GROUP:
+        group = (Group *)obj;
+        group->mesh_merged = merged;
+        if (stamp != 0)
+            group->cache_stamp = stamp;
+        group->mesh_dirty = FALSE;
+        break;
+
+    case OBJ_INSTANCE:
+        // The instance's mesh is only needed while merging. Keep it if it could not
+        // be merged, so it can still be drawn or exported on its own.
+        inst = (Instance *)obj;
+        inst->mesh_merged = merged;
+        if (stamp != 0)
+            inst->cache_stamp = stamp;
+        inst->mesh_dirty = FALSE;
+        if (merged && inst->mesh != NULL)
+        {
+            mesh_destroy(inst->mesh);
+            inst->mesh = NULL;
+        }
+        break;
+    }
+}
+
+// Merge a member into the parent tree mesh, or add it to the batch if there is one.
+// Return FALSE if an error occurred and the user cancelled via the message box.
+static BOOL
+merge_member(OPERATION op, Object *obj, Mesh *mesh, int pass, Group *parent_tree, int *n_merged, MergeBatch *batch)
+{
+    BOOL merged;
+
+    if (batch != NULL)
+    {
+        if (batch->n_objs == batch->max_objs)
+        {
+            batch->max_objs = batch->max_objs == 0 ? 16 : batch->max_objs * 2;
+            batch->objs = realloc(batch->objs, batch->max_objs * sizeof(Object *));
+            batch->meshes = realloc(batch->meshes, batch->max_objs * sizeof(Mesh *));
+        }
+        batch->objs[batch->n_objs] = obj;
+        batch->meshes[batch->n_objs] = mesh;
+        batch->n_objs++;
+        return TRUE;
+    }
+
+    if (!merge_member_mesh(op, obj, mesh, &merged, parent_tree))
+        return FALSE;
+    settle_member(op, obj, merged, pass, parent_tree, n_merged);
+    return TRUE;
+}
+
+// Union a batch of members together in a balanced tree, and merge the result
+// into the parent tree mesh. If anything goes wrong, fall back to merging them
+// one at a time so the errors can be reported against the offending objects.
+// Return FALSE if an error occurred and the user cancelled via the message box.
+static BOOL
+flush_merge_batch(OPERATION op, MergeBatch *batch, int pass, Group *parent_tree, int *n_merged)
+{
+    Mesh *mesh;
+    BOOL merged = FALSE;
+    BOOL rc = TRUE;
+    char buf[64];
+    int i;
+
+    if (batch->n_objs >= MIN_BALANCED_MERGE)
+    {
+        sprintf_s(buf, 64, "%d", batch->n_objs);
+        show_status("Merging volumes: ", buf);
+        process_messages();
+        if (mesh_union_balanced(batch->meshes, batch->n_objs, &mesh))
+        {
+            if (!parent_tree->mesh_valid)
+            {
+                parent_tree->mesh = mesh;
+                parent_tree->mesh_valid = TRUE;
+                merged = TRUE;
+            }
+            else
+            {
+                merged = mesh_union(&parent_tree->mesh, mesh);
+                mesh_destroy(mesh);
+            }
+        }
+    }
+
+    for (i = 0; i < batch->n_objs; i++)
+    {
+        if (merged)
+        {
+            bump_progress();
+            settle_member(op, batch->objs[i], TRUE, pass, parent_tree, n_merged);
+        }
+        else if (!merge_member(op, batch->objs[i], batch->meshes[i], pass, parent_tree, n_merged, NULL))
+        {
+            rc = FALSE;
+            break;
+        }
+    }
+
+    batch->n_objs = 0;
+    return rc;
+}
+
+// Make the mesh of an instance, by copying its source's mesh (making sure it is up to
+// date first) and transforming the copy. Return FALSE if the source has no mesh.
+static BOOL
+materialise_instance(Instance *inst)
+{
+    Volume *vol;
+    Group *group;
+    Mesh *mesh = NULL;
+
+    switch (inst->source->type)
+    {
+    case OBJ_VOLUME:
+        vol = (Volume *)inst->source;
+        if (vol->mesh == NULL)
+            return FALSE;
+        if (!vol->mesh_valid && !vol->mesh_only && !mesh_cache_lookup(inst->source))
+            gen_view_list_surfaces(vol);
+        vol->mesh_valid = TRUE;
+        mesh = vol->mesh;
+        break;
+
+    case OBJ_GROUP:
+        group = (Group *)inst->source;
+        gen_view_list_tree_surfaces(group, group);
+        if (group->mesh_valid)
+            mesh = group->mesh;
+        break;
+    }
+    if (mesh == NULL)
+        return FALSE;
+
+    inst->mesh = mesh_copy(mesh);
+    mesh_transform(inst->mesh, inst->xform, instance_reflects(inst));
+    return TRUE;
+}
+
 // Generate mesh for a class of operations for a group tree (or the object tree).
+// Only members selected by the pass, and not already in the parent's stage cache,
+// are merged. Settled members that merge successfully are stamped into the cache.
+// The number of successful merges is accumulated in n_merged. If a batch is passed,
+// members are collected into it to be merged later.
 // Return FALSE if an error occurred and the user cancelled via the message box.
-BOOL
-gen_view_list_tree_surfaces_op(OPERATION op, Group *tree, Group *parent_tree)
+static BOOL
+gen_view_list_tree_surfaces_op(OPERATION op, Group *tree, Group *parent_tree, int pass, int *n_merged, MergeBatch *batch)
 {
     Object *obj;
-    Face *f;
     Volume *vol;
     Group *group;
+    Instance *inst;
     char buf[64];
     int i;
+    int stamp = parent_tree->stage_stamp[op];
+    LARGE_INTEGER start;
 
     for (obj = tree->obj_list.head; obj != NULL; obj = obj->next)
     {
@@ -364,10 +845,20 @@ gen_view_list_tree_surfaces_op(OPERATION op, Group *tree, Group *parent_tree)
                 break;
             if (materials[vol->material].hidden)
                 break;
+            if (stamp != 0 && vol->cache_stamp == stamp)
+                break;
+            if ((pass & (vol->mesh_dirty ? PASS_DIRTY : PASS_SETTLED)) == 0)
+                break;
 
-            // update the triangle mesh for the volume
-            for (f = (Face *)vol->faces.head; f != NULL; f = (Face *)f->hdr.next)
-                gen_view_list_surface(f);
+            // update the triangle mesh for the volume, unless it's already been done
+            // or it can be found in the mesh cache
+            if (!vol->mesh_valid && !vol->mesh_only && !mesh_cache_lookup(obj))
+            {
+                bench_start(&start);
+                gen_view_list_surfaces(vol);
+                if (benchmarking)
+                    bench_end(BENCH_SURFACE, &start, mesh_num_faces(vol->mesh));
+            }
 #ifdef DEBUG_WRITE_VOL_MESH
             mesh_write_off("vol", obj->ID, vol->mesh);
 #endif
@@ -411,45 +902,8 @@ gen_view_list_tree_surfaces_op(OPERATION op, Group *tree, Group *parent_tree)
 
             // Mark it valid in any case
             vol->mesh_valid = TRUE;
-            if (!parent_tree->mesh_valid)
-            {
-                // First one: copy vol->mesh into tree->mesh
-                show_status("Copying volume: ", obj_description(obj, buf, 64, FALSE));
-                bump_progress();
-                process_messages();
-
-                parent_tree->mesh = mesh_copy(vol->mesh);
-                parent_tree->mesh_valid = TRUE;
-                vol->mesh_merged = TRUE;
-#ifdef DEBUG_WRITE_VOL_MESH
-                sprintf_s(buf, 64, "Copied vol %d\r\n", obj->ID);
-                Log(buf);
-#endif
-            }
-            else
-            {
-                show_status("Merging volume: ", obj_description(obj, buf, 64, FALSE));
-                bump_progress();
-                process_messages();
-
-                // TEMP
-                i = mesh_check_for_manifold(parent_tree->mesh);
-
-                // Merge volume mesh to tree mesh
-                vol->mesh_merged = mesh_merge_op(op, &parent_tree->mesh, vol->mesh);
-                if (!vol->mesh_merged)
-                {
-                    parent_tree->mesh_complete = FALSE;
-                    if (inform_mesh_error(obj) == IDCANCEL)
-                    {
-                        parent_tree->mesh_valid = FALSE;
-                        return FALSE;
-                    }
-                }
-#ifdef DEBUG_WRITE_VOL_MESH
-                mesh_write_off("merge_vol", obj->ID, parent_tree->mesh);
-#endif
-            }
+            if (!merge_member(op, obj, vol->mesh, pass, parent_tree, n_merged, batch))
+                return FALSE;
             break;
 
         case OBJ_GROUP:
@@ -457,86 +911,192 @@ gen_view_list_tree_surfaces_op(OPERATION op, Group *tree, Group *parent_tree)
             if (group->op == OP_NONE)
             {
                 // Render contents of group as if in the parent
-                gen_view_list_tree_surfaces_op(op, group, parent_tree);
+                if (!gen_view_list_tree_surfaces_op(op, group, parent_tree, pass, n_merged, batch))
+                    return FALSE;
+                break;
             }
-            else
-            {
-                if (group->op != op)
-                    break;
 
-                // Render group and merge it with parent using group op
-                gen_view_list_tree_surfaces(group, group);
-                group->mesh_valid = TRUE;
-                if (!parent_tree->mesh_valid)
-                {
-                    // First one: copy vol->mesh into tree->mesh
-                    show_status("Copying group: ", obj_description(obj, buf, 64, FALSE));
-                    bump_progress();
-                    process_messages();
-
-                    parent_tree->mesh = mesh_copy(group->mesh);
-                    parent_tree->mesh_valid = TRUE;
-                    group->mesh_merged = TRUE;
-#ifdef DEBUG_WRITE_VOL_MESH
-                    sprintf_s(buf, 64, "Copied group %d\r\n", obj->ID);
-                    Log(buf);
-#endif
-                }
-                else
-                {
-                    show_status("Merging group: ", obj_description(obj, buf, 64, FALSE));
-                    bump_progress();
-                    process_messages();
+            if (group->op != op)
+                break;
+            if (stamp != 0 && group->cache_stamp == stamp)
+                break;
+            if ((pass & (group->mesh_dirty ? PASS_DIRTY : PASS_SETTLED)) == 0)
+                break;
 
-                    // Merge group mesh to tree mesh
-                    group->mesh_merged = mesh_merge_op(op, &parent_tree->mesh, group->mesh);
-                    if (!group->mesh_merged)
-                    {
-                        parent_tree->mesh_complete = FALSE;
-                        if (inform_mesh_error(obj) == IDCANCEL)
-                        {
-                            parent_tree->mesh_valid = FALSE;
-                            return FALSE;
-                        }
-                    }
-#ifdef DEBUG_WRITE_VOL_MESH
-                    mesh_write_off("merge_group", obj->ID, parent_tree->mesh);
-#endif
-                }
-            }
+            // Render group and merge it with parent using group op
+            gen_view_list_tree_surfaces(group, group);
+            group->mesh_valid = TRUE;
+            if (!merge_member(op, obj, group->mesh, pass, parent_tree, n_merged, batch))
+                return FALSE;
+            break;
+
+        case OBJ_INSTANCE:
+            inst = (Instance *)obj;
+            if (inst->op != op || instance_hidden(inst))
+                break;
+            if (stamp != 0 && inst->cache_stamp == stamp)
+                break;
+            if ((pass & (inst->mesh_dirty ? PASS_DIRTY : PASS_SETTLED)) == 0)
+                break;
+
+            // Materialise a transformed copy of the source's mesh, just for the merge
+            if (inst->mesh == NULL && !materialise_instance(inst))
+                break;
+            if (!merge_member(op, obj, inst->mesh, pass, parent_tree, n_merged, batch))
+                return FALSE;
             break;
         }
     }
     return TRUE;
 }
 
+// Generate the mesh for one op stage, starting from the cached stage mesh if it is
+// still good. On entry, *changed indicates that the input to this stage (the output of
+// the previous stage) differs from the last time round; on exit, it indicates whether
+// the output of this stage differs.
+static BOOL
+gen_view_list_tree_stage(OPERATION op, Group *tree, Group *parent_tree, BOOL *changed)
+{
+    int n_dirty = 0;
+    int n_cached = count_cached_members(op, tree, parent_tree, &n_dirty);
+    int n_merged = 0;
+    MergeBatch batch = { NULL, NULL, 0, 0 };
+    MergeBatch *pbatch = op == OP_UNION ? &batch : NULL;
+    BOOL rc = TRUE;
+    BOOL dropped;
+
+    // If any member merged on top of the cache last time has gone (deleted, hidden or
+    // had its op changed) the output differs, even if nothing else is merged this time.
+    // (members still there are either merged again or settled into the cache)
+    dropped = n_dirty != parent_tree->dirty_count[op];
+    parent_tree->dirty_stamp[op] = 0;
+    parent_tree->dirty_count[op] = 0;
+
+    if (!*changed && parent_tree->stage_stamp[op] != 0 && n_cached == parent_tree->stage_count[op])
+    {
+        // The cache is good. Replace the stage input with it.
+        if (parent_tree->mesh != NULL)
+            mesh_destroy(parent_tree->mesh);
+        parent_tree->mesh = NULL;
+        parent_tree->mesh_valid = FALSE;
+        if (parent_tree->stage_mesh[op] != NULL)
+        {
+            parent_tree->mesh = mesh_copy(parent_tree->stage_mesh[op]);
+            parent_tree->mesh_valid = TRUE;
+        }
+    }
+    else
+    {
+        // Start a new cache from the stage input.
+        if (parent_tree->stage_mesh[op] != NULL)
+            mesh_destroy(parent_tree->stage_mesh[op]);
+        parent_tree->stage_mesh[op] = NULL;
+        parent_tree->stage_stamp[op] = ++stage_stamp_counter;
+        parent_tree->stage_count[op] = 0;
+        *changed = TRUE;
+
+        // When a difference or intersection stage has no input, the first member is
+        // copied and the rest are merged with it, so the order of members matters.
+        // Merge them all in order and don't cache anything.
+        if (op != OP_UNION && !parent_tree->mesh_valid)
+        {
+            parent_tree->stage_stamp[op] = 0;
+            return gen_view_list_tree_surfaces_op(op, tree, parent_tree, PASS_ALL, &n_merged, NULL);
+        }
+    }
+
+    // Merge the settled members that are not yet in the cache, and update it
+    // if anything was added. Unions are collected up and merged in a balanced tree.
+    if
+    (
+        !gen_view_list_tree_surfaces_op(op, tree, parent_tree, PASS_SETTLED, &n_merged, pbatch)
+        ||
+        (pbatch != NULL && !flush_merge_batch(op, pbatch, PASS_SETTLED, parent_tree, &n_merged))
+    )
+    {
+        rc = FALSE;
+        goto fail;
+    }
+    if (*changed || n_merged > 0)
+    {
+        if (parent_tree->stage_mesh[op] != NULL)
+            mesh_destroy(parent_tree->stage_mesh[op]);
+        parent_tree->stage_mesh[op] = NULL;
+        if (parent_tree->mesh_valid)
+            parent_tree->stage_mesh[op] = mesh_copy(parent_tree->mesh);
+        *changed = TRUE;
+    }
+
+    // Merge the changed members on top of the cache.
+    n_merged = 0;
+    parent_tree->dirty_stamp[op] = ++stage_stamp_counter;
+    if
+    (
+        !gen_view_list_tree_surfaces_op(op, tree, parent_tree, PASS_DIRTY, &n_merged, pbatch)
+        ||
+        (pbatch != NULL && !flush_merge_batch(op, pbatch, PASS_DIRTY, parent_tree, &n_merged))
+    )
+    {
+        rc = FALSE;
+        goto fail;
+    }
+    if (n_merged > 0 || dropped)
+        *changed = TRUE;
+
+fail:
+    if (!rc)
+    {
+        parent_tree->stage_stamp[op] = 0;
+        parent_tree->dirty_stamp[op] = 0;
+        parent_tree->dirty_count[op] = 0;
+    }
+    free(batch.objs);
+    free(batch.meshes);
+    return rc;
+}
+
 // Generate mesh for entire tree (a group or the object tree)
 BOOL
 gen_view_list_tree_surfaces(Group *tree, Group *parent_tree)
 {
-
     BOOL rc = TRUE;
+    BOOL changed = FALSE;
 
     // If the parent tree is up to date, we have nothing to do. (but don't do this
     // check if recursing)
     if (tree == parent_tree && parent_tree->mesh_valid)
         return TRUE;
 
+    // The whole tree's mesh may be in the mesh cache.
+    if (tree == parent_tree && mesh_cache_lookup((Object *)tree))
+        return TRUE;
+
     // Start up the progress bar
     if (tree == parent_tree)
         set_progress_range(accum_render_count(tree));
 
     suppress_drawing = TRUE;
     parent_tree->mesh_complete = TRUE;
+    if (tree == parent_tree)
+    {
+        if (parent_tree->mesh != NULL)
+            mesh_destroy(parent_tree->mesh);
+        parent_tree->mesh = NULL;
+    }
 
     // Precedence order: unions, then differences, then intersections.
     // If any are cancelled (by user) then bail out (expression will evaluate FALSE)
     rc =
-        gen_view_list_tree_surfaces_op(OP_UNION, tree, parent_tree)
+        gen_view_list_tree_stage(OP_UNION, tree, parent_tree, &changed)
         &&
-        gen_view_list_tree_surfaces_op(OP_DIFFERENCE, tree, parent_tree)
+        gen_view_list_tree_stage(OP_DIFFERENCE, tree, parent_tree, &changed)
         &&
-        gen_view_list_tree_surfaces_op(OP_INTERSECTION, tree, parent_tree);
+        gen_view_list_tree_stage(OP_INTERSECTION, tree, parent_tree, &changed);
+
+    // The tree mesh has been kept exact through the merges. Round it now it's finished.
+    // (the stage meshes are left exact, to carry on from next time)
+    if (tree == parent_tree && parent_tree->mesh != NULL)
+        mesh_round(parent_tree->mesh);
 
     suppress_drawing = FALSE;
     if (tree == parent_tree)
@@ -545,14 +1105,12 @@ gen_view_list_tree_surfaces(Group *tree, Group *parent_tree)
     return rc;
 }
 
-// Regenerate the view lists for all faces of a volume, and also do some special stuff that
-// only volumes need (initialise the vol surface mesh). Return TRUE if volume was regenerated,
-// or FALSE if everything was up to date.
-BOOL
-gen_view_list_vol(Volume *vol)
+// Get a volume ready for the view lists of its faces to be regenerated, and add the faces
+// to the growable array. Return FALSE if everything was up to date.
+static BOOL
+begin_gen_view_list_vol(Volume *vol, Face ***faces, int *n_faces, int *max_faces)
 {
     Face *f;
-    Bbox *box = &vol->bbox;
 
     for (f = (Face *)vol->faces.head; f != NULL; f = (Face *)f->hdr.next)
     {
@@ -572,24 +1130,104 @@ gen_view_list_vol(Volume *vol)
     // clear out the point bucket and free all its points
     free_bucket_points(vol->point_bucket);
 
+    // the face boxes will need refitting before the next pick
+    invalidate_bvh(vol);
+
     // create a new mesh
     if (vol->mesh != NULL)
         mesh_destroy(vol->mesh);
     vol->mesh = mesh_new(vol->material);
     vol->mesh_valid = FALSE;
 
-    // generate view lists for all the faces
+    // collect the faces to be generated
     for (f = (Face *)vol->faces.head; f != NULL; f = (Face *)f->hdr.next)
-        gen_view_list_face(f);
+    {
+        if (*n_faces >= *max_faces)
+        {
+            *max_faces = *max_faces == 0 ? 64 : *max_faces * 2;
+            *faces = realloc(*faces, *max_faces * sizeof(Face *));
+        }
+        (*faces)[(*n_faces)++] = f;
+    }
 
-    // update the volume bbox centre
-    box->xc = (box->xmin + box->xmax) / 2;
-    box->yc = (box->ymin + box->ymax) / 2;
-    box->zc = (box->zmin + box->zmax) / 2;
+    return TRUE;
+}
+
+// Update the bbox centres of the volumes of the given faces, after they have been generated.
+static void
+end_gen_view_list_vols(Face **faces, int n_faces)
+{
+    Bbox *box;
+    int i;
+
+    for (i = 0; i < n_faces; i++)
+    {
+        if (faces[i]->vol == NULL)
+            continue;
+        box = &faces[i]->vol->bbox;
+        box->xc = (box->xmin + box->xmax) / 2;
+        box->yc = (box->ymin + box->ymax) / 2;
+        box->zc = (box->zmin + box->zmax) / 2;
+    }
+}
+
+// Regenerate the view lists for all faces of a volume, and also do some special stuff that
+// only volumes need (initialise the vol surface mesh). Return TRUE if volume was regenerated,
+// or FALSE if everything was up to date. The faces are spread over worker threads.
+BOOL
+gen_view_list_vol(Volume *vol)
+{
+    Face **faces = NULL;
+    int n_faces = 0;
+    int max_faces = 0;
+
+    if (!begin_gen_view_list_vol(vol, &faces, &n_faces, &max_faces))
+        return FALSE;
+
+    gen_view_list_faces(faces, n_faces);
+    end_gen_view_list_vols(faces, n_faces);
+    free(faces);
 
     return TRUE;
 }
 
+// Collect the faces of all volumes in the tree, and in its groups, that need regenerating.
+static void
+begin_gen_view_list_tree(Group *tree, Face ***faces, int *n_faces, int *max_faces)
+{
+    Object *obj;
+
+    for (obj = tree->obj_list.head; obj != NULL; obj = obj->next)
+    {
+        if (obj->type == OBJ_VOLUME)
+            begin_gen_view_list_vol((Volume *)obj, faces, n_faces, max_faces);
+        else if (obj->type == OBJ_GROUP)
+            begin_gen_view_list_tree((Group *)obj, faces, n_faces, max_faces);
+    }
+}
+
+// Generate volume view lists (meshes) for all volumes in tree. Return TRUE if something new
+// was generated, FALSE if everything was up to date. The faces of all the volumes are
+// regenerated together first, so they can be spread over worker threads.
+BOOL
+gen_view_list_tree_volumes(Group *tree)
+{
+    Face **faces = NULL;
+    int n_faces = 0;
+    int max_faces = 0;
+    BOOL rc;
+
+    begin_gen_view_list_tree(tree, &faces, &n_faces, &max_faces);
+    gen_view_list_faces(faces, n_faces);
+    end_gen_view_list_vols(faces, n_faces);
+    free(faces);
+
+    rc = gen_view_list_tree_vols(tree);
+    if (gen_view_list_tree_instances(tree))
+        rc = TRUE;
+    return rc;
+}
+
 // Find the edge's endpoints in the face's already existing set of local normals.
 // Return TRUE if both are found.
 BOOL
@@ -629,9 +1267,9 @@ bez_interp(BezierEdge* be, float t)
 }
 
 // Regenerate the unclipped view list for a face. While here, also calculate the outward
-// normal for the face. 
+// normal for the face, and expand the given bbox (if any) to take in its points.
 void
-gen_view_list_face(Face* face)
+gen_view_list_face_box(Face* face, Bbox *box)
 {
     int i, j, c, bez_nsteps, side_nsteps;
     float step, t;
@@ -650,6 +1288,7 @@ gen_view_list_face(Face* face)
     Plane outward;
     BOOL inward;
     Point ed[4];
+    BezierEdge bez[4];
 
     //char buf[256];
 
@@ -691,8 +1330,8 @@ gen_view_list_face(Face* face)
         // Add points at tail of list, to preserve order
         // First the start point
         p = point_newpv(face->initial_point);
-        if (face->vol != NULL)
-            expand_bbox(&face->vol->bbox, p);
+        if (box != NULL)
+            expand_bbox(box, p);
         link_tail((Object*)p, list);
 
 #if DEBUG_VIEW_LIST_RECT_FACE
@@ -738,15 +1377,15 @@ gen_view_list_face(Face* face)
 
                     p = point_newpv(e->endpoints[idx]);
                     p->flags = FLAG_NEW_CONTOUR;
-                    if (face->vol != NULL)
-                        expand_bbox(&face->vol->bbox, p);
+                    if (box != NULL)
+                        expand_bbox(box, p);
                     link_tail((Object*)p, list);
                     last_point = e->endpoints[1 - idx];
                 }
 
                 p = point_newpv(last_point);
-                if (face->vol != NULL)
-                    expand_bbox(&face->vol->bbox, p);
+                if (box != NULL)
+                    expand_bbox(box, p);
                 link_tail((Object*)p, list);
                 break;
 
@@ -765,8 +1404,8 @@ gen_view_list_face(Face* face)
                     for (v = (Point*)e->view_list.head->next; v != NULL; v = (Point*)v->hdr.next)
                     {
                         p = point_newpv(v);
-                        if (face->vol != NULL)
-                            expand_bbox(&face->vol->bbox, p);
+                        if (box != NULL)
+                            expand_bbox(box, p);
                         link_tail((Object*)p, list);
                     }
                 }
@@ -779,15 +1418,15 @@ gen_view_list_face(Face* face)
                     for (v = (Point*)e->view_list.tail->prev; v != NULL; v = (Point*)v->hdr.prev)
                     {
                         p = point_newpv(v);
-                        if (face->vol != NULL)
-                            expand_bbox(&face->vol->bbox, p);
+                        if (box != NULL)
+                            expand_bbox(box, p);
                         link_tail((Object*)p, list);
                     }
                 }
 
                 p = point_newpv(last_point);
-                if (face->vol != NULL)
-                    expand_bbox(&face->vol->bbox, p);
+                if (box != NULL)
+                    expand_bbox(box, p);
                 link_tail((Object*)p, list);
                 break;
             }
@@ -796,9 +1435,6 @@ gen_view_list_face(Face* face)
         // calculate the normal vector.  Store a new refpt here too, in case something has moved.
         polygon_normal((Point*)face->view_list.head, &face->normal);
         face->normal.refpt = *face->edges[0]->endpoints[0];
-
-        // Update the 2D view list
-        update_view_list_2D(face);
         break;
 
     case FACE_CYLINDRICAL:
@@ -864,6 +1500,11 @@ gen_view_list_face(Face* face)
                 be = (BezierEdge*)e;
                 gen_view_list_bez(be);
 
+                // Order the control points in a copy of the edge, as the edge may be shared
+                // with a face that is being generated at the same time.
+                bez[i] = *be;
+                be = &bez[i];
+
             // fallthrough
 
             copy_view_list_cyl:
@@ -875,8 +1516,8 @@ gen_view_list_face(Face* face)
                     for (v = (Point*)e->view_list.head; v != NULL; v = (Point*)v->hdr.next)
                     {
                         p = point_newpv(v);
-                        if (face->vol != NULL)
-                            expand_bbox(&face->vol->bbox, p);
+                        if (box != NULL)
+                            expand_bbox(box, p);
                         link_tail((Object*)p, list);
                     }
 
@@ -900,8 +1541,8 @@ gen_view_list_face(Face* face)
                     for (v = (Point*)e->view_list.tail; v != NULL; v = (Point*)v->hdr.prev)
                     {
                         p = point_newpv(v);
-                        if (face->vol != NULL)
-                            expand_bbox(&face->vol->bbox, p);
+                        if (box != NULL)
+                            expand_bbox(box, p);
                         link_tail((Object*)p, list);
                     }
                     if ((e->type & ~EDGE_CONSTRUCTION) == EDGE_BEZIER)
@@ -990,7 +1631,7 @@ gen_view_list_face(Face* face)
                 goto free_up_cyl;      // no local normals if an arc is found
 
             case EDGE_BEZIER:
-                be = (BezierEdge*)e;
+                be = &bez[i];
 
                 cp[0][0].x = be->bezctl[0]->x;
                 cp[0][0].y = be->bezctl[0]->y;
@@ -1190,8 +1831,8 @@ gen_view_list_face(Face* face)
                     for (v = (Point*)e->view_list.head; v != NULL; v = (Point*)v->hdr.next)
                     {
                         p = point_newpv(v);
-                        if (face->vol != NULL)
-                            expand_bbox(&face->vol->bbox, p);
+                        if (box != NULL)
+                            expand_bbox(box, p);
                         link_tail((Object*)p, list);
                     }
                 }
@@ -1204,8 +1845,8 @@ gen_view_list_face(Face* face)
                     for (v = (Point*)e->view_list.tail; v != NULL; v = (Point*)v->hdr.prev)
                     {
                         p = point_newpv(v);
-                        if (face->vol != NULL)
-                            expand_bbox(&face->vol->bbox, p);
+                        if (box != NULL)
+                            expand_bbox(box, p);
                         link_tail((Object*)p, list);
                     }
                 }
@@ -1361,13 +2002,10 @@ gen_view_list_face(Face* face)
         s1 = (Point *)slists[1]->head->next;
         for (i = 1, t = step; i < side_nsteps; i++, t += step)
         {
-            ArcEdge* ae = (ArcEdge*)edge_new(EDGE_ARC);
+            ArcEdge* ae = (ArcEdge*)edge_newv(EDGE_ARC);     // Don't add this edge to the object tree.
             Edge* e = (Edge*)ae;
             Plane centreline;
 
-            // Don't add this edge to the object tree.
-            e->hdr.ID = 0;
-            objid--;
             ae->centre = point_newv(0, 0, 0);
             e->endpoints[0] = point_newpv(s0);
             e->endpoints[1] = point_newpv(s1);
@@ -1495,6 +2133,8 @@ gen_view_list_face(Face* face)
 
             ASSERT((e->type & ~EDGE_CONSTRUCTION) == EDGE_BEZIER, "Should only be bezier edges in here");
             gen_view_list_bez(be);
+            bez[i] = *be;               // order the control points in a copy, as in the cylinder case
+            be = &bez[i];
 
             if (last_point == e->endpoints[c])
             {
@@ -1504,8 +2144,8 @@ gen_view_list_face(Face* face)
                 for (v = (Point*)e->view_list.head; v != NULL; v = (Point*)v->hdr.next)
                 {
                     p = point_newpv(v);
-                    if (face->vol != NULL)
-                        expand_bbox(&face->vol->bbox, p);
+                    if (box != NULL)
+                        expand_bbox(box, p);
                     link_tail((Object*)p, list);
                 }
 
@@ -1524,8 +2164,8 @@ gen_view_list_face(Face* face)
                 for (v = (Point*)e->view_list.tail; v != NULL; v = (Point*)v->hdr.prev)
                 {
                     p = point_newpv(v);
-                    if (face->vol != NULL)
-                        expand_bbox(&face->vol->bbox, p);
+                    if (box != NULL)
+                        expand_bbox(box, p);
                     link_tail((Object*)p, list);
                 }
                 be->bezctl[0] = e->endpoints[1];
@@ -1567,9 +2207,9 @@ gen_view_list_face(Face* face)
         // Get together the 16 control points for the bezier surface. Each one has the (u,v) of the
         // point on the surface, as well as the underlying control point, to help calculation of
         // their local normals later on. (a NULL point means we don't need the normal)
-        be = (BezierEdge*)face->edges[3];
-        be0 = (BezierEdge*)face->edges[0];
-        be2 = (BezierEdge*)face->edges[2];
+        be = &bez[3];
+        be0 = &bez[0];
+        be2 = &bez[2];
 
         cp[0][0].x = be->bezctl[0]->x;
         cp[0][0].y = be->bezctl[0]->y;
@@ -1635,7 +2275,7 @@ gen_view_list_face(Face* face)
         cp[3][1].v = be2->t1;
         cp[3][1].p = be2->bezctl[1];
 
-        be = (BezierEdge*)face->edges[1];
+        be = &bez[1];
         cp[0][2].x = be0->bezctl[2]->x;
         cp[0][2].y = be0->bezctl[2]->y;
         cp[0][2].z = be0->bezctl[2]->z;
@@ -1876,49 +2516,131 @@ gen_view_list_face(Face* face)
         break;
     }
 
+    // Pack the points into the view arrays, and free them.
+    pack_view_list(face);
+    free_point_list(&face->view_list);
+
     // The view list is valid, as is the 2D view list, the face normal, and the face's
     // contribution to the volume bounding bbox.
     face->view_valid = TRUE;
     return;
 }
 
+// Regenerate the unclipped view list for a face, expanding its volume's bbox.
+void
+gen_view_list_face(Face* face)
+{
+    gen_view_list_face_box(face, face->vol != NULL ? &face->vol->bbox : NULL);
+}
+
+// Start a new run in the face's packed view list, at the next point to be added.
+static ViewRun *
+add_view_run(Face *face, PFLAG flag)
+{
+    ViewRun *run;
+
+    if (face->n_view_runs >= face->n_alloc_view_runs)
+    {
+        face->n_alloc_view_runs = face->n_alloc_view_runs == 0 ? 4 : face->n_alloc_view_runs * 2;
+        face->view_runs = realloc(face->view_runs, face->n_alloc_view_runs * sizeof(ViewRun));
+    }
+    run = &face->view_runs[face->n_view_runs++];
+    run->first = face->n_view;
+    run->flag = flag;
+    run->A = run->B = run->C = 0;
+
+    return run;
+}
+
+// Pack the face's view list points into its view arrays. Facet normal points are not
+// copied; they start a new run holding the normal. Contour starts also begin a new run.
+// The list is only followed forwards, as rects and hexes being drawn in only link their
+// points that way. The 2D view list is updated, and the triangles will be regenerated.
+void
+pack_view_list(Face *face)
+{
+    Point *v;
+    ViewRun *run;
+    int n;
+
+    for (n = 0, v = (Point *)face->view_list.head; v != NULL; v = (Point *)v->hdr.next)
+        n++;
+    if (n > face->n_alloc_view)
+    {
+        while (n > face->n_alloc_view)
+            face->n_alloc_view = face->n_alloc_view == 0 ? 16 : face->n_alloc_view * 2;
+        free(face->view_x);
+        face->view_x = malloc(3 * face->n_alloc_view * sizeof(float));
+        face->view_y = face->view_x + face->n_alloc_view;
+        face->view_z = face->view_y + face->n_alloc_view;
+    }
+
+    face->n_view = 0;
+    face->n_view_runs = 0;
+    for (v = (Point *)face->view_list.head; v != NULL; v = (Point *)v->hdr.next)
+    {
+        if (v->flags == FLAG_NEW_FACET)
+        {
+            run = add_view_run(face, FLAG_NEW_FACET);
+            run->A = v->x;
+            run->B = v->y;
+            run->C = v->z;
+            continue;
+        }
+
+        // Don't start a contour run where a facet run has just started
+        if (face->n_view_runs == 0)
+            add_view_run(face, FLAG_NONE);
+        else if (v->flags == FLAG_NEW_CONTOUR && face->view_runs[face->n_view_runs - 1].first != face->n_view)
+            add_view_run(face, FLAG_NEW_CONTOUR);
+
+        face->view_x[face->n_view] = v->x;
+        face->view_y[face->n_view] = v->y;
+        face->view_z[face->n_view] = v->z;
+        face->n_view++;
+    }
+
+    face->tri_valid = FALSE;
+    update_view_list_2D(face);
+}
+
 void
 update_view_list_2D(Face *face)
 {
     int i;
-    Point *v;
+    float a, b, c;
 
     // Update the 2D view list as seen from the facing plane closest to the face normal,
     // to facilitate quick point-in-polygon testing.
     if (!IS_FLAT(face))
         return;
 
-    for (i = 0, v = (Point *)face->view_list.head; v != NULL; v = (Point *)v->hdr.next, i++)
+    if (face->n_view >= face->n_alloc2D)
     {
-        float a = fabsf(face->normal.A);
-        float b = fabsf(face->normal.B);
-        float c = fabsf(face->normal.C);
+        while (face->n_view >= face->n_alloc2D)
+            face->n_alloc2D *= 2;
+        face->view_list2D = realloc(face->view_list2D, face->n_alloc2D * sizeof(Point2D));
+    }
 
+    a = fabsf(face->normal.A);
+    b = fabsf(face->normal.B);
+    c = fabsf(face->normal.C);
+    for (i = 0; i < face->n_view; i++)
+    {
         if (c > b && c > a)
         {
-            face->view_list2D[i].x = v->x;
-            face->view_list2D[i].y = v->y;
+            face->view_list2D[i].x = face->view_x[i];
+            face->view_list2D[i].y = face->view_y[i];
         }
         else if (b > a && b > c)
         {
-            face->view_list2D[i].x = v->x;
-            face->view_list2D[i].y = v->z;
+            face->view_list2D[i].x = face->view_x[i];
+            face->view_list2D[i].y = face->view_z[i];
         }
         else
         {
-            face->view_list2D[i].x = v->y;
-            face->view_list2D[i].y = v->z;
-        }
-
-        if (i == face->n_alloc2D - 1)
-        {
-            face->n_alloc2D *= 2;
-            face->view_list2D = realloc(face->view_list2D, face->n_alloc2D * sizeof(Point2D));
+            face->view_list2D[i].x = face->view_y[i];
+            face->view_list2D[i].y = face->view_z[i];
         }
     }
     face->view_list2D[i] = face->view_list2D[0];    // copy first point for fast poly testing
@@ -1951,20 +2673,20 @@ adjust_stepsizes(Object *obj, float new_tol)
             ae = (ArcEdge*)e;
 
             // Protect against doing this twice for shared edges.
-            if (ae->centre->moved)
+            if (IS_MOVED(ae->centre))
                 break;
             e->nsteps = (int)(e->stepsize * factor + 0.99f);
             e->stepsize /= factor;
-            ae->centre->moved = TRUE;
+            SET_MOVED(ae->centre);
             break;
 
         case EDGE_BEZIER:
             be = (BezierEdge*)e;
-            if (be->ctrlpoints[0]->moved)
+            if (IS_MOVED(be->ctrlpoints[0]))
                 break;
             e->nsteps = (int)(e->stepsize * factor + 0.99f);
             e->stepsize /= factor;
-            be->ctrlpoints[0]->moved = TRUE;
+            SET_MOVED(be->ctrlpoints[0]);
             break;
         }
         break;
@@ -1995,7 +2717,10 @@ free_view_list_face(Face *face)
 {
     free_point_list(&face->view_list);
     face->view_valid = FALSE;
+    face->n_view = 0;
+    face->n_view_runs = 0;
     face->n_view2D = 0;
+    face->tri_valid = FALSE;
 }
 
 void
@@ -2285,39 +3010,79 @@ gen_view_list_bez(BezierEdge *be)
 }
 
 
-    // callbacks for rendering tessellated stuff to GL
-void 
-render_beginData(GLenum type, void * polygon_data)
+// Face triangle buffers. Each face is tessellated once into an array of vertices
+// (with their normals) and an array of triangle indices into it, which are kept with
+// the face until its view list is freed. The face is then drawn from the arrays.
+// The vertex data passed through the tessellator is the vertex index plus one.
+
+// What we are building, passed as the tessellator's polygon data.
+typedef struct TriBuild
 {
-    Plane *norm = (Plane *)polygon_data;
+    Face    *face;
+    Plane   *norm;          // Normal of the current facet
+} TriBuild;
 
-    glNormal3f(norm->A, norm->B, norm->C); 
-    glBegin(type);
+// Add a vertex to the face's triangle buffer, and return its index.
+static int
+tri_add_vertex(Face *face, float x, float y, float z, Plane *norm)
+{
+    float *v;
+
+    if (face->n_tri_verts >= face->n_alloc_tri_verts)
+    {
+        face->n_alloc_tri_verts = face->n_alloc_tri_verts == 0 ? 16 : face->n_alloc_tri_verts * 2;
+        face->tri_verts = realloc(face->tri_verts, face->n_alloc_tri_verts * 6 * sizeof(float));
+    }
+    v = &face->tri_verts[face->n_tri_verts * 6];
+    v[0] = x;
+    v[1] = y;
+    v[2] = z;
+    v[3] = norm->A;
+    v[4] = norm->B;
+    v[5] = norm->C;
+
+    return face->n_tri_verts++;
+}
+
+    // callbacks for tessellating faces into their triangle buffers
+void 
+tri_beginData(GLenum type, void * polygon_data)
+{
+    // Always GL_TRIANGLES, as there is an edge flag callback
 }
 
 void 
-render_vertexData(void * vertex_data, void * polygon_data)
+tri_vertexData(void * vertex_data, void * polygon_data)
 {
-    Point *v = (Point *)vertex_data;
+    Face *face = ((TriBuild *)polygon_data)->face;
 
-    glVertex3d(v->x, v->y, v->z);
+    if (face->n_tri_index >= face->n_alloc_tri_index)
+    {
+        face->n_alloc_tri_index = face->n_alloc_tri_index == 0 ? 48 : face->n_alloc_tri_index * 2;
+        face->tri_index = realloc(face->tri_index, face->n_alloc_tri_index * sizeof(unsigned int));
+    }
+    face->tri_index[face->n_tri_index++] = (unsigned int)((INT_PTR)vertex_data - 1);
 }
 
 void 
-render_endData(void * polygon_data)
+tri_endData(void * polygon_data)
+{
+}
+
+void
+tri_edgeFlagData(GLboolean flag, void * polygon_data)
 {
-    glEnd();
 }
 
 void 
-render_combineData(GLdouble coords[3], void *vertex_data[4], GLfloat weight[4], void **outData, void * polygon_data)
+tri_combineData(GLdouble coords[3], void *vertex_data[4], GLfloat weight[4], void **outData, void * polygon_data)
 {
-    // Allocate a new Point for the new vertex, and (TODO:) hang it off the face's spare vertices list.
-    // It will be freed when the view list is regenerated.
-    *outData = point_newv((float)coords[0], (float)coords[1], (float)coords[2]);;
+    TriBuild *tb = (TriBuild *)polygon_data;
+
+    *outData = (void *)(INT_PTR)(tri_add_vertex(tb->face, (float)coords[0], (float)coords[1], (float)coords[2], tb->norm) + 1);
 }
 
-void render_errorData(GLenum errno, void * polygon_data)
+void tri_errorData(GLenum errno, void * polygon_data)
 {
     ASSERT(FALSE, "tesselator error");
 }
@@ -2339,70 +3104,112 @@ void
 init_triangulator(void)
 {
     rtess = gluNewTess();
-    gluTessCallback(rtess, GLU_TESS_BEGIN_DATA, (void(__stdcall *)(void))render_beginData);
-    gluTessCallback(rtess, GLU_TESS_VERTEX_DATA, (void(__stdcall *)(void))render_vertexData);
-    gluTessCallback(rtess, GLU_TESS_END_DATA, (void(__stdcall *)(void))render_endData);
-    gluTessCallback(rtess, GLU_TESS_COMBINE_DATA, (void(__stdcall *)(void))render_combineData);
-    gluTessCallback(rtess, GLU_TESS_ERROR_DATA, (void(__stdcall *)(void))render_errorData);
-
-    init_clip_tess();
+    gluTessCallback(rtess, GLU_TESS_BEGIN_DATA, (void(__stdcall *)(void))tri_beginData);
+    gluTessCallback(rtess, GLU_TESS_VERTEX_DATA, (void(__stdcall *)(void))tri_vertexData);
+    gluTessCallback(rtess, GLU_TESS_END_DATA, (void(__stdcall *)(void))tri_endData);
+    gluTessCallback(rtess, GLU_TESS_EDGE_FLAG_DATA, (void(__stdcall *)(void))tri_edgeFlagData);
+    gluTessCallback(rtess, GLU_TESS_COMBINE_DATA, (void(__stdcall *)(void))tri_combineData);
+    gluTessCallback(rtess, GLU_TESS_ERROR_DATA, (void(__stdcall *)(void))tri_errorData);
 }
 
-// Shade in a face by triangulating its view list. The view list is assumed up to date.
-void
-face_shade(GLUtesselator *tess, Face *face, PRESENTATION pres, BOOL locked)
+// Tessellate a face's view list into its triangle buffer. The view list is assumed up to date.
+static void
+face_triangulate(GLUtesselator *tess, Face *face)
 {
-    Point   *v, *vfirst;
+    ViewRun *run;
     Plane norm;
+    TriBuild tb;
+    double coords[3];
+    int index, i, r, c, first, end;
 
-#ifdef DEBUG_FACE_SHADE
-    Log("Face view list:\r\n");
-    for (v = face->view_list; v->hdr.next != NULL; v = (Point *)v->hdr.next)
-    {
-        char buf[64];
-        sprintf_s(buf, 64, "%d %f %f %f\r\n", v->flags, v->x, v->y, v->z);
-        Log(buf);
-    }
-#endif       
-    color((Object *)face, face->type & FACE_CONSTRUCTION, pres, locked);
+    face->n_tri_verts = 0;
+    face->n_tri_index = 0;
+    tb.face = face;
+    tb.norm = &norm;
 
     // If there are no facets, just use the face normal
     norm = face->normal;
-    v = (Point *)face->view_list.head;
-    while (v != NULL)
+    r = 0;
+    while (r < face->n_view_runs)
     {
-        if (v->flags == FLAG_NEW_FACET)
+        // Each facet is a polygon, and its following contour runs are contours within it.
+        run = &face->view_runs[r];
+        if (run->flag == FLAG_NEW_FACET)
         {
-            norm.A = v->x;
-            norm.B = v->y;
-            norm.C = v->z;
-            v = (Point *)v->hdr.next;
+            norm.A = run->A;
+            norm.B = run->B;
+            norm.C = run->C;
         }
-        vfirst = v;
-        gluTessBeginPolygon(tess, &norm);
+        first = run->first;
+        c = ++r;
+        while (r < face->n_view_runs && face->view_runs[r].flag == FLAG_NEW_CONTOUR)
+            r++;
+        end = r < face->n_view_runs ? face->view_runs[r].first : face->n_view;
+
+        gluTessBeginPolygon(tess, &tb);
         gluTessBeginContour(tess);
-        while (VALID_VP(v))
+        for (i = first; i < end; )
         {
-            if (v->flags == FLAG_NEW_CONTOUR)
+            if (c < r && i >= face->view_runs[c].first)
             {
                 gluTessEndContour(tess);
                 gluTessBeginContour(tess);
+                while (c < r && i >= face->view_runs[c].first)
+                    c++;
             }
 
-            tess_vertex(tess, v);
+            index = tri_add_vertex(face, face->view_x[i], face->view_y[i], face->view_z[i], &norm);
+            coords[0] = face->view_x[i];
+            coords[1] = face->view_y[i];
+            coords[2] = face->view_z[i];
+            gluTessVertex(tess, coords, (void *)(INT_PTR)(index + 1));
 
             // Skip coincident points for robustness (don't create zero-area triangles)
-            while (v->hdr.next != NULL && near_pt(v, (Point *)v->hdr.next, SMALL_COORD))
-                v = (Point *)v->hdr.next;
+            while (i + 1 < end && near_view_pt(face, i, i + 1, SMALL_COORD))
+                i++;
 
-            v = (Point *)v->hdr.next;
+            i++;
                 
             // If face(t) is closed, skip the closing point. Watch for dups at the end.
-            while (v != NULL && near_pt(v, vfirst, SMALL_COORD))
-                v = (Point *)v->hdr.next;
+            while (i < end && near_view_pt(face, i, first, SMALL_COORD))
+                i++;
         }
         gluTessEndContour(tess);
         gluTessEndPolygon(tess);
     }
+
+    face->tri_valid = TRUE;
+}
+
+// Shade in a face from its triangle buffer, tessellating it first if needed.
+// The view list is assumed up to date.
+void
+face_shade(GLUtesselator *tess, Face *face, PRESENTATION pres, BOOL locked)
+{
+#ifdef DEBUG_FACE_SHADE
+    int     i;
+
+    Log("Face view list:\r\n");
+    for (i = 0; i < face->n_view; i++)
+    {
+        char buf[64];
+        sprintf_s(buf, 64, "%d %f %f %f\r\n", i, face->view_x[i], face->view_y[i], face->view_z[i]);
+        Log(buf);
+    }
+#endif       
+    color((Object *)face, face->type & FACE_CONSTRUCTION, pres, locked);
+
+    if (!face->tri_valid)
+        face_triangulate(tess, face);
+    if (face->n_tri_index == 0)
+        return;
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glVertexPointer(3, GL_FLOAT, 6 * sizeof(float), face->tri_verts);
+    glNormalPointer(GL_FLOAT, 6 * sizeof(float), &face->tri_verts[3]);
+    glDrawElements(GL_TRIANGLES, face->n_tri_index, GL_UNSIGNED_INT, face->tri_index);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
 }
 
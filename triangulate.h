@@ -6,6 +6,16 @@
 // View list point is valid coordinate for continuing a contour
 #define VALID_VP(v) ((v) != NULL && (v)->flags != FLAG_NEW_FACET)
 
+// Two points in a face's packed view list are coincident
+#define near_view_pt(f, i, j, tol) \
+    (   \
+        fabsf((f)->view_x[i] - (f)->view_x[j]) < tol  \
+        &&  \
+        fabsf((f)->view_y[i] - (f)->view_y[j]) < tol  \
+        &&  \
+        fabsf((f)->view_z[i] - (f)->view_z[j]) < tol  \
+    )
+
 
 // Bounding boxes
 void clear_bbox(Bbox *box);
@@ -18,6 +28,8 @@ BOOL in_bbox(Point* pt, Bbox* box, float tol);
 // Regenerate a view list
 void invalidate_all_view_lists(Object *parent, Object *obj, float dx, float dy, float dz);
 void gen_view_list_face(Face *face);
+void gen_view_list_face_box(Face *face, Bbox *box);
+void pack_view_list(Face *face);
 void update_view_list_2D(Face *face);
 void gen_view_list_arc(ArcEdge *ae);
 void gen_view_list_bez(BezierEdge *be);
@@ -29,16 +41,45 @@ void adjust_stepsizes(Object* obj, float new_tol);
 BOOL gen_view_list_vol(Volume *vol);
 BOOL gen_view_list_tree_volumes(Group *tree);
 BOOL gen_view_list_tree_surfaces(Group *tree, Group *parent_tree);
+void free_stage_meshes(Group *group);
 BOOL mesh_merge_op(OPERATION op, Mesh *mesh1, Mesh *mesh2);
 
+// Don't use more worker threads than this, whatever the processor count.
+#define MAX_WORKER_THREADS  16
+
+// Balanced parallel merging of meshes (mergetree.c)
+BOOL mesh_union_balanced(Mesh **meshes, int n, Mesh **result);
+int worker_thread_count(void);
+
+// A batch of triangles from one face. Each triangle is 3 indices into the face's view arrays.
+typedef struct TriBatch
+{
+    int     *tri;
+    int     nt;
+    int     n_alloc;
+} TriBatch;
+
+// Parallel generation of face view lists and triangles (viewthreads.c)
+void gen_view_list_faces(Face **faces, int n);
+void triangulate_faces(Face **faces, TriBatch *batches, int n);
+
+// Triangulate a face by ear clipping (earclip.c)
+void triangulate_face(Face *face, TriBatch *batch);
+
 // Clip a view list (clipviewlist.c)
-void init_clip_tess(void);
-void gen_view_list_surface(Face *face);
+void gen_view_list_surfaces(Volume *vol);
 
 // Mesh functions, and interface to CGAL (mesh.cpp) 
 // NOTE: DO NOT include mesh.h in any C files.
 Mesh *mesh_new(int material);
+Mesh *mesh_new_from_arrays(int material, float *xyz, int nv, int *tri, int nt, int *n_skipped);
+int mesh_add_arrays(Mesh *mesh, float *xyz, int nv, int *tri, int nt);
+void mesh_get_arrays(Mesh *mesh, float **xyz, int *nv, int **tri, int *nt);
 Mesh *mesh_copy(Mesh *from);
+BOOL mesh_split_by_material(Mesh *mesh, Mesh **parts, int n_parts);
+void mesh_translate(Mesh *mesh, double dx, double dy, double dz);
+void mesh_transform(Mesh *mesh, double m[12], BOOL reflect);
+void mesh_round(Mesh *mesh);
 void mesh_destroy(Mesh *mesh);
 void mesh_add_vertex(Mesh *mesh, double x, double y, double z, Vertex_index *vi);
 void mesh_add_face(Mesh *mesh, Vertex_index *v1, Vertex_index *v2, Vertex_index *v3, Face_index *fi);
@@ -63,6 +104,14 @@ int mesh_check_for_manifold(Mesh* mesh);
 int mesh_duplicate_non_manifold_vertices(Mesh* mesh);
 int mesh_self_intersections(Mesh* mesh);
 int mesh_repair_self_intersections(Mesh* mesh);
+void mesh_write_binary(Mesh* mesh, FILE* f);
+Mesh* mesh_read_binary(FILE* f);
+
+// Persistent mesh cache (meshcache.c)
+void mesh_cache_open(char *filename);
+void mesh_cache_close(void);
+void mesh_cache_save(Group *tree, char *filename);
+BOOL mesh_cache_lookup(Object *obj);
 
 // Triangulate and render
 void init_triangulator(void);
@@ -76,6 +125,7 @@ void mesh_write_off(char* prefix, int id, Mesh* mesh);
 
 // Import from STL and various formats (import.c)
 BOOL read_stl_to_group(Group *group, char *filename);
+void expand_mesh_volume(Volume *vol);
 BOOL read_amf_to_group(Group* group, char* filename);
 BOOL read_obj_to_group(Group* group, char* filename);
 BOOL read_off_to_group(Group* group, char* filename);
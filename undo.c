@@ -0,0 +1,1206 @@
+#include "stdafx.h"
+#include "LoftyCAD.h"
+#include <stdio.h>
+
+// Undo journal.
+//
+// Instead of writing the whole tree out to a checkpoint file on every change, and reading
+// it all back in to undo a step, keep an in-memory journal of just the top-level objects
+// that each change touched.
+//
+// A shadow table holds, for each top-level object in the tree, a copy of it as at the last
+// checkpoint and a hash of its contents. At each checkpoint the tree's top-level objects
+// are hashed, and those whose hash has changed (or that have been added or deleted) go into
+// an undo record, which holds the copies of their previous states. Undoing a record swaps
+// the objects in the tree with the ones held in the record, so the record then holds what
+// is needed to redo it. Undo and redo only touch the objects that changed.
+//
+// The records are limited to UNDO_MEMORY bytes (approximately). When the limit is exceeded
+// the oldest records are spilled to disk (if undo_spill is set) or forgotten.
+//
+// Each generation also keeps the state of the drawing that is not in its objects (title,
+// settings, materials, clip plane, selection and path). A change to the settings makes an
+// undo step, like a change to an object; a change to the selection or path alone does not,
+// but is remembered against the current generation.
+
+// Approximate memory that may be held by undo records before old ones are spilled
+#define UNDO_MEMORY     (64 * 1024 * 1024)
+
+// One top-level object changed by an undo record.
+typedef struct UndoEntry
+{
+    unsigned int    id;             // ID of the top-level object
+    Object          *obj;           // The state of the object that is not in the tree,
+                                    // or NULL if it is not there at all
+    int             size;           // Approximate memory used by obj
+    int             pos;            // Position of obj in the tree's list, when it is put back
+    BOOL            in_file;        // obj has been spilled to the record's file
+} UndoEntry;
+
+// A selected object, by its ID and the ID of the top-level object it belongs to.
+typedef struct SelRef
+{
+    unsigned int    id;
+    unsigned int    top;
+    int             index;          // Its place in the selection
+} SelRef;
+
+// The state of the drawing apart from its objects. The selection and path are
+// kept by ID, as the objects they point to may be swapped in and out.
+typedef struct UndoState
+{
+    BOOL            valid;          // FALSE if never captured (e.g. a new drawing)
+    char            title[256];
+    float           half_size;
+    float           grid_snap;
+    float           tolerance;
+    int             angle_snap;
+    float           round_rad;
+    float           default_stepsize;
+    Material        materials[MAX_MATERIAL];
+    Plane           clip_plane;
+    BOOL            view_clipped;
+    BOOL            draw_on_clip_plane;
+    SelRef          *sel;           // The selection
+    int             n_sel;
+    unsigned int    path_id;        // ID of the current path (0 if none)
+    unsigned int    path_top;       // ID of its top-level object
+} UndoState;
+
+// The changes going from generation - 1 to generation.
+typedef struct UndoRecord
+{
+    int             generation;     // The generation this record moves to
+    UndoEntry       *entries;       // Array of the objects changed
+    int             n_entries;
+    int             n_alloc;
+    int             size;           // Total memory used by the entries' objects
+    BOOL            spilled;        // The objects have been written to spill_file
+    char            spill_file[256];
+    UndoState       state;          // The state at this generation (never spilled)
+} UndoRecord;
+
+// A top-level object as at the last checkpoint.
+typedef struct Shadow
+{
+    unsigned int    id;             // ID of the top-level object
+    unsigned __int64 hash;          // Hash of its contents
+    Object          *copy;          // A copy of it
+    int             size;           // Approximate memory used by the copy
+    int             pos;            // Its position in the tree's list
+    int             seen;           // Stamp of the last checkpoint that saw it in the tree
+} Shadow;
+
+// The records, oldest first. Their generations are consecutive.
+static UndoRecord *records = NULL;
+static int n_records = 0;
+static int max_records = 0;
+static int records_size = 0;        // Memory used by records not spilled
+
+// The generation the tree is currently at, as far as the journal is concerned.
+static int journal_generation = 0;
+
+// The state at the generation before the oldest record (or the current generation,
+// if there are no records).
+static UndoState base_state = { 0, };
+
+// The shadow table, and its hash index (of shadow indices, or -1).
+static Shadow *shadows = NULL;
+static int n_shadows = 0;
+static int max_shadows = 0;
+static int *shadow_slots = NULL;
+static int n_shadow_slots = 0;
+static int shadow_stamp = 0;
+
+// Hash (FNV-1a) some bytes into a running hash.
+static void
+hash_bytes(unsigned __int64 *h, void *data, int len)
+{
+    unsigned char *p = (unsigned char *)data;
+    int i;
+
+    for (i = 0; i < len; i++)
+    {
+        *h ^= p[i];
+        *h *= 0x100000001B3ULL;
+    }
+}
+
+#define HASH_VAL(h, v)      hash_bytes((h), &(v), sizeof(v))
+
+static void
+hash_point(unsigned __int64 *h, Point *p)
+{
+    HASH_VAL(h, p->x);
+    HASH_VAL(h, p->y);
+    HASH_VAL(h, p->z);
+}
+
+// Hash everything about an object that is written out when it is serialised, and
+// accumulate the approximate memory its copy would take.
+static void
+hash_obj(Object *obj, unsigned __int64 *h, int *size)
+{
+    Edge *e;
+    ArcEdge *ae;
+    BezierEdge *be;
+    Face *face;
+    Volume *vol;
+    Group *group;
+    Instance *inst;
+    Object *o;
+    EDGE type;
+    int i, nf;
+
+    HASH_VAL(h, obj->type);
+    HASH_VAL(h, obj->lock);
+    HASH_VAL(h, obj->show_dims);
+    switch (obj->type)
+    {
+    case OBJ_POINT:
+        hash_point(h, (Point *)obj);
+        *size += sizeof(Point);
+        break;
+
+    case OBJ_EDGE:
+        e = (Edge *)obj;
+        HASH_VAL(h, e->type);
+        HASH_VAL(h, e->corner);
+        HASH_VAL(h, e->nsteps);
+        hash_point(h, e->endpoints[0]);
+        hash_point(h, e->endpoints[1]);
+        *size += sizeof(ArcEdge) + 2 * sizeof(Point);
+        type = e->type & ~EDGE_CONSTRUCTION;
+        switch (type)
+        {
+        case EDGE_ARC:
+            ae = (ArcEdge *)e;
+            hash_point(h, ae->centre);
+            HASH_VAL(h, ae->clockwise);
+            HASH_VAL(h, ae->normal.A);
+            HASH_VAL(h, ae->normal.B);
+            HASH_VAL(h, ae->normal.C);
+            HASH_VAL(h, ae->ecc);
+            *size += sizeof(Point);
+            break;
+
+        case EDGE_BEZIER:
+            be = (BezierEdge *)e;
+            hash_point(h, be->ctrlpoints[0]);
+            hash_point(h, be->ctrlpoints[1]);
+            *size += 2 * sizeof(Point);
+            break;
+        }
+        break;
+
+    case OBJ_FACE:
+        face = (Face *)obj;
+        HASH_VAL(h, face->type);
+        HASH_VAL(h, face->corner);
+        HASH_VAL(h, face->n_edges);
+        HASH_VAL(h, face->n_contours);
+        hash_point(h, face->initial_point);
+        for (i = 0; i < face->n_edges; i++)
+            hash_obj((Object *)face->edges[i], h, size);
+        if (face->n_contours != 0)
+            hash_bytes(h, face->contours, face->n_contours * sizeof(Contour));
+        if (face->text != NULL)
+        {
+            hash_bytes(h, face->text->string, strlen(face->text->string));
+            hash_bytes(h, face->text->font, strlen(face->text->font));
+            HASH_VAL(h, face->text->bold);
+            HASH_VAL(h, face->text->italic);
+            hash_point(h, &face->text->origin);
+            hash_point(h, &face->text->endpt);
+            *size += sizeof(Text);
+        }
+        *size += sizeof(Face) + face->max_edges * sizeof(Edge *);
+        break;
+
+    case OBJ_VOLUME:
+        vol = (Volume *)obj;
+        HASH_VAL(h, vol->op);
+        HASH_VAL(h, vol->material);
+        HASH_VAL(h, vol->mesh_only);
+        if (vol->mesh_only)
+        {
+            // The mesh is only ever moved as a whole, so its box and size will do.
+            nf = mesh_num_faces(vol->mesh);
+            HASH_VAL(h, nf);
+            hash_bytes(h, &vol->bbox, sizeof(Bbox));
+            *size += nf * 64;
+        }
+        for (face = (Face *)vol->faces.head; face != NULL; face = (Face *)face->hdr.next)
+            hash_obj((Object *)face, h, size);
+        *size += sizeof(Volume);
+        break;
+
+    case OBJ_GROUP:
+        group = (Group *)obj;
+        HASH_VAL(h, group->op);
+        HASH_VAL(h, group->n_members);
+        hash_bytes(h, group->title, strlen(group->title));
+        if (group->loft != NULL)
+            hash_bytes(h, group->loft, sizeof(LoftParams) + group->loft->n_bays * sizeof(float));
+        for (o = group->obj_list.head; o != NULL; o = o->next)
+            hash_obj(o, h, size);
+        *size += sizeof(Group);
+        break;
+
+    case OBJ_INSTANCE:
+        inst = (Instance *)obj;
+        HASH_VAL(h, inst->op);
+        HASH_VAL(h, inst->source_id);
+        hash_bytes(h, inst->xform, 12 * sizeof(double));
+        *size += sizeof(Instance);
+        break;
+    }
+}
+
+// Give the volumes and groups in a copy the same ID's as the originals, so instances
+// (which find their sources by ID) still find them when the copy is swapped back in.
+static void
+keep_source_ids(Object *obj, Object *copy)
+{
+    Object *o, *c;
+
+    copy->ID = obj->ID;
+    switch (obj->type)
+    {
+    case OBJ_GROUP:
+        c = ((Group *)copy)->obj_list.head;
+        for (o = ((Group *)obj)->obj_list.head; o != NULL && c != NULL; o = o->next, c = c->next)
+        {
+            if (o->type == OBJ_VOLUME || o->type == OBJ_GROUP || o->type == OBJ_INSTANCE)
+                keep_source_ids(o, c);
+        }
+        break;
+
+    case OBJ_INSTANCE:
+        ((Instance *)copy)->source_id = ((Instance *)obj)->source_id;
+        break;
+    }
+}
+
+// Copy an object for the journal.
+static Object *
+snapshot(Object *obj)
+{
+    Object *copy = copy_obj(obj, 0, 0, 0, FALSE);
+
+    clear_move_copy_flags(obj);
+    keep_source_ids(obj, copy);
+    return copy;
+}
+
+// Find the top-level object an object belongs to. Members of groups can go up
+// through their parent groups; anything else has to be searched for.
+static Object *
+top_of(Object *obj, Group *tree)
+{
+    Object *o;
+
+    for (o = obj; o->parent_group != NULL; o = (Object *)o->parent_group)
+    {
+        if (o->parent_group == tree)
+            return o;
+    }
+    return find_top_level_parent(obj);
+}
+
+// Find an object by ID within a top-level object.
+static Object *
+find_in_top(Object *obj, unsigned int id)
+{
+    Object *o, *found;
+    Face *face;
+    Edge *e;
+    int i;
+
+    if (obj->ID == id)
+        return obj;
+    found = NULL;
+    switch (obj->type)
+    {
+    case OBJ_GROUP:
+        for (o = ((Group *)obj)->obj_list.head; o != NULL && found == NULL; o = o->next)
+            found = find_in_top(o, id);
+        break;
+
+    case OBJ_VOLUME:
+        for (o = ((Volume *)obj)->faces.head; o != NULL && found == NULL; o = o->next)
+            found = find_in_top(o, id);
+        break;
+
+    case OBJ_FACE:
+        face = (Face *)obj;
+        for (i = 0; i < face->n_edges && found == NULL; i++)
+            found = find_in_top((Object *)face->edges[i], id);
+        break;
+
+    case OBJ_EDGE:
+        e = (Edge *)obj;
+        if (e->endpoints[0]->hdr.ID == id)
+            found = (Object *)e->endpoints[0];
+        else if (e->endpoints[1]->hdr.ID == id)
+            found = (Object *)e->endpoints[1];
+        break;
+    }
+    return found;
+}
+
+// Free the selection held in a state.
+static void
+free_state(UndoState *st)
+{
+    free(st->sel);
+    st->sel = NULL;
+    st->n_sel = 0;
+}
+
+// Capture the state of the drawing apart from its objects.
+static void
+capture_state(UndoState *st, Group *tree)
+{
+    Object *obj, *top;
+    int n;
+
+    st->valid = TRUE;
+    strcpy_s(st->title, 256, tree->title);
+    st->half_size = half_size;
+    st->grid_snap = grid_snap;
+    st->tolerance = tolerance;
+    st->angle_snap = angle_snap;
+    st->round_rad = round_rad;
+    st->default_stepsize = default_stepsize;
+    memcpy(st->materials, materials, sizeof(materials));
+    st->clip_plane = clip_plane;
+    st->view_clipped = view_clipped;
+    st->draw_on_clip_plane = draw_on_clip_plane;
+
+    for (n = 0, obj = selection.head; obj != NULL; obj = obj->next)
+        n++;
+    st->sel = malloc((n + 1) * sizeof(SelRef));
+    st->n_sel = 0;
+    for (obj = selection.head; obj != NULL; obj = obj->next)
+    {
+        top = top_of(obj->prev, tree);
+        if (top == NULL)
+            continue;
+        st->sel[st->n_sel].id = obj->prev->ID;
+        st->sel[st->n_sel].top = top->ID;
+        st->sel[st->n_sel].index = st->n_sel;
+        st->n_sel++;
+    }
+
+    st->path_id = 0;
+    st->path_top = 0;
+    if (curr_path != NULL && (top = top_of(curr_path, tree)) != NULL)
+    {
+        st->path_id = curr_path->ID;
+        st->path_top = top->ID;
+    }
+}
+
+// Compare the settings, materials, title and clip plane of two states. Material
+// visibility is a view setting and doesn't count.
+static BOOL
+same_settings(UndoState *a, UndoState *b)
+{
+    Material *ma, *mb;
+    int i;
+
+    if
+    (
+        strcmp(a->title, b->title) != 0
+        ||
+        a->half_size != b->half_size
+        ||
+        a->grid_snap != b->grid_snap
+        ||
+        a->tolerance != b->tolerance
+        ||
+        a->angle_snap != b->angle_snap
+        ||
+        a->round_rad != b->round_rad
+        ||
+        a->default_stepsize != b->default_stepsize
+        ||
+        a->view_clipped != b->view_clipped
+        ||
+        a->draw_on_clip_plane != b->draw_on_clip_plane
+        ||
+        a->clip_plane.A != b->clip_plane.A
+        ||
+        a->clip_plane.B != b->clip_plane.B
+        ||
+        a->clip_plane.C != b->clip_plane.C
+        ||
+        a->clip_plane.D != b->clip_plane.D
+    )
+        return FALSE;
+
+    for (i = 0; i < MAX_MATERIAL; i++)
+    {
+        ma = &a->materials[i];
+        mb = &b->materials[i];
+        if (ma->valid != mb->valid)
+            return FALSE;
+        if (!ma->valid)
+            continue;
+        if
+        (
+            ma->color[0] != mb->color[0]
+            ||
+            ma->color[1] != mb->color[1]
+            ||
+            ma->color[2] != mb->color[2]
+            ||
+            ma->shiny != mb->shiny
+            ||
+            strcmp(ma->name, mb->name) != 0
+        )
+            return FALSE;
+    }
+    return TRUE;
+}
+
+// Sort selection refs by their top-level object.
+static int
+compare_sel_top(const void *a, const void *b)
+{
+    unsigned int ta = ((SelRef *)a)->top;
+    unsigned int tb = ((SelRef *)b)->top;
+
+    return ta < tb ? -1 : ta > tb ? 1 : 0;
+}
+
+// Put back the state of the drawing apart from its objects. The selection must
+// have been cleared. Selected objects that are no longer there are left out.
+static void
+restore_state(UndoState *st, Group *tree)
+{
+    SelRef *sorted;
+    Object **found;
+    Object *obj;
+    BOOL hidden;
+    int i, lo, hi, mid;
+
+    if (!st->valid)
+        return;
+
+    strcpy_s(tree->title, 256, st->title);
+    half_size = st->half_size;
+    grid_snap = st->grid_snap;
+    tolerance = st->tolerance;
+    snap_tol = 3 * tolerance;
+    chamfer_rad = 3.5f * tolerance;
+    tol_log = (int)ceilf(log10f(1.0f / tolerance));
+    angle_snap = st->angle_snap;
+    round_rad = st->round_rad;
+    default_stepsize = st->default_stepsize;
+    for (i = 0; i < MAX_MATERIAL; i++)
+    {
+        hidden = materials[i].hidden;
+        materials[i] = st->materials[i];
+        materials[i].hidden = hidden;
+    }
+    clip_plane = st->clip_plane;
+    view_clipped = st->view_clipped;
+    draw_on_clip_plane = st->draw_on_clip_plane;
+    if (view_clipped)
+        glEnable(GL_CLIP_PLANE0);
+    else
+        glDisable(GL_CLIP_PLANE0);
+
+    // Look the selected objects up in one pass over the tree, using a copy of
+    // the selection sorted by top-level object.
+    if (st->n_sel > 0)
+    {
+        sorted = malloc(st->n_sel * sizeof(SelRef));
+        memcpy(sorted, st->sel, st->n_sel * sizeof(SelRef));
+        qsort(sorted, st->n_sel, sizeof(SelRef), compare_sel_top);
+        found = calloc(st->n_sel, sizeof(Object *));
+        for (obj = tree->obj_list.head; obj != NULL; obj = obj->next)
+        {
+            for (lo = 0, hi = st->n_sel; lo < hi; )
+            {
+                mid = (lo + hi) / 2;
+                if (sorted[mid].top < obj->ID)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            for (i = lo; i < st->n_sel && sorted[i].top == obj->ID; i++)
+                found[sorted[i].index] = find_in_top(obj, sorted[i].id);
+        }
+
+        // link_single puts them on the front, so go backwards to keep the order
+        for (i = st->n_sel - 1; i >= 0; i--)
+        {
+            if (found[i] != NULL)
+                link_single(found[i], &selection);
+        }
+        free(found);
+        free(sorted);
+    }
+
+    curr_path = NULL;
+    if (st->path_id != 0)
+    {
+        for (obj = tree->obj_list.head; obj != NULL; obj = obj->next)
+        {
+            if (obj->ID == st->path_top)
+            {
+                curr_path = find_in_top(obj, st->path_id);
+                break;
+            }
+        }
+    }
+}
+
+// Find a shadow by ID. Return its index, or -1 if there isn't one.
+static int
+find_shadow(unsigned int id)
+{
+    int i;
+
+    if (n_shadow_slots == 0)
+        return -1;
+    for (i = id & (n_shadow_slots - 1); shadow_slots[i] >= 0; i = (i + 1) & (n_shadow_slots - 1))
+    {
+        if (shadows[shadow_slots[i]].id == id)
+            return shadow_slots[i];
+    }
+    return -1;
+}
+
+// Rebuild the hash index of the shadows, making it at least twice the size of the table.
+static void
+index_shadows(void)
+{
+    int i, j;
+
+    if (n_shadow_slots < 2 * max_shadows)
+    {
+        free(shadow_slots);
+        n_shadow_slots = 256;
+        while (n_shadow_slots < 2 * max_shadows)
+            n_shadow_slots *= 2;
+        shadow_slots = malloc(n_shadow_slots * sizeof(int));
+    }
+    for (i = 0; i < n_shadow_slots; i++)
+        shadow_slots[i] = -1;
+    for (i = 0; i < n_shadows; i++)
+    {
+        for (j = shadows[i].id & (n_shadow_slots - 1); shadow_slots[j] >= 0; j = (j + 1) & (n_shadow_slots - 1))
+            ;
+        shadow_slots[j] = i;
+    }
+}
+
+// Add a shadow for a top-level object, taking a copy of it.
+static void
+add_shadow(Object *obj, unsigned __int64 hash, int size, int pos)
+{
+    Shadow *s;
+    int i;
+
+    if (n_shadows >= max_shadows)
+    {
+        max_shadows = max_shadows == 0 ? 128 : max_shadows * 2;
+        shadows = realloc(shadows, max_shadows * sizeof(Shadow));
+    }
+    s = &shadows[n_shadows++];
+    s->id = obj->ID;
+    s->hash = hash;
+    s->copy = snapshot(obj);
+    s->size = size;
+    s->pos = pos;
+    s->seen = shadow_stamp;
+
+    if (n_shadow_slots < 2 * max_shadows)
+    {
+        index_shadows();
+    }
+    else
+    {
+        for (i = s->id & (n_shadow_slots - 1); shadow_slots[i] >= 0; i = (i + 1) & (n_shadow_slots - 1))
+            ;
+        shadow_slots[i] = n_shadows - 1;
+    }
+}
+
+// Remove a shadow (its copy has been freed or handed over to an undo record).
+static void
+remove_shadow(int s)
+{
+    shadows[s] = shadows[--n_shadows];
+    index_shadows();
+}
+
+// Remove the shadows that were not seen by the latest stamp. Their copies
+// have already been handed over to an undo record.
+static void
+remove_unseen_shadows(void)
+{
+    int i, j;
+
+    for (i = j = 0; i < n_shadows; i++)
+    {
+        if (shadows[i].seen == shadow_stamp)
+            shadows[j++] = shadows[i];
+    }
+    if (j != n_shadows)
+    {
+        n_shadows = j;
+        index_shadows();
+    }
+}
+
+// Add an entry to an undo record.
+static void
+add_entry(UndoRecord *rec, unsigned int id, Object *obj, int size, int pos)
+{
+    UndoEntry *ent;
+
+    if (rec->n_entries >= rec->n_alloc)
+    {
+        rec->n_alloc = rec->n_alloc == 0 ? 8 : rec->n_alloc * 2;
+        rec->entries = realloc(rec->entries, rec->n_alloc * sizeof(UndoEntry));
+    }
+    ent = &rec->entries[rec->n_entries++];
+    ent->id = id;
+    ent->obj = obj;
+    ent->size = obj != NULL ? size : 0;
+    ent->pos = pos;
+    ent->in_file = FALSE;
+    rec->size += ent->size;
+}
+
+// Free an undo record's objects, and its spill file if it has one.
+static void
+free_record(UndoRecord *rec)
+{
+    int i;
+
+    for (i = 0; i < rec->n_entries; i++)
+    {
+        if (rec->entries[i].obj != NULL)
+            purge_obj(rec->entries[i].obj);
+    }
+    if (rec->spilled)
+        DeleteFile(rec->spill_file);
+    else
+        records_size -= rec->size;
+    free(rec->entries);
+    free_state(&rec->state);
+}
+
+// Make up the name of the spill file for a generation.
+static void
+spill_filename(char *filename, int gen, char *spill_file)
+{
+    char basename[256], tmpdir[256];
+    char *pdot;
+
+    pdot = strrchr(filename, '\\');
+    if (pdot != NULL)
+        strcpy_s(basename, 256, pdot + 1);          // cut off any directory in file
+    else if (filename[0] != '\0')
+        strcpy_s(basename, 256, filename);
+    else
+        strcpy_s(basename, 256, "Untitled");
+    if (strlen(basename) > 4 && (pdot = strrchr(basename, '.')) != NULL)
+        *pdot = '\0';                               // cut off ".lcd"
+    GetTempPath(256, tmpdir);
+    sprintf_s(spill_file, 256, "%s%s_%04d.lcd", tmpdir, basename, gen);
+}
+
+// Write an undo record's objects out to disk, and free them.
+static void
+spill_record(UndoRecord *rec, char *filename)
+{
+    Object **objs;
+    int i, n;
+
+    objs = malloc(rec->n_entries * sizeof(Object *));
+    for (i = n = 0; i < rec->n_entries; i++)
+    {
+        if (rec->entries[i].obj != NULL)
+            objs[n++] = rec->entries[i].obj;
+    }
+    spill_filename(filename, rec->generation, rec->spill_file);
+    serialise_objects(objs, n, rec->spill_file);
+    free(objs);
+
+    for (i = 0; i < rec->n_entries; i++)
+    {
+        if (rec->entries[i].obj != NULL)
+        {
+            purge_obj(rec->entries[i].obj);
+            rec->entries[i].obj = NULL;
+            rec->entries[i].in_file = TRUE;
+        }
+    }
+    records_size -= rec->size;
+    rec->spilled = TRUE;
+}
+
+// Read a spilled undo record's objects back in.
+static BOOL
+unspill_record(UndoRecord *rec)
+{
+    Group *group = group_new();
+    Object *obj;
+    int i;
+
+    if (!deserialise_objects(group, rec->spill_file))
+    {
+        purge_obj((Object *)group);
+        return FALSE;
+    }
+
+    // The objects come back in the order they were written.
+    for (i = 0; i < rec->n_entries; i++)
+    {
+        if (!rec->entries[i].in_file)
+            continue;
+        obj = group->obj_list.head;
+        ASSERT(obj != NULL, "Spill file is missing objects");
+        if (obj == NULL)
+            break;
+        delink_group(obj, group);
+        obj->ID = rec->entries[i].id;
+        rec->entries[i].obj = obj;
+        rec->entries[i].in_file = FALSE;
+    }
+    purge_obj((Object *)group);
+    DeleteFile(rec->spill_file);
+    records_size += rec->size;
+    rec->spilled = FALSE;
+    return TRUE;
+}
+
+// Keep the records within the memory limit by spilling or forgetting the oldest.
+// The newest record is always kept in memory.
+static void
+trim_records(char *filename)
+{
+    int i, n_forget = 0;
+    int size = records_size;
+
+    for (i = 0; i < n_records - 1 && size > UNDO_MEMORY; i++)
+    {
+        if (records[i].spilled)
+            continue;
+        size -= records[i].size;
+        if (undo_spill)
+            spill_record(&records[i], filename);
+        else
+            n_forget = i + 1;
+    }
+
+    // Forgetting a record makes all the ones before it useless too.
+    if (n_forget > 0)
+    {
+        // The last one forgotten holds the state at the new oldest generation.
+        free_state(&base_state);
+        base_state = records[n_forget - 1].state;
+        records[n_forget - 1].state.sel = NULL;
+        for (i = 0; i < n_forget; i++)
+            free_record(&records[i]);
+        oldest_generation = records[n_forget - 1].generation;
+        memmove(records, &records[n_forget], (n_records - n_forget) * sizeof(UndoRecord));
+        n_records -= n_forget;
+    }
+}
+
+// Free the records for generations after the current one (they can't be redone any more).
+static void
+truncate_records(void)
+{
+    while (n_records > 0 && records[n_records - 1].generation > journal_generation)
+        free_record(&records[--n_records]);
+}
+
+// Return the state at a generation.
+static UndoState *
+state_of(int gen)
+{
+    if (n_records == 0 || gen < records[0].generation)
+        return &base_state;
+    return &records[gen - records[0].generation].state;
+}
+
+// Find a top-level object in the tree by ID, and its position in the tree's list.
+static Object *
+find_top(Group *tree, unsigned int id, int *pos)
+{
+    Object *obj;
+    int i;
+
+    for (i = 0, obj = tree->obj_list.head; obj != NULL; obj = obj->next, i++)
+    {
+        if (obj->ID == id)
+        {
+            *pos = i;
+            return obj;
+        }
+    }
+    return NULL;
+}
+
+// Set the positions of the shadows from the tree.
+static void
+position_shadows(Group *tree)
+{
+    Object *obj;
+    int i, s;
+
+    for (i = 0, obj = tree->obj_list.head; obj != NULL; obj = obj->next, i++)
+    {
+        s = find_shadow(obj->ID);
+        if (s >= 0)
+            shadows[s].pos = i;
+    }
+}
+
+// Return TRUE if the object is, or contains, the current path.
+static BOOL
+contains_path(Object *obj)
+{
+    Object *o;
+
+    if (obj == curr_path)
+        return TRUE;
+    if (obj->type == OBJ_GROUP)
+    {
+        for (o = ((Group *)obj)->obj_list.head; o != NULL; o = o->next)
+        {
+            if (contains_path(o))
+                return TRUE;
+        }
+        return FALSE;
+    }
+    return find_obj(obj, curr_path);
+}
+
+// Put obj in the tree in place of old.
+static void
+replace_top(Object *old, Object *obj, Group *tree)
+{
+    obj->prev = old->prev;
+    obj->next = old->next;
+    if (old->prev != NULL)
+        old->prev->next = obj;
+    else
+        tree->obj_list.head = obj;
+    if (old->next != NULL)
+        old->next->prev = obj;
+    else
+        tree->obj_list.tail = obj;
+    obj->parent_group = tree;
+    old->parent_group = NULL;
+    old->next = old->prev = NULL;
+}
+
+// Sort undo entries by the position their objects go back in at.
+static int
+compare_entry_pos(const void *a, const void *b)
+{
+    return (*(UndoEntry **)a)->pos - (*(UndoEntry **)b)->pos;
+}
+
+// Swap the objects in an undo record with those in the tree. This undoes the record
+// if it has been done, and redoes it if it has been undone. Objects put back into the
+// tree go back where they were, as the order of a group's members can matter to its CSG.
+static BOOL
+swap_record(UndoRecord *rec, Group *tree)
+{
+    UndoEntry *ent;
+    UndoEntry **inserts;
+    Object **live;
+    Object *obj, *o;
+    int *live_pos;
+    unsigned __int64 hash;
+    int i, j, n_inserts, s, size, pos;
+
+    if (rec->spilled && !unspill_record(rec))
+        return FALSE;
+
+    // Find the objects in the tree, and where they are, before moving any of them.
+    live = malloc((rec->n_entries + 1) * sizeof(Object *));
+    live_pos = malloc((rec->n_entries + 1) * sizeof(int));
+    inserts = malloc((rec->n_entries + 1) * sizeof(UndoEntry *));
+    n_inserts = 0;
+    for (i = 0; i < rec->n_entries; i++)
+    {
+        ent = &rec->entries[i];
+        live_pos[i] = 0;
+        live[i] = find_top(tree, ent->id, &live_pos[i]);
+        if (live[i] != NULL && curr_path != NULL && contains_path(live[i]))
+            curr_path = NULL;
+
+        if (live[i] != NULL && ent->obj != NULL)
+            replace_top(live[i], ent->obj, tree);
+        else if (live[i] != NULL)
+            delink_group(live[i], tree);
+        else if (ent->obj != NULL)
+            inserts[n_inserts++] = ent;
+    }
+
+    // Put the new objects in, in order of position, so each one's position
+    // counts the ones put in before it.
+    qsort(inserts, n_inserts, sizeof(UndoEntry *), compare_entry_pos);
+    o = tree->obj_list.head;
+    for (i = j = 0; j < n_inserts; j++)
+    {
+        for ( ; o != NULL && i < inserts[j]->pos; o = o->next, i++)
+            ;
+        obj = inserts[j]->obj;
+        if (o == NULL)
+        {
+            link_tail_group(obj, tree);
+            continue;
+        }
+        obj->next = o;
+        obj->prev = o->prev;
+        if (o->prev != NULL)
+            o->prev->next = obj;
+        else
+            tree->obj_list.head = obj;
+        o->prev = obj;
+        obj->parent_group = tree;
+        tree->n_members++;
+        i++;
+    }
+    free(inserts);
+
+    records_size -= rec->size;
+    rec->size = 0;
+    for (i = 0; i < rec->n_entries; i++)
+    {
+        // The object taken out of the tree goes into the record. Its shadow is
+        // replaced by one for the object put into the tree (if any).
+        ent = &rec->entries[i];
+        obj = ent->obj;
+        pos = live[i] != NULL ? live_pos[i] : ent->pos;
+        s = find_shadow(ent->id);
+        ent->obj = live[i];
+        ent->pos = live_pos[i];
+        ent->size = (live[i] != NULL && s >= 0) ? shadows[s].size : 0;
+        rec->size += ent->size;
+        if (s >= 0)
+        {
+            purge_obj(shadows[s].copy);
+            remove_shadow(s);
+        }
+        if (obj != NULL)
+        {
+            hash = 0xCBF29CE484222325ULL;
+            size = 0;
+            hash_obj(obj, &hash, &size);
+            add_shadow(obj, hash, size, pos);
+        }
+    }
+    records_size += rec->size;
+    free(live);
+    free(live_pos);
+
+    return TRUE;
+}
+
+// Throw away the whole journal.
+static void
+free_journal(void)
+{
+    int i;
+
+    while (n_records > 0)
+        free_record(&records[--n_records]);
+    for (i = 0; i < n_shadows; i++)
+        purge_obj(shadows[i].copy);
+    n_shadows = 0;
+    index_shadows();
+    records_size = 0;
+    journal_generation = 0;
+    free_state(&base_state);
+    base_state.valid = FALSE;
+}
+
+// Start the journal off from the current state of the tree (e.g. when it has just been read in)
+void
+reset_undo_journal(Group *tree)
+{
+    Object *obj;
+    unsigned __int64 hash;
+    int size, pos;
+
+    free_journal();
+    capture_state(&base_state, tree);
+    shadow_stamp++;
+    for (pos = 0, obj = tree->obj_list.head; obj != NULL; obj = obj->next, pos++)
+    {
+        hash = 0xCBF29CE484222325ULL;
+        size = 0;
+        hash_obj(obj, &hash, &size);
+        add_shadow(obj, hash, size, pos);
+    }
+    generation = 0;
+    latest_generation = 0;
+    max_generation = 0;
+    oldest_generation = 0;
+}
+
+// Write a checkpoint (an entry in the undo journal). Only the top-level objects that
+// have changed since the last checkpoint are recorded. If nothing has changed,
+// no checkpoint is written, but the selection and path are remembered.
+void
+write_checkpoint(Group *tree, char *filename)
+{
+    UndoRecord rec = { 0, };
+    UndoState st = { 0, };
+    UndoState *cur;
+    Object *obj;
+    unsigned __int64 hash;
+    int i, s, size, pos;
+
+    shadow_stamp++;
+    for (pos = 0, obj = tree->obj_list.head; obj != NULL; obj = obj->next, pos++)
+    {
+        hash = 0xCBF29CE484222325ULL;
+        size = 0;
+        hash_obj(obj, &hash, &size);
+        s = find_shadow(obj->ID);
+        if (s < 0)
+        {
+            // A new object. Undoing it will just take it out of the tree.
+            add_entry(&rec, obj->ID, NULL, 0, pos);
+            add_shadow(obj, hash, size, pos);
+        }
+        else
+        {
+            shadows[s].seen = shadow_stamp;
+            shadows[s].pos = pos;
+            if (shadows[s].hash != hash)
+            {
+                // A changed object. Give its old state to the record.
+                add_entry(&rec, obj->ID, shadows[s].copy, shadows[s].size, pos);
+                shadows[s].copy = snapshot(obj);
+                shadows[s].hash = hash;
+                shadows[s].size = size;
+            }
+        }
+    }
+
+    // Objects that are no longer in the tree have been deleted. They go back
+    // where they were at the last checkpoint.
+    for (i = 0; i < n_shadows; i++)
+    {
+        if (shadows[i].seen != shadow_stamp)
+            add_entry(&rec, shadows[i].id, shadows[i].copy, shadows[i].size, shadows[i].pos);
+    }
+    remove_unseen_shadows();
+
+    // A change to the settings makes a checkpoint by itself. A change to the
+    // selection or path alone just updates the current generation's state.
+    capture_state(&st, tree);
+    cur = state_of(journal_generation);
+    if (rec.n_entries == 0 && (!cur->valid || same_settings(&st, cur)))
+    {
+        free_state(cur);
+        *cur = st;
+        return;
+    }
+
+    truncate_records();
+    if (n_records >= max_records)
+    {
+        max_records = max_records == 0 ? 64 : max_records * 2;
+        records = realloc(records, max_records * sizeof(UndoRecord));
+    }
+    rec.generation = ++generation;
+    rec.state = st;
+    records[n_records++] = rec;
+    records_size += rec.size;
+    journal_generation = generation;
+    latest_generation = generation;
+    if (generation > max_generation)
+        max_generation = generation;
+
+    trim_records(filename);
+}
+
+// Move the tree to a given generation, by undoing or redoing records from the journal.
+// If it can't be reached, leave the tree at the nearest generation it could get to.
+BOOL
+read_checkpoint(Group *tree, char *filename, int gen)
+{
+    UndoRecord *rec;
+    BOOL rc = TRUE;
+
+    clear_selection(&selection);
+    clear_selection(&saved_list);
+    clear_selection(&clipboard);
+
+    while (rc && journal_generation != gen)
+    {
+        if (n_records == 0)
+        {
+            rc = FALSE;
+            break;
+        }
+        if (journal_generation > gen)
+        {
+            // Undo the record that moved to this generation
+            rec = &records[journal_generation - records[0].generation];
+            if (journal_generation <= oldest_generation || !swap_record(rec, tree))
+                rc = FALSE;
+            else
+                journal_generation--;
+        }
+        else
+        {
+            // Redo the record that moves to the next generation
+            if (journal_generation + 1 > latest_generation)
+            {
+                rc = FALSE;
+                break;
+            }
+            rec = &records[journal_generation + 1 - records[0].generation];
+            if (!swap_record(rec, tree))
+                rc = FALSE;
+            else
+                journal_generation++;
+        }
+    }
+
+    // Put back the state that goes with the generation reached, and note where
+    // the objects now are.
+    restore_state(state_of(journal_generation), tree);
+    position_shadows(tree);
+
+    generation = journal_generation;
+    if (generation == 0)
+        drawing_changed = FALSE;
+    if (tree->mesh != NULL)
+        mesh_destroy(tree->mesh);
+    tree->mesh = NULL;
+    tree->mesh_valid = FALSE;
+    tree->mesh_complete = FALSE;
+    relink_instances(tree);
+    invalidate_dl();
+    return rc;
+}
+
+// Clean out the undo journal (and any spill files) for a filename.
+void
+clean_checkpoints(char *filename)
+{
+    free_journal();
+    generation = 0;
+    latest_generation = 0;
+    max_generation = 0;
+    oldest_generation = 0;
+}
@@ -0,0 +1,166 @@
+#include "stdafx.h"
+#include "LoftyCAD.h"
+#include <stdio.h>
+
+// Parallel regeneration of face view lists, and triangulation of faces into surface meshes.
+//
+// Faces only depend on the view lists of their edges, which may be shared with the
+// neighbouring faces. So the edges are brought up to date first, in a quick serial pass,
+// and then the faces are handed out to a pool of worker threads. The workers allocate
+// Points from their own free lists (see objtree.c), and each face's contribution to its
+// volume's bbox is gathered separately and combined when the workers have finished.
+//
+// Triangulating a face only reads its view list, so the faces of a volume can be
+// triangulated on the worker threads too, each into its own batch of triangles.
+
+// Don't bother with threads for fewer faces than this.
+#define MIN_THREADED_FACES  8
+
+// The faces to be worked on, and what to do with each one.
+typedef struct FaceJobs
+{
+    Face            **faces;
+    Bbox            *boxes;         // A bbox for each face (view list generation)
+    TriBatch        *batches;       // A batch of triangles for each face (triangulation)
+    void            (*job)(struct FaceJobs *jobs, int job);
+    int             n_jobs;
+    volatile LONG   next_job;       // Index of the next job to be picked up
+} FaceJobs;
+
+// Generate one face into its own bbox.
+static void
+view_list_job(FaceJobs *jobs, int job)
+{
+    Face *face = jobs->faces[job];
+
+    clear_bbox(&jobs->boxes[job]);
+    gen_view_list_face_box(face, face->vol != NULL ? &jobs->boxes[job] : NULL);
+}
+
+// Triangulate one face into its own batch.
+static void
+triangulate_job(FaceJobs *jobs, int job)
+{
+    triangulate_face(jobs->faces[job], &jobs->batches[job]);
+}
+
+// Worker thread. Keep taking faces until there are none left.
+static DWORD WINAPI
+face_worker(LPVOID param)
+{
+    FaceJobs *jobs = (FaceJobs *)param;
+    int job;
+
+    begin_thread_alloc();
+    while ((job = InterlockedIncrement(&jobs->next_job) - 1) < jobs->n_jobs)
+        jobs->job(jobs, job);
+    end_thread_alloc();
+
+    return 0;
+}
+
+// Run all the jobs, on worker threads if there are enough of them.
+static void
+run_face_jobs(FaceJobs *jobs)
+{
+    HANDLE threads[MAX_WORKER_THREADS];
+    int n_threads = worker_thread_count();
+    int i;
+
+    jobs->next_job = 0;
+    if (n_threads > jobs->n_jobs)
+        n_threads = jobs->n_jobs;
+    if (jobs->n_jobs < MIN_THREADED_FACES)
+        n_threads = 0;
+
+    init_thread_alloc();
+    for (i = 0; i < n_threads; i++)
+    {
+        threads[i] = CreateThread(NULL, 0, face_worker, jobs, 0, NULL);
+        if (threads[i] == NULL)
+            break;
+    }
+    n_threads = i;
+
+    if (n_threads == 0)
+    {
+        // Too few faces, or couldn't start any threads; do them all here
+        for (i = 0; i < jobs->n_jobs; i++)
+            jobs->job(jobs, i);
+    }
+    else
+    {
+        // The jobs are quick, so don't process messages while waiting
+        WaitForMultipleObjects(n_threads, threads, TRUE, INFINITE);
+        for (i = 0; i < n_threads; i++)
+            CloseHandle(threads[i]);
+    }
+}
+
+// Regenerate the view lists of n faces, spreading them over worker threads. The faces may
+// come from several volumes, whose bboxes are expanded to take in the new view lists.
+void
+gen_view_list_faces(Face **faces, int n)
+{
+    FaceJobs jobs;
+    int i, j;
+    Edge *e;
+    LARGE_INTEGER start;
+
+    if (n <= 0)
+        return;
+
+    bench_start(&start);
+
+    // Bring the shared edges up to date here, so the workers only ever read them.
+    for (i = 0; i < n; i++)
+    {
+        for (j = 0; j < faces[i]->n_edges; j++)
+        {
+            e = faces[i]->edges[j];
+            switch (e->type & ~EDGE_CONSTRUCTION)
+            {
+            case EDGE_ARC:
+                gen_view_list_arc((ArcEdge *)e);
+                break;
+            case EDGE_BEZIER:
+                gen_view_list_bez((BezierEdge *)e);
+                break;
+            }
+        }
+    }
+
+    jobs.faces = faces;
+    jobs.boxes = malloc(n * sizeof(Bbox));
+    jobs.batches = NULL;
+    jobs.job = view_list_job;
+    jobs.n_jobs = n;
+    run_face_jobs(&jobs);
+
+    // Now it's safe to expand the volume bboxes.
+    for (i = 0; i < n; i++)
+    {
+        if (faces[i]->vol != NULL)
+            union_bbox(&jobs.boxes[i], &faces[i]->vol->bbox, &faces[i]->vol->bbox);
+    }
+    free(jobs.boxes);
+
+    bench_end(BENCH_FACE, &start, n);
+}
+
+// Triangulate n faces into a batch of triangles each, spreading them over worker threads.
+void
+triangulate_faces(Face **faces, TriBatch *batches, int n)
+{
+    FaceJobs jobs;
+
+    if (n <= 0)
+        return;
+
+    jobs.faces = faces;
+    jobs.boxes = NULL;
+    jobs.batches = batches;
+    jobs.job = triangulate_job;
+    jobs.n_jobs = n;
+    run_face_jobs(&jobs);
+}